@@ -0,0 +1,547 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "archive.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define ARCHIVEHEAD  64           // bytes of the file header
+#define ENTRYBYTES   128          // bytes of a directory entry, as in files of type 2
+#define KEYRUN       16           // spectra sharing a key
+#define BATCHSIZE    256          // observations packed at a time
+#define BATCHBYTES   (16 << 20)   // bytes of data packed at a time
+#define MINMATCH     4            // shortest match of the codec
+#define HASHLOG      14           // bits of the hash table of the codec
+
+/*
+ * The file starts with a header of ARCHIVEHEAD bytes:
+ *
+ *   "CLAR", version (int32), number of observations (int64), offset of the
+ *   directory (int64), bytes of an entry and of a record (int32 each)
+ *
+ * followed by the observations, each its header sections (version and
+ * number of sections as int32, the codes as int32, the lengths in words as
+ * int64, then the sections) and its packed data. The directory at the end
+ * holds the entries of all observations, as in files of type 2 with the
+ * record number in place of the block, followed by the ArchiveRecords.
+ */
+
+static_assert(sizeof(ArchiveRecord) == 32, "archive records have to be of 32 bytes");
+
+/*
+ * The codec is LZ77 in the block format of LZ4: a token with the numbers of
+ * literals and matched bytes beyond MINMATCH, 4 bits each, extended by
+ * further bytes for 15 or more, the literals, and the offset of the match
+ * as two bytes. The last token has no match.
+ */
+static inline uint32_t read32(const char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline int hash4(uint32_t v)
+{
+    return (v*2654435761u) >> (32 - HASHLOG);
+}
+
+static void putLength(std::vector<char> &dst, size_t len)
+{
+    while (len >= 255) {
+        dst.push_back((char)255);
+        len -= 255;
+    }
+    dst.push_back((char)len);
+}
+
+static void putToken(std::vector<char> &dst, const char *literals, size_t nlit, size_t offset, size_t len)
+{
+    size_t m = (len >= MINMATCH) ? len - MINMATCH : 0;
+    dst.push_back((char)(((nlit < 15 ? nlit : 15) << 4) | (m < 15 ? m : 15)));
+    if (nlit >= 15) putLength(dst, nlit - 15);
+    dst.insert(dst.end(), literals, literals + nlit);
+    if (len == 0) return;
+    dst.push_back((char)(offset & 0xff));
+    dst.push_back((char)(offset >> 8));
+    if (m >= 15) putLength(dst, m - 15);
+}
+
+void archiveCompress(const char *src, size_t n, std::vector<char> &dst)
+{
+    static thread_local std::vector<int32_t> table;
+    table.assign(1 << HASHLOG, -1);
+    dst.clear();
+    dst.reserve(n + n/255 + 16);
+
+    size_t anchor = 0, i = 0;
+    while (i + MINMATCH <= n) {
+        uint32_t v = read32(src + i);
+        int h = hash4(v);
+        long cand = table[h];
+        table[h] = i;
+        if (cand < 0 || i - cand > 65535 || read32(src + cand) != v) {
+            /* skip faster through data that do not compress */
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
+        size_t len = MINMATCH;
+        while (i + len < n && src[cand + len] == src[i + len]) len++;
+        putToken(dst, src + anchor, i - anchor, i - cand, len);
+        i += len;
+        anchor = i;
+        if (i >= 2 && i + MINMATCH <= n + 2) table[hash4(read32(src + i - 2))] = i - 2;
+    }
+    putToken(dst, src + anchor, n - anchor, 0, 0);
+}
+
+static bool getLength(const unsigned char *&p, const unsigned char *end, size_t &len)
+{
+    unsigned int b;
+    do {
+        if (p >= end) return false;
+        b = *p++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool archiveDecompress(const char *src, size_t n, char *dst, size_t size)
+{
+    const unsigned char *p = (const unsigned char *)src, *end = p + n;
+    size_t o = 0;
+    while (p < end) {
+        unsigned int token = *p++;
+        size_t nlit = token >> 4;
+        if (nlit == 15 && !getLength(p, end, nlit)) return false;
+        if (nlit > (size_t)(end - p) || nlit > size - o) return false;
+        memcpy(dst + o, p, nlit);
+        p += nlit;
+        o += nlit;
+        if (p == end) break;
+
+        if (end - p < 2) return false;
+        size_t offset = p[0] | (p[1] << 8);
+        p += 2;
+        size_t len = token & 15;
+        if (len == 15 && !getLength(p, end, len)) return false;
+        len += MINMATCH;
+        if (offset == 0 || offset > o || len > size - o) return false;
+        if (offset >= len) {
+            memcpy(dst + o, dst + o - offset, len);
+        } else {
+            for (size_t k = 0; k < len; k++) dst[o + k] = dst[o + k - offset];
+        }
+        o += len;
+    }
+    return o == size;
+}
+
+/*
+ * Shuffle the data into planes of bytes, XORed with the key where it has
+ * data, and compress them, unless this saves nothing.
+ */
+static int packData(const std::vector<char> &data, const std::vector<char> *key, std::vector<char> &work,
+                    std::vector<char> &packed)
+{
+    size_t n = data.size(), words = n/4;
+    size_t nkey = key ? key->size() : 0;
+    const char *src = data.data(), *mask = key ? key->data() : 0;
+    work.resize(n);
+    for (int b = 0; b < 4; b++) {
+        char *plane = &work[b*words];
+        for (size_t k = 0; k < words; k++) {
+            size_t j = 4*k+b;
+            plane[k] = (j < nkey) ? src[j] ^ mask[j] : src[j];
+        }
+    }
+    for (size_t k = 4*words; k < n; k++) work[k] = (k < nkey) ? src[k] ^ mask[k] : src[k];
+    archiveCompress(work.data(), n, packed);
+    if (packed.size() < n) return ARCHIVE_COMPRESSED;
+    packed.swap(work);
+    return 0;
+}
+
+ArchiveReader::ArchiveReader(const char *filename) : ClassReader(filename)
+{
+    getFileDescriptor();
+}
+
+ArchiveReader::ArchiveReader(ClassSource *source) : ClassReader(source)
+{
+    getFileDescriptor();
+}
+
+ArchiveReader::~ArchiveReader()
+{
+}
+
+ClassReader *ArchiveReader::clone()
+{
+    getIndex();
+    ArchiveReader *reader = new ArchiveReader(*this);
+    reader->m_shared = true;
+    return reader;
+}
+
+void ArchiveReader::getFileDescriptor()
+{
+    m_type = 3;
+    m_count = 0;
+    m_dirOffset = 0;
+    m_keyRecord = -1;
+
+    char head[ARCHIVEHEAD];
+    if (m_source->read(0L, head, ARCHIVEHEAD) != ARCHIVEHEAD) {
+        fprintf(stderr, "failed to read archive header\n");
+        return;
+    }
+    m_ptr = head + 4;
+    int version = getInt();
+    int64_t count = getLong();
+    int64_t offset = getLong();
+    int entryBytes = getInt();
+    int recordBytes = getInt();
+    if (version != 1) {
+        fprintf(stderr, "unsupported archive version %d\n", version);
+        return;
+    }
+    if (entryBytes != ENTRYBYTES || recordBytes != (int)sizeof(ArchiveRecord)) {
+        fprintf(stderr, "archive entries of %d bytes and records of %d bytes, instead of %d and %d\n",
+                entryBytes, recordBytes, ENTRYBYTES, (int)sizeof(ArchiveRecord));
+        return;
+    }
+    /* the directory and records have to lie inside the file, before they are allocated */
+    long size = m_source->size();
+    int64_t perRecord = ENTRYBYTES + sizeof(ArchiveRecord);
+    if (size < 0 || count < 0 || offset < ARCHIVEHEAD || offset > size || count > (size - offset)/perRecord) {
+        fprintf(stderr, "corrupt archive header of %s\n", m_source->name());
+        return;
+    }
+    m_count = count;
+    m_dirOffset = offset;
+}
+
+void ArchiveReader::getEntry(int k)
+{
+    m_ptr = &m_entries[(size_t)k*ENTRYBYTES];
+    ClassEntry entry;
+    entry.xblock = getLong();
+    entry.xword = getInt();
+    entry.xnum = getLong();
+    entry.xver = getInt();
+    getChar((unsigned char *)entry.xsourc, 12);
+    getChar((unsigned char *)entry.xline, 12);
+    getChar((unsigned char *)entry.xtel, 12);
+    entry.xdobs = getInt();
+    entry.xdred = getInt();
+    entry.xoff1 = getFloat();
+    entry.xoff2 = getFloat();
+    getChar((unsigned char *)entry.xtype, 4);
+    entry.xkind = getInt();
+    entry.xqual = getInt();
+    entry.xposa = getInt();
+    entry.xscan = getLong();
+    entry.xsubs = getInt();
+    if (entry.xnum >= 1 && entry.xblock >= 1 && entry.xblock <= m_count) m_index.push_back(entry);
+}
+
+/* the entries are only needed until they are decoded into the index, the records stay */
+int ArchiveReader::getDirectory()
+{
+    TraceScope trace("directory");
+    m_index.clear();
+    m_records.resize(m_count);
+    m_entries.resize(m_count*ENTRYBYTES);
+    size_t nrec = m_count*sizeof(ArchiveRecord);
+    if (m_source->read(m_dirOffset, m_entries.data(), m_entries.size()) != m_entries.size()
+        || m_source->read(m_dirOffset + m_entries.size(), m_records.data(), nrec) != nrec) {
+        fprintf(stderr, "failed to read directory information\n");
+        m_records.clear();
+        m_entries.clear();
+        m_nspec = 0;
+        return 0;
+    }
+    for (int64_t k = 0; k < m_count; k++) getEntry(k);
+    std::vector<char>().swap(m_entries);
+    latestVersions();
+    return m_nspec;
+}
+
+/* the header sections of a spectrum, with m_entry set to its entry */
+bool ArchiveReader::readHead(int scan, const char *&head)
+{
+    if (!findEntry(scan)) return false;
+    const ArchiveRecord &rec = m_records[m_entry.xblock-1];
+    head = readBlock(rec.offset, rec.headBytes, true);
+    if (!head || rec.headBytes < 8) {
+        fprintf(stderr, "failed to read header of spectrum %d\n", scan);
+        return false;
+    }
+    m_ptr = (char *)head + 4;
+    int nsec = getInt();
+    if (nsec < 0 || nsec > 10 || rec.headBytes < 8 + 12*nsec) {
+        fprintf(stderr, "corrupt header of spectrum %d\n", scan);
+        return false;
+    }
+    long words = 0;
+    m_ptr += 4*nsec;
+    for (int i = 0; i < nsec; i++) words += getLong();
+    if (rec.headBytes != 8 + 12*nsec + 4*words) {
+        fprintf(stderr, "corrupt header of spectrum %d\n", scan);
+        return false;
+    }
+    return true;
+}
+
+/* the data of a record, decoding its key first unless it is the one decoded last */
+bool ArchiveReader::unpack(int record, std::vector<char> &data)
+{
+    const ArchiveRecord &rec = m_records[record];
+    const std::vector<char> *key = 0;
+    if (rec.key >= 0) {
+        if (rec.key >= m_count || m_records[rec.key].key >= 0) {
+            fprintf(stderr, "corrupt key of record %d\n", record);
+            return false;
+        }
+        if (rec.key != m_keyRecord) {
+            m_keyRecord = -1;
+            if (!unpack(rec.key, m_key)) return false;
+            m_keyRecord = rec.key;
+        }
+        key = &m_key;
+    }
+
+    if (rec.dataBytes < 0 || rec.packedBytes < 0 || (size_t)rec.dataBytes > 4*MAXCHANNELS) {
+        fprintf(stderr, "corrupt data of record %d\n", record);
+        return false;
+    }
+    const char *packed = readBlock(rec.offset + rec.headBytes, rec.packedBytes, true);
+    if (!packed) {
+        fprintf(stderr, "failed to read data of record %d\n", record);
+        return false;
+    }
+    size_t n = rec.dataBytes, words = n/4;
+    m_scratch.resize(n);
+    if (rec.flags & ARCHIVE_COMPRESSED) {
+        if (!archiveDecompress(packed, rec.packedBytes, m_scratch.data(), n)) {
+            fprintf(stderr, "corrupt data of record %d\n", record);
+            return false;
+        }
+    } else {
+        if ((size_t)rec.packedBytes != n) {
+            fprintf(stderr, "corrupt data of record %d\n", record);
+            return false;
+        }
+        memcpy(m_scratch.data(), packed, n);
+    }
+
+    data.resize(n);
+    for (int b = 0; b < 4; b++) {
+        const char *plane = &m_scratch[b*words];
+        for (size_t k = 0; k < words; k++) data[4*k+b] = plane[k];
+    }
+    for (size_t k = 4*words; k < n; k++) data[k] = m_scratch[k];
+    size_t nkey = key ? key->size() : 0;
+    for (size_t k = 0; k < n && k < nkey; k++) data[k] ^= (*key)[k];
+    return true;
+}
+
+bool ArchiveReader::readObservation(int scan, bool withData)
+{
+    TraceScope sections("sections", scan);
+    const char *head;
+    if (!readHead(scan, head)) return false;
+    m_ptr = (char *)head + 4;
+    int nsec = getInt();
+    int codes[10];
+    long lengths[10];
+    for (int i = 0; i < nsec; i++) codes[i] = getInt();
+    for (int i = 0; i < nsec; i++) lengths[i] = getLong();
+
+    resetSections();
+    char *block = m_ptr;
+    int addr = 1;
+    for (int i = 0; i < nsec; i++) {
+        fillHeader(block, codes[i], addr, lengths[i]);
+        addr += lengths[i];
+    }
+    sections.end();
+
+    cdesc.ndata = (m_entry.xkind == 0) ? cdesc.nchan : cdesc.npoin;
+    if (cdesc.ndata > (int)MAXCHANNELS) {
+        fprintf(stderr, "maximum number of channels exceeded: %d %ld\n", cdesc.ndata, MAXCHANNELS);
+        return false;
+    }
+    cdesc.data = 0;
+    if (!withData) return true;
+
+    TraceScope data("data", scan);
+    if (!unpack(m_entry.xblock-1, m_data)) return false;
+    if (cdesc.ndata < 0 || m_data.size() < 4*(size_t)cdesc.ndata) {
+        fprintf(stderr, "spectrum %d has %d channels, but %ld data words\n", scan, cdesc.ndata, (long)m_data.size()/4);
+        return false;
+    }
+    cdesc.data = (float *)m_data.data();
+    return true;
+}
+
+bool ArchiveReader::getObservation(int scan, ClassObservation &obs)
+{
+    const char *head;
+    if (!readHead(scan, head)) return false;
+    const ArchiveRecord &rec = m_records[m_entry.xblock-1];
+    m_ptr = (char *)head;
+    obs.version = getInt();
+    int nsec = getInt();
+    obs.codes.clear();
+    obs.lengths.clear();
+    for (int i = 0; i < nsec; i++) obs.codes.push_back(getInt());
+    for (int i = 0; i < nsec; i++) obs.lengths.push_back(getLong());
+    obs.sections.assign((const char *)m_ptr, head + rec.headBytes);
+    return unpack(m_entry.xblock-1, obs.data);
+}
+
+static bool writeAll(int fd, long offset, const void *src, size_t len)
+{
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(fd, (const char *)src + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "failed to write %ld bytes: %s\n", (long)len, strerror(errno));
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+template <class T> static void append(std::vector<char> &dst, T value)
+{
+    const char *p = (const char *)&value;
+    dst.insert(dst.end(), p, p + sizeof(T));
+}
+
+/* an observation packed for the archive */
+struct PackedObservation {
+    std::vector<char> head;
+    std::vector<char> packed;
+    std::vector<char> alternative;
+    int key;
+    int flags;
+};
+
+long int archiveFile(const char *input, const char *output, const CompactOptions &options, int nthreads)
+{
+    TraceScope trace("archive");
+    std::vector<int> scans;
+    ClassReader *reader = openRewrite(input, output, options, scans);
+    if (reader == 0) return -1;
+    int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "failed to create '%s': %s\n", output, strerror(errno));
+        delete reader;
+        return -1;
+    }
+    if (nthreads <= 0) nthreads = defaultThreads();
+
+    const std::vector<ClassEntry> &index = reader->getIndex();
+    std::vector<char> entries;
+    std::vector<ArchiveRecord> records;
+    std::vector<ClassObservation> batch(BATCHSIZE);
+    std::vector<PackedObservation> packs(BATCHSIZE);
+    std::vector<std::vector<char> > work(nthreads);
+    std::vector<int> batchScans;
+    std::vector<char> buffer;
+    int64_t offset = ARCHIVEHEAD;
+    int nskip = 0;
+    bool ok = true;
+    for (size_t i = 0; ok && i < scans.size(); ) {
+        /* read a batch, in which runs of spectra of equal size share the first as key */
+        int m = 0;
+        size_t bytes = 0;
+        batchScans.clear();
+        for (; i < scans.size() && m < BATCHSIZE && bytes < BATCHBYTES; i++) {
+            if (!reader->getObservation(scans[i], batch[m])) {
+                nskip++;
+                continue;
+            }
+            bytes += batch[m].data.size();
+            int key = -1;
+            if (m > 0) {
+                key = (packs[m-1].key >= 0) ? packs[m-1].key : m-1;
+                if (m - key >= KEYRUN || batch[key].data.size() != batch[m].data.size()) key = -1;
+            }
+            packs[m].key = key;
+            batchScans.push_back(scans[i]);
+            m++;
+        }
+
+        parallelFor(m, nthreads, [&](int j, int w) {
+            const ClassObservation &obs = batch[j];
+            PackedObservation &pack = packs[j];
+            int nsec = obs.codes.size();
+            pack.head.clear();
+            append(pack.head, (int32_t)obs.version);
+            append(pack.head, (int32_t)nsec);
+            for (int k = 0; k < nsec; k++) append(pack.head, (int32_t)obs.codes[k]);
+            for (int k = 0; k < nsec; k++) append(pack.head, (int64_t)obs.lengths[k]);
+            pack.head.insert(pack.head.end(), obs.sections.begin(), obs.sections.end());
+
+            /* with a key, keep what packs better, XORed or not */
+            pack.flags = packData(obs.data, 0, work[w], pack.packed);
+            if (pack.key >= 0) {
+                int flags = packData(obs.data, &batch[pack.key].data, work[w], pack.alternative);
+                if (pack.alternative.size() < pack.packed.size()) {
+                    pack.packed.swap(pack.alternative);
+                    pack.flags = flags;
+                } else {
+                    pack.key = -1;
+                }
+            }
+        });
+
+        int base = records.size();
+        buffer.clear();
+        for (int j = 0; j < m; j++) {
+            const PackedObservation &pack = packs[j];
+            ArchiveRecord rec;
+            memset(&rec, 0, sizeof(rec));
+            rec.offset = offset + buffer.size();
+            rec.headBytes = pack.head.size();
+            rec.packedBytes = pack.packed.size();
+            rec.dataBytes = batch[j].data.size();
+            rec.key = (pack.key >= 0) ? base + pack.key : -1;
+            rec.flags = pack.flags;
+            records.push_back(rec);
+            buffer.insert(buffer.end(), pack.head.begin(), pack.head.end());
+            buffer.insert(buffer.end(), pack.packed.begin(), pack.packed.end());
+
+            size_t estart = entries.size();
+            entries.resize(estart + ENTRYBYTES, 0);
+            packEntry(&entries[estart], index[batchScans[j]-1], base + j + 1, 1);
+        }
+        ok = writeAll(fd, offset, buffer.data(), buffer.size());
+        offset += buffer.size();
+    }
+
+    /* the directory, then the header pointing to it */
+    std::vector<char> head;
+    head.insert(head.end(), "CLAR", "CLAR" + 4);
+    append(head, (int32_t)1);
+    append(head, (int64_t)records.size());
+    append(head, (int64_t)offset);
+    append(head, (int32_t)ENTRYBYTES);
+    append(head, (int32_t)sizeof(ArchiveRecord));
+    head.resize(ARCHIVEHEAD, 0);
+    ok = ok && writeAll(fd, offset, entries.data(), entries.size())
+            && writeAll(fd, offset + entries.size(), records.data(), records.size()*sizeof(ArchiveRecord))
+            && writeAll(fd, 0, head.data(), head.size());
+    if (close(fd) != 0) ok = false;
+    if (nskip > 0) fprintf(stderr, "%d spectra of '%s' could not be read and were left out\n", nskip, input);
+    delete reader;
+    return ok ? (long)records.size() : -1;
+}
@@ -0,0 +1,109 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSARCHIVE_H
+#define CLASSARCHIVE_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "class.h"
+#include "writer.h"
+
+/**
+ * @file archive.h
+ *
+ * CLASSIC archives hold the observations of a CLASSIC file losslessly in
+ * less space. The header sections of every observation are kept as they
+ * are, while its data are packed on their own: the channels are XORed with
+ * those of a key spectrum, the first of a run of neighbouring spectra of
+ * equal size, shuffled into planes of the first, second, ... byte of every
+ * channel, and compressed with a fast LZ77 codec. An index at the end of
+ * the file gives the place of every observation and its key, so that any
+ * spectrum is decoded from its own packed data and at most its key.
+ *
+ * Archives are opened with openClassFile() like the other file types, and
+ * read through an ArchiveReader.
+ */
+
+/**
+ * @brief The index of an observation in an archive.
+ */
+struct ArchiveRecord {
+    int64_t offset;       ///< offset of the header sections in the file
+    int32_t headBytes;    ///< bytes of the header sections
+    int32_t packedBytes;  ///< bytes of the packed data, which follow the header sections
+    int32_t dataBytes;    ///< bytes of the data when unpacked
+    int32_t key;          ///< record whose data were XORed with these, or -1
+    int32_t flags;        ///< ARCHIVE_COMPRESSED if the shuffled data were compressed
+    int32_t reserved;
+};
+
+#define ARCHIVE_COMPRESSED 1
+
+/**
+ * A class to read a CLASSIC archive.
+ */
+class ArchiveReader : public ClassReader {
+
+ public:
+    ArchiveReader(const char *);
+    ArchiveReader(ClassSource *);
+    ~ArchiveReader();
+
+    ClassReader *clone();
+    int getDirectory();
+    bool getObservation(int scan, ClassObservation &obs);
+
+ private:
+    void getFileDescriptor();
+    void getEntry(int k);
+    bool readObservation(int scan, bool withData);
+    bool readHead(int scan, const char *&head);
+    bool unpack(int record, std::vector<char> &data);
+
+    int64_t m_count;                       // observations in the archive
+    int64_t m_dirOffset;                   // offset of the directory and records
+    std::vector<char> m_entries;           // directory entries of type 2
+    std::vector<ArchiveRecord> m_records;
+    std::vector<char> m_data;              // data of the observation read last
+    std::vector<char> m_key;               // data of the key read last
+    int m_keyRecord;
+    std::vector<char> m_scratch;
+};
+
+/**
+ * Compress n bytes with the LZ77 codec of archives.
+ *
+ * @param src the bytes to compress
+ * @param n number of bytes
+ * @param dst the compressed bytes, replaced
+ */
+void archiveCompress(const char *src, size_t n, std::vector<char> &dst);
+
+/**
+ * Decompress the output of archiveCompress().
+ *
+ * @param src the compressed bytes
+ * @param n number of compressed bytes
+ * @param dst destination of size bytes
+ * @param size number of bytes expected
+ * @return false if the compressed bytes are corrupt or of another size
+ */
+bool archiveDecompress(const char *src, size_t n, char *dst, size_t size);
+
+/**
+ * Rewrite a file of type 1 or 2 as an archive. Observations are read and
+ * written in batches, which are packed in parallel. Sorting by source, line
+ * and time puts similar spectra next to each other, which improves the
+ * compression.
+ *
+ * @param input name of the file to archive
+ * @param output name of the archive written, which must not be the input
+ * @param options which observations to keep and in which order
+ * @param nthreads number of threads, <= 0 for the default
+ * @return number of observations written, or -1 on error
+ */
+long int archiveFile(const char *input, const char *output, const CompactOptions &options = CompactOptions(),
+                     int nthreads = 0);
+
+#endif
@@ -0,0 +1,169 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "average.h"
+#include "trace.h"
+
+AverageResult::AverageResult() : nspec(0), nskip(0)
+{
+}
+
+/* running sums and buffers of one worker */
+struct Accumulator {
+    AverageSums sums;
+    std::vector<float> values;
+    std::vector<double> resampled;
+    ResamplePlan plan;
+};
+
+void AverageSums::reset(int nchan)
+{
+    sum.assign(nchan, 0.0);
+    wsum.assign(nchan, 0.0);
+    time = tsys = weight = 0.0;
+    nspec = nskip = nincompatible = 0;
+}
+
+void AverageSums::reduce(const AverageSums &other)
+{
+    for (size_t k = 0; k < sum.size(); k++) {
+        sum[k] += other.sum[k];
+        wsum[k] += other.wsum[k];
+    }
+    time += other.time;
+    tsys += other.tsys;
+    weight += other.weight;
+    nspec += other.nspec;
+    nskip += other.nskip;
+    nincompatible += other.nincompatible;
+}
+
+bool AverageSums::finish(const ScanRef &first, AverageResult &result)
+{
+    if (nincompatible > 0) {
+        fprintf(stderr, "%d spectra with an axis different from spectrum %d of '%s' skipped\n",
+                nincompatible, first.scan, first.reader->getFileName());
+    }
+
+    int nchan = sum.size();
+    result.data.resize(nchan);
+    for (int k = 0; k < nchan; k++) {
+        result.data[k] = (wsum[k] > 0.0) ? sum[k]/wsum[k] : NAN;
+    }
+    result.weight.swap(wsum);
+    result.nspec = nspec;
+    result.nskip = nskip;
+    result.head.dt = time;
+    if (weight > 0.0) result.head.tsys = tsys/weight;
+    return result.nspec > 0;
+}
+
+double spectrumWeight(const ClassDescriptor *desc, Weighting weighting)
+{
+    switch (weighting) {
+    case WEIGHT_TSYS:
+        if (desc->tsys <= 0.0) return 0.0;
+        return desc->time/((double)desc->tsys*desc->tsys);
+    case WEIGHT_TIME:
+        return desc->time;
+    default:
+        return 1.0;
+    }
+}
+
+/*
+ * Without a target axis, the first readable spectrum defines the axis, and
+ * spectra with another axis are skipped. Otherwise, every spectrum is
+ * resampled onto the target axis first.
+ */
+static bool averageOn(const std::vector<ScanRef> &refs, Weighting weighting, const SpectralAxis *to,
+                      bool velocity, ResampleMode mode, AverageResult &result, int nthreads)
+{
+    TraceScope trace("average", refs.size(), "count");
+    result = AverageResult();
+
+    size_t first = 0;
+    SpectralAxis axis;
+    for (first = 0; first < refs.size(); first++) {
+        ClassReader *reader = refs[first].reader;
+        const ClassDescriptor *desc = reader->getDescriptor(refs[first].scan, false);
+        if (desc) {
+            axis = spectrumAxis(reader, desc, false);
+            result.head = reader->getHead(refs[first].scan);
+            result.freq = reader->getFreq(refs[first].scan);
+            break;
+        }
+    }
+    if (to) {
+        axis = *to;
+        result.freq = to->values();
+    }
+    int nchan = axis.nchan;
+    if (first == refs.size() || nchan <= 0) {
+        result.nskip = refs.size();
+        return false;
+    }
+
+    if (nthreads <= 0) nthreads = defaultThreads();
+    std::vector<Accumulator> acc(nthreads);
+    for (int w = 0; w < nthreads; w++) {
+        acc[w].sums.reset(nchan);
+        if (to) acc[w].resampled.resize(nchan);
+    }
+
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int, int worker) {
+        Accumulator &a = acc[worker];
+        const ClassDescriptor *desc = reader->getDescriptor(scan, true);
+        if (desc == 0 || desc->data == 0) {
+            a.sums.nskip++;
+            return;
+        }
+        if (!to && !axis.same(spectrumAxis(reader, desc, false))) {
+            a.sums.nincompatible++;
+            a.sums.nskip++;
+            return;
+        }
+        double w = spectrumWeight(desc, weighting);
+        if (!(w > 0.0)) {
+            a.sums.nskip++;
+            return;
+        }
+
+        /* the raw data need not be aligned */
+        a.values.resize(desc->ndata);
+        memcpy(&a.values[0], desc->data, desc->ndata*sizeof(float));
+        if (to) {
+            SpectralAxis from = spectrumAxis(reader, desc, velocity);
+            if (a.plan.source().nchan == 0 || !a.plan.source().same(from, 1.0e-6)) a.plan = ResamplePlan(from, *to, mode);
+            a.plan.apply(&a.values[0], desc->badl, &a.resampled[0]);
+            a.sums.add(&a.resampled[0], (double)NAN, desc, w);
+        } else {
+            a.sums.add(&a.values[0], desc->badl, desc, w);
+        }
+    });
+
+    /* reduce the workers' sums */
+    for (int w = 1; w < nthreads; w++) acc[0].sums.reduce(acc[w].sums);
+    return acc[0].sums.finish(refs[first], result);
+}
+
+bool average(const std::vector<ScanRef> &refs, Weighting weighting, AverageResult &result, int nthreads)
+{
+    return averageOn(refs, weighting, 0, false, RESAMPLE_LINEAR, result, nthreads);
+}
+
+bool average(const std::vector<ScanRef> &refs, Weighting weighting, const SpectralAxis &to, bool velocity,
+             ResampleMode mode, AverageResult &result, int nthreads)
+{
+    return averageOn(refs, weighting, &to, velocity, mode, result, nthreads);
+}
+
+bool average(ClassReader *reader, const std::vector<int> &scans, Weighting weighting,
+             AverageResult &result, int nthreads)
+{
+    return average(scanRefs(reader, scans), weighting, result, nthreads);
+}
+
+bool average(ClassDataset *dataset, const std::vector<int> &scans, Weighting weighting,
+             AverageResult &result)
+{
+    return average(dataset->scanRefs(scans), weighting, result, dataset->getThreads());
+}
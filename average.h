@@ -0,0 +1,149 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSAVERAGE_H
+#define CLASSAVERAGE_H
+
+#include <vector>
+
+#include "class.h"
+#include "dataset.h"
+#include "resample.h"
+
+/**
+ * @file average.h
+ */
+
+/**
+ * @brief Weights of the spectra of an average.
+ */
+enum Weighting {
+    WEIGHT_TSYS,          ///< integration time / tsys^2
+    WEIGHT_TIME,          ///< integration time
+    WEIGHT_EQUAL          ///< equal weights
+};
+
+/**
+ * @brief The result of averaging spectra.
+ */
+struct AverageResult {
+    AverageResult();      ///< constructor
+
+    SpectrumHeader head;           ///< header of the first spectrum, with total time and weighted mean tsys
+    std::vector<double> freq;      ///< frequency (or time) axis
+    std::vector<double> data;      ///< averaged data, NaN for channels without valid data
+    std::vector<double> weight;    ///< sum of weights per channel
+    int nspec;                     ///< number of spectra averaged
+    int nskip;                     ///< number of spectra skipped: unreadable, incompatible or of zero weight
+};
+
+/**
+ * Return the weight of a spectrum, 0 if it cannot be weighted.
+ */
+double spectrumWeight(const ClassDescriptor *desc, Weighting weighting);
+
+/**
+ * Add w*data to sum and w to wsum, for all channels which are not bad.
+ * Written without branches and aliasing, so that the compiler vectorizes it.
+ */
+template <typename T>
+void accumulate(double *__restrict__ sum, double *__restrict__ wsum, const T *__restrict__ data,
+                int nchan, double w, T badl)
+{
+    for (int k = 0; k < nchan; k++) {
+        T v = data[k];
+        bool good = (v == v) & (v != badl);
+        double m = good ? w : 0.0;
+        sum[k] += m*(good ? v : (T)0);
+        wsum[k] += m;
+    }
+}
+
+/**
+ * @brief The running sums of an average, one per thread.
+ *
+ * Every thread adds its spectra with add(). The sums of all threads are
+ * then combined with reduce() into those of the first, which finish() turns
+ * into the average.
+ */
+struct AverageSums {
+    void reset(int nchan);    ///< zero the sums of nchan channels
+
+    /**
+     * Add the channels of a spectrum with weight w, see accumulate(), and
+     * its integration time and tsys.
+     */
+    template <typename T>
+    void add(const T *data, T badl, const ClassDescriptor *desc, double w)
+    {
+        accumulate(sum.data(), wsum.data(), data, sum.size(), w, badl);
+        time += desc->time;
+        tsys += w*desc->tsys;
+        weight += w;
+        nspec++;
+    }
+
+    void reduce(const AverageSums &other);   ///< add the sums of another thread
+
+    /**
+     * Divide the sums into the data of the average, and fill in its weights,
+     * counts, total time and mean tsys. Spectra skipped for their axis are
+     * reported with reference to the first spectrum.
+     *
+     * @return false if not a single spectrum was averaged
+     */
+    bool finish(const ScanRef &first, AverageResult &result);
+
+    std::vector<double> sum;       ///< sum of the weighted data per channel
+    std::vector<double> wsum;      ///< sum of the weights per channel
+    double time;                   ///< total integration time
+    double tsys;                   ///< weighted sum of tsys
+    double weight;                 ///< sum of the weights of the spectra
+    int nspec;                     ///< number of spectra added
+    int nskip;                     ///< number of spectra skipped
+    int nincompatible;             ///< number of spectra skipped for their axis
+};
+
+/**
+ * Average spectra of a reader.
+ *
+ * The data of the selected spectra are streamed through per-thread
+ * accumulators, so memory does not depend on the number of spectra. Bad
+ * channels (equal to the blanking value of the spectrum, or NaN) are left
+ * out. Spectra whose number of channels, reference channel, channel width
+ * or reference frequency differ from those of the first spectrum are
+ * skipped.
+ *
+ * @param reader the reader
+ * @param scans numbers of spectra (1..nscans)
+ * @param weighting how to weight the spectra
+ * @param result the average
+ * @param nthreads number of threads, <= 0 for the default
+ * @return false if not a single spectrum could be averaged
+ */
+bool average(ClassReader *reader, const std::vector<int> &scans, Weighting weighting,
+             AverageResult &result, int nthreads = 0);
+
+/**
+ * Average spectra of a dataset, given by global numbers, see above.
+ */
+bool average(ClassDataset *dataset, const std::vector<int> &scans, Weighting weighting,
+             AverageResult &result);
+
+/**
+ * Average spectra referenced by refs, see above.
+ */
+bool average(const std::vector<ScanRef> &refs, Weighting weighting, AverageResult &result, int nthreads = 0);
+
+/**
+ * Average spectra referenced by refs after resampling them onto a common
+ * axis, so that spectra with different axes may be combined. Channels of
+ * the target axis outside a spectrum do not contribute.
+ *
+ * @param to the target axis, which is also the axis of the result
+ * @param velocity if set, to is a velocity axis
+ * @param mode how to resample
+ */
+bool average(const std::vector<ScanRef> &refs, Weighting weighting, const SpectralAxis &to, bool velocity,
+             ResampleMode mode, AverageResult &result, int nthreads = 0);
+
+#endif
@@ -0,0 +1,205 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "baseline.h"
+#include "trace.h"
+
+BaselineOptions::BaselineOptions() : degree(1), velocity(true), stored(false)
+{
+}
+
+BaselineFit::BaselineFit() : m_degree(-1), m_nterms(0)
+{
+}
+
+BaselineFit::BaselineFit(const SpectralAxis &axis, int degree, const std::vector<double> &w1,
+                         const std::vector<double> &w2)
+    : m_axis(axis), m_degree(degree), m_w1(w1), m_w2(w2)
+{
+    int n = axis.nchan;
+    int p = m_nterms = degree+1;
+    m_basis.resize((size_t)n*p);
+    m_mask.assign(n, 1);
+    m_normal.assign(p*p, 0.0);
+    m_work.resize(p*p);
+    m_rhs.resize(p);
+
+    for (int k = 0; k < n; k++) {
+        /* Legendre polynomials by their recurrence */
+        double x = (n > 1) ? 2.0*k/(n-1) - 1.0 : 0.0;
+        double *b = &m_basis[(size_t)k*p];
+        b[0] = 1.0;
+        if (p > 1) b[1] = x;
+        for (int j = 2; j < p; j++) b[j] = ((2*j-1)*x*b[j-1] - (j-1)*b[j-2])/j;
+
+        double v = axis.value(k+1);
+        for (size_t i = 0; i < w1.size(); i++) {
+            double lo = (w1[i] < w2[i]) ? w1[i] : w2[i];
+            double hi = (w1[i] < w2[i]) ? w2[i] : w1[i];
+            if (v >= lo && v <= hi) m_mask[k] = 0;
+        }
+        if (!m_mask[k]) continue;
+        for (int i = 0; i < p; i++) {
+            for (int j = 0; j <= i; j++) m_normal[i*p+j] += b[i]*b[j];
+        }
+    }
+}
+
+bool BaselineFit::matches(const SpectralAxis &axis, int degree, const std::vector<double> &w1,
+                          const std::vector<double> &w2) const
+{
+    return m_degree == degree && m_axis.nchan == axis.nchan && m_axis.same(axis, 1.0e-6) && m_w1 == w1 && m_w2 == w2;
+}
+
+/* solve the lower triangle of normal * x = rhs by Cholesky decomposition, in place */
+bool BaselineFit::solve(std::vector<double> &a, std::vector<double> &x)
+{
+    int p = m_nterms;
+    for (int j = 0; j < p; j++) {
+        double d = a[j*p+j];
+        for (int k = 0; k < j; k++) d -= a[j*p+k]*a[j*p+k];
+        if (!(d > 1.0e-12*(a[j*p+j] > 1.0 ? a[j*p+j] : 1.0))) return false;
+        d = sqrt(d);
+        a[j*p+j] = d;
+        for (int i = j+1; i < p; i++) {
+            double s = a[i*p+j];
+            for (int k = 0; k < j; k++) s -= a[i*p+k]*a[j*p+k];
+            a[i*p+j] = s/d;
+        }
+    }
+    for (int i = 0; i < p; i++) {
+        double s = x[i];
+        for (int k = 0; k < i; k++) s -= a[i*p+k]*x[k];
+        x[i] = s/a[i*p+i];
+    }
+    for (int i = p-1; i >= 0; i--) {
+        double s = x[i];
+        for (int k = i+1; k < p; k++) s -= a[k*p+i]*x[k];
+        x[i] = s/a[i*p+i];
+    }
+    return true;
+}
+
+double BaselineFit::subtract(const float *src, float badl, double *dst)
+{
+    return fit(src, badl, dst);
+}
+
+double BaselineFit::subtract(const double *src, double *dst)
+{
+    return fit(src, (double)NAN, dst);
+}
+
+template <typename T>
+double BaselineFit::fit(const T *src, T badl, double *dst)
+{
+    int n = m_axis.nchan;
+    int p = m_nterms;
+
+    /* right hand side, and bad channels removed from the normal matrix */
+    m_work = m_normal;
+    for (int i = 0; i < p; i++) m_rhs[i] = 0.0;
+    for (int k = 0; k < n; k++) {
+        if (!m_mask[k]) continue;
+        const double *b = &m_basis[(size_t)k*p];
+        T v = src[k];
+        if (v != v || v == badl) {
+            for (int i = 0; i < p; i++) {
+                for (int j = 0; j <= i; j++) m_work[i*p+j] -= b[i]*b[j];
+            }
+        } else {
+            for (int i = 0; i < p; i++) m_rhs[i] += b[i]*v;
+        }
+    }
+
+    if (!solve(m_work, m_rhs)) {
+        for (int k = 0; k < n; k++) dst[k] = NAN;
+        return NAN;
+    }
+
+    double sum2 = 0.0;
+    int nused = 0;
+    for (int k = 0; k < n; k++) {
+        const double *b = &m_basis[(size_t)k*p];
+        double base = 0.0;
+        for (int i = 0; i < p; i++) base += m_rhs[i]*b[i];
+        T v = src[k];
+        bool good = (v == v) & (v != badl);
+        double r = good ? v - base : NAN;
+        dst[k] = r;
+        if (good && m_mask[k]) {
+            sum2 += r*r;
+            nused++;
+        }
+    }
+    return (nused > 0) ? sqrt(sum2/nused) : NAN;
+}
+
+void baselineWindows(const ClassDescriptor *desc, const BaselineOptions &options, bool &velocity,
+                     int &degree, std::vector<double> &w1, std::vector<double> &w2)
+{
+    /* a degree out of range means no usable baseline is stored */
+    if (options.stored && desc->deg >= 0 && desc->deg <= MAXDEGREE) {
+        /* CLASS stores windows in velocity for spectra, on the time axis for drifts */
+        velocity = true;
+        degree = desc->deg;
+        w1.resize(desc->nwind);
+        w2.resize(desc->nwind);
+        for (int i = 0; i < desc->nwind; i++) {
+            w1[i] = desc->w1[i];
+            w2[i] = desc->w2[i];
+        }
+    } else {
+        velocity = options.velocity;
+        degree = options.degree;
+        w1 = options.w1;
+        w2 = options.w2;
+    }
+    if (degree > MAXDEGREE) degree = MAXDEGREE;
+}
+
+int baselineBlock(const std::vector<ScanRef> &refs, const BaselineOptions &options,
+                  std::vector<double> &block, std::vector<double> &rms, int nthreads)
+{
+    TraceScope trace("baseline", refs.size(), "count");
+    int n = refs.size();
+    rms.assign(n, NAN);
+
+    /* widths first, so that the block is allocated once */
+    int width = 0;
+    std::vector<int> widths(n, 0);
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int) {
+        widths[pos] = reader->getChannels(scan);
+    });
+    for (int i = 0; i < n; i++) {
+        if (widths[i] > width) width = widths[i];
+    }
+    block.assign((size_t)n*width, NAN);
+    if (width == 0) return width;
+
+    /* the fit of every worker is reused as long as axis, degree and windows do not change */
+    if (nthreads <= 0) nthreads = defaultThreads();
+    std::vector<BaselineFit> fits(nthreads);
+    std::vector<std::vector<float> > values(nthreads);
+
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int worker) {
+        const ClassDescriptor *desc = reader->getDescriptor(scan, true);
+        if (desc == 0 || desc->data == 0 || desc->ndata <= 0) return;
+
+        bool velocity;
+        int degree;
+        std::vector<double> w1, w2;
+        baselineWindows(desc, options, velocity, degree, w1, w2);
+        if (desc->ndata <= degree) return;
+
+        /* the fit is set up on the axis of the windows, velocity or frequency */
+        SpectralAxis axis = spectrumAxis(reader, desc, velocity && reader->getIndex()[scan-1].xkind == 0);
+        BaselineFit &fit = fits[worker];
+        if (!fit.matches(axis, degree, w1, w2)) fit = BaselineFit(axis, degree, w1, w2);
+
+        /* the raw data need not be aligned */
+        std::vector<float> &v = values[worker];
+        v.resize(desc->ndata);
+        memcpy(&v[0], desc->data, desc->ndata*sizeof(float));
+        rms[pos] = fit.subtract(&v[0], desc->badl, &block[(size_t)pos*width]);
+    });
+    return width;
+}
@@ -0,0 +1,119 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSBASELINE_H
+#define CLASSBASELINE_H
+
+#include <vector>
+
+#include "class.h"
+#include "dataset.h"
+#include "resample.h"
+
+/**
+ * @file baseline.h
+ */
+
+#define MAXDEGREE 15      // maximum degree of a baseline polynomial
+
+/**
+ * @brief How baselines are fitted.
+ *
+ * Windows are given in velocity (km/s) or, if velocity is false, in the
+ * units of the frequency axis (MHz, or the time axis of continuum drifts).
+ * Channels inside any window, e.g. around lines, are left out of the fit.
+ */
+struct BaselineOptions {
+    BaselineOptions();    ///< first degree, no windows, in velocity
+
+    int degree;                   ///< degree of the polynomial, 0..MAXDEGREE
+    std::vector<double> w1;       ///< lower limits of the windows
+    std::vector<double> w2;       ///< upper limits of the windows
+    bool velocity;                ///< windows in velocity
+    bool stored;                  ///< use degree and windows of the baseline section of a spectrum, if it has one of a degree up to MAXDEGREE
+};
+
+/**
+ * @brief A least squares fit of a polynomial to the channels of an axis
+ * outside the windows.
+ *
+ * The polynomial is expanded in Legendre polynomials of the channel number,
+ * scaled to [-1, 1], to keep the normal equations well conditioned. These
+ * only depend on the axis, the windows and the degree, so they are set up
+ * once and reused for all spectra sharing them. Bad channels of a spectrum
+ * are removed from the normal equations of that spectrum only.
+ */
+class BaselineFit {
+ public:
+    BaselineFit();
+    /**
+     * Set up the normal equations for an axis.
+     *
+     * @param axis the axis of the spectra
+     * @param degree degree of the polynomial
+     * @param w1 lower limits of the windows, in units of the axis
+     * @param w2 upper limits of the windows, in units of the axis
+     */
+    BaselineFit(const SpectralAxis &axis, int degree, const std::vector<double> &w1, const std::vector<double> &w2);
+
+    /** true if set up for the same axis, degree and windows */
+    bool matches(const SpectralAxis &axis, int degree, const std::vector<double> &w1, const std::vector<double> &w2) const;
+
+    /**
+     * Fit and subtract the baseline of a spectrum.
+     *
+     * @param src the nchan raw data values
+     * @param badl the blanking value
+     * @param dst the data with the baseline subtracted, NaN for bad channels
+     * @return rms of the residuals of the channels used in the fit, NaN if the fit failed
+     */
+    double subtract(const float *src, float badl, double *dst);
+    /**
+     * Fit and subtract the baseline of a spectrum already decoded, with
+     * bad channels as NaN. src and dst may be the same.
+     */
+    double subtract(const double *src, double *dst);
+
+ private:
+    template <typename T> double fit(const T *src, T badl, double *dst);
+    bool solve(std::vector<double> &normal, std::vector<double> &rhs);
+
+    SpectralAxis m_axis;
+    int m_degree;
+    std::vector<double> m_w1, m_w2;
+    int m_nterms;
+    std::vector<double> m_basis;       // nchan x nterms, row-major
+    std::vector<char> m_mask;          // 1 for channels used in the fit
+    std::vector<double> m_normal;      // nterms x nterms normal matrix of all masked channels
+    std::vector<double> m_work;        // normal matrix of the current spectrum
+    std::vector<double> m_rhs;
+};
+
+/**
+ * Return degree and windows to use for a spectrum, from its baseline
+ * section if options.stored is set and it has one, else from options.
+ *
+ * @param desc the descriptor of the spectrum
+ * @param options how to fit
+ * @param velocity set if the windows are in velocity
+ * @param degree degree of the polynomial
+ * @param w1 lower limits of the windows
+ * @param w2 upper limits of the windows
+ */
+void baselineWindows(const ClassDescriptor *desc, const BaselineOptions &options, bool &velocity,
+                     int &degree, std::vector<double> &w1, std::vector<double> &w2);
+
+/**
+ * Fit and subtract baselines of the referenced spectra, in parallel.
+ *
+ * @param refs the spectra
+ * @param options how to fit
+ * @param block the subtracted spectra, row-major, padded with NaN to the
+ *              largest number of channels
+ * @param rms rms of the residuals of every spectrum
+ * @param nthreads number of threads, <= 0 for the default
+ * @return the width of the block
+ */
+int baselineBlock(const std::vector<ScanRef> &refs, const BaselineOptions &options,
+                  std::vector<double> &block, std::vector<double> &rms, int nthreads = 0);
+
+#endif
@@ -1,4 +1,9 @@
 #include "class.h"
+#include "archive.h"
+#include "trace.h"
+
+#include <fnmatch.h>
+#include <unordered_map>
 
 #undef DEBUG
 #define NHEAD 14
@@ -24,80 +29,158 @@ void SpectrumHeader::print()
            id, scanno, target, line, instr, RA, Dec, fLO, f0, df, vs, dt, tsys, fmt);
 }
 
+ClassSelection::ClassSelection(): scan1(0L), scan2(-1L), kind(-1)
+{
+    memset(source,    0, sizeof(source));
+    memset(line,      0, sizeof(line));
+    memset(telescope, 0, sizeof(telescope));
+}
+
+bool ClassSelection::matches(const ClassEntry &entry) const
+{
+    if (kind >= 0 && entry.xkind != kind) return false;
+    if (entry.xscan < scan1) return false;
+    if (scan2 >= scan1 && entry.xscan > scan2) return false;
+    if (source[0] && fnmatch(source, entry.xsourc, 0) != 0) return false;
+    if (line[0] && fnmatch(line, entry.xline, 0) != 0) return false;
+    if (telescope[0] && fnmatch(telescope, entry.xtel, 0) != 0) return false;
+    return true;
+}
+
 int fileType(const char *cfname)
 {
-    FILE *cfp = fopen(cfname, "r");
-    if (!cfp) return -1;
+    FileSource source(cfname);
+    return fileType(&source);
+}
+
+int fileType(ClassSource *source)
+{
+    if (!source->good()) return -1;
 
     char code[4];
-    size_t len = fread(code, sizeof(char), 4, cfp);
+    size_t len = source->read(0L, code, 4);
     if (len != 4) return -2;
 
-    code[2] = '\0';
-    code[3] = '\0';
-    fclose(cfp);
-
     if (strncmp((const char *)code, "1A", 2) == 0) return 1;
     if (strncmp((const char *)code, "2A", 2) == 0) return 2;
+    if (strncmp((const char *)code, "CLAR", 4) == 0) return 3;
     return 0;
 }
 
-ClassReader *openClassFile(const char *cfname)
+ClassReader *openClassSource(ClassSource *source)
 {
     ClassReader *reader = 0;
 
-    int type = fileType(cfname);
+    int type = fileType(source);
     if (type == -1) {
-        fprintf(stderr, "failed to open file '%s'\n", cfname);
+        fprintf(stderr, "failed to open file '%s'\n", source->name());
+        delete source;
         return reader;
     }
     if (type == -2) {
-        fprintf(stderr, "failed to determine file type of '%s'\n", cfname);
+        fprintf(stderr, "failed to determine file type of '%s'\n", source->name());
+        delete source;
         return reader;
     }
 
-    if ((type != 1) && (type != 2)) {
+    if ((type < 1) || (type > 3)) {
         fprintf(stderr, "unrecognized file type!\n");
+        delete source;
         return reader;
     }
 
-    if (type == 1) reader = new Type1Reader(cfname);
-    if (type == 2) reader = new Type2Reader(cfname);
+    if (type == 1) reader = new Type1Reader(source);
+    if (type == 2) reader = new Type2Reader(source);
+    if (type == 3) reader = new ArchiveReader(source);
 
     return reader;
 }
 
+ClassReader *openClassFile(const char *cfname)
+{
+    return openClassSource(new FileSource(cfname));
+}
+
+ClassReader *openClassFd(int fd)
+{
+    return openClassSource(new FileSource(fd, false));
+}
+
+ClassReader *openClassBuffer(const void *data, size_t len)
+{
+    return openClassSource(new MemorySource(data, len));
+}
+
 ClassReader::ClassReader(const char *filename)
 {
-    strncpy(cfname, filename, 255);
+    m_source = new FileSource(filename);
+    strncpy(cfname, m_source->name(), 255);
+    m_reclen = 0;
+    m_nspec = 0;
+    m_shared = false;
+    m_allVersions = false;
+    m_block = 0;
+}
+
+ClassReader::ClassReader(ClassSource *source)
+{
+    m_source = source;
+    strncpy(cfname, m_source->name(), 255);
     m_reclen = 0;
     m_nspec = 0;
-    open();
+    m_shared = false;
+    m_allVersions = false;
+    m_block = 0;
 }
 
 ClassReader::~ClassReader()
 {
-    if (cfp != NULL) {
-        fclose(cfp);
-        cfp = NULL;
-    }
+    if (!m_shared) delete m_source;
 }
 
-bool ClassReader::open()
+/*
+ * The read buffer, shared by all readers used in the calling thread. A reader
+ * only needs it from reading an observation until it has been decoded, which
+ * happens within one call, so readers need no buffer of their own.
+ */
+static char *threadBuffer()
 {
-    cfp = fopen(cfname, "r");
-    return true;
+    static thread_local std::vector<char> buffer;
+    if (buffer.empty()) buffer.resize(BUFSIZE);
+    return &buffer[0];
 }
 
-void ClassReader::getRecord()
+/*
+ * Return a pointer to size bytes at the given offset of the file. These are
+ * taken directly from the source if it is held in memory, otherwise they are
+ * read into the buffer. If exact is set, a short read is an error, otherwise
+ * the missing part is zero filled.
+ */
+char *ClassReader::readBlock(long offset, size_t size, bool exact)
 {
-    if (m_reclen == 0) return;
-    size_t len = fread(buffer, sizeof(int), m_reclen, cfp);
-    if (feof(cfp)) return;
+    const char *ptr = m_source->data(offset, size);
+    if (ptr) {
+        m_block = (char *)ptr;
+        return m_block;
+    }
 
-    if (len != m_reclen) {
-        fprintf(stderr, "failed to read record of size %d words (%ld)\n", m_reclen, len);
+    if (size > BUFSIZE) {
+        fprintf(stderr, "buffer too small!");
+        return 0;
+    }
+    char *buffer = threadBuffer();
+    size_t len = m_source->read(offset, buffer, size);
+    if (len != size) {
+        if (exact) return 0;
+        memset(buffer+len, 0, size-len);
     }
+    m_block = buffer;
+    return m_block;
+}
+
+char *ClassReader::getRecord(long offset)
+{
+    return readBlock(offset, 4*m_reclen, false);
 }
 
 int ClassReader::getInt()
@@ -142,7 +225,7 @@ void ClassReader::dumpRecord()
     const int wpl = 8;
 
     if (m_reclen == 0) return;
-    m_ptr = buffer;
+    m_ptr = m_block;
     for (unsigned int i = 0; i < m_reclen; i++) {
         word = getInt();
         printf("[%03d] %10d ", i, word);
@@ -188,24 +271,314 @@ double ClassReader::rta(float rad)
 
 std::vector<double> ClassReader::dataVector(int nchan, float *s)
 {
-    std::vector<double> data(nchan);
+    std::vector<double> data;
+    dataVector(data, nchan, s);
+
+    return data;
+}
+
+void ClassReader::dataVector(std::vector<double> &data, int nchan, float *s, const Smoothing &smoothing)
+{
+    TraceScope trace("decode");
+    if (smoothing.active()) {
+        data.resize(smoothing.channels(nchan));
+        smoothing.apply((const char *)s, nchan, cdesc.badl, data.data());
+        return;
+    }
+    data.resize(nchan);
 
     m_ptr = (char *)s;
     for (int k = 0; k < nchan; k++) data[k] = getFloat();
+}
 
-    return data;
+SpectralAxis::SpectralAxis() : nchan(0), f0(0.0), ref(0.0), df(0.0)
+{
+}
+
+SpectralAxis::SpectralAxis(int n, double f, double r, double d) : nchan(n), f0(f), ref(r), df(d)
+{
+}
+
+double SpectralAxis::value(double k) const
+{
+    return (k - ref)*df + f0;
+}
+
+double SpectralAxis::channel(double v) const
+{
+    return (df == 0.0) ? ref : (v - f0)/df + ref;
+}
+
+std::vector<double> SpectralAxis::values() const
+{
+    std::vector<double> v;
+    values(v);
+    return v;
+}
+
+void SpectralAxis::values(std::vector<double> &v) const
+{
+    v.resize(nchan);
+    for (int k = 0; k < nchan; k++) v[k] = value(k+1);
+}
+
+bool SpectralAxis::same(const SpectralAxis &other, double tol) const
+{
+    if (nchan != other.nchan) return false;
+    if (df == 0.0 || other.df == 0.0) return df == other.df && f0 == other.f0;
+    /* compare the channels of the first and last channel of this axis on the other */
+    return fabs(other.channel(value(1)) - 1.0) <= tol && fabs(other.channel(value(nchan)) - nchan) <= tol;
+}
+
+/* frequency axis of the observation last read, after smoothing, channel numbers without a channel width */
+SpectralAxis ClassReader::readAxis(const Smoothing &smoothing)
+{
+    double f0, ref, df;
+    axis(f0, ref, df);
+    smoothing.axis(ref, df);
+    int nchan = smoothing.channels(cdesc.ndata);
+    if (df == 0.0) return SpectralAxis(nchan, 0.0, 0.0, 1.0);
+    return SpectralAxis(nchan, f0, ref, df);
+}
+
+/* axis of the observation last read: reference frequency, channel and resolution */
+void ClassReader::axis(double &f0, double &ref, double &df)
+{
+    if (m_entry.xkind == 0) {
+        f0 = cdesc.restf;
+        ref = cdesc.rchan;
+        df = cdesc.fres;
+    } else {
+        f0 = cdesc.tref;
+        ref = cdesc.rpoin;
+        df = cdesc.tres;
+    }
+}
+
+void ClassReader::setAllVersions(bool all)
+{
+    m_allVersions = all;
+}
+
+bool ClassReader::getAllVersions() const
+{
+    return m_allVersions;
+}
+
+/*
+ * Drop the entries of superseded versions from the index, keeping the order
+ * of the others. Of equal versions, the entry written last wins.
+ */
+void ClassReader::latestVersions()
+{
+    if (!m_allVersions) {
+        std::unordered_map<long int, size_t> latest;     // observation number -> entry kept
+        latest.reserve(m_index.size());
+        for (size_t i = 0; i < m_index.size(); i++) {
+            if (m_index[i].xver <= 0) continue;
+            auto it = latest.find(m_index[i].xnum);
+            if (it == latest.end()) latest[m_index[i].xnum] = i;
+            else if (m_index[i].xver >= m_index[it->second].xver) it->second = i;
+        }
+        size_t n = 0;
+        for (size_t i = 0; i < m_index.size(); i++) {
+            if (m_index[i].xver <= 0 || latest[m_index[i].xnum] != i) continue;
+            m_index[n++] = m_index[i];
+        }
+        m_index.resize(n);
+    }
+    m_nspec = m_index.size();
+}
+
+bool ClassReader::findEntry(int scan)
+{
+    if (m_index.empty()) getDirectory();
+    if (scan < 1 || scan > (int)m_index.size()) {
+        fprintf(stderr, "spectrum number %d out of range\n", scan);
+        return false;
+    }
+    m_entry = m_index[scan-1];
+    return true;
+}
+
+SpectrumHeader ClassReader::makeHeader(int scan)
+{
+    SpectrumHeader head;
+
+    bool spectrum = (m_entry.xkind == 0);
+
+    double restf, LO, fres;
+    if (spectrum) {
+        restf = cdesc.restf;
+        LO = (cdesc.restf + cdesc.image)/2.0;
+        fres = cdesc.fres;
+    } else {
+        restf = cdesc.tref;
+        LO = (cdesc.freq + cdesc.cimag)/2.0;
+        fres = cdesc.tres;
+    }
+    double lam = cdesc.lam;
+    double bet = cdesc.bet;
+    lam += cdesc.lamof/cos(bet);
+    bet += cdesc.betof;
+    time_t datetime = obssecond(m_entry.xdobs + 60549L, cdesc.ut);
+    head.id = scan;
+    head.scanno = m_entry.xscan;
+    memcpy(head.target, m_entry.xsourc, 12);
+    memcpy(head.line, m_entry.xline, 12);
+    memcpy(head.instr, m_entry.xtel, 12);
+    head.RA = lam*180.0/M_PI;
+    head.Dec = bet*180.0/M_PI;
+    head.fLO = LO;
+    head.f0 = restf;
+    head.df = fres;
+    head.vs = cdesc.voff;
+    head.dt = cdesc.time;
+    head.tsys = cdesc.tsys;
+    head.utc = datetime;
+    return head;
+}
+
+SpectrumHeader ClassReader::getHead(int scan)
+{
+    TraceScope trace("getHead", scan);
+    SpectrumHeader head;
+
+    if (!readObservation(scan, false)) return head;
+    return makeHeader(scan);
+}
+
+std::vector<double> ClassReader::getFreq(int scan)
+{
+    TraceScope trace("getFreq", scan);
+    std::vector<double> f;
+
+    if (!readObservation(scan, false)) return f;
+
+    readAxis(Smoothing()).values(f);
+    return f;
+}
+
+SpectralAxis ClassReader::getAxis(int scan, const Smoothing &smoothing)
+{
+    if (!readObservation(scan, false)) return SpectralAxis();
+    return readAxis(smoothing);
+}
+
+std::vector<double> ClassReader::getData(int scan)
+{
+    TraceScope trace("getData", scan);
+    std::vector<double> d;
+
+    if (!readObservation(scan, true)) return d;
+
+    dataVector(d, cdesc.ndata, cdesc.data);
+    return d;
+}
+
+bool ClassReader::getSpectrum(int scan, SpectrumHeader &head, std::vector<double> &freq, std::vector<double> &data,
+                              const Smoothing &smoothing)
+{
+    SpectralAxis axis;
+    if (!getSpectrum(scan, head, axis, data, smoothing)) return false;
+
+    axis.values(freq);
+    return true;
+}
+
+bool ClassReader::getSpectrum(int scan, SpectrumHeader &head, SpectralAxis &axis, std::vector<double> &data,
+                              const Smoothing &smoothing)
+{
+    TraceScope trace("getSpectrum", scan);
+
+    if (!readObservation(scan, true)) return false;
+
+    head = makeHeader(scan);
+    if (smoothing.bin > 1) head.df *= smoothing.bin;
+    axis = readAxis(smoothing);
+    dataVector(data, cdesc.ndata, cdesc.data, smoothing);
+    return true;
+}
+
+int ClassReader::getChannels(int scan)
+{
+    if (!readObservation(scan, false)) return -1;
+    return cdesc.ndata;
 }
 
-std::vector<double> ClassReader::freqVector(int nchan, double f0, double ref, double df)
+int ClassReader::getData(int scan, double *dst, int size, const Smoothing &smoothing)
 {
-    std::vector<double> freq(nchan);
-    if (df == 0.0) {
-        for (int k = 0; k < nchan; k++) freq[k] = (double)(k+1);
+    TraceScope trace("getData", scan);
+
+    if (!readObservation(scan, true)) {
+        for (int k = 0; k < size; k++) dst[k] = NAN;
+        return -1;
+    }
+
+    int nchan = smoothing.channels(cdesc.ndata);
+    if (smoothing.active()) {
+        /* decoded straight into the destination, unless it is too short */
+        if (nchan <= size) {
+            smoothing.apply((const char *)cdesc.data, cdesc.ndata, cdesc.badl, dst);
+        } else {
+            std::vector<double> d;
+            dataVector(d, cdesc.ndata, cdesc.data, smoothing);
+            memcpy(dst, d.data(), size*sizeof(double));
+        }
     } else {
-        for (int k = 0; k < nchan; k++) freq[k] = ((double)(k+1)-ref)*df + f0;
+        int n = (nchan < size) ? nchan : size;
+        m_ptr = (char *)cdesc.data;
+        for (int k = 0; k < n; k++) dst[k] = getFloat();
+    }
+    for (int k = nchan; k < size; k++) dst[k] = NAN;
+    return nchan;
+}
+
+const char *ClassReader::getFileName()
+{
+    return cfname;
+}
+
+const ClassDescriptor *ClassReader::getDescriptor(int scan, bool withData)
+{
+    if (!readObservation(scan, withData)) return 0;
+    return &cdesc;
+}
+
+const std::vector<ClassEntry> &ClassReader::getIndex()
+{
+    if (m_index.empty()) getDirectory();
+    return m_index;
+}
+
+std::vector<int> ClassReader::find(const ClassSelection &sel)
+{
+    std::vector<int> scans;
+    const std::vector<ClassEntry> &index = getIndex();
+    for (size_t i = 0; i < index.size(); i++) {
+        if (sel.matches(index[i])) scans.push_back(i+1);
     }
+    return scans;
+}
 
-    return freq;
+std::vector<SpectrumHeader> ClassReader::getHeaders(const std::vector<int> &scans)
+{
+    std::vector<SpectrumHeader> heads(scans.size());
+    for (size_t i = 0; i < scans.size(); i++) heads[i] = getHead(scans[i]);
+    return heads;
+}
+
+int ClassReader::getDataBlock(const std::vector<int> &scans, std::vector<double> &block, const Smoothing &smoothing)
+{
+    /* headers first, which are cheap, so that the block is allocated only once */
+    int width = 0;
+    for (size_t i = 0; i < scans.size(); i++) {
+        int nchan = smoothing.channels(getChannels(scans[i]));
+        if (nchan > width) width = nchan;
+    }
+    block.resize(scans.size()*width);
+    if (width > 0) for (size_t i = 0; i < scans.size(); i++) getData(scans[i], &block[i*width], width, smoothing);
+    return width;
 }
 
 void ClassReader::getChar(unsigned char *dst, int len)
@@ -216,6 +589,16 @@ void ClassReader::getChar(unsigned char *dst, int len)
     m_ptr += len;
 }
 
+/* mark the optional sections as missing, before the sections of an observation are decoded */
+void ClassReader::resetSections()
+{
+    cdesc.deg = -1;
+    cdesc.nwind = 0;
+    cdesc.nline = -1;
+    cdesc.nphas = -1;
+    cdesc.taus = cdesc.taui = cdesc.h2omm = NAN;
+}
+
 void ClassReader::fillHeader(char *obsblock, int code, int addr, int len)
 {
     int noff = (addr-1)*4;
@@ -246,6 +629,9 @@ void ClassReader::fillHeader(char *obsblock, int code, int addr, int len)
             cdesc.sl0p    = getDouble();
             cdesc.sb0p    = getDouble();
             cdesc.sk0p    = getDouble();
+            /* no system and angle in this version */
+            cdesc.system  = SYSTEM_EQUATORIAL;
+            cdesc.projang = 0.0;
         } else {
             getChar(cdesc.source, 12);
             cdesc.system  = getInt();
@@ -281,15 +667,84 @@ void ClassReader::fillHeader(char *obsblock, int code, int addr, int len)
                cdesc.restf, cdesc.image, cdesc.fres, cdesc.foff, cdesc.nchan, cdesc.rchan, cdesc.vres, cdesc.voff, cdesc.doppler);
 #endif
     } else if (code == -5) { /* Baseline info section (for spectra or drifts) */
-        /* Not supported, silently ignored */
+        int mw = (len - 7)/2;
+        cdesc.deg      = getInt();
+        cdesc.sigfi    = getFloat();
+        cdesc.aire     = getFloat();
+        cdesc.nwind    = getInt();
+        if (mw < 0) mw = 0;
+        for (int i = 0; i < mw; i++) {
+            float w = getFloat();
+            if (i < MAXWIND) cdesc.w1[i] = w;
+        }
+        for (int i = 0; i < mw; i++) {
+            float w = getFloat();
+            if (i < MAXWIND) cdesc.w2[i] = w;
+        }
+        for (int i = 0; i < 3; i++) cdesc.sinus[i] = getFloat();
+        if (cdesc.nwind > mw) cdesc.nwind = mw;
+        if (cdesc.nwind > MAXWIND) cdesc.nwind = MAXWIND;
+        if (cdesc.nwind < 0) cdesc.nwind = 0;
+
+#ifdef DEBUG
+        printf("    -5  deg=%d nwind=%d w=%f %f\n", cdesc.deg, cdesc.nwind, cdesc.w1[0], cdesc.w2[0]);
+#endif
     } else if (code == -6) { /* Scan numbers of initial observations */
         /* Not supported , silently ignored*/
     } else if (code == -7) { /* Default plotting limits */
         /* Not supported, silently ignored */
     } else if (code == -8) { /* Switching information */
-        /* Not supported, silently ignored */
+        int mx = (len - 2)/6;
+        if (mx < 0) mx = 0;
+        cdesc.nphas    = getInt();
+        for (int i = 0; i < mx; i++) {
+            double v = getDouble();
+            if (i < MAXPHASE) cdesc.decal[i] = v;
+        }
+        for (int i = 0; i < mx; i++) {
+            float v = getFloat();
+            if (i < MAXPHASE) cdesc.duree[i] = v;
+        }
+        for (int i = 0; i < mx; i++) {
+            float v = getFloat();
+            if (i < MAXPHASE) cdesc.poids[i] = v;
+        }
+        cdesc.swmod    = getInt();
+        for (int i = 0; i < mx; i++) {
+            float v = getFloat();
+            if (i < MAXPHASE) cdesc.ldecal[i] = v;
+        }
+        for (int i = 0; i < mx; i++) {
+            float v = getFloat();
+            if (i < MAXPHASE) cdesc.bdecal[i] = v;
+        }
+        if (cdesc.nphas < 0) cdesc.nphas = 0;
+        if (cdesc.nphas > mx) cdesc.nphas = mx;
+        if (cdesc.nphas > MAXPHASE) cdesc.nphas = MAXPHASE;
+
+#ifdef DEBUG
+        printf("    -8  nphas=%d mode=%d decal=%f %f\n", cdesc.nphas, cdesc.swmod, cdesc.decal[0], cdesc.decal[1]);
+#endif
     } else if (code == -9) { /* Gauss fit results */
-        /* Not supported, silently ignored */
+        int mf = (len - 3)/2;
+        cdesc.nline    = getInt();
+        cdesc.sigba    = getFloat();
+        cdesc.sigra    = getFloat();
+        if (mf < 0) mf = 0;
+        for (int i = 0; i < mf; i++) {
+            float v = getFloat();
+            if (i < 3*MAXGAUSS) cdesc.nfit[i] = v;
+        }
+        for (int i = 0; i < mf; i++) {
+            float v = getFloat();
+            if (i < 3*MAXGAUSS) cdesc.nerr[i] = v;
+        }
+        if (cdesc.nline > mf/3) cdesc.nline = mf/3;
+        if (cdesc.nline > MAXGAUSS) cdesc.nline = MAXGAUSS;
+
+#ifdef DEBUG
+        printf("    -9  nline=%d area=%f pos=%f width=%f\n", cdesc.nline, cdesc.nfit[0], cdesc.nfit[1], cdesc.nfit[2]);
+#endif
     } else if (code == -10) { /* Continuum drifts */
         cdesc.freq     = getDouble();
         cdesc.width    = getFloat();
@@ -350,19 +805,30 @@ Type1Reader::Type1Reader(const char *filename) : ClassReader(filename)
     getFileDescriptor();
 }
 
+Type1Reader::Type1Reader(ClassSource *source) : ClassReader(source)
+{
+    getFileDescriptor();
+}
+
 Type1Reader::~Type1Reader()
 {
 }
 
+ClassReader *Type1Reader::clone()
+{
+    getIndex();
+    Type1Reader *reader = new Type1Reader(*this);
+    reader->m_shared = true;
+    return reader;
+}
+
 void Type1Reader::getFileDescriptor()
 {
     m_type = 1;
 
     m_reclen = 128;
 
-    fseek(cfp, 0L, SEEK_SET);
-    getRecord();
-    m_ptr = buffer;
+    m_ptr = getRecord(0L);
 
     getChar(fdesc.code, 4);
 
@@ -375,9 +841,11 @@ void Type1Reader::getFileDescriptor()
     fdesc.nex   = getInt();
     fdesc.xnext = getInt();
 
+    /* the extensions follow the 5 words above, within the record */
     int nex = fdesc.nex;
-    if (nex > MAXEXT) {
+    if (nex > MAXEXT1) {
         fprintf(stderr, "number of extensions too large!");
+        nex = fdesc.nex = MAXEXT1;
     }
     for (int i = 0; i < nex; i++) {
         ext[i] = getInt();
@@ -390,7 +858,7 @@ void Type1Reader::getFileDescriptor()
 
 void  Type1Reader::getEntry(int k)
 {
-    m_ptr = buffer + k*m_reclen;
+    m_ptr = m_block + k*m_reclen;
     centry.xblock = getInt();
     centry.xnum = getInt();
     centry.xver = getInt();
@@ -411,27 +879,48 @@ void  Type1Reader::getEntry(int k)
 
 int Type1Reader::getDirectory()
 {
+    TraceScope trace("directory");
     int nst = fdesc.xnext;
     long pos = (ext[0]-1)*m_reclen;
 
-    fseek(cfp, 4*pos, SEEK_SET);
-
+    m_index.clear();
     int nrec = 2;
     int nspec = 0;
     while (nrec < nst) {
 #ifdef DEBUG
-        printf("in %s extension 0 spectrum %d at position %ld\n", __FUNCTION__, nspec+1, ftell(cfp));
+        printf("in %s extension 0 spectrum %d at position %ld\n", __FUNCTION__, nspec+1, 4*pos);
 #endif
-        getRecord();
+        getRecord(4*pos);
+        pos += m_reclen;
         for (int k = 0; k < 4; k++) {
             getEntry(k);
-            if (centry.xver == 1 && centry.xnum > 0 && centry.xnum < nst) {
+            /* xnext is the number of the next free entry */
+            if (nspec < nst-1 && centry.xver != 0 && centry.xnum > 0 && centry.xnum < nst) {
                 nspec++;
 #ifdef DEBUG
                 printf("%5d: xblock=%6d xnum=%4d xver=%d: xsource='%s'  xline='%s' xtel='%s'\n",
                         nspec, centry.xblock, centry.xnum, centry.xver,
                         centry.xsourc, centry.xline, centry.xtel);
 #endif
+                ClassEntry entry;
+                entry.xblock = centry.xblock;
+                entry.xword = 1;
+                entry.xnum = centry.xnum;
+                entry.xver = centry.xver;
+                strncpy(entry.xsourc, (const char *)centry.xsourc, 13);
+                strncpy(entry.xline, (const char *)centry.xline, 13);
+                strncpy(entry.xtel, (const char *)centry.xtel, 13);
+                entry.xdobs = centry.xdobs;
+                entry.xdred = centry.xdred;
+                entry.xoff1 = centry.xoff1;
+                entry.xoff2 = centry.xoff2;
+                strncpy(entry.xtype, (const char *)centry.xtype, 5);
+                entry.xkind = centry.xkind;
+                entry.xqual = centry.xqual;
+                entry.xposa = centry.xposa;
+                entry.xscan = centry.xscan;
+                entry.xsubs = 0;
+                m_index.push_back(entry);
             } else {
                 nrec = nst;
                 break;
@@ -439,27 +928,20 @@ int Type1Reader::getDirectory()
         }
         nrec++;
     }
-    m_nspec = nspec;
-    return nspec;
+    latestVersions();
+    return m_nspec;
 }
 
-SpectrumHeader Type1Reader::getHead(int scan)
+bool Type1Reader::readObservation(int scan, bool withData)
 {
-    SpectrumHeader head;
-    // head.print();
-
-    long pos = (ext[0]-1)*m_reclen;
-    int nrec = (scan-1)/4;
-    int k = (scan-1)%4;
-
-    fseek(cfp, 4*(pos+nrec*m_reclen), SEEK_SET);
-    getRecord();
-    getEntry(k);
+    TraceScope entry("entry", scan);
+    if (!findEntry(scan)) return false;
+    entry.end();
 
-    pos = (centry.xblock-1)*m_reclen;
-    fseek(cfp, 4*pos, SEEK_SET);
-    getRecord();
-    m_ptr = buffer;
+    TraceScope sections("sections", scan);
+    long pos = (m_entry.xblock-1)*m_reclen;
+    m_ptr = getRecord(4*pos);
+    if (!m_ptr) return false;
 
     getChar(csect.ident, 4);
     csect.nbl = getInt();
@@ -477,214 +959,85 @@ SpectrumHeader Type1Reader::getHead(int scan)
     for (int i = 0; i < nsec; i++) csect.sec_adr[i] = getInt();
 #ifdef DEBUG
     printf("%7d %12s %12s %d %d %d %d %d %d %d %d %d (%d %d %d %d | %d %d %d %d | %d %d %d %d)\n",
-           scan, centry.xsourc, centry.xline, centry.xkind,
+           scan, m_entry.xsourc, m_entry.xline, m_entry.xkind,
            csect.nbl, csect.bytes, csect.adr, csect.nhead, csect.len, csect.ientry, csect.nsec, csect.obsnum,
            csect.sec_cod[0], csect.sec_cod[1], csect.sec_cod[2], csect.sec_cod[3],
            csect.sec_adr[0], csect.sec_adr[1], csect.sec_adr[2], csect.sec_adr[3],
            csect.sec_len[0], csect.sec_len[1], csect.sec_len[2], csect.sec_len[3]);
 #endif
     unsigned int size = csect.nbl*m_reclen*4;
-    if (size > sizeof(buffer)) {
-        fprintf(stderr, "buffer too small!");
-    }
+    char *obsblock = m_block;
     if (csect.nbl > 1) {
-        size -= 4*m_reclen;
-        size_t len = fread(buffer+4*m_reclen, sizeof(char), size, cfp);
-        if (len != size) {
-            fprintf(stderr, "failed to read obsblock (%ld != %ld)!", len, static_cast<size_t>(size));
+        obsblock = readBlock(4*pos, size, true);
+        if (!obsblock) {
+            fprintf(stderr, "failed to read obsblock of %d bytes!", size);
+            return false;
         }
     }
 
+    resetSections();
     for (int i = 0; i < nsec; i++) {
-        fillHeader(buffer, csect.sec_cod[i], csect.sec_adr[i], csect.sec_len[i]);
+        fillHeader(obsblock, csect.sec_cod[i], csect.sec_adr[i], csect.sec_len[i]);
     }
+    sections.end();
 
-    bool spectrum = (centry.xkind == 0);
+    cdesc.ndata = (m_entry.xkind == 0) ? cdesc.nchan : cdesc.npoin;
+    if (cdesc.ndata > (int)MAXCHANNELS) {
+        fprintf(stderr, "maximum number of channels exceeded: %d %ld\n", cdesc.ndata, MAXCHANNELS);
+        return false;
+    }
+    /* the data have to lie within the obsblock read */
+    long available = (long)((csect.nbl > 1) ? csect.nbl : 1)*m_reclen*4;
+    if (cdesc.ndata < 0 || csect.nhead < 1 || 4L*(csect.nhead-1) + 4L*cdesc.ndata > available) {
+        fprintf(stderr, "data of spectrum %d outside of its obsblock\n", scan);
+        return false;
+    }
+    cdesc.data = withData ? (float *)(obsblock+4*(csect.nhead-1)) : 0;
+    return true;
+}
 
-    double restf, LO, fres;
-    if (spectrum) {
-        restf = cdesc.restf;
-        LO = (cdesc.restf + cdesc.image)/2.0;
-        fres = cdesc.fres;
-    } else {
-        restf = cdesc.tref;
-        LO = (cdesc.freq + cdesc.cimag)/2.0;
-        fres = cdesc.tres;
+/* the sections are found in the obsblock read along with the data, which directly follow the header */
+bool Type1Reader::getObservation(int scan, ClassObservation &obs)
+{
+    if (!readObservation(scan, true)) return false;
+    const char *obsblock = (const char *)cdesc.data - 4*(csect.nhead-1);
+    int nsec = (csect.nsec > 4) ? 4 : csect.nsec;
+
+    obs.version = 1;
+    obs.codes.clear();
+    obs.lengths.clear();
+    obs.sections.clear();
+    for (int i = 0; i < nsec; i++) {
+        obs.codes.push_back(csect.sec_cod[i]);
+        obs.lengths.push_back(csect.sec_len[i]);
+        const char *sec = obsblock + 4*(csect.sec_adr[i]-1);
+        obs.sections.insert(obs.sections.end(), sec, sec + 4*csect.sec_len[i]);
     }
-    double lam = cdesc.lam;
-    double bet = cdesc.bet;
-    lam += cdesc.lamof/cos(bet);
-    bet += cdesc.betof;
-    time_t datetime = obssecond(centry.xdobs + 60549L, cdesc.ut);
-    // const char *datetime = obstime(centry.xdobs + 60549, cdesc.ut);
-    head.id = scan;
-    head.scanno = centry.xscan;
-    strncpy(head.target, (const char *)centry.xsourc, 12);
-    strncpy(head.line, (const char *)centry.xline, 12);
-    strncpy(head.instr, (const char *)centry.xtel, 12);
-    head.RA = lam*180.0/M_PI;
-    head.Dec = bet*180.0/M_PI;
-    head.fLO = LO;
-    head.f0 = restf;
-    head.df = fres;
-    head.vs = cdesc.voff;
-    head.dt = cdesc.time;
-    head.tsys = cdesc.tsys;
-    head.utc = datetime;
-    return head;
+    const char *data = (const char *)cdesc.data;
+    obs.data.assign(data, data + 4*cdesc.ndata);
+    return true;
 }
 
-std::vector<double> Type1Reader::getFreq(int scan)
+Type2Reader::Type2Reader(const char *filename) : ClassReader(filename)
 {
-    std::vector<double> f;
+    getFileDescriptor();
+}
 
-    long pos = (ext[0]-1)*m_reclen;
-    int nrec = (scan-1)/4;
-    int k = (scan-1)%4;
-
-    fseek(cfp, 4*(pos+nrec*m_reclen), SEEK_SET);
-    getRecord();
-    getEntry(k);
-
-    pos = (centry.xblock-1)*m_reclen;
-    fseek(cfp, 4*pos, SEEK_SET);
-    getRecord();
-    m_ptr = buffer;
-
-    getChar(csect.ident, 4);
-    csect.nbl = getInt();
-    csect.bytes = getInt();
-    csect.adr = getInt();
-    csect.nhead = getInt();
-    csect.len = getInt();
-    csect.ientry = getInt();
-    csect.nsec = getInt();
-    csect.obsnum = getInt();
-    int nsec = csect.nsec;
-    if (nsec > 4) nsec = 4;
-    for (int i = 0; i < nsec; i++) csect.sec_cod[i] = getInt();
-    for (int i = 0; i < nsec; i++) csect.sec_len[i] = getInt();
-    for (int i = 0; i < nsec; i++) csect.sec_adr[i] = getInt();
-
-    unsigned int size = csect.nbl*m_reclen*4;
-    if (size > sizeof(buffer)) {
-        fprintf(stderr, "buffer too small!");
-    }
-    if (csect.nbl > 1) {
-        size -= 4*m_reclen;
-        size_t len = fread(buffer+4*m_reclen, sizeof(char), size, cfp);
-        if (len != size) {
-            fprintf(stderr, "failed to read obsblock (%ld != %ld)!", len, static_cast<size_t>(size));
-        }
-    }
-
-    for (int i = 0; i < nsec; i++) {
-        fillHeader(buffer, csect.sec_cod[i], csect.sec_adr[i], csect.sec_len[i]);
-    }
-
-    bool spectrum = (centry.xkind == 0);
-    int rchan = 0;
-    double restf = 0.0;
-    double fres = 0.0;
-    int ndata = 0;
-    if (spectrum) {
-        rchan = cdesc.rchan;
-        restf = cdesc.restf;
-        fres = cdesc.fres;
-        ndata = cdesc.nchan;
-    } else {
-        rchan = cdesc.rpoin;
-        restf = cdesc.tref;
-        fres = cdesc.tres;
-        ndata = cdesc.npoin;
-    }
-
-    if (ndata > (int)MAXCHANNELS) {
-        fprintf(stderr, "maximum number of channels exceeded: %d %ld\n", ndata, MAXCHANNELS);
-        return f;
-    }
-
-    f = freqVector(ndata, restf, rchan, fres);
-    return f;
-}
-
-std::vector<double> Type1Reader::getData(int scan)
+Type2Reader::Type2Reader(ClassSource *source) : ClassReader(source)
 {
-    std::vector<double> d;
-
-    long pos = (ext[0]-1)*m_reclen;
-    int nrec = (scan-1)/4;
-    int k = (scan-1)%4;
-
-    fseek(cfp, 4*(pos+nrec*m_reclen), SEEK_SET);
-    getRecord();
-    getEntry(k);
-
-    pos = (centry.xblock-1)*m_reclen;
-    fseek(cfp, 4*pos, SEEK_SET);
-    getRecord();
-    m_ptr = buffer;
-
-    getChar(csect.ident, 4);
-    csect.nbl = getInt();
-    csect.bytes = getInt();
-    csect.adr = getInt();
-    csect.nhead = getInt();
-    csect.len = getInt();
-    csect.ientry = getInt();
-    csect.nsec = getInt();
-    csect.obsnum = getInt();
-    int nsec = csect.nsec;
-    if (nsec > 4) nsec = 4;
-    for (int i = 0; i < nsec; i++) csect.sec_cod[i] = getInt();
-    for (int i = 0; i < nsec; i++) csect.sec_len[i] = getInt();
-    for (int i = 0; i < nsec; i++) csect.sec_adr[i] = getInt();
-#ifdef DEBUG
-    printf("%7d %12s %12s %d %d %d %d %d %d %d %d %d (%d %d %d %d | %d %d %d %d | %d %d %d %d)\n",
-           scan, centry.xsourc, centry.xline, centry.xkind,
-           csect.nbl, csect.bytes, csect.adr, csect.nhead, csect.len, csect.ientry, csect.nsec, csect.obsnum,
-           csect.sec_cod[0], csect.sec_cod[1], csect.sec_cod[2], csect.sec_cod[3],
-           csect.sec_adr[0], csect.sec_adr[1], csect.sec_adr[2], csect.sec_adr[3],
-           csect.sec_len[0], csect.sec_len[1], csect.sec_len[2], csect.sec_len[3]);
-#endif
-    unsigned int size = csect.nbl*m_reclen*4;
-    if (size > sizeof(buffer)) {
-        fprintf(stderr, "buffer too small!");
-    }
-    if (csect.nbl > 1) {
-        size -= 4*m_reclen;
-        size_t len = fread(buffer+4*m_reclen, sizeof(char), size, cfp);
-        if (len != size) {
-            fprintf(stderr, "failed to read obsblock (%ld != %ld)!", len, static_cast<size_t>(size));
-        }
-    }
-
-    for (int i = 0; i < nsec; i++) {
-        fillHeader(buffer, csect.sec_cod[i], csect.sec_adr[i], csect.sec_len[i]);
-    }
-
-    bool spectrum = (centry.xkind == 0);
-
-    int ndata = 0;
-    if (spectrum) ndata = cdesc.nchan;
-    else          ndata = cdesc.npoin;
-
-    if (ndata > (int)MAXCHANNELS) {
-        printf("maximum number of channels exceeded: %d %ld\n", ndata, MAXCHANNELS);
-    }
-
-    float *s = (float *)(buffer+4*(csect.nhead-1));
-    d = dataVector(ndata, s);
-    return d;
+    getFileDescriptor();
 }
 
-Type2Reader::Type2Reader(const char *filename) : ClassReader(filename)
+Type2Reader::~Type2Reader()
 {
-    getFileDescriptor();
 }
 
-Type2Reader::~Type2Reader()
+ClassReader *Type2Reader::clone()
 {
+    getIndex();
+    Type2Reader *reader = new Type2Reader(*this);
+    reader->m_shared = true;
+    return reader;
 }
 
 void Type2Reader::getFileDescriptor()
@@ -692,11 +1045,11 @@ void Type2Reader::getFileDescriptor()
     size_t len = 0;
     m_type = 2;
 
-    fseek(cfp, 0L, SEEK_SET);
-    len = fread((char *)&fdesc, sizeof(char), 4, cfp);
-    len = fread((char *)&fdesc.reclen, sizeof(int), 1, cfp);
-    if (len != 1) {
+    len = m_source->read(0L, (char *)&fdesc, 4);
+    len = m_source->read(4L, (char *)&fdesc.reclen, sizeof(int));
+    if (len != sizeof(int)) {
         fprintf(stderr, "failed to read record length\n");
+        fdesc.reclen = 0;
     }
     m_reclen = fdesc.reclen;
 
@@ -704,9 +1057,12 @@ void Type2Reader::getFileDescriptor()
     printf("type=%d, reclen=%d\n", m_type, m_reclen);
 #endif
 
-    fseek(cfp, 0L, SEEK_SET);
-    getRecord();
-    m_ptr = buffer+4*sizeof(char)+sizeof(int);
+    m_ptr = getRecord(0L);
+    if (!m_ptr) {
+        fdesc.nex = 0;
+        return;
+    }
+    m_ptr += 4*sizeof(char)+sizeof(int);
 
     fdesc.kind  = getInt();
     fdesc.vind  = getInt();
@@ -730,9 +1086,13 @@ void Type2Reader::getFileDescriptor()
         return;
     }
 
+    /* the extensions follow the 14 words above, within the record */
     int nex = fdesc.nex;
-    if (nex > MAXEXT) {
+    int maxext = (m_reclen > 14) ? (m_reclen - 14)/2 : 0;
+    if (maxext > MAXEXT) maxext = MAXEXT;
+    if (nex > maxext) {
         fprintf(stderr, "number of extensions too large!");
+        nex = fdesc.nex = maxext;
     }
     unsigned int size = m_reclen;
     for (int i = 0; i < nex; i++) {
@@ -749,7 +1109,7 @@ void Type2Reader::getFileDescriptor()
 
 void Type2Reader::getEntry(int k)
 {
-    m_ptr = buffer + k*4*fdesc.lind;
+    m_ptr = m_block + k*4*fdesc.lind;
     centry.xblock = getLong();
     centry.xword = getInt();
     centry.xnum = getLong();
@@ -772,24 +1132,23 @@ void Type2Reader::getEntry(int k)
 
 int Type2Reader::getDirectory()
 {
+    TraceScope trace("directory");
     int growth = 1;
 
+    m_index.clear();
     int nspec = 0;
     for (int iext = 0; iext < fdesc.nex; iext++) {
         int nst = fdesc.lex1*growth;
         unsigned int isize = nst*fdesc.lind;
         long pos = (ext[iext]-1)*1024;
 
-        fseek(cfp, 4*pos, SEEK_SET);
 #ifdef DEBUG
-        printf("in %s extension %d spectrum %d at position %ld\n", __FUNCTION__, iext, nspec+1, ftell(cfp));
+        printf("in %s extension %d spectrum %d at position %ld\n", __FUNCTION__, iext, nspec+1, 4*pos);
 #endif
-        size_t len = fread(buffer, sizeof(int), isize, cfp);
-        if (len != isize) {
+        if (!readBlock(4*pos, 4*isize, true)) {
             fprintf(stderr, "failed to read directory information\n");
             return 0;
         }
-        m_ptr = buffer;
 
         for (int k = 0; k < nst; k++) {
             getEntry(k);
@@ -800,63 +1159,48 @@ int Type2Reader::getDirectory()
                        nspec, centry.xblock, centry.xword, centry.xnum, centry.xver,
                        centry.xsourc, centry.xline, centry.xtel);
 #endif
+                ClassEntry entry;
+                entry.xblock = centry.xblock;
+                entry.xword = centry.xword;
+                entry.xnum = centry.xnum;
+                entry.xver = centry.xver;
+                strncpy(entry.xsourc, (const char *)centry.xsourc, 13);
+                strncpy(entry.xline, (const char *)centry.xline, 13);
+                strncpy(entry.xtel, (const char *)centry.xtel, 13);
+                entry.xdobs = centry.xdobs;
+                entry.xdred = centry.xdred;
+                entry.xoff1 = centry.xoff1;
+                entry.xoff2 = centry.xoff2;
+                strncpy(entry.xtype, (const char *)centry.xtype, 5);
+                entry.xkind = centry.xkind;
+                entry.xqual = centry.xqual;
+                entry.xposa = centry.xposa;
+                entry.xscan = centry.xscan;
+                entry.xsubs = centry.xsubs;
+                m_index.push_back(entry);
             }
         }
         if (fdesc.gex == 20) growth *= 2;
     }
-    m_nspec = nspec;
-    return nspec;
+    latestVersions();
+    return m_nspec;
 }
 
-SpectrumHeader Type2Reader::getHead(int scan)
+bool Type2Reader::readObservation(int scan, bool withData)
 {
-    SpectrumHeader head;
-    // head.print();
+    TraceScope entry("entry", scan);
+    if (!findEntry(scan)) return false;
+    entry.end();
 
-    size_t len = 0;
-    int iext = 0;
-    unsigned int isize = 0;
-    int jent = 0;
+    TraceScope sections("sections", scan);
+    long pos = (m_entry.xblock-1)*m_reclen+m_entry.xword-1;
 
-    int growth = 1;
-    int nspec = 0;
-    for (int i = 0; i < fdesc.nex; i++) {
-        int nst = fdesc.lex1*growth;
-        isize = nst*fdesc.lind;
-        for (int k = 0; k < nst; k++) {
-            nspec++;
-            if (nspec == scan) {
-                jent = k;
-                iext = i;
-                break;
-            }
-        }
-        if (nspec == scan) break;
-        if (fdesc.gex == 20) growth *= 2;
-    }
-
-    long pos = (ext[iext]-1)*m_reclen;
 #ifdef DEBUG
-    // printf("in %s spectrum %d at position %ld in extension %d entry %d at word %d\n",
-    //         __FUNCTION__, scan, pos, iext, jent, startword);
+    printf("in %s reading spectrum %d at block %ld, word %d position %ld\n",
+            __FUNCTION__, scan, m_entry.xblock, m_entry.xword, 4*pos);
 #endif
-    fseek(cfp, 4*pos, SEEK_SET);
-    len = fread(buffer, sizeof(int), isize, cfp);
-    if (len != isize) {
-        fprintf(stderr, "failed to read entry descriptor\n");
-        return head;
-    }
-
-    getEntry(jent);
-    pos = (centry.xblock-1)*m_reclen+centry.xword-1;
-
-    fseek(cfp, 4*pos, SEEK_SET);
-#ifdef DEBUG
-    printf("in %s reading spectrum %d at block %ld, word %d position %ld (%ld)\n",
-            __FUNCTION__, scan, centry.xblock, centry.xword, ftell(cfp), 4*pos);
-#endif
-    getRecord();
-    m_ptr = buffer;
+    m_ptr = getRecord(4*pos);
+    if (!m_ptr) return false;
 
     getChar(csect.ident, 4);
     csect.version = getInt();
@@ -873,313 +1217,95 @@ SpectrumHeader Type2Reader::getHead(int scan)
 #ifdef DEBUG
     printf("%7d %12s %12s %d %d (%d %d %d %d | %d %d %d %d | %d %d %d %d)\n",
            scan,
-           centry.xsourc, centry.xline, centry.xkind,
+           m_entry.xsourc, m_entry.xline, m_entry.xkind,
            csect.nsec,
            csect.sec_cod[0], csect.sec_cod[1], csect.sec_cod[2], csect.sec_cod[3],
            csect.sec_adr[0], csect.sec_adr[1], csect.sec_adr[2], csect.sec_adr[3],
            csect.sec_len[0], csect.sec_len[1], csect.sec_len[2], csect.sec_len[3]);
 #endif
 
+    resetSections();
     for (int i = 0; i < nsec; i++) {
         unsigned int isize = csect.sec_len[i];
         unsigned int size = 4*isize;
         long secpos = 4*(pos + csect.sec_adr[i]-1);
 #ifdef DEBUG
         printf("in %s reading section %d at position %ld (%ld,%ld)\n",
-                __FUNCTION__, i, ftell(cfp), pos, csect.sec_adr[i]);
+                __FUNCTION__, i, secpos, pos, csect.sec_adr[i]);
 #endif
-        int ierr = fseek(cfp, secpos, SEEK_SET);
-        if (ierr == -1) {
-            fprintf(stderr, "failure to position section %d (%ld)\n", i, secpos);
-            break;
-        }
-        len = fread(buffer, sizeof(char), size, cfp);
-        if (len != size) {
-            fprintf(stderr, "failed to read section %d (%ld != %ld)\n", i, len, static_cast<size_t>(size));
+        char *section = readBlock(secpos, size, true);
+        if (!section) {
+            fprintf(stderr, "failed to read section %d (%ld)\n", i, static_cast<size_t>(size));
             break;
         }
-        m_ptr = buffer;
 #ifdef DEBUG
-        printf("Sect[%d]=%3d at adr %d of length %d.\n", i, csect.sec_cod[i], secpos, size);
+        printf("Sect[%d]=%3d at adr %ld of length %d.\n", i, csect.sec_cod[i], secpos, size);
 #endif
-        fillHeader(buffer, csect.sec_cod[i], 1, csect.sec_len[i]);
+        fillHeader(section, csect.sec_cod[i], 1, csect.sec_len[i]);
     }
+    sections.end();
 
-    bool spectrum = (centry.xkind == 0);
-
-    double restf, LO, fres;
-    if (spectrum) {
-        restf = cdesc.restf;
-        LO = (cdesc.restf + cdesc.image)/2.0;
-        fres = cdesc.fres;
-    } else {
-        restf = cdesc.tref;
-        LO = (cdesc.freq + cdesc.cimag)/2.0;
-        fres = cdesc.tres;
-    }
-    double lam = cdesc.lam;
-    double bet = cdesc.bet;
-    lam += cdesc.lamof/cos(bet);
-    bet += cdesc.betof;
-    time_t datetime = obssecond(centry.xdobs + 60549L, cdesc.ut);
-    // const char *datetime = obstime(centry.xdobs + 60549, cdesc.ut);
-    head.id = scan;
-    head.scanno = centry.xscan;
-    strncpy(head.target, (const char *)centry.xsourc, 12);
-    strncpy(head.line, (const char *)centry.xline, 12);
-    strncpy(head.instr, (const char *)centry.xtel, 12);
-    head.RA = lam*180.0/M_PI;
-    head.Dec = bet*180.0/M_PI;
-    head.fLO = LO;
-    head.f0 = restf;
-    head.df = fres;
-    head.vs = cdesc.voff;
-    head.dt = cdesc.time;
-    head.tsys = cdesc.tsys;
-    head.utc = datetime;
-    return head;
-}
-
-std::vector<double> Type2Reader::getFreq(int scan)
-{
-    std::vector<double> f;
-    size_t len = 0;
-    int iext = 0;
-    unsigned int isize = 0;
-    int jent = 0;
-
-    int growth = 1;
-    int nspec = 0;
-    for (int i = 0; i < fdesc.nex; i++) {
-        int nst = fdesc.lex1*growth;
-        isize = nst*fdesc.lind;
-        for (int k = 0; k < nst; k++) {
-            nspec++;
-            if (nspec == scan) {
-                jent = k;
-                iext = i;
-                break;
-            }
-        }
-        if (nspec == scan) break;
-        if (fdesc.gex == 20) growth *= 2;
+    cdesc.ndata = (m_entry.xkind == 0) ? cdesc.nchan : cdesc.npoin;
+    if (cdesc.ndata > (int)MAXCHANNELS) {
+        fprintf(stderr, "maximum number of channels exceeded: %d %ld\n", cdesc.ndata, MAXCHANNELS);
+        return false;
     }
-
-    long pos = (ext[iext]-1)*m_reclen;
-#ifdef DEBUG
-    // printf("in %s spectrum %d at position %ld in extension %d entry %d at word %d\n",
-    //         __FUNCTION__, scan, pos, iext, jent, startword);
-#endif
-    fseek(cfp, 4*pos, SEEK_SET);
-    len = fread(buffer, sizeof(int), isize, cfp);
-    if (len != isize) {
-        fprintf(stderr, "failed to read entry descriptor\n");
-        return f;
+    if (cdesc.ndata < 0 || cdesc.ndata > csect.ldata) {
+        fprintf(stderr, "spectrum %d has %d channels, but %ld data words\n", scan, cdesc.ndata, csect.ldata);
+        return false;
     }
+    cdesc.data = 0;
+    if (!withData) return true;
 
-    getEntry(jent);
-    pos = (centry.xblock-1)*m_reclen+centry.xword-1;
-
-    fseek(cfp, 4*pos, SEEK_SET);
-#ifdef DEBUG
-    printf("in %s reading spectrum %d at block %ld, word %d position %ld (%ld)\n",
-            __FUNCTION__, scan, centry.xblock, centry.xword, ftell(cfp), 4*pos);
-#endif
-    getRecord();
-    m_ptr = buffer;
-
-    getChar(csect.ident, 4);
-    csect.version = getInt();
-    csect.nsec = getInt();
-    csect.nword = getLong();
-    csect.adata = getLong();
-    csect.ldata = getLong();
-    csect.xnum = getLong();
-    int nsec = csect.nsec;
-    if (nsec > 10) nsec = 10;
-    for (int i = 0; i < nsec; i++) csect.sec_cod[i] = getInt();
-    for (int i = 0; i < nsec; i++) csect.sec_len[i] = getLong();
-    for (int i = 0; i < nsec; i++) csect.sec_adr[i] = getLong();
-#ifdef DEBUG
-    printf("%7d %12s %12s %d %d (%d %d %d %d | %d %d %d %d | %d %d %d %d)\n",
-           scan,
-           centry.xsourc, centry.xline, centry.xkind,
-           csect.nsec,
-           csect.sec_cod[0], csect.sec_cod[1], csect.sec_cod[2], csect.sec_cod[3],
-           csect.sec_adr[0], csect.sec_adr[1], csect.sec_adr[2], csect.sec_adr[3],
-           csect.sec_len[0], csect.sec_len[1], csect.sec_len[2], csect.sec_len[3]);
-#endif
-
-    for (int i = 0; i < nsec; i++) {
-        unsigned int isize = csect.sec_len[i];
-        unsigned int size = 4*isize;
-        long secpos = 4*(pos + csect.sec_adr[i]-1);
-#ifdef DEBUG
-        printf("in %s reading section %d at position %ld (%ld,%ld)\n",
-                __FUNCTION__, i, ftell(cfp), pos, csect.sec_adr[i]);
-#endif
-        int ierr = fseek(cfp, secpos, SEEK_SET);
-        if (ierr == -1) {
-            fprintf(stderr, "failure to position section %d (%ld)\n", i, secpos);
-            break;
-        }
-        len = fread(buffer, sizeof(char), size, cfp);
-        if (len != size) {
-            fprintf(stderr, "failed to read section %d (%ld != %ld)\n", i, len, static_cast<size_t>(size));
-            break;
-        }
-        m_ptr = buffer;
+    TraceScope data("data", scan);
+    unsigned int isize = csect.ldata;
+    long datapos = 4*(pos + csect.adata-1);
 #ifdef DEBUG
-        printf("Sect[%d]=%3d at adr %d of length %d.\n", i, csect.sec_cod[i], secpos, size);
+    printf("in %s reading data for spectrum %d at position %ld (%ld,%ld)\n",
+           __FUNCTION__, scan, datapos, pos, csect.adata);
 #endif
-        fillHeader(buffer, csect.sec_cod[i], 1, csect.sec_len[i]);
-    }
-
-    bool spectrum = (centry.xkind == 0);
-
-    int ndata = 0;
-    double restf, rchan, fres;
-    if (spectrum) {
-        rchan = cdesc.rchan;
-        restf = cdesc.restf;
-        fres = cdesc.fres;
-        ndata = cdesc.nchan;
-    } else {
-        rchan = cdesc.rpoin;
-        restf = cdesc.tref;
-        fres = cdesc.tres;
-        ndata = cdesc.npoin;
-    }
-    if (ndata > (int)MAXCHANNELS) {
-        fprintf(stderr, "maximum number of channels exceeded: %d %ld\n", ndata, MAXCHANNELS);
+    char *datatbl = readBlock(datapos, 4*isize, false);
+    if (!datatbl) {
+        fprintf(stderr, "failed to read data block\n");
+        return false;
     }
+    data.end();
 
-    f = freqVector(ndata, restf, rchan, fres);
-    return f;
+    cdesc.data = (float *)(datatbl);
+    return true;
 }
 
-std::vector<double> Type2Reader::getData(int scan)
+/* the header is decoded first, then the whole obsblock is read at once */
+bool Type2Reader::getObservation(int scan, ClassObservation &obs)
 {
-    std::vector<double> d;
-    size_t len = 0;
-    int iext = 0;
-    unsigned int isize = 0;
-    int jent = 0;
-
-    int growth = 1;
-    int nspec = 0;
-    for (int i = 0; i < fdesc.nex; i++) {
-        int nst = fdesc.lex1*growth;
-        isize = nst*fdesc.lind;
-        for (int k = 0; k < nst; k++) {
-            nspec++;
-            if (nspec == scan) {
-                jent = k;
-                iext = i;
-                break;
-            }
-        }
-        if (nspec == scan) break;
-        if (fdesc.gex == 20) growth *= 2;
-    }
-
-    long pos = (ext[iext]-1)*m_reclen;
-#ifdef DEBUG
-    // printf("in %s spectrum %d at position %ld in extension %d entry %d at word %d\n",
-    //         __FUNCTION__, scan, pos, iext, jent, startword);
-#endif
-    fseek(cfp, 4*pos, SEEK_SET);
-    len = fread(buffer, sizeof(int), isize, cfp);
-    if (len != isize) {
-        fprintf(stderr, "failed to read entry descriptor\n");
-        return d;
+    if (!readObservation(scan, false)) return false;
+    long pos = (m_entry.xblock-1)*m_reclen+m_entry.xword-1;
+    const char *obsblock = readBlock(4*pos, 4*csect.nword, true);
+    if (!obsblock) {
+        fprintf(stderr, "failed to read obsblock of %ld words\n", csect.nword);
+        return false;
     }
+    int nsec = (csect.nsec > 10) ? 10 : csect.nsec;
 
-    getEntry(jent);
-    pos = (centry.xblock-1)*m_reclen+centry.xword-1;
-
-    fseek(cfp, 4*pos, SEEK_SET);
-#ifdef DEBUG
-    printf("in %s reading spectrum %d at block %ld, word %d position %ld (%ld)\n",
-            __FUNCTION__, scan, centry.xblock, centry.xword, ftell(cfp), 4*pos);
-#endif
-    getRecord();
-    m_ptr = buffer;
-
-    getChar(csect.ident, 4);
-    csect.version = getInt();
-    csect.nsec = getInt();
-    csect.nword = getLong();
-    csect.adata = getLong();
-    csect.ldata = getLong();
-    csect.xnum = getLong();
-    int nsec = csect.nsec;
-    if (nsec > 10) nsec = 10;
-    for (int i = 0; i < nsec; i++) csect.sec_cod[i] = getInt();
-    for (int i = 0; i < nsec; i++) csect.sec_len[i] = getLong();
-    for (int i = 0; i < nsec; i++) csect.sec_adr[i] = getLong();
-#ifdef DEBUG
-    printf("%7d %12s %12s %d %d (%d %d %d %d | %d %d %d %d | %d %d %d %d)\n",
-           scan,
-           centry.xsourc, centry.xline, centry.xkind,
-           csect.nsec,
-           csect.sec_cod[0], csect.sec_cod[1], csect.sec_cod[2], csect.sec_cod[3],
-           csect.sec_adr[0], csect.sec_adr[1], csect.sec_adr[2], csect.sec_adr[3],
-           csect.sec_len[0], csect.sec_len[1], csect.sec_len[2], csect.sec_len[3]);
-#endif
-
+    obs.version = csect.version;
+    obs.codes.clear();
+    obs.lengths.clear();
+    obs.sections.clear();
     for (int i = 0; i < nsec; i++) {
-        unsigned int isize = csect.sec_len[i];
-        unsigned int size = 4*isize;
-        long secpos = 4*(pos + csect.sec_adr[i]-1);
-#ifdef DEBUG
-        printf("in %s reading section %d at position %ld (%ld,%ld)\n",
-                __FUNCTION__, i, ftell(cfp), pos, csect.sec_adr[i]);
-#endif
-        int ierr = fseek(cfp, secpos, SEEK_SET);
-        if (ierr == -1) {
-            fprintf(stderr, "failure to position section %d (%ld)\n", i, secpos);
-            break;
-        }
-        len = fread(buffer, sizeof(char), size, cfp);
-        if (len != size) {
-            fprintf(stderr, "failed to read section %d (%ld != %ld)\n", i, len, static_cast<size_t>(size));
-            break;
+        if (csect.sec_adr[i] < 1 || csect.sec_adr[i]-1 + csect.sec_len[i] > csect.nword) {
+            fprintf(stderr, "section %d of spectrum %d outside of its obsblock\n", csect.sec_cod[i], scan);
+            return false;
         }
-        m_ptr = buffer;
-#ifdef DEBUG
-        printf("Sect[%d]=%3d at adr %d of length %d.\n", i, csect.sec_cod[i], secpos, size);
-#endif
-        fillHeader(buffer, csect.sec_cod[i], 1, csect.sec_len[i]);
-    }
-
-    bool spectrum = (centry.xkind == 0);
-
-    isize = csect.ldata;
-    char *datatbl = buffer;
-    if (4*isize > sizeof(buffer)) {
-        fprintf(stderr, "buffer too small!");
-    }
-    long datapos = 4*(pos + csect.adata-1);
-    fseek(cfp, datapos, SEEK_SET);
-#ifdef DEBUG
-    printf("in %s reading data for spectrum %d at position %ld (%ld,%ld)\n",
-           __FUNCTION__, scan, ftell(cfp), pos, csect.adata);
-#endif
-    len = fread(datatbl, sizeof(int), isize, cfp);
-    if (len != isize) {
-        fprintf(stderr, "failed to read data block\n");
+        obs.codes.push_back(csect.sec_cod[i]);
+        obs.lengths.push_back(csect.sec_len[i]);
+        const char *sec = obsblock + 4*(csect.sec_adr[i]-1);
+        obs.sections.insert(obs.sections.end(), sec, sec + 4*csect.sec_len[i]);
     }
-
-    int ndata = 0;
-    if (spectrum) ndata = cdesc.nchan;
-    else          ndata = cdesc.npoin;
-
-    if (ndata > (int)MAXCHANNELS) {
-        fprintf(stderr, "maximum number of channels exceeded: %d %ld\n", ndata, MAXCHANNELS);
+    if (csect.adata < 1 || csect.adata-1 + csect.ldata > csect.nword) {
+        fprintf(stderr, "data of spectrum %d outside of its obsblock\n", scan);
+        return false;
     }
-
-    float *s = (float *)(datatbl);
-    d = dataVector(ndata, s);
-    return d;
+    const char *data = obsblock + 4*(csect.adata-1);
+    obs.data.assign(data, data + 4*csect.ldata);
+    return true;
 }
@@ -13,6 +13,9 @@
 #include <math.h>
 #include <time.h>
 
+#include "smooth.h"
+#include "source.h"
+
 /**
  * @file class.h
  */
@@ -53,10 +56,66 @@ struct SpectrumHeader {
  * the type of CLASSIC file.
  *
  * @param filename a string holding the name of a file to check
- * @return 1 or 2 for file type, or error code (< 1) if unsuccessful
+ * @return 1 or 2 for file type, 3 for an archive (see archive.h), or error
+ *         code (< 1) if unsuccessful
  */
 int fileType(const char *filename);
 
+/**
+ * @brief Get type of CLASSIC data from a source
+ *
+ * @param source the source to check
+ * @return 1 or 2 for file type, 3 for an archive (see archive.h), or error
+ *         code (< 1) if unsuccessful
+ */
+int fileType(ClassSource *source);
+
+#define MAXWIND 100       // maximum number of baseline windows kept
+#define MAXGAUSS 10       // maximum number of gaussian components kept
+#define MAXPHASE 8        // maximum number of switching phases kept
+
+/**
+ * @brief Switching modes of the switching section.
+ */
+enum SwitchMode {
+    SWITCH_FREQUENCY = 1, ///< frequency switching
+    SWITCH_POSITION,      ///< position switching
+    SWITCH_FOLDED,        ///< frequency switched, already folded
+    SWITCH_WOBBLER,       ///< wobbler switching
+    SWITCH_MIXED          ///< mixed frequency and position switching
+};
+
+/**
+ * @brief Coordinate systems of the position section, with the codes used by
+ * CLASS.
+ */
+enum CoordSystem {
+    SYSTEM_UNKNOWN = 1,   ///< unknown
+    SYSTEM_EQUATORIAL,    ///< equatorial, of the epoch of the section
+    SYSTEM_GALACTIC,      ///< galactic
+    SYSTEM_HORIZONTAL,    ///< azimuth and elevation
+    SYSTEM_ICRS           ///< ICRS, taken as equatorial J2000
+};
+
+/**
+ * @brief Projections of the offsets of the position section, with the codes
+ * used by CLASS.
+ */
+enum Projection {
+    PROJ_NONE = 0,        ///< offsets added to the centre
+    PROJ_GNOMONIC,        ///< gnomonic (TAN)
+    PROJ_ORTHO,           ///< orthographic (SIN)
+    PROJ_AZIMUTHAL,       ///< azimuthal equidistant (ARC)
+    PROJ_STEREO,          ///< stereographic (STG)
+    PROJ_LAMBERT,         ///< Lambert azimuthal equal area (ZEA)
+    PROJ_AITOFF,          ///< Hammer-Aitoff (AIT)
+    PROJ_RADIO,           ///< classic radio, x divided by cos of the centre latitude (GLS)
+    PROJ_SFL,             ///< Sanson-Flamsteed, x divided by cos of the latitude (SFL)
+    PROJ_MOLLWEIDE,       ///< Mollweide (MOL)
+    PROJ_NCP,             ///< north celestial pole (NCP)
+    PROJ_CARTESIAN        ///< plain cartesian (CAR)
+};
+
 struct ClassDescriptor {
     int xbloc;
     int xnum;
@@ -108,6 +167,22 @@ struct ClassDescriptor {
     float atfac, alti, count[3], lcalof, bcalof;
     double geolong, geolat;
 
+    int deg;              // baseline degree, -1 if there is no baseline section
+    float sigfi, aire;
+    int nwind;
+    float w1[MAXWIND], w2[MAXWIND];
+    float sinus[3];
+
+    int nline;            // number of gaussian components, -1 if there is no gauss section
+    float sigba, sigra;
+    float nfit[3*MAXGAUSS], nerr[3*MAXGAUSS];   // area, position and width of every component
+
+    int nphas;            // number of switching phases, -1 if there is no switching section
+    double decal[MAXPHASE];                     // frequency offsets of the phases in MHz
+    float duree[MAXPHASE], poids[MAXPHASE];     // time and weight of the phases
+    int swmod;            // switching mode, SWITCH_FREQUENCY etc.
+    float ldecal[MAXPHASE], bdecal[MAXPHASE];   // position offsets of the phases
+
     double freq;
     float width;
     int npoin;
@@ -120,6 +195,64 @@ struct ClassDescriptor {
     float *data;
 };
 
+/**
+ * @brief A directory entry, common to files of type 1 and 2.
+ *
+ * The directory of a file is read once by ClassReader::getDirectory(),
+ * after which spectra are located through these entries.
+ */
+struct ClassEntry {
+    long int xblock;      ///< record number of the observation
+    int xword;            ///< first word of the observation in that record (always 1 for type 1)
+    long int xnum;        ///< observation number
+    int xver;             ///< observation version
+    char xsourc[13];      ///< source name
+    char xline[13];       ///< line name
+    char xtel[13];        ///< telescope name
+    int xdobs;            ///< observation date (CLASS days)
+    int xdred;            ///< reduction date (CLASS days)
+    float xoff1;          ///< first offset (radians)
+    float xoff2;          ///< second offset (radians)
+    char xtype[5];        ///< type of offsets
+    int xkind;            ///< 0 for spectra, 1 for continuum drifts
+    int xqual;            ///< quality
+    int xposa;            ///< position angle
+    long int xscan;       ///< scan number
+    int xsubs;            ///< subscan number (always 0 for type 1)
+};
+
+/**
+ * @brief The undecoded header sections and data of an observation, as
+ * needed to copy it to another file.
+ */
+struct ClassObservation {
+    int version;                      ///< version of the observation, 1 for files of type 1
+    std::vector<int> codes;           ///< section codes
+    std::vector<long int> lengths;    ///< section lengths in words
+    std::vector<char> sections;       ///< the sections, one after the other
+    std::vector<char> data;           ///< the data, as stored
+};
+
+/**
+ * @brief Criteria for selecting spectra by their directory entries.
+ *
+ * Names are matched with shell wildcards ('*', '?', '[...]'), where an empty
+ * pattern matches anything. A scan range with scan2 < scan1 has no upper
+ * limit.
+ */
+struct ClassSelection {
+    ClassSelection();     ///< constructor, selecting everything
+
+    char source[33];      ///< pattern for the source name
+    char line[33];        ///< pattern for the line name
+    char telescope[33];   ///< pattern for the telescope name
+    long int scan1;       ///< first scan number
+    long int scan2;       ///< last scan number
+    int kind;             ///< 0 for spectra, 1 for continuum drifts, -1 for both
+
+    bool matches(const ClassEntry &entry) const;   ///< true if the entry is selected
+};
+
 struct FileDescriptor1 {
     unsigned char code[4];
     int next;
@@ -214,6 +347,32 @@ struct ClassSection2 {
     long int sec_adr[10];
 };
 
+/**
+ * @brief A linear spectral axis, in frequency (or time) or in velocity.
+ *
+ * The value of channel k (1..nchan) is (k - ref)*df + f0. Axes are small
+ * descriptors, passed around by value, whose values are only computed when
+ * needed.
+ */
+struct SpectralAxis {
+    SpectralAxis();                                           ///< empty axis
+    SpectralAxis(int nchan, double f0, double ref, double df); ///< constructor
+
+    int nchan;            ///< number of channels
+    double f0;            ///< value at the reference channel
+    double ref;           ///< reference channel
+    double df;            ///< channel width
+
+    double value(double channel) const;     ///< value at a (fractional) channel
+    double channel(double value) const;     ///< (fractional) channel of a value
+    std::vector<double> values() const;     ///< values of all channels
+    void values(std::vector<double> &v) const;  ///< values of all channels, filled in place
+    /**
+     * True if both axes agree to within tol channels, at every channel.
+     */
+    bool same(const SpectralAxis &other, double tol = 1.0e-3) const;
+};
+
 #define BUFSIZE (1024*1024)                  // 1 Mb
 #define MAXCHANNELS (BUFSIZE/sizeof(float))  // 262144
 
@@ -221,69 +380,215 @@ struct ClassSection2 {
  * A class to read a CLASSIC file.
  *
  * This is the virtual base class, from which the Type1Reader and Type2Reader,
- * for file types 1 and 2, respectively, will inherit.
+ * for file types 1 and 2, respectively, and the ArchiveReader will inherit.
  */ 
 class ClassReader {
  public:
     ClassReader(const char *);
+    ClassReader(ClassSource *);
     virtual ~ClassReader();
 
+    /**
+     * Return a copy of this reader, including its directory, which reads
+     * from the same source, so that spectra may be read by several threads
+     * at once, each using its own copy. The source stays owned by this
+     * reader, so copies have to be deleted first.
+     */
+    virtual ClassReader *clone() = 0;
     /**
      * Scan the file contents and return number of spectra found.
+     *
+     * Unless setAllVersions() was called, only the latest version of every
+     * observation number is kept, as in CLASS: an observation written again
+     * gets a higher version, and negative versions mark obsolete ones.
      */
     virtual int getDirectory() = 0;
+    /**
+     * Keep all versions of every observation in the directory, or only the
+     * latest one (the default). Takes effect with the next getDirectory().
+     */
+    void setAllVersions(bool all);
+    bool getAllVersions() const;      ///< true if all versions are kept
     /**
      * Return header for given spectrum number.
      *
      * @param scan number of spectrum (1..nscans)
      * @return object of type SpectrumHeader
      */
-    virtual SpectrumHeader getHead(int scan) = 0;
+    virtual SpectrumHeader getHead(int scan);
     /**
      * Return frequency vector for given spectrum number.
      *
      * @param scan number of spectrum (1..nscans)
      * @return vector of doubles
      */
-    virtual std::vector<double> getFreq(int scan) = 0;
+    virtual std::vector<double> getFreq(int scan);
+    /**
+     * Return the frequency (or time, for continuum drifts) axis of given
+     * spectrum number, without reading its data. As for getFreq(), an
+     * axis without a channel width gives the channel numbers.
+     *
+     * @param scan number of spectrum (1..nscans)
+     * @param smoothing smoothing and binning, which change the axis
+     * @return the axis, of no channels if the spectrum could not be read
+     */
+    SpectralAxis getAxis(int scan, const Smoothing &smoothing = Smoothing());
     /**
      * Return data vector for given spectrum number.
      *
      * @param scan number of spectrum (1..nscans)
      * @return vector of doubles
      */
-    virtual std::vector<double> getData(int scan) = 0;
+    virtual std::vector<double> getData(int scan);
+    /**
+     * Return header, frequency and data vector for given spectrum number.
+     *
+     * The observation is read only once, and the vectors are filled in
+     * place, so that their storage may be reused from one call to the next.
+     *
+     * @param scan number of spectrum (1..nscans)
+     * @param head header of the spectrum
+     * @param freq frequency vector of the spectrum
+     * @param data data vector of the spectrum
+     * @param smoothing smoothing and binning applied while decoding, which
+     *                  also changes the frequency vector and head.df
+     * @return true if successful
+     */
+    bool getSpectrum(int scan, SpectrumHeader &head, std::vector<double> &freq, std::vector<double> &data,
+                     const Smoothing &smoothing = Smoothing());
+    /**
+     * Return header, axis and data vector for given spectrum number, as
+     * above, without computing the frequency vector.
+     */
+    bool getSpectrum(int scan, SpectrumHeader &head, SpectralAxis &axis, std::vector<double> &data,
+                     const Smoothing &smoothing = Smoothing());
+    /**
+     * Return the number of channels of given spectrum number, without
+     * reading its data.
+     *
+     * @param scan number of spectrum (1..nscans)
+     * @return number of channels, or -1 if the spectrum could not be read
+     */
+    int getChannels(int scan);
+    /**
+     * Read the data of given spectrum number into a caller supplied array.
+     *
+     * Channels beyond the end of the spectrum are set to NaN.
+     *
+     * @param scan number of spectrum (1..nscans)
+     * @param dst destination of size values
+     * @param size number of values to fill
+     * @param smoothing smoothing and binning applied while decoding
+     * @return number of channels of the spectrum after binning, or -1 if it could not be read
+     */
+    int getData(int scan, double *dst, int size, const Smoothing &smoothing = Smoothing());
+    /**
+     * Return the directory entries, reading the directory if needed.
+     */
+    const std::vector<ClassEntry> &getIndex();
+    /**
+     * Return the numbers of all spectra matching the selection.
+     */
+    std::vector<int> find(const ClassSelection &sel);
+    /**
+     * Return the headers of the given spectrum numbers.
+     */
+    std::vector<SpectrumHeader> getHeaders(const std::vector<int> &scans);
+    /**
+     * Read the data of the given spectrum numbers into one row-major block.
+     *
+     * The width of the block is the largest number of channels, shorter
+     * spectra and spectra that could not be read are padded with NaN.
+     *
+     * @param scans numbers of spectra (1..nscans)
+     * @param block the block, resized to scans.size() rows
+     * @param smoothing smoothing and binning applied while decoding
+     * @return the width of the block
+     */
+    int getDataBlock(const std::vector<int> &scans, std::vector<double> &block,
+                     const Smoothing &smoothing = Smoothing());
+    /**
+     * Read given spectrum number and return its decoded header sections.
+     *
+     * This is meant for processing code needing more than SpectrumHeader.
+     * The result is valid until the next spectrum is read by this reader.
+     * If withData is set, the data may lie in the read buffer, which is
+     * shared by all readers of the calling thread, so that they are only
+     * valid until any reader reads another spectrum on that thread.
+     *
+     * @param scan number of spectrum (1..nscans)
+     * @param withData if set, the descriptor points to the raw data values
+     * @return the descriptor, or NULL if the spectrum could not be read
+     */
+    const ClassDescriptor *getDescriptor(int scan, bool withData);
+    /**
+     * Read given spectrum number without decoding it, see ClassObservation.
+     *
+     * @param scan number of spectrum (1..nscans)
+     * @param obs the observation, whose vectors are reused
+     * @return true if successful
+     */
+    virtual bool getObservation(int scan, ClassObservation &obs) = 0;
+    /**
+     * Return the axis of the spectrum read last: reference frequency (or
+     * time), reference channel and channel width.
+     */
+    void axis(double &f0, double &ref, double &df);
+    /**
+     * Return the name of the file (or other source) read.
+     */
+    const char *getFileName();
 
     void dumpRecord();
 
  protected:
-    bool open();
     virtual void getFileDescriptor() = 0;
     virtual void  getEntry(int k) = 0;
-    void getRecord();
+    /**
+     * Read the observation of given spectrum number.
+     *
+     * This sets m_entry to its directory entry and decodes its header
+     * sections into cdesc. If withData is set, cdesc.data will point
+     * to the cdesc.ndata raw data values.
+     *
+     * @return true if successful
+     */
+    virtual bool readObservation(int scan, bool withData) = 0;
+    bool findEntry(int scan);
+    SpectrumHeader makeHeader(int scan);
+    char *readBlock(long offset, size_t size, bool exact);
+    char *getRecord(long offset);
     int getInt();
     long int getLong();
     void getChar(unsigned char *dst, int len);
     float getFloat();
     double getDouble();
+    void resetSections();
     void fillHeader(char *obsblock, int code, int addr, int len);
     void trim(unsigned char *ptr);
     time_t obssecond(long mjdn, double utc);
     double rta(float rad);
     std::vector<double> dataVector(int nchan, float *data);
-    std::vector<double> freqVector(int nchan, double f0, double ref, double df);
+    void dataVector(std::vector<double> &dst, int nchan, float *data, const Smoothing &smoothing = Smoothing());
+    SpectralAxis readAxis(const Smoothing &smoothing);
+    void latestVersions();
 
     struct ClassDescriptor cdesc;
+    std::vector<ClassEntry> m_index;
+    ClassEntry m_entry;
     int m_type;
     char cfname[256];
-    FILE *cfp;
+    ClassSource *m_source;
+    bool m_shared;        // source owned by another reader
+    bool m_allVersions;   // keep superseded versions in the index
+    char *m_block;
     char *m_ptr;
     unsigned int m_reclen;
     int m_nspec;
-    char buffer[BUFSIZE];
 };
 
-#define MAXEXT 10
+#define MAXEXT 500       // directory extensions, as many as fit into the file descriptor of type 2
+#define MAXEXT1 123      // directory extensions of type 1, as many as fit into its record of 128 words
 
 /**
  * A class to read a CLASSIC file of type 1.
@@ -293,21 +598,22 @@ class Type1Reader : public ClassReader {
 
  public:
     Type1Reader(const char *);
+    Type1Reader(ClassSource *);
     ~Type1Reader();
 
+    ClassReader *clone();
     int getDirectory();
-    SpectrumHeader getHead(int scan);
-    std::vector<double> getFreq(int scan);
-    std::vector<double> getData(int scan);
+    bool getObservation(int scan, ClassObservation &obs);
 
  private:
     void getFileDescriptor();
     void getEntry(int k);
+    bool readObservation(int scan, bool withData);
 
     FileDescriptor1 fdesc;
     Type1Entry centry;
     ClassSection1 csect;
-    int ext[MAXEXT];
+    int ext[MAXEXT1];
 };
 
 /**
@@ -318,16 +624,17 @@ class Type2Reader : public ClassReader {
 
  public:
     Type2Reader(const char *);
+    Type2Reader(ClassSource *);
     ~Type2Reader();
 
+    ClassReader *clone();
     int getDirectory();
-    SpectrumHeader getHead(int scan);
-    std::vector<double> getFreq(int scan);
-    std::vector<double> getData(int scan);
+    bool getObservation(int scan, ClassObservation &obs);
 
  private:
     void getFileDescriptor();
     void getEntry(int k);
+    bool readObservation(int scan, bool withData);
 
     FileDescriptor2 fdesc;
     Type2Entry centry;
@@ -339,8 +646,39 @@ class Type2Reader : public ClassReader {
  * Open a CLASSIC file and return a suitable reader.
  *
  * @param filename a string holding the name of a file to check
- * @return a pointer to either a Type1Reader or Type2Reader instance.
+ * @return a pointer to a Type1Reader, Type2Reader or ArchiveReader instance.
  */
 ClassReader *openClassFile(const char *filename);
 
+/**
+ * Return a suitable reader for an already open file descriptor.
+ *
+ * The descriptor is read with positioned reads, and is not closed by the reader.
+ *
+ * @param fd an open file descriptor
+ * @return a pointer to a Type1Reader, Type2Reader or ArchiveReader instance.
+ */
+ClassReader *openClassFd(int fd);
+
+/**
+ * Return a suitable reader for CLASSIC data held in memory.
+ *
+ * The data is not copied, so the memory region has to stay valid until
+ * the reader is deleted.
+ *
+ * @param data start of the memory region
+ * @param len size of the memory region in bytes
+ * @return a pointer to a Type1Reader, Type2Reader or ArchiveReader instance.
+ */
+ClassReader *openClassBuffer(const void *data, size_t len);
+
+/**
+ * Return a suitable reader for the given source, which is owned by the
+ * reader from then on (and deleted if no reader could be created).
+ *
+ * @param source the source of the CLASSIC data
+ * @return a pointer to a Type1Reader, Type2Reader or ArchiveReader instance.
+ */
+ClassReader *openClassSource(ClassSource *source);
+
 #endif
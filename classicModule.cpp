@@ -7,221 +7,2885 @@
 #include <numpy/arrayobject.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
+#include <algorithm>
 #include <fstream>
 
+#include "archive.h"
+#include "average.h"
+#include "baseline.h"
 #include "class.h"
+#include "coords.h"
+#include "dataset.h"
+#include "export.h"
+#include "fold.h"
+#include "gauss.h"
+#include "grid.h"
+#include "lines.h"
+#include "pipeline.h"
+#include "resample.h"
+#include "spatial.h"
+#include "stats.h"
+#include "times.h"
+#include "trace.h"
+#include "writer.h"
 
+typedef struct {
+    PyTypeObject *ReaderType;
+    PyTypeObject *ReaderIterType;
+    PyTypeObject *DatasetType;
+} ModuleState;
+
+typedef struct {
+    PyObject_HEAD
+    ClassReader *reader;
+    PyObject *filename;
+    int count;
+    PyThread_type_lock lock;
+    Py_buffer view;             // exported buffer of the data when reading from memory
+    int hasView;
+    PyObject *axes;             // axis values shared by spectra, see axisArray()
+    SpatialIndex *offsets;      // spatial and time indexes, built on first use
+    SpatialIndex *positions;
+    TimeIndex *times;
+} Reader;
+
+/*
+ * All reader work runs without holding the GIL. A ClassReader keeps the
+ * state of the observation it has read last, so calls on the same reader
+ * object are serialised by a lock of its own, while different readers
+ * proceed in parallel. The lock is only ever waited for with the GIL
+ * released, so that it cannot deadlock against it.
+ */
+static void acquireLock(PyThread_type_lock lock)
+{
+    if (!PyThread_acquire_lock(lock, NOWAIT_LOCK)) {
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock(lock, WAIT_LOCK);
+        Py_END_ALLOW_THREADS
+    }
+}
+
+static void lockReader(Reader *self)
+{
+    acquireLock(self->lock);
+}
+
+/* used for Reader and Dataset objects alike */
+#define BEGIN_READER(self) acquireLock((self)->lock); Py_BEGIN_ALLOW_THREADS
+#define END_READER(self) Py_END_ALLOW_THREADS PyThread_release_lock((self)->lock);
+
+/* drop the spatial and time indexes of a Reader or Dataset object, once its spectra change */
+template <class Object>
+static void dropIndexes(Object *self)
+{
+    delete self->offsets;
+    delete self->positions;
+    delete self->times;
+    self->offsets = self->positions = 0;
+    self->times = 0;
+}
+
+/* 'latest' (or None) keeps the latest version of every observation, 'all' all of them */
+static bool parseVersions(const char *versions, bool &all)
+{
+    all = false;
+    if (versions == NULL || strcmp(versions, "latest") == 0) return true;
+    if (strcmp(versions, "all") == 0) {
+        all = true;
+        return true;
+    }
+    PyErr_SetString(PyExc_ValueError, "versions must be 'latest' or 'all'");
+    return false;
+}
+
+static PyObject* getDirectory(Reader* self, PyObject *args, PyObject *kwds)
+{
+    static const char *kwlist[] = {"versions", NULL};
+    const char *versions = NULL;
+    bool all;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|z:getDirectory", (char **)kwlist, &versions)) return NULL;
+    if (!parseVersions(versions, all)) return NULL;
+
+    int nscans = 0;
+    if (self->reader) {
+        ClassReader *reader = self->reader;
+        BEGIN_READER(self)
+        reader->setAllVersions(all);
+        nscans = reader->getDirectory();
+        self->count = nscans;
+        dropIndexes(self);
+        END_READER(self)
+    }
+    return Py_BuildValue("i", nscans);
+}
+
+static PyObject* headerDict(const SpectrumHeader &S)
+{
+    char fmt[] = "0000-00-00 00:00:00"; // %Y-%m-%d %H:%M:%S
+    strftime(fmt, sizeof(fmt), "%Y-%m-%d %H:%M:%S", gmtime(&S.utc));
+
+    return Py_BuildValue("{s:i,s:i,s:s,s:s,s:s,s:d,s:d,s:d,s:d,s:d,s:d,s:d,s:d,s:s}",
+                         "id", S.id,
+                         "scanno", S.scanno,
+                         "target", S.target,
+                         "line", S.line,
+                         "instr", S.instr,
+                         "RA", S.RA,
+                         "Dec", S.Dec,
+                         "fLO", S.fLO,
+                         "f0", S.f0,
+                         "df", S.df,
+                         "vs", S.vs,
+                         "dt", S.dt,
+                         "tsys", S.tsys,
+                         "utc", fmt);
+}
+
+/* a 1-D array of the given numpy type string, e.g. "S12" or "M8[s]" */
+static PyObject* typedArray(const char *type, npy_intp n)
+{
+    PyArray_Descr *descr;
+    PyObject *op = Py_BuildValue("s", type);
+    if (op == NULL) return NULL;
+    int ok = PyArray_DescrConverter(op, &descr);
+    Py_DECREF(op);
+    if (!ok) return NULL;
+
+    npy_intp dims[] = { n };
+    PyObject *array = PyArray_Zeros(1, dims, descr, 0);
+    return array;
+}
+
+/*
+ * Headers as a table, i.e. a dict of columns (numpy arrays) with the same
+ * keys as the header dicts. If entries are given, the columns "file" and
+ * "scan" hold the file id and the number of the spectrum in that file.
+ */
+static PyObject* headerTable(const std::vector<SpectrumHeader> &heads, const std::vector<DatasetEntry> *entries)
+{
+    npy_intp n = heads.size();
+    PyObject *columns[18];
+    const char *names[] = { "id", "scanno", "target", "line", "instr", "RA", "Dec", "fLO", "f0", "df",
+                            "vs", "dt", "tsys", "utc", "file", "scan" };
+    int ncols = entries ? 16 : 14;
+    npy_intp dims[] = { n };
+
+    for (int c = 0; c < ncols; c++) {
+        if (c < 2 || c > 13)  columns[c] = PyArray_SimpleNew(1, dims, NPY_INT32);
+        else if (c < 5)       columns[c] = typedArray("S12", n);
+        else if (c < 13)      columns[c] = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+        else                  columns[c] = typedArray("M8[s]", n);
+        if (columns[c] == NULL) {
+            for (int k = 0; k < c; k++) Py_DECREF(columns[k]);
+            return NULL;
+        }
+    }
+
+    for (npy_intp i = 0; i < n; i++) {
+        const SpectrumHeader &S = heads[i];
+        *(int *)PyArray_GETPTR1((PyArrayObject *)columns[0], i) = S.id;
+        *(int *)PyArray_GETPTR1((PyArrayObject *)columns[1], i) = S.scanno;
+        strncpy((char *)PyArray_GETPTR1((PyArrayObject *)columns[2], i), S.target, 12);
+        strncpy((char *)PyArray_GETPTR1((PyArrayObject *)columns[3], i), S.line, 12);
+        strncpy((char *)PyArray_GETPTR1((PyArrayObject *)columns[4], i), S.instr, 12);
+        const double values[] = { S.RA, S.Dec, S.fLO, S.f0, S.df, S.vs, S.dt, S.tsys };
+        for (int c = 5; c < 13; c++) *(double *)PyArray_GETPTR1((PyArrayObject *)columns[c], i) = values[c-5];
+        *(npy_int64 *)PyArray_GETPTR1((PyArrayObject *)columns[13], i) = (npy_int64)S.utc;
+        if (entries) {
+            *(int *)PyArray_GETPTR1((PyArrayObject *)columns[14], i) = (*entries)[i].file;
+            *(int *)PyArray_GETPTR1((PyArrayObject *)columns[15], i) = (*entries)[i].scan;
+        }
+    }
+
+    PyObject *table = PyDict_New();
+    for (int c = 0; c < ncols; c++) {
+        if (table && PyDict_SetItemString(table, names[c], columns[c]) < 0) Py_CLEAR(table);
+        Py_DECREF(columns[c]);
+    }
+    return table;
+}
+
+/* statistics of spectra as a dict of columns, with "file" and "scan" numbers in a dataset if entries are given */
+static PyObject* statsColumns(const std::vector<int> &scans, const StatsTable &table,
+                              const std::vector<DatasetEntry> *entries)
+{
+    npy_intp n = scans.size();
+    npy_intp dims[] = { n };
+    const char *names[] = { "id", "nchan", "nbad", "file", "scan",
+                            "mean", "rms", "min", "max", "flatness", "tsys", "el", "tau", "taus", "h2omm" };
+    const std::vector<int> *ints[] = { &scans, &table.nchan, &table.nbad };
+    const std::vector<double> *doubles[] = { &table.mean, &table.rms, &table.min, &table.max, &table.flatness,
+                                             &table.tsys, &table.el, &table.tau, &table.taus, &table.h2omm };
+    PyObject *table_ = PyDict_New();
+    if (table_ == NULL) return NULL;
+
+    for (int c = 0; c < 15; c++) {
+        if (!entries && (c == 3 || c == 4)) continue;
+        PyObject *column = PyArray_SimpleNew(1, dims, (c < 5) ? NPY_INT32 : NPY_DOUBLE);
+        if (column == NULL) {
+            Py_DECREF(table_);
+            return NULL;
+        }
+        for (npy_intp i = 0; i < n; i++) {
+            void *p = PyArray_GETPTR1((PyArrayObject *)column, i);
+            if (c < 3)       *(int *)p = (*ints[c])[i];
+            else if (c == 3) *(int *)p = (*entries)[i].file;
+            else if (c == 4) *(int *)p = (*entries)[i].scan;
+            else             *(double *)p = (*doubles[c-5])[i];
+        }
+        int rc = PyDict_SetItemString(table_, names[c], column);
+        Py_DECREF(column);
+        if (rc < 0) {
+            Py_DECREF(table_);
+            return NULL;
+        }
+    }
+    return table_;
+}
+
+/* positions as a dict of columns, with "file" and "scan" numbers in a dataset if entries are given */
+static PyObject* positionColumns(const std::vector<int> &scans, const PositionTable &table,
+                                 const std::vector<DatasetEntry> *entries)
+{
+    npy_intp n = scans.size();
+    npy_intp dims[] = { n };
+    const char *names[] = { "id", "system", "proj", "file", "scan",
+                            "epoch", "lam", "bet", "ra", "dec", "glon", "glat" };
+    const std::vector<int> *ints[] = { &scans, &table.system, &table.proj };
+    const std::vector<double> *doubles[] = { &table.epoch, &table.lam, &table.bet, &table.ra, &table.dec,
+                                             &table.glon, &table.glat };
+    PyObject *table_ = PyDict_New();
+    if (table_ == NULL) return NULL;
+
+    for (int c = 0; c < 12; c++) {
+        if (!entries && (c == 3 || c == 4)) continue;
+        PyObject *column = PyArray_SimpleNew(1, dims, (c < 5) ? NPY_INT32 : NPY_DOUBLE);
+        if (column == NULL) {
+            Py_DECREF(table_);
+            return NULL;
+        }
+        for (npy_intp i = 0; i < n; i++) {
+            void *p = PyArray_GETPTR1((PyArrayObject *)column, i);
+            if (c < 3)       *(int *)p = (*ints[c])[i];
+            else if (c == 3) *(int *)p = (*entries)[i].file;
+            else if (c == 4) *(int *)p = (*entries)[i].scan;
+            else             *(double *)p = (*doubles[c-5])[i];
+        }
+        int rc = PyDict_SetItemString(table_, names[c], column);
+        Py_DECREF(column);
+        if (rc < 0) {
+            Py_DECREF(table_);
+            return NULL;
+        }
+    }
+    return table_;
+}
+
+/* lines as a dict of columns, with "file" and "scan" numbers in a dataset if entries are given */
+static PyObject* lineColumns(const std::vector<int> &scans, const std::vector<LineCandidate> &lines,
+                             const std::vector<DatasetEntry> *entries)
+{
+    npy_intp n = lines.size();
+    npy_intp dims[] = { n };
+    const char *names[] = { "id", "first", "last", "channel", "file", "scan",
+                            "peak", "snr", "area", "freq", "velo", "noise" };
+    PyObject *table = PyDict_New();
+    if (table == NULL) return NULL;
+
+    for (int c = 0; c < 12; c++) {
+        if (!entries && (c == 4 || c == 5)) continue;
+        PyObject *column = PyArray_SimpleNew(1, dims, (c < 6) ? NPY_INT32 : NPY_DOUBLE);
+        if (column == NULL) {
+            Py_DECREF(table);
+            return NULL;
+        }
+        for (npy_intp i = 0; i < n; i++) {
+            const LineCandidate &line = lines[i];
+            void *p = PyArray_GETPTR1((PyArrayObject *)column, i);
+            switch (c) {
+            case 0:  *(int *)p = scans[line.row]; break;
+            case 1:  *(int *)p = line.first; break;
+            case 2:  *(int *)p = line.last; break;
+            case 3:  *(int *)p = line.channel; break;
+            case 4:  *(int *)p = (*entries)[line.row].file; break;
+            case 5:  *(int *)p = (*entries)[line.row].scan; break;
+            case 6:  *(double *)p = line.peak; break;
+            case 7:  *(double *)p = line.snr; break;
+            case 8:  *(double *)p = line.area; break;
+            case 9:  *(double *)p = line.freq; break;
+            case 10: *(double *)p = line.velo; break;
+            default: *(double *)p = line.noise; break;
+            }
+        }
+        int rc = PyDict_SetItemString(table, names[c], column);
+        Py_DECREF(column);
+        if (rc < 0) {
+            Py_DECREF(table);
+            return NULL;
+        }
+    }
+    return table;
+}
+
+/*
+ * Gauss fits as a dict of columns, with the parameters and their errors
+ * as arrays of one row per spectrum and ncomp columns. Stored results have
+ * the sigmas of the gauss section, fits the iterations and the rms.
+ */
+static PyObject* gaussColumns(const std::vector<int> &scans, const std::vector<GaussResult> &results, int ncomp,
+                              bool stored, const std::vector<DatasetEntry> *entries)
+{
+    npy_intp n = results.size();
+    npy_intp dims[] = { n, ncomp };
+    const char *names[] = { "id", "ncomp", "file", "scan", "niter", "converged", "rms", "sigba", "sigra" };
+    const char *params[] = { "area", "position", "width", "area_err", "position_err", "width_err" };
+    PyObject *table = PyDict_New();
+    if (table == NULL) return NULL;
+
+    for (int c = 0; c < 9 + 6; c++) {
+        if (!entries && (c == 2 || c == 3)) continue;
+        if (stored && (c == 4 || c == 5 || c == 6)) continue;
+        if (!stored && (c == 7 || c == 8)) continue;
+        int type = (c < 5) ? NPY_INT32 : (c == 5) ? NPY_BOOL : NPY_DOUBLE;
+        PyObject *column = PyArray_SimpleNew((c < 9) ? 1 : 2, dims, type);
+        if (column == NULL) {
+            Py_DECREF(table);
+            return NULL;
+        }
+        for (npy_intp i = 0; i < n; i++) {
+            const GaussResult &result = results[i];
+            if (c >= 9) {
+                const double *values = (c < 12) ? result.par : result.err;
+                for (int j = 0; j < ncomp; j++) {
+                    *(double *)PyArray_GETPTR2((PyArrayObject *)column, i, j) = values[3*j + (c - 9) % 3];
+                }
+                continue;
+            }
+            void *p = PyArray_GETPTR1((PyArrayObject *)column, i);
+            switch (c) {
+            case 0:  *(int *)p = scans[i]; break;
+            case 1:  *(int *)p = result.ncomp; break;
+            case 2:  *(int *)p = (*entries)[i].file; break;
+            case 3:  *(int *)p = (*entries)[i].scan; break;
+            case 4:  *(int *)p = result.niter; break;
+            case 5:  *(npy_bool *)p = result.converged; break;
+            case 7:  *(double *)p = result.base; break;
+            default: *(double *)p = result.rms; break;
+            }
+        }
+        int rc = PyDict_SetItemString(table, (c < 9) ? names[c] : params[c-9], column);
+        Py_DECREF(column);
+        if (rc < 0) {
+            Py_DECREF(table);
+            return NULL;
+        }
+    }
+    return table;
+}
+
+/* the largest number of stored components, at least one */
+static int storedComponents(const std::vector<GaussResult> &results)
+{
+    int ncomp = 1;
+    for (size_t i = 0; i < results.size(); i++) {
+        if (results[i].ncomp > ncomp) ncomp = results[i].ncomp;
+    }
+    return ncomp;
+}
+
+/* a 2-D array of nrows rows from a row-major block */
+static PyObject* blockArray(const std::vector<double> &block, npy_intp nrows, npy_intp width)
+{
+    npy_intp dims[] = { nrows, width };
+    PyObject *array = PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+    if (array == NULL) return NULL;
+
+    if (nrows*width > 0) memcpy(PyArray_DATA((PyArrayObject *)array), &block[0], nrows*width*sizeof(double));
+    return array;
+}
+
+/* spectrum numbers from None (all of 1..count) or a sequence, checked against count */
+static bool scanList(PyObject *select, int count, std::vector<int> &scans)
+{
+    if (select == NULL || select == Py_None) {
+        scans.resize(count);
+        for (int i = 0; i < count; i++) scans[i] = i+1;
+        return true;
+    }
+
+    PyObject *seq = PySequence_Fast(select, "select must be a sequence of scan numbers");
+    if (seq == NULL) return false;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    scans.resize(n);
+    for (Py_ssize_t i = 0; i < n; i++) {
+        long iscan = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+        if (iscan == -1 && PyErr_Occurred()) {
+            Py_DECREF(seq);
+            return false;
+        }
+        if (iscan < 1 || iscan > count) {
+            PyErr_SetString(PyExc_IndexError, "scan number out of range");
+            Py_DECREF(seq);
+            return false;
+        }
+        scans[i] = (int)iscan;
+    }
+    Py_DECREF(seq);
+    return true;
+}
+
+/* selection from the keywords source, line, telescope (patterns), scan (number or (first, last)) and kind */
+static bool parseSelection(PyObject *args, PyObject *kwds, ClassSelection &sel)
+{
+    const char *source = NULL, *line = NULL, *telescope = NULL;
+    PyObject *scan = NULL;
+
+    static const char *kwlist[] = {"source", "line", "telescope", "scan", "kind", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zzzOi:find", (char **)kwlist,
+                                     &source, &line, &telescope, &scan, &sel.kind)) return false;
+
+    if (source)    strncpy(sel.source, source, sizeof(sel.source)-1);
+    if (line)      strncpy(sel.line, line, sizeof(sel.line)-1);
+    if (telescope) strncpy(sel.telescope, telescope, sizeof(sel.telescope)-1);
+    if (scan && scan != Py_None) {
+        if (PyTuple_Check(scan)) {
+            if (!PyArg_ParseTuple(scan, "ll:find", &sel.scan1, &sel.scan2)) return false;
+        } else {
+            sel.scan1 = PyLong_AsLong(scan);
+            if (sel.scan1 == -1 && PyErr_Occurred()) return false;
+            sel.scan2 = sel.scan1;
+        }
+    }
+    return true;
+}
+
+/* a numpy array of spectrum numbers */
+static PyObject* scanArray(const std::vector<int> &scans)
+{
+    npy_intp dims[] = { (npy_intp)scans.size() };
+    PyObject *array = PyArray_SimpleNew(1, dims, NPY_INT32);
+    if (array == NULL) return NULL;
+
+    if (dims[0] > 0) memcpy(PyArray_DATA((PyArrayObject *)array), &scans[0], dims[0]*sizeof(int));
+    return array;
+}
+
+#define MAXAXES 1024     // distinct axes kept per reader or dataset
+
+/*
+ * The values of an axis as a read-only array, shared by all spectra with
+ * the same axis through the cache of the reader or dataset, so that
+ * thousands of spectra with one axis do not each get a copy. The cache is
+ * emptied once it holds MAXAXES axes; arrays returned before stay valid.
+ */
+static PyObject* axisArray(PyObject *cache, const SpectralAxis &axis)
+{
+    PyObject *key = Py_BuildValue("(iddd)", axis.nchan, axis.f0, axis.ref, axis.df);
+    if (key == NULL) return NULL;
+    PyObject *array;
+#if PY_VERSION_HEX >= 0x030D0000
+    if (PyDict_GetItemRef(cache, key, &array) != 0) {
+        Py_DECREF(key);
+        return array;
+    }
+#else
+    array = PyDict_GetItemWithError(cache, key);
+    if (array || PyErr_Occurred()) {
+        Py_XINCREF(array);
+        Py_DECREF(key);
+        return array;
+    }
+#endif
+
+    npy_intp dims[] = { axis.nchan };
+    array = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+    if (array == NULL) {
+        Py_DECREF(key);
+        return NULL;
+    }
+    double *values = (double *)PyArray_DATA((PyArrayObject *)array);
+    for (int k = 0; k < axis.nchan; k++) values[k] = axis.value(k+1);
+    PyArray_CLEARFLAGS((PyArrayObject *)array, NPY_ARRAY_WRITEABLE);
+
+    if (PyDict_Size(cache) >= MAXAXES) PyDict_Clear(cache);
+    int rc = PyDict_SetItem(cache, key, array);
+    Py_DECREF(key);
+    if (rc < 0) {
+        Py_DECREF(array);
+        return NULL;
+    }
+    return array;
+}
+
+static PyObject* vectorArray(const std::vector<double> &v)
+{
+    npy_intp dims[] = { 0 };
+    dims[0] = v.size();
+    PyObject *array = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+    if (array == NULL) return NULL;
+
+    double *data = (double *)PyArray_DATA((PyArrayObject *)array);
+    if (dims[0] > 0) memcpy(data, &v[0], dims[0]*sizeof(double));
+    return array;
+}
+
+/* a spatial index of spectra numbered 1..n, on their offsets from the directory or their absolute positions */
+static SpatialIndex *spatialIndex(const std::vector<ScanRef> &refs, bool absolute, int nthreads)
+{
+    std::vector<double> x, y;
+    std::vector<int> ids(refs.size());
+    for (size_t i = 0; i < refs.size(); i++) ids[i] = i+1;
+    if (absolute) headerPositions(refs, x, y, nthreads);
+    else          entryOffsets(refs, x, y);
+    SpatialIndex *index = new SpatialIndex();
+    index->build(x, y, ids, absolute);
+    return index;
+}
+
+static bool parseCone(PyObject *args, PyObject *kwds, double &x, double &y, double &radius, int &absolute)
+{
+    static const char *kwlist[] = {"x", "y", "radius", "absolute", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "ddd|p:cone", (char **)kwlist, &x, &y, &radius, &absolute)) {
+        return false;
+    }
+    if (!(radius >= 0.0)) {
+        PyErr_SetString(PyExc_ValueError, "radius must not be negative");
+        return false;
+    }
+    return true;
+}
+
+static bool parseBox(PyObject *args, PyObject *kwds, double &x1, double &y1, double &x2, double &y2, int &absolute)
+{
+    static const char *kwlist[] = {"x1", "y1", "x2", "y2", "absolute", NULL};
+    return PyArg_ParseTupleAndKeywords(args, kwds, "dddd|p:box", (char **)kwlist, &x1, &y1, &x2, &y2, &absolute);
+}
+
+static bool parseNearest(PyObject *args, PyObject *kwds, double &x, double &y, int &k, int &absolute)
+{
+    static const char *kwlist[] = {"x", "y", "k", "absolute", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "dd|ip:nearest", (char **)kwlist, &x, &y, &k, &absolute)) {
+        return false;
+    }
+    if (k < 1) {
+        PyErr_SetString(PyExc_ValueError, "k must be positive");
+        return false;
+    }
+    return true;
+}
+
+/* spectrum numbers found by a query, in ascending order */
+static PyObject* queryArray(std::vector<int> &scans)
+{
+    std::sort(scans.begin(), scans.end());
+    return scanArray(scans);
+}
+
+/*
+ * A time in seconds since 1970-01-01 00:00 (UTC), from a number or a string
+ * 'YYYY-MM-DD[ HH:MM[:SS]]' as in the utc of headers. None gives dflt.
+ */
+static bool parseTime(PyObject *value, double dflt, double &t)
+{
+    t = dflt;
+    if (value == NULL || value == Py_None) return true;
+    if (PyUnicode_Check(value)) {
+        const char *text = PyUnicode_AsUTF8(value);
+        if (text == NULL) return false;
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        double sec = 0.0;
+        int n = sscanf(text, "%d-%d-%d%*[ T]%d:%d:%lf", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                       &tm.tm_hour, &tm.tm_min, &sec);
+        if (n != 3 && n < 5) {
+            PyErr_Format(PyExc_ValueError, "cannot parse time '%s'", text);
+            return false;
+        }
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        t = timegm(&tm) + sec;
+        return true;
+    }
+    t = PyFloat_AsDouble(value);
+    return !(t == -1.0 && PyErr_Occurred());
+}
+
+#define MAXBINS 10000000
+
+/*
+ * Bins of width seconds from t1 to t2, by default from the first spectrum
+ * indexed, down to a multiple of width, to just after the last one. Return
+ * false for too many bins.
+ */
+static bool indexBins(const TimeIndex *index, double width, double t1, double t2, TimeBins &bins)
+{
+    if (t1 != t1) t1 = floor(index->first()/width)*width;
+    if (t2 != t2) t2 = nextafter(index->last(), HUGE_VAL);
+    if ((t2 - t1)/width > MAXBINS) return false;
+    index->bins(t1, t2, width, bins);
+    return true;
+}
+
+static bool parseBins(PyObject *args, PyObject *kwds, double &width, double &t1, double &t2)
+{
+    PyObject *start = NULL, *end = NULL;
+    static const char *kwlist[] = {"width", "start", "end", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "d|OO:timeBins", (char **)kwlist, &width, &start, &end)) return false;
+    if (!(width > 0.0)) {
+        PyErr_SetString(PyExc_ValueError, "width must be positive");
+        return false;
+    }
+    return parseTime(start, NAN, t1) && parseTime(end, NAN, t2);
+}
+
+static bool parseRange(PyObject *args, PyObject *kwds, double &t1, double &t2)
+{
+    PyObject *start = NULL, *end = NULL;
+    static const char *kwlist[] = {"start", "end", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OO:timeRange", (char **)kwlist, &start, &end)) return false;
+    return parseTime(start, -HUGE_VAL, t1) && parseTime(end, HUGE_VAL, t2);
+}
+
+/* spectrum numbers and times of a range */
+static PyObject* rangeTuple(const std::vector<int> &scans, const std::vector<double> &times)
+{
+    PyObject *a = scanArray(scans);
+    PyObject *b = vectorArray(times);
+    if (a == NULL || b == NULL) {
+        Py_XDECREF(a);
+        Py_XDECREF(b);
+        return NULL;
+    }
+    return Py_BuildValue("(NN)", a, b);
+}
+
+/* time bins as a dict of columns */
+static PyObject* binColumns(const TimeBins &bins)
+{
+    npy_intp n = bins.time.size();
+    npy_intp dims[] = { n };
+    const char *names[] = { "count", "time", "tsys", "tsys_min", "tsys_max", "tau" };
+    const std::vector<double> *doubles[] = { &bins.time, &bins.tsys, &bins.tsysMin, &bins.tsysMax, &bins.tau };
+    PyObject *table = PyDict_New();
+    if (table == NULL) return NULL;
+
+    for (int c = 0; c < 6; c++) {
+        PyObject *column = PyArray_SimpleNew(1, dims, (c < 1) ? NPY_INT32 : NPY_DOUBLE);
+        if (column == NULL) {
+            Py_DECREF(table);
+            return NULL;
+        }
+        for (npy_intp i = 0; i < n; i++) {
+            void *p = PyArray_GETPTR1((PyArrayObject *)column, i);
+            if (c < 1) *(int *)p = bins.count[i];
+            else       *(double *)p = (*doubles[c-1])[i];
+        }
+        int rc = PyDict_SetItemString(table, names[c], column);
+        Py_DECREF(column);
+        if (rc < 0) {
+            Py_DECREF(table);
+            return NULL;
+        }
+    }
+    return table;
+}
+
+static PyObject* binTable(bool ok, const TimeBins &bins)
+{
+    if (!ok) {
+        PyErr_SetString(PyExc_ValueError, "too many time bins");
+        return NULL;
+    }
+    return binColumns(bins);
+}
+
+/* spectrum numbers and distances of the nearest spectra */
+static PyObject* nearestTuple(const std::vector<int> &scans, const std::vector<double> &dist)
+{
+    PyObject *a = scanArray(scans);
+    PyObject *b = vectorArray(dist);
+    if (a == NULL || b == NULL) {
+        Py_XDECREF(a);
+        Py_XDECREF(b);
+        return NULL;
+    }
+    return Py_BuildValue("(NN)", a, b);
+}
+
+static PyObject* getHead(Reader* self, PyObject *args)
+{
+    int iscan = 1;
+    if (!PyArg_ParseTuple(args, "i:getHead", &iscan)) return NULL;
+
+    if (iscan < 1 || iscan > self->count) {
+        PyErr_SetString(PyExc_IndexError, "scan number out of range");
+        return NULL;
+    }
+    if (self->reader) {
+        ClassReader *reader = self->reader;
+        SpectrumHeader S;
+        BEGIN_READER(self)
+        S = reader->getHead(iscan);
+        END_READER(self)
+        return headerDict(S);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject* getFreq(Reader* self, PyObject *args)
+{
+    int iscan = 1;
+    if (!PyArg_ParseTuple(args, "i:getHead", &iscan)) return NULL;
+
+    if (iscan < 1 || iscan > self->count) {
+        PyErr_SetString(PyExc_IndexError, "scan number out of range");
+        return NULL;
+    }
+    if (self->reader) {
+        ClassReader *reader = self->reader;
+        SpectralAxis axis;
+        BEGIN_READER(self)
+        axis = reader->getAxis(iscan);
+        END_READER(self)
+        return axisArray(self->axes, axis);
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject* getData(Reader* self, PyObject *args)
+{
+    int iscan = 1;
+    if (!PyArg_ParseTuple(args, "i:getHead", &iscan)) return NULL;
+
+    if (iscan < 1 || iscan > self->count) {
+        PyErr_SetString(PyExc_IndexError, "scan number out of range");
+        return NULL;
+    }
+    if (self->reader) {
+        ClassReader *reader = self->reader;
+        std::vector<double> d;
+        BEGIN_READER(self)
+        d = reader->getData(iscan);
+        END_READER(self)
+        PyObject *array;
+
+        long int dims[] = { 0 };
+        dims[0] = d.size();
+        array = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+        double *data = (double *)PyArray_GETPTR1((PyArrayObject *)array, 0);
+        for (int i = 0; i < dims[0]; i++) {
+            data[i] = d[i];
+        }
+        return array;
+    }
+
+    Py_RETURN_NONE;
+}
+
+/* smoothing from its keyword arguments: kernel 'hanning', 'boxcar' or None, boxcar width and binning factor */
+static bool parseSmoothing(const char *name, int width, int bin, Smoothing &smoothing)
+{
+    if (name == NULL)                      smoothing.kernel = SMOOTH_NONE;
+    else if (strcmp(name, "hanning") == 0) smoothing.kernel = SMOOTH_HANNING;
+    else if (strcmp(name, "boxcar") == 0)  smoothing.kernel = SMOOTH_BOXCAR;
+    else {
+        PyErr_Format(PyExc_ValueError, "unknown smoothing '%s', expected 'hanning' or 'boxcar'", name);
+        return false;
+    }
+    if (width < 1 || width % 2 == 0) {
+        PyErr_SetString(PyExc_ValueError, "width must be a positive odd number");
+        return false;
+    }
+    if (bin < 1) {
+        PyErr_SetString(PyExc_ValueError, "bin must be positive");
+        return false;
+    }
+    smoothing.width = width;
+    smoothing.bin = bin;
+    return true;
+}
+
+static PyObject* getSpectrum(Reader* self, PyObject *args, PyObject *kwds)
+{
+    int iscan = 1;
+    const char *smooth = NULL;
+    int width = 3, bin = 1;
+    static const char *kwlist[] = {"scan", "smooth", "width", "bin", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "i|zii:getSpectrum", (char **)kwlist,
+                                     &iscan, &smooth, &width, &bin)) return NULL;
+    Smoothing smoothing;
+    if (!parseSmoothing(smooth, width, bin, smoothing)) return NULL;
+
+    if (iscan < 1 || iscan > self->count) {
+        PyErr_SetString(PyExc_IndexError, "scan number out of range");
+        return NULL;
+    }
+    if (self->reader) {
+        ClassReader *reader = self->reader;
+        SpectrumHeader S;
+        SpectralAxis axis;
+        std::vector<double> d;
+        bool ok;
+        BEGIN_READER(self)
+        ok = reader->getSpectrum(iscan, S, axis, d, smoothing);
+        END_READER(self)
+        if (!ok) {
+            PyErr_Format(PyExc_IOError, "failed to read spectrum %d", iscan);
+            return NULL;
+        }
+        return Py_BuildValue("(NNN)", headerDict(S), axisArray(self->axes, axis), vectorArray(d));
+    }
+    Py_RETURN_NONE;
+}
+
+static bool parseMode(const char *name, ResampleMode &mode)
+{
+    if (name == NULL || strcmp(name, "linear") == 0) mode = RESAMPLE_LINEAR;
+    else if (strcmp(name, "nearest") == 0)          mode = RESAMPLE_NEAREST;
+    else if (strcmp(name, "flux") == 0)             mode = RESAMPLE_FLUX;
+    else {
+        PyErr_Format(PyExc_ValueError, "unknown mode '%s', expected 'nearest', 'linear' or 'flux'", name);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * A target axis, either as a tuple (nchan, f0, ref, df) of an integer
+ * number of channels and the value f0 at channel ref (1-based), or as a
+ * sequence of equally spaced values, to within a thousandth of a channel.
+ */
+static bool parseAxis(PyObject *obj, SpectralAxis &axis)
+{
+    if (PyTuple_Check(obj) && PyTuple_GET_SIZE(obj) == 4 && PyIndex_Check(PyTuple_GET_ITEM(obj, 0))) {
+        if (!PyArg_ParseTuple(obj, "iddd:axis", &axis.nchan, &axis.f0, &axis.ref, &axis.df)) return false;
+        if (axis.nchan <= 0) {
+            PyErr_SetString(PyExc_ValueError, "axis needs at least one channel");
+            return false;
+        }
+        return true;
+    }
+    PyObject *seq = PySequence_Fast(obj, "axis must be (nchan, f0, ref, df) or a sequence of values");
+    if (seq == NULL) return false;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    if (n < 2) {
+        Py_DECREF(seq);
+        PyErr_SetString(PyExc_ValueError, "axis needs at least two values");
+        return false;
+    }
+    std::vector<double> v(n);
+    for (Py_ssize_t k = 0; k < n; k++) v[k] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, k));
+    Py_DECREF(seq);
+    if (PyErr_Occurred()) return false;
+    double df = (v[n-1] - v[0])/(n - 1);
+    for (Py_ssize_t k = 0; k < n; k++) {
+        if (!(fabs(v[k] - (v[0] + k*df)) <= 1.0e-3*fabs(df)) || df == 0.0) {
+            PyErr_SetString(PyExc_ValueError, "axis values must be equally spaced");
+            return false;
+        }
+    }
+    axis = SpectralAxis(n, v[0], 1.0, df);
+    return true;
+}
+
+/* read the directory, unless done already */
+static bool readerCount(Reader *self)
+{
+    if (!self->reader) {
+        PyErr_SetString(PyExc_IOError, "no CLASSIC file open");
+        return false;
+    }
+    if (self->count == 0) {
+        BEGIN_READER(self)
+        if (self->count == 0) self->count = self->reader->getDirectory();
+        END_READER(self)
+    }
+    return true;
+}
+
+static PyObject* find(Reader* self, PyObject *args, PyObject *kwds)
+{
+    ClassSelection sel;
+    if (!parseSelection(args, kwds, sel)) return NULL;
+    if (!readerCount(self)) return NULL;
+
+    std::vector<int> scans;
+    BEGIN_READER(self)
+    scans = self->reader->find(sel);
+    END_READER(self)
+    return scanArray(scans);
+}
+
+static PyObject* getHeadTable(Reader* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    static const char *kwlist[] = {"select", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:getHeadTable", (char **)kwlist, &select)) return NULL;
+    if (!readerCount(self)) return NULL;
+
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<SpectrumHeader> heads;
+    BEGIN_READER(self)
+    heads = self->reader->getHeaders(scans);
+    END_READER(self)
+    return headerTable(heads, NULL);
+}
+
+static PyObject* getDataBlock(Reader* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL, *axisObj = NULL;
+    const char *modeName = NULL, *smooth = NULL;
+    int velocity = 0, nthreads = 0, boxcar = 3, bin = 1;
+    static const char *kwlist[] = {"select", "axis", "mode", "velocity", "threads", "smooth", "width", "bin", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOspizii:getDataBlock", (char **)kwlist,
+                                     &select, &axisObj, &modeName, &velocity, &nthreads,
+                                     &smooth, &boxcar, &bin)) return NULL;
+
+    SpectralAxis axis;
+    ResampleMode mode;
+    Smoothing smoothing;
+    bool resample = (axisObj != NULL && axisObj != Py_None);
+    if (resample && !parseAxis(axisObj, axis)) return NULL;
+    if (!parseMode(modeName, mode)) return NULL;
+    if (!parseSmoothing(smooth, boxcar, bin, smoothing)) return NULL;
+    if (resample && smoothing.active()) {
+        PyErr_SetString(PyExc_ValueError, "spectra cannot be smoothed and resampled at once");
+        return NULL;
+    }
+    if (!readerCount(self)) return NULL;
+
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<double> block;
+    int width;
+    BEGIN_READER(self)
+    if (resample) {
+        resampleBlock(scanRefs(self->reader, scans), axis, velocity, mode, block, nthreads);
+        width = axis.nchan;
+    } else {
+        width = self->reader->getDataBlock(scans, block, smoothing);
+    }
+    END_READER(self)
+    return blockArray(block, scans.size(), width);
+}
+
+static bool parseWeighting(const char *name, Weighting &weighting)
+{
+    if (name == NULL || strcmp(name, "tsys") == 0) weighting = WEIGHT_TSYS;
+    else if (strcmp(name, "time") == 0)            weighting = WEIGHT_TIME;
+    else if (strcmp(name, "equal") == 0)           weighting = WEIGHT_EQUAL;
+    else {
+        PyErr_Format(PyExc_ValueError, "unknown weighting '%s', expected 'tsys', 'time' or 'equal'", name);
+        return false;
+    }
+    return true;
+}
+
+/* (header, freq, data, weight) of an average, with its counts added to the header */
+static PyObject* averageTuple(bool ok, const AverageResult &result)
+{
+    if (!ok) {
+        PyErr_SetString(PyExc_ValueError, "no spectra could be averaged");
+        return NULL;
+    }
+    PyObject *head = headerDict(result.head);
+    if (head == NULL) return NULL;
+    PyObject *nspec = PyLong_FromLong(result.nspec);
+    PyObject *nskip = PyLong_FromLong(result.nskip);
+    if (nspec) PyDict_SetItemString(head, "nspec", nspec);
+    if (nskip) PyDict_SetItemString(head, "nskip", nskip);
+    Py_XDECREF(nspec);
+    Py_XDECREF(nskip);
+    return Py_BuildValue("(NNNN)", head, vectorArray(result.freq), vectorArray(result.data), vectorArray(result.weight));
+}
+
+static PyObject* rd_average(Reader* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL, *axisObj = NULL;
+    const char *weight = NULL, *modeName = NULL;
+    int velocity = 0, nthreads = 0;
+    static const char *kwlist[] = {"select", "weight", "axis", "mode", "velocity", "threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OsOspi:average", (char **)kwlist,
+                                     &select, &weight, &axisObj, &modeName, &velocity, &nthreads)) return NULL;
+
+    Weighting weighting;
+    SpectralAxis axis;
+    ResampleMode mode;
+    bool resample = (axisObj != NULL && axisObj != Py_None);
+    if (!parseWeighting(weight, weighting)) return NULL;
+    if (resample && !parseAxis(axisObj, axis)) return NULL;
+    if (!parseMode(modeName, mode)) return NULL;
+    if (!readerCount(self)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    AverageResult result;
+    bool ok;
+    BEGIN_READER(self)
+    if (resample) ok = average(scanRefs(self->reader, scans), weighting, axis, velocity, mode, result, nthreads);
+    else          ok = average(self->reader, scans, weighting, result, nthreads);
+    END_READER(self)
+    return averageTuple(ok, result);
+}
+
+/* baseline options from the arguments, with windows as a sequence of (lo, hi) pairs */
+static bool parseBaseline(int degree, PyObject *windows, int velocity, int stored, BaselineOptions &options)
+{
+    if (degree < 0 || degree > MAXDEGREE) {
+        PyErr_Format(PyExc_ValueError, "degree must be between 0 and %d", MAXDEGREE);
+        return false;
+    }
+    options.degree = degree;
+    options.velocity = velocity;
+    options.stored = stored;
+    if (windows == NULL || windows == Py_None) return true;
+
+    PyObject *seq = PySequence_Fast(windows, "windows must be a sequence of (lo, hi) pairs");
+    if (seq == NULL) return false;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    for (Py_ssize_t i = 0; i < n; i++) {
+        double lo, hi;
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, i), "dd:windows", &lo, &hi)) {
+            Py_DECREF(seq);
+            return false;
+        }
+        options.w1.push_back(lo);
+        options.w2.push_back(hi);
+    }
+    Py_DECREF(seq);
+    return true;
+}
+
+static PyObject* rd_baseline(Reader* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL, *windows = NULL;
+    int degree = 1, velocity = 1, stored = 0, nthreads = 0;
+    static const char *kwlist[] = {"select", "degree", "windows", "velocity", "stored", "threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OiOppi:baseline", (char **)kwlist,
+                                     &select, &degree, &windows, &velocity, &stored, &nthreads)) return NULL;
+
+    BaselineOptions options;
+    if (!parseBaseline(degree, windows, velocity, stored, options)) return NULL;
+    if (!readerCount(self)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<double> block, rms;
+    int width;
+    BEGIN_READER(self)
+    width = baselineBlock(scanRefs(self->reader, scans), options, block, rms, nthreads);
+    END_READER(self)
+    return Py_BuildValue("(NN)", blockArray(block, scans.size(), width), vectorArray(rms));
+}
+
+/*
+ * Steps of a pipeline, as a sequence of step names or (name, dict of
+ * parameters) pairs, with the parameters of the corresponding methods.
+ */
+static bool parsePipeline(PyObject *steps, Pipeline &pipeline)
+{
+    PyObject *seq = PySequence_Fast(steps, "steps must be a sequence of names or (name, parameters) pairs");
+    if (seq == NULL) return false;
+    PyObject *empty = PyTuple_New(0);
+    bool ok = (empty != NULL);
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    for (Py_ssize_t i = 0; ok && i < n; i++) {
+        PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+        PyObject *kwds = NULL;
+        const char *name = NULL;
+        if (PyUnicode_Check(item)) {
+            name = PyUnicode_AsUTF8(item);
+        } else if (!PyArg_ParseTuple(item, "sO!:steps", &name, &PyDict_Type, &kwds)) {
+            ok = false;
+            break;
+        }
+        if (name == NULL) {
+            ok = false;
+        } else if (strcmp(name, "baseline") == 0) {
+            PyObject *windows = NULL;
+            int degree = 1, velocity = 1, stored = 0;
+            static const char *kwlist[] = {"degree", "windows", "velocity", "stored", NULL};
+            BaselineOptions options;
+            ok = PyArg_ParseTupleAndKeywords(empty, kwds, "|iOpp:baseline", (char **)kwlist,
+                                             &degree, &windows, &velocity, &stored)
+                 && parseBaseline(degree, windows, velocity, stored, options);
+            if (ok) pipeline.baseline(options);
+        } else if (strcmp(name, "smooth") == 0) {
+            const char *kernel = "hanning";
+            int width = 3, bin = 1;
+            static const char *kwlist[] = {"kernel", "width", "bin", NULL};
+            Smoothing smoothing;
+            ok = PyArg_ParseTupleAndKeywords(empty, kwds, "|zii:smooth", (char **)kwlist, &kernel, &width, &bin)
+                 && parseSmoothing(kernel, width, bin, smoothing);
+            if (ok) pipeline.smooth(smoothing);
+        } else if (strcmp(name, "resample") == 0) {
+            PyObject *axisObj = NULL;
+            const char *modeName = NULL;
+            int velocity = 0;
+            static const char *kwlist[] = {"axis", "mode", "velocity", NULL};
+            SpectralAxis axis;
+            ResampleMode mode;
+            ok = PyArg_ParseTupleAndKeywords(empty, kwds, "O|sp:resample", (char **)kwlist,
+                                             &axisObj, &modeName, &velocity)
+                 && parseAxis(axisObj, axis) && parseMode(modeName, mode);
+            if (ok) pipeline.resample(axis, velocity, mode);
+        } else if (strcmp(name, "fold") == 0) {
+            static const char *kwlist[] = {NULL};
+            ok = PyArg_ParseTupleAndKeywords(empty, kwds, ":fold", (char **)kwlist);
+            if (ok) pipeline.fold();
+        } else {
+            PyErr_Format(PyExc_ValueError, "unknown step '%s', expected 'baseline', 'smooth', 'resample' or 'fold'",
+                         name);
+            ok = false;
+        }
+    }
+    Py_XDECREF(empty);
+    Py_DECREF(seq);
+    return ok;
+}
+
+static bool parseReduce(const char *name, bool &average)
+{
+    if (name == NULL || strcmp(name, "average") == 0) average = true;
+    else if (strcmp(name, "block") == 0)             average = false;
+    else {
+        PyErr_Format(PyExc_ValueError, "unknown reducer '%s', expected 'average' or 'block'", name);
+        return false;
+    }
+    return true;
+}
+
+static PyObject* rd_pipeline(Reader* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *steps = NULL, *select = NULL;
+    const char *reduce = NULL, *weight = NULL;
+    int nthreads = 0;
+    static const char *kwlist[] = {"steps", "select", "reduce", "weight", "threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|Ossi:pipeline", (char **)kwlist,
+                                     &steps, &select, &reduce, &weight, &nthreads)) return NULL;
+
+    Pipeline pipeline;
+    Weighting weighting;
+    bool averaged;
+    if (!parsePipeline(steps, pipeline)) return NULL;
+    if (!parseReduce(reduce, averaged)) return NULL;
+    if (!parseWeighting(weight, weighting)) return NULL;
+    if (!readerCount(self)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    AverageResult result;
+    std::vector<double> block;
+    bool ok = true;
+    int width = 0;
+    BEGIN_READER(self)
+    if (averaged) ok = pipeline.average(scanRefs(self->reader, scans), weighting, result, nthreads);
+    else          width = pipeline.block(scanRefs(self->reader, scans), block, nthreads);
+    END_READER(self)
+    if (averaged) return averageTuple(ok, result);
+    return blockArray(block, scans.size(), width);
+}
+
+/* the switching section of a spectrum as a dict, or None without one */
+static PyObject* getSwitching(Reader* self, PyObject *args)
+{
+    int iscan = 1;
+    if (!PyArg_ParseTuple(args, "i:getSwitching", &iscan)) return NULL;
+    if (!readerCount(self)) return NULL;
+    if (iscan < 1 || iscan > self->count) {
+        PyErr_SetString(PyExc_IndexError, "scan number out of range");
+        return NULL;
+    }
+    const ClassDescriptor *desc;
+    ClassDescriptor copy;
+    BEGIN_READER(self)
+    desc = self->reader->getDescriptor(iscan, false);
+    if (desc) copy = *desc;
+    END_READER(self)
+    if (desc == NULL) {
+        PyErr_Format(PyExc_IOError, "failed to read spectrum %d", iscan);
+        return NULL;
+    }
+    if (copy.nphas < 0) Py_RETURN_NONE;
+
+    std::vector<double> offset(copy.decal, copy.decal + copy.nphas);
+    std::vector<double> time(copy.duree, copy.duree + copy.nphas);
+    std::vector<double> weight(copy.poids, copy.poids + copy.nphas);
+    std::vector<double> loff(copy.ldecal, copy.ldecal + copy.nphas);
+    std::vector<double> boff(copy.bdecal, copy.bdecal + copy.nphas);
+    return Py_BuildValue("{s:i,s:N,s:N,s:N,s:N,s:N}", "mode", copy.swmod, "offset", vectorArray(offset),
+                         "time", vectorArray(time), "weight", vectorArray(weight),
+                         "loff", vectorArray(loff), "boff", vectorArray(boff));
+}
+
+/* grid options from the arguments, for a map of nx by ny cells of size cell centred on center */
+static bool parseGrid(int nx, int ny, double cell, double cx, double cy, const char *kernel, double width,
+                      double support, const char *weight, int tile, GridOptions &options)
+{
+    if (nx < 1 || ny < 1 || !(cell > 0.0)) {
+        PyErr_SetString(PyExc_ValueError, "nx, ny and cell must be positive");
+        return false;
+    }
+    if (kernel == NULL || strcmp(kernel, "gauss") == 0) options.kernel = GRID_GAUSS;
+    else if (strcmp(kernel, "bessel") == 0)             options.kernel = GRID_BESSEL_GAUSS;
+    else {
+        PyErr_Format(PyExc_ValueError, "unknown kernel '%s', expected 'gauss' or 'bessel'", kernel);
+        return false;
+    }
+    options.nx = nx;
+    options.ny = ny;
+    options.dx = options.dy = cell;
+    options.x0 = cx - 0.5*(nx - 1)*cell;
+    options.y0 = cy - 0.5*(ny - 1)*cell;
+    options.width = width;
+    options.support = support;
+    options.tile = tile;
+    return parseWeighting(weight, options.weighting);
+}
+
+/* (header, freq, data, weight) of a cube, with data and weight of shape (ny, nx, nchan) */
+static PyObject* cubeTuple(bool ok, const GridCube &cube)
+{
+    if (!ok) {
+        PyErr_SetString(PyExc_ValueError, "no spectra could be gridded");
+        return NULL;
+    }
+    PyObject *head = headerDict(cube.head);
+    if (head == NULL) return NULL;
+    PyObject *nspec = PyLong_FromLong(cube.nspec);
+    PyObject *nskip = PyLong_FromLong(cube.nskip);
+    if (nspec) PyDict_SetItemString(head, "nspec", nspec);
+    if (nskip) PyDict_SetItemString(head, "nskip", nskip);
+    Py_XDECREF(nspec);
+    Py_XDECREF(nskip);
+
+    npy_intp dims[] = { cube.ny, cube.nx, cube.nchan };
+    PyObject *data = PyArray_SimpleNew(3, dims, NPY_DOUBLE);
+    PyObject *weight = PyArray_SimpleNew(3, dims, NPY_DOUBLE);
+    if (data == NULL || weight == NULL) {
+        Py_DECREF(head);
+        Py_XDECREF(data);
+        Py_XDECREF(weight);
+        return NULL;
+    }
+    if (!cube.data.empty()) {
+        memcpy(PyArray_DATA((PyArrayObject *)data), &cube.data[0], cube.data.size()*sizeof(double));
+        memcpy(PyArray_DATA((PyArrayObject *)weight), &cube.weight[0], cube.weight.size()*sizeof(double));
+    }
+    return Py_BuildValue("(NNNN)", head, vectorArray(cube.freq), data, weight);
+}
+
+static PyObject* rd_grid(Reader* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    int nx, ny, tile = 256, nthreads = 0;
+    double cell, cx = 0.0, cy = 0.0, width = 0.0, support = 0.0;
+    const char *kernel = NULL, *weight = NULL;
+    static const char *kwlist[] = {"nx", "ny", "cell", "select", "center", "kernel", "width", "support", "weight",
+                                   "tile", "threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "iid|O(dd)zddzii:grid", (char **)kwlist, &nx, &ny, &cell, &select,
+                                     &cx, &cy, &kernel, &width, &support, &weight, &tile, &nthreads)) return NULL;
+
+    GridOptions options;
+    if (!parseGrid(nx, ny, cell, cx, cy, kernel, width, support, weight, tile, options)) return NULL;
+    if (!readerCount(self)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    GridCube cube;
+    bool ok;
+    BEGIN_READER(self)
+    ok = gridSpectra(scanRefs(self->reader, scans), options, cube, nthreads);
+    END_READER(self)
+    return cubeTuple(ok, cube);
+}
+
+static PyObject* rd_fold(Reader* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    int nthreads = 0;
+    static const char *kwlist[] = {"select", "threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oi:fold", (char **)kwlist, &select, &nthreads)) return NULL;
+    if (!readerCount(self)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<double> block;
+    int width;
+    BEGIN_READER(self)
+    width = foldBlock(scanRefs(self->reader, scans), block, nthreads);
+    END_READER(self)
+    return blockArray(block, scans.size(), width);
+}
+
+static PyObject* rd_statsTable(Reader* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    int nthreads = 0;
+    static const char *kwlist[] = {"select", "threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oi:statsTable", (char **)kwlist, &select, &nthreads)) return NULL;
+    if (!readerCount(self)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    StatsTable table;
+    BEGIN_READER(self)
+    statsTable(scanRefs(self->reader, scans), table, nthreads);
+    END_READER(self)
+    return statsColumns(scans, table, NULL);
+}
+
+/* kind of axis from None (frequency), 'frequency', 'velocity' or 'image' */
+static bool parseAxisKind(const char *kind, AxisKind &akind)
+{
+    akind = AXIS_FREQUENCY;
+    if (kind == NULL || strcmp(kind, "frequency") == 0) return true;
+    if (strcmp(kind, "velocity") == 0) akind = AXIS_VELOCITY;
+    else if (strcmp(kind, "image") == 0) akind = AXIS_IMAGE;
+    else {
+        PyErr_SetString(PyExc_ValueError, "kind must be 'frequency', 'velocity' or 'image'");
+        return false;
+    }
+    return true;
+}
+
+static bool parseLines(double threshold, double edge, int channels, int gap, int absorption,
+                       const char *smooth, int width, int bin, LineOptions &options)
+{
+    if (!(threshold > 0.0) || !(edge > 0.0) || edge > threshold) {
+        PyErr_SetString(PyExc_ValueError, "threshold and edge must be positive, with edge <= threshold");
+        return false;
+    }
+    if (channels < 1 || gap < 0) {
+        PyErr_SetString(PyExc_ValueError, "channels must be positive and gap not negative");
+        return false;
+    }
+    options.threshold = threshold;
+    options.edge = edge;
+    options.channels = channels;
+    options.gap = gap;
+    options.absorption = absorption;
+    return parseSmoothing(smooth, width, bin, options.smoothing);
+}
+
+static PyObject* rd_findLines(Reader* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    double threshold = 5.0, edge = 2.0;
+    int channels = 2, gap = 1, absorption = 0, width = 3, bin = 1, nthreads = 0;
+    const char *smooth = NULL;
+    static const char *kwlist[] = {"select", "threshold", "edge", "channels", "gap", "absorption",
+                                   "smooth", "width", "bin", "threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oddiipziii:findLines", (char **)kwlist, &select, &threshold,
+                                     &edge, &channels, &gap, &absorption, &smooth, &width, &bin, &nthreads)) return NULL;
+
+    LineOptions options;
+    if (!parseLines(threshold, edge, channels, gap, absorption, smooth, width, bin, options)) return NULL;
+    if (!readerCount(self)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<LineCandidate> lines;
+    BEGIN_READER(self)
+    findLines(scanRefs(self->reader, scans), options, lines, nthreads);
+    END_READER(self)
+    return lineColumns(scans, lines, NULL);
+}
+
+static PyObject* rd_storedGauss(Reader* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    int nthreads = 0;
+    static const char *kwlist[] = {"select", "threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oi:storedGauss", (char **)kwlist, &select, &nthreads)) return NULL;
+    if (!readerCount(self)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<GaussResult> results;
+    BEGIN_READER(self)
+    storedGauss(scanRefs(self->reader, scans), results, nthreads);
+    END_READER(self)
+    return gaussColumns(scans, results, storedComponents(results), true, NULL);
+}
+
+static bool parseGauss(int ncomp, int stored, int velocity, int maxiter, GaussOptions &options)
+{
+    if (ncomp < 1 || ncomp > MAXGAUSS) {
+        PyErr_Format(PyExc_ValueError, "components must be 1..%d", MAXGAUSS);
+        return false;
+    }
+    if (maxiter < 1) {
+        PyErr_SetString(PyExc_ValueError, "maxiter must be positive");
+        return false;
+    }
+    options.ncomp = ncomp;
+    options.stored = stored;
+    options.velocity = velocity;
+    options.maxiter = maxiter;
+    return true;
+}
+
+static PyObject* rd_fitGauss(Reader* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    int ncomp = 1, stored = 1, velocity = 1, maxiter = 50;
+    double threshold = 5.0, edge = 2.0;
+    int channels = 2, gap = 1, absorption = 0, width = 3, bin = 1, nthreads = 0;
+    const char *smooth = NULL;
+    static const char *kwlist[] = {"select", "components", "stored", "velocity", "maxiter", "threshold", "edge",
+                                   "channels", "gap", "absorption", "smooth", "width", "bin", "threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oippiddiipziii:fitGauss", (char **)kwlist, &select, &ncomp,
+                                     &stored, &velocity, &maxiter, &threshold, &edge, &channels, &gap, &absorption,
+                                     &smooth, &width, &bin, &nthreads)) return NULL;
+
+    GaussOptions options;
+    if (!parseGauss(ncomp, stored, velocity, maxiter, options)) return NULL;
+    if (!parseLines(threshold, edge, channels, gap, absorption, smooth, width, bin, options.lines)) return NULL;
+    if (!readerCount(self)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<GaussResult> results;
+    BEGIN_READER(self)
+    fitGauss(scanRefs(self->reader, scans), options, results, nthreads);
+    END_READER(self)
+    return gaussColumns(scans, results, ncomp, false, NULL);
+}
+
+static PyObject* rd_getPositions(Reader* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    int nthreads = 0;
+    static const char *kwlist[] = {"select", "threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oi:getPositions", (char **)kwlist, &select, &nthreads)) return NULL;
+    if (!readerCount(self)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    PositionTable table;
+    BEGIN_READER(self)
+    positionTable(scanRefs(self->reader, scans), table, nthreads);
+    END_READER(self)
+    return positionColumns(scans, table, NULL);
+}
+
+static PyObject* rd_getAxes(Reader* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    const char *kind = NULL;
+    int nthreads = 0;
+    static const char *kwlist[] = {"select", "kind", "threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Ozi:getAxes", (char **)kwlist, &select, &kind, &nthreads)) return NULL;
+    AxisKind akind;
+    if (!parseAxisKind(kind, akind)) return NULL;
+    if (!readerCount(self)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<double> block;
+    int width;
+    BEGIN_READER(self)
+    width = axisBlock(scanRefs(self->reader, scans), akind, block, nthreads);
+    END_READER(self)
+    return blockArray(block, scans.size(), width);
+}
+
+static PyObject* rd_export(Reader* self, PyObject *args, PyObject *kwds)
+{
+    const char *directory = NULL;
+    PyObject *select = NULL;
+    int group = 0, nthreads = 0;
+    static const char *kwlist[] = {"directory", "select", "group", "threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|Opi:export", (char **)kwlist, &directory, &select, &group, &nthreads))
+        return NULL;
+    if (!readerCount(self)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    long int n;
+    BEGIN_READER(self)
+    n = exportColumns(scanRefs(self->reader, scans), scans, NULL, directory, group, nthreads);
+    END_READER(self)
+    if (n < 0) {
+        PyErr_Format(PyExc_IOError, "failed to export to '%s'", directory);
+        return NULL;
+    }
+    return Py_BuildValue("l", n);
+}
+
+static PyObject* rd_exportSDFITS(Reader* self, PyObject *args, PyObject *kwds)
+{
+    const char *filename = NULL;
+    PyObject *select = NULL;
+    int nthreads = 0;
+    static const char *kwlist[] = {"filename", "select", "threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|Oi:exportSDFITS", (char **)kwlist, &filename, &select, &nthreads))
+        return NULL;
+    if (!readerCount(self)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    long int n;
+    BEGIN_READER(self)
+    n = exportSDFITS(scanRefs(self->reader, scans), filename, nthreads);
+    END_READER(self)
+    if (n < 0) {
+        PyErr_Format(PyExc_IOError, "failed to export to '%s'", filename);
+        return NULL;
+    }
+    return Py_BuildValue("l", n);
+}
+
+/* the spatial index of a reader, built on first use, with the reader locked */
+static const SpatialIndex *readerIndex(Reader *self, bool absolute)
+{
+    SpatialIndex *&index = absolute ? self->positions : self->offsets;
+    if (index == 0) {
+        std::vector<int> scans(self->count);
+        for (int i = 0; i < self->count; i++) scans[i] = i+1;
+        index = spatialIndex(scanRefs(self->reader, scans), absolute, 0);
+    }
+    return index;
+}
+
+static PyObject* rd_cone(Reader* self, PyObject *args, PyObject *kwds)
+{
+    double x, y, radius;
+    int absolute = 0;
+    if (!parseCone(args, kwds, x, y, radius, absolute)) return NULL;
+    if (!readerCount(self)) return NULL;
+
+    std::vector<int> scans;
+    BEGIN_READER(self)
+    readerIndex(self, absolute)->cone(x, y, radius, scans);
+    END_READER(self)
+    return queryArray(scans);
+}
+
+static PyObject* rd_box(Reader* self, PyObject *args, PyObject *kwds)
+{
+    double x1, y1, x2, y2;
+    int absolute = 0;
+    if (!parseBox(args, kwds, x1, y1, x2, y2, absolute)) return NULL;
+    if (!readerCount(self)) return NULL;
+
+    std::vector<int> scans;
+    BEGIN_READER(self)
+    readerIndex(self, absolute)->box(x1, y1, x2, y2, scans);
+    END_READER(self)
+    return queryArray(scans);
+}
+
+static PyObject* rd_nearest(Reader* self, PyObject *args, PyObject *kwds)
+{
+    double x, y;
+    int k = 1, absolute = 0;
+    if (!parseNearest(args, kwds, x, y, k, absolute)) return NULL;
+    if (!readerCount(self)) return NULL;
+
+    std::vector<int> scans;
+    std::vector<double> dist;
+    BEGIN_READER(self)
+    readerIndex(self, absolute)->nearest(x, y, k, scans, dist);
+    END_READER(self)
+    return nearestTuple(scans, dist);
+}
+
+/* the time index of a reader, built on first use, with the reader locked */
+static const TimeIndex *readerTimes(Reader *self)
+{
+    if (self->times == 0) {
+        std::vector<int> scans(self->count);
+        for (int i = 0; i < self->count; i++) scans[i] = i+1;
+        self->times = new TimeIndex();
+        self->times->build(scanRefs(self->reader, scans), scans, 0);
+    }
+    return self->times;
+}
+
+static PyObject* rd_timeRange(Reader* self, PyObject *args, PyObject *kwds)
+{
+    double t1, t2;
+    if (!parseRange(args, kwds, t1, t2)) return NULL;
+    if (!readerCount(self)) return NULL;
+
+    std::vector<int> scans;
+    std::vector<double> times;
+    BEGIN_READER(self)
+    readerTimes(self)->range(t1, t2, scans, times);
+    END_READER(self)
+    return rangeTuple(scans, times);
+}
+
+static PyObject* rd_timeBins(Reader* self, PyObject *args, PyObject *kwds)
+{
+    double width, t1, t2;
+    if (!parseBins(args, kwds, width, t1, t2)) return NULL;
+    if (!readerCount(self)) return NULL;
+
+    TimeBins bins;
+    bool ok;
+    BEGIN_READER(self)
+    ok = indexBins(readerTimes(self), width, t1, t2, bins);
+    END_READER(self)
+    return binTable(ok, bins);
+}
+
+/*
+ * Iterator streaming the spectra of a reader.
+ *
+ * With chunk == 0, every step yields (header, freq, data) of a single
+ * spectrum, with freq shared by all spectra of the same axis. Otherwise, up
+ * to chunk consecutive spectra with the same number of channels are yielded
+ * as (list of headers, 2-D freq, 2-D data). If reuse is set, the same output
+ * arrays are refilled on every step as long as their shape fits, so memory
+ * use does not grow with the size of the file. Spectra are smoothed and
+ * binned while they are decoded, if requested.
+ */
+typedef struct {
+    PyObject_HEAD
+    Reader *owner;
+    int *scans;
+    int nscans;
+    int pos;
+    int chunk;
+    int reuse;
+    PyObject *freq;
+    PyObject *data;
+    Smoothing *smoothing;
+    SpectrumHeader *head;           // spectrum decoded but not yet returned
+    SpectralAxis *axis;
+    std::vector<double> *d;
+    int pending;
+} ReaderIter;
+
+static void iter_dealloc(ReaderIter *it)
+{
+    PyTypeObject *tp = Py_TYPE(it);
+    Py_XDECREF(it->owner);
+    Py_XDECREF(it->freq);
+    Py_XDECREF(it->data);
+    PyMem_Free(it->scans);
+    delete it->smoothing;
+    delete it->head;
+    delete it->axis;
+    delete it->d;
+    PyObject_Del(it);
+    Py_DECREF(tp);
+}
+
+/*
+ * Decode the next selected spectrum into the scratch vectors, unless already there.
+ * Called with the lock of the owning reader held.
+ */
+static bool iter_fetch(ReaderIter *it)
+{
+    if (it->pending) return true;
+
+    int iscan = it->scans[it->pos];
+    bool ok;
+    Py_BEGIN_ALLOW_THREADS
+    ok = it->owner->reader->getSpectrum(iscan, *it->head, *it->axis, *it->d, *it->smoothing);
+    Py_END_ALLOW_THREADS
+    if (!ok) {
+        PyErr_Format(PyExc_IOError, "failed to read spectrum %d", iscan);
+        return false;
+    }
+    it->pending = 1;
+    return true;
+}
+
+/* return an output array of the given shape, reusing the previous one if allowed */
+static PyObject *iter_array(ReaderIter *it, PyObject **cache, int nd, npy_intp *dims)
+{
+    PyObject *array = *cache;
+    if (array && PyArray_NDIM((PyArrayObject *)array) == nd) {
+        npy_intp *shape = PyArray_DIMS((PyArrayObject *)array);
+        bool same = true;
+        for (int i = 0; i < nd; i++) same = same && (shape[i] == dims[i]);
+        if (same) {
+            Py_INCREF(array);
+            return array;
+        }
+    }
+    array = PyArray_SimpleNew(nd, dims, NPY_DOUBLE);
+    if (array && it->reuse) {
+        Py_XDECREF(*cache);
+        Py_INCREF(array);
+        *cache = array;
+    }
+    return array;
+}
+
+static PyObject *iter_step(ReaderIter *it);
+
+static PyObject *iter_next(ReaderIter *it)
+{
+    /* the reader lock also protects the iterator state */
+    lockReader(it->owner);
+    PyObject *result = iter_step(it);
+    PyThread_release_lock(it->owner->lock);
+    return result;
+}
+
+static PyObject *iter_step(ReaderIter *it)
+{
+    if (it->pos >= it->nscans) return NULL;
+    if (!iter_fetch(it)) return NULL;
+
+    if (it->chunk == 0) {
+        npy_intp dims[] = { (npy_intp)it->d->size() };
+        PyObject *freq = axisArray(it->owner->axes, *it->axis);
+        PyObject *data = iter_array(it, &it->data, 1, dims);
+        if (freq == NULL || data == NULL) {
+            Py_XDECREF(freq);
+            Py_XDECREF(data);
+            return NULL;
+        }
+        if (dims[0] > 0) memcpy(PyArray_DATA((PyArrayObject *)data), &(*it->d)[0], dims[0]*sizeof(double));
+        it->pending = 0;
+        it->pos++;
+        return Py_BuildValue("(NNN)", headerDict(*it->head), freq, data);
+    }
+
+    int nrows = it->nscans - it->pos;
+    if (nrows > it->chunk) nrows = it->chunk;
+    int width = it->axis->nchan;
+    npy_intp dims[] = { (npy_intp)(it->reuse ? it->chunk : nrows), (npy_intp)width };
+
+    PyObject *heads = PyList_New(0);
+    PyObject *freq = iter_array(it, &it->freq, 2, dims);
+    PyObject *data = iter_array(it, &it->data, 2, dims);
+    if (heads == NULL || freq == NULL || data == NULL) {
+        Py_XDECREF(heads);
+        Py_XDECREF(freq);
+        Py_XDECREF(data);
+        return NULL;
+    }
+    double *fdst = (double *)PyArray_DATA((PyArrayObject *)freq);
+    double *ddst = (double *)PyArray_DATA((PyArrayObject *)data);
+
+    int irow = 0;
+    while (irow < nrows) {
+        if (!iter_fetch(it)) {
+            Py_DECREF(heads);
+            Py_DECREF(freq);
+            Py_DECREF(data);
+            return NULL;
+        }
+        if (it->axis->nchan != width) break;   // start a new chunk for a different axis length
+
+        PyObject *head = headerDict(*it->head);
+        if (head == NULL || PyList_Append(heads, head) < 0) {
+            Py_XDECREF(head);
+            Py_DECREF(heads);
+            Py_DECREF(freq);
+            Py_DECREF(data);
+            return NULL;
+        }
+        Py_DECREF(head);
+        double *frow = fdst + (size_t)irow*width;
+        for (int k = 0; k < width; k++) frow[k] = it->axis->value(k+1);
+        if (width > 0) memcpy(ddst + (size_t)irow*width, &(*it->d)[0], width*sizeof(double));
+        it->pending = 0;
+        it->pos++;
+        irow++;
+        if (it->pos >= it->nscans) break;
+    }
+
+    if (irow < dims[0]) {
+        /* fewer rows than allocated, return views of the filled part */
+        PyObject *fview = PySequence_GetSlice(freq, 0, irow);
+        PyObject *dview = PySequence_GetSlice(data, 0, irow);
+        Py_DECREF(freq);
+        Py_DECREF(data);
+        freq = fview;
+        data = dview;
+    }
+    return Py_BuildValue("(NNN)", heads, freq, data);
+}
+
+static PyType_Slot ReaderIter_slots[] = {
+    {Py_tp_dealloc, (void *)iter_dealloc},
+    {Py_tp_doc, (void *)"iterator over the spectra of a CLASSIC file"},
+    {Py_tp_iter, (void *)PyObject_SelfIter},
+    {Py_tp_iternext, (void *)iter_next},
+    {0, NULL}
+};
+
+static PyType_Spec ReaderIter_spec = {
+    "classic.ReaderIterator",
+    sizeof(ReaderIter),
+    0,
+#ifdef Py_TPFLAGS_DISALLOW_INSTANTIATION
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+#else
+    Py_TPFLAGS_DEFAULT,
+#endif
+    ReaderIter_slots
+};
+
+static PyObject *makeIter(Reader *self, PyObject *select, int chunk, int reuse, const Smoothing &smoothing)
+{
+    if (chunk < 0) {
+        PyErr_SetString(PyExc_ValueError, "chunk must not be negative");
+        return NULL;
+    }
+    if (!readerCount(self)) return NULL;
+
+    ModuleState *state = (ModuleState *)PyType_GetModuleState(Py_TYPE(self));
+    ReaderIter *it = PyObject_New(ReaderIter, state->ReaderIterType);
+    if (it == NULL) return NULL;
+
+    Py_INCREF(self);
+    it->owner = self;
+    it->scans = NULL;
+    it->nscans = 0;
+    it->pos = 0;
+    it->chunk = chunk;
+    it->reuse = reuse;
+    it->freq = NULL;
+    it->data = NULL;
+    it->smoothing = new Smoothing(smoothing);
+    it->head = new SpectrumHeader();
+    it->axis = new SpectralAxis();
+    it->d = new std::vector<double>();
+    it->pending = 0;
+
+    if (select == NULL || select == Py_None) {
+        it->nscans = self->count;
+        it->scans = (int *)PyMem_Malloc((it->nscans+1)*sizeof(int));
+        if (it->scans == NULL) {
+            Py_DECREF(it);
+            return PyErr_NoMemory();
+        }
+        for (int i = 0; i < it->nscans; i++) it->scans[i] = i+1;
+    } else {
+        PyObject *seq = PySequence_Fast(select, "select must be a sequence of scan numbers");
+        if (seq == NULL) {
+            Py_DECREF(it);
+            return NULL;
+        }
+        it->nscans = PySequence_Fast_GET_SIZE(seq);
+        it->scans = (int *)PyMem_Malloc((it->nscans+1)*sizeof(int));
+        if (it->scans == NULL) {
+            Py_DECREF(seq);
+            Py_DECREF(it);
+            return PyErr_NoMemory();
+        }
+        for (int i = 0; i < it->nscans; i++) {
+            long iscan = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+            if (iscan == -1 && PyErr_Occurred()) {
+                Py_DECREF(seq);
+                Py_DECREF(it);
+                return NULL;
+            }
+            if (iscan < 1 || iscan > self->count) {
+                PyErr_SetString(PyExc_IndexError, "scan number out of range");
+                Py_DECREF(seq);
+                Py_DECREF(it);
+                return NULL;
+            }
+            it->scans[i] = (int)iscan;
+        }
+        Py_DECREF(seq);
+    }
+    return (PyObject *)it;
+}
+
+static PyObject* iter(Reader* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    int chunk = 0;
+    int reuse = 0;
+    const char *smooth = NULL;
+    int width = 3, bin = 1;
+
+    static const char *kwlist[] = {"select", "chunk", "reuse", "smooth", "width", "bin", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oipzii:iter", (char **)kwlist, &select, &chunk, &reuse,
+                                     &smooth, &width, &bin)) return NULL;
+    Smoothing smoothing;
+    if (!parseSmoothing(smooth, width, bin, smoothing)) return NULL;
+
+    return makeIter(self, select, chunk, reuse, smoothing);
+}
+
+static PyObject* Reader_iter(Reader* self)
+{
+    return makeIter(self, NULL, 0, 0, Smoothing());
+}
+
+static void class_dealloc(Reader* self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+    if (self->reader) delete self->reader;
+    if (self->hasView) PyBuffer_Release(&self->view);
+    if (self->lock) PyThread_free_lock(self->lock);
+    dropIndexes(self);
+    Py_XDECREF(self->filename);
+    Py_XDECREF(self->axes);
+    tp->tp_free((PyObject*)self);
+    Py_DECREF(tp);
+}
+
+static PyObject *Reader_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    Reader *self;
+
+    self = (Reader *)type->tp_alloc(type, 0);
+    printf("new Reader ... %p\n", self);
+    if (self != NULL) {
+        self->filename = PyUnicode_FromString("");
+        self->axes = PyDict_New();
+        if (self->filename == NULL || self->axes == NULL) {
+            Py_DECREF(self);
+            return NULL;
+        }
+        self->count = 0;
+        self->reader = 0;
+        self->hasView = 0;
+        self->offsets = self->positions = 0;
+        self->times = 0;
+        self->lock = PyThread_allocate_lock();
+        if (self->lock == NULL) {
+            Py_DECREF(self);
+            return PyErr_NoMemory();
+        }
+    }
+    return (PyObject *)self;
+}
+
+/*
+ * A reader is opened from a file name (str or path-like object), from an
+ * open file descriptor (int), or from any object supporting the buffer
+ * protocol (bytes, bytearray, memoryview, mmap, numpy arrays, ...), which
+ * is read in place without copying.
+ */
+static int Reader_init(Reader *self, PyObject *args, PyObject *kwds)
+{
+    PyObject *filename = NULL, *tmp;
+
+    static const char *kwlist[] = {"filename", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", (char **)kwlist, &filename)) return -1;
+
+    int fd = -1;
+    Py_buffer view;
+    int hasView = 0;
+    PyObject *name = NULL;
+    if (PyLong_Check(filename)) {
+        fd = PyLong_AsLong(filename);
+        if (fd == -1 && PyErr_Occurred()) return -1;
+        if (fd < 0) {
+            PyErr_SetString(PyExc_ValueError, "file descriptor must not be negative");
+            return -1;
+        }
+        name = PyUnicode_FromFormat("<fd %d>", fd);
+    } else if (PyObject_CheckBuffer(filename)) {
+        if (PyObject_GetBuffer(filename, &view, PyBUF_SIMPLE) < 0) return -1;
+        hasView = 1;
+        name = PyUnicode_FromString("<memory>");
+    } else {
+        name = PyOS_FSPath(filename);
+        if (name && !PyUnicode_Check(name)) {
+            Py_DECREF(name);
+            PyErr_SetString(PyExc_TypeError, "expected a file name, a file descriptor or a buffer");
+            name = NULL;
+        }
+    }
+    if (name == NULL) {
+        if (hasView) PyBuffer_Release(&view);
+        return -1;
+    }
+
+    tmp = self->filename;
+    self->filename = name;
+    Py_XDECREF(tmp);
+    self->count = 0;
+
+    const char *cname = PyUnicode_AsUTF8(self->filename);
+    if (cname == NULL) {
+        if (hasView) PyBuffer_Release(&view);
+        return -1;
+    }
+
+    /* the old buffer is released once the GIL is held again */
+    Py_buffer oldView;
+    int hadView;
+    BEGIN_READER(self)
+    if (self->reader) delete self->reader;
+    hadView = self->hasView;
+    if (hadView) oldView = self->view;
+    dropIndexes(self);
+    self->hasView = hasView;
+    if (hasView) {
+        self->view = view;
+        self->reader = openClassBuffer(view.buf, view.len);
+    } else if (fd >= 0) {
+        self->reader = openClassFd(fd);
+    } else {
+        struct stat buffer;
+        if (stat(cname, &buffer) == 0) self->reader = openClassFile(cname);
+        else                           self->reader = 0;
+    }
+    END_READER(self)
+    if (hadView) PyBuffer_Release(&oldView);
+
+    return 0;
+}
+
+static PyMemberDef Reader_members[] = {
+    {"filename", T_OBJECT_EX, offsetof(Reader, filename), 0,
+     "filename"},
+    {"count",    T_INT,       offsetof(Reader, count),    0,
+     "count"},
+    {NULL}  /* Sentinel */
+};
+
+static PyMethodDef Reader_methods[] = {
+    {"getDirectory", (PyCFunction)getDirectory, METH_VARARGS | METH_KEYWORDS,
+     "get number of spectra in file, of the latest version of every observation unless versions='all'" },
+    {"getHead", (PyCFunction)getHead, METH_VARARGS, "get header of spectrum" },
+    {"getFreq", (PyCFunction)getFreq, METH_VARARGS, "get frequency vector of spectrum, read-only and shared by all spectra with the same axis" },
+    {"getData", (PyCFunction)getData, METH_VARARGS, "get data vector of spectrum" },
+    {"getSpectrum", (PyCFunction)getSpectrum, METH_VARARGS | METH_KEYWORDS,
+     "getSpectrum(scan, smooth=None, width=3, bin=1): get header, frequency and data vector of spectrum, "
+     "optionally smoothed ('hanning' or 'boxcar' of width channels) and binned" },
+    {"iter", (PyCFunction)iter, METH_VARARGS | METH_KEYWORDS,
+     "iter(select=None, chunk=0, reuse=False, smooth=None, width=3, bin=1): "
+     "iterate over (header, freq, data) of selected spectra" },
+    {"find", (PyCFunction)find, METH_VARARGS | METH_KEYWORDS,
+     "find(source=None, line=None, telescope=None, scan=None, kind=-1): numbers of matching spectra" },
+    {"getHeadTable", (PyCFunction)getHeadTable, METH_VARARGS | METH_KEYWORDS,
+     "getHeadTable(select=None): headers of selected spectra as a dict of columns" },
+    {"getDataBlock", (PyCFunction)getDataBlock, METH_VARARGS | METH_KEYWORDS,
+     "getDataBlock(select=None, axis=None, mode='linear', velocity=False, threads=0, smooth=None, width=3, bin=1): "
+     "data of selected spectra as 2-D array, padded with NaN, resampled onto axis, or smoothed and binned" },
+    {"average", (PyCFunction)rd_average, METH_VARARGS | METH_KEYWORDS,
+     "average(select=None, weight='tsys', axis=None, mode='linear', velocity=False, threads=0): "
+     "weighted average of selected spectra as (header, freq, data, weight)" },
+    {"baseline", (PyCFunction)rd_baseline, METH_VARARGS | METH_KEYWORDS,
+     "baseline(select=None, degree=1, windows=None, velocity=True, stored=False, threads=0): "
+     "selected spectra with polynomial baselines fitted outside windows subtracted, as (block, rms)" },
+    {"findLines", (PyCFunction)rd_findLines, METH_VARARGS | METH_KEYWORDS,
+     "findLines(select=None, threshold=5.0, edge=2.0, channels=2, gap=1, absorption=False, smooth=None, width=3, "
+     "bin=1, threads=0): lines above threshold times the robust noise, extended down to edge times the noise, "
+     "as a dict of columns" },
+    {"getSwitching", (PyCFunction)getSwitching, METH_VARARGS,
+     "getSwitching(scan): the switching section of a spectrum as a dict of mode, offset (MHz), time, weight, "
+     "loff and boff of the phases, or None" },
+    {"grid", (PyCFunction)rd_grid, METH_VARARGS | METH_KEYWORDS,
+     "grid(nx, ny, cell, select=None, center=(0, 0), kernel='gauss', width=0, support=0, weight='tsys', tile=256, threads=0): "
+     "grid spectra by their offsets (arcsec) into a cube, returning (header, freq, data, weight) with data and "
+     "weight of shape (ny, nx, nchan)" },
+    {"fold", (PyCFunction)rd_fold, METH_VARARGS | METH_KEYWORDS,
+     "fold(select=None, threads=0): fold frequency-switched spectra into a 2-D array, NaN for other spectra" },
+    {"storedGauss", (PyCFunction)rd_storedGauss, METH_VARARGS | METH_KEYWORDS,
+     "storedGauss(select=None, threads=0): the gauss fit results stored with the spectra (area, position, width "
+     "and their errors) as a dict of columns" },
+    {"fitGauss", (PyCFunction)rd_fitGauss, METH_VARARGS | METH_KEYWORDS,
+     "fitGauss(select=None, components=1, stored=True, velocity=True, maxiter=50, threshold=5.0, edge=2.0, "
+     "channels=2, gap=1, absorption=False, smooth=None, width=3, bin=1, threads=0): fit gaussians, starting from the "
+     "stored results or the strongest lines, and return area, position, width and their errors as a dict of columns" },
+    {"cone", (PyCFunction)rd_cone, METH_VARARGS | METH_KEYWORDS,
+     "cone(x, y, radius, absolute=False): numbers of spectra within radius of (x, y), by their offsets (arcsec) "
+     "or, if absolute, by RA and Dec (degrees)" },
+    {"box", (PyCFunction)rd_box, METH_VARARGS | METH_KEYWORDS,
+     "box(x1, y1, x2, y2, absolute=False): numbers of spectra with x1 <= x <= x2 and y1 <= y <= y2, by their offsets "
+     "(arcsec) or, if absolute, by RA and Dec (degrees), RA wrapping around 0 if x1 > x2" },
+    {"nearest", (PyCFunction)rd_nearest, METH_VARARGS | METH_KEYWORDS,
+     "nearest(x, y, k=1, absolute=False): numbers and distances of the k spectra nearest to (x, y), by their "
+     "offsets (arcsec) or, if absolute, by RA and Dec (degrees)" },
+    {"getPositions", (PyCFunction)rd_getPositions, METH_VARARGS | METH_KEYWORDS,
+     "getPositions(select=None, threads=0): system, projection, epoch and absolute positions (degrees) of selected "
+     "spectra, in their own system and in equatorial and galactic coordinates, as a dict of columns" },
+    {"getAxes", (PyCFunction)rd_getAxes, METH_VARARGS | METH_KEYWORDS,
+     "getAxes(select=None, kind='frequency', threads=0): frequency, velocity or image frequency axes of selected spectra "
+     "as 2-D array, padded with NaN" },
+    {"export", (PyCFunction)rd_export, METH_VARARGS | METH_KEYWORDS,
+     "export(directory, select=None, group=False, threads=0): write selected spectra as .npy files of header columns "
+     "and a float32 data matrix, one set per axis if grouped, returns number of spectra" },
+    {"exportSDFITS", (PyCFunction)rd_exportSDFITS, METH_VARARGS | METH_KEYWORDS,
+     "exportSDFITS(filename, select=None, threads=0): write selected spectra as an SDFITS binary table, "
+     "returns number of spectra" },
+    {"timeRange", (PyCFunction)rd_timeRange, METH_VARARGS | METH_KEYWORDS,
+     "timeRange(start=None, end=None): numbers and times (seconds since 1970) of spectra observed from start up "
+     "to end, given as seconds since 1970 or 'YYYY-MM-DD HH:MM:SS' (UTC), in time order" },
+    {"timeBins", (PyCFunction)rd_timeBins, METH_VARARGS | METH_KEYWORDS,
+     "timeBins(width, start=None, end=None): number of spectra, mean, minimum and maximum tsys and mean tau "
+     "in bins of width seconds from start to end, as a dict of columns" },
+    {"statsTable", (PyCFunction)rd_statsTable, METH_VARARGS | METH_KEYWORDS,
+     "statsTable(select=None, threads=0): statistics (mean, rms, min, max, nbad, flatness) and calibration "
+     "(tsys, el, tau, taus, h2omm) of selected spectra as a dict of columns" },
+    {"stats_table", (PyCFunction)rd_statsTable, METH_VARARGS | METH_KEYWORDS, "alias of statsTable" },
+    {"pipeline", (PyCFunction)rd_pipeline, METH_VARARGS | METH_KEYWORDS,
+     "pipeline(steps, select=None, reduce='average', weight='tsys', threads=0): take selected spectra "
+     "through steps ('baseline', 'smooth', 'resample', 'fold') in one pass, reduced to their average or a 2-D array" },
+    {NULL}  /* Sentinel */
+};
+
+static PyType_Slot Reader_slots[] = {
+    {Py_tp_dealloc, (void *)class_dealloc},
+    {Py_tp_doc, (void *)"CLASSIC file reader object"},
+    {Py_tp_iter, (void *)Reader_iter},
+    {Py_tp_methods, Reader_methods},
+    {Py_tp_members, Reader_members},
+    {Py_tp_init, (void *)Reader_init},
+    {Py_tp_new, (void *)Reader_new},
+    {0, NULL}
+};
+
+static PyType_Spec Reader_spec = {
+    "classic.Reader",
+    sizeof(Reader),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    Reader_slots
+};
+
+/*
+ * A dataset of several CLASSIC files, with spectra numbered 1..count across
+ * all files. Like readers, dataset calls run without the GIL and are
+ * serialised per object, while the dataset spreads its work over threads.
+ */
 typedef struct {
     PyObject_HEAD
-    ClassReader *reader;
-    PyObject *filename;
+    ClassDataset *dataset;
+    PyObject *files;
     int count;
-} Reader;
+    PyThread_type_lock lock;
+    PyObject *axes;             // axis values shared by spectra, see axisArray()
+    SpatialIndex *offsets;      // spatial and time indexes, built on first use
+    SpatialIndex *positions;
+    TimeIndex *times;
+} Dataset;
 
-static PyObject* getDirectory(Reader* self)
+static bool datasetScan(Dataset *self, int iscan)
 {
-    int nscans = 0;
-    if (self->reader) {
-        ClassReader *reader = self->reader;
-        nscans = reader->getDirectory();
-        self->count = nscans;
+    if (iscan < 1 || iscan > self->count) {
+        PyErr_SetString(PyExc_IndexError, "scan number out of range");
+        return false;
     }
+    return true;
+}
+
+static PyObject* ds_getDirectory(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    static const char *kwlist[] = {"versions", NULL};
+    const char *versions = NULL;
+    bool all;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|z:getDirectory", (char **)kwlist, &versions)) return NULL;
+    if (!parseVersions(versions, all)) return NULL;
+
+    int nscans;
+    BEGIN_READER(self)
+    self->dataset->setAllVersions(all);
+    nscans = self->dataset->getDirectory();
+    self->count = nscans;
+    dropIndexes(self);
+    END_READER(self)
     return Py_BuildValue("i", nscans);
 }
 
-static PyObject* getHead(Reader* self, PyObject *args)
+static PyObject* ds_locate(Dataset* self, PyObject *args)
 {
-    static char fmt[] = "0000-00-00 00:00:00"; // %Y-%m-%d %H:%M:%S
+    int iscan = 1;
+    if (!PyArg_ParseTuple(args, "i:locate", &iscan)) return NULL;
+    if (!datasetScan(self, iscan)) return NULL;
 
+    DatasetEntry entry;
+    self->dataset->locate(iscan, entry);
+    return Py_BuildValue("(ii)", entry.file, entry.scan);
+}
+
+static PyObject* ds_getHead(Dataset* self, PyObject *args)
+{
     int iscan = 1;
     if (!PyArg_ParseTuple(args, "i:getHead", &iscan)) return NULL;
+    if (!datasetScan(self, iscan)) return NULL;
 
-    if (iscan < 1 || iscan > self->count) {
-        PyErr_SetString(PyExc_IndexError, "scan number out of range");
-        return NULL;
-    }
-    if (self->reader) {
-        ClassReader *reader = self->reader;
-        SpectrumHeader S = reader->getHead(iscan);
-        strftime(fmt, sizeof(fmt), "%Y-%m-%d %H:%M:%S", gmtime(&S.utc));
-
-        return Py_BuildValue("{s:i,s:i,s:s,s:s,s:s,s:d,s:d,s:d,s:d,s:d,s:d,s:d,s:d,s:s}",
-                             "id", S.id,
-                             "scanno", S.scanno,
-                             "target", S.target,
-                             "line", S.line,
-                             "instr", S.instr,
-                             "RA", S.RA,
-                             "Dec", S.Dec,
-                             "fLO", S.fLO,
-                             "f0", S.f0,
-                             "df", S.df,
-                             "vs", S.vs,
-                             "dt", S.dt,
-                             "tsys", S.tsys,
-                             "utc", fmt);
-    }
-    Py_RETURN_NONE;
+    SpectrumHeader S;
+    BEGIN_READER(self)
+    S = self->dataset->getHead(iscan);
+    END_READER(self)
+    return headerDict(S);
 }
 
-static PyObject* getFreq(Reader* self, PyObject *args)
+static PyObject* ds_getFreq(Dataset* self, PyObject *args)
 {
     int iscan = 1;
-    if (!PyArg_ParseTuple(args, "i:getHead", &iscan)) return NULL;
+    if (!PyArg_ParseTuple(args, "i:getFreq", &iscan)) return NULL;
+    if (!datasetScan(self, iscan)) return NULL;
 
-    if (iscan < 1 || iscan > self->count) {
-        PyErr_SetString(PyExc_IndexError, "scan number out of range");
+    SpectralAxis axis;
+    BEGIN_READER(self)
+    axis = self->dataset->getAxis(iscan);
+    END_READER(self)
+    return axisArray(self->axes, axis);
+}
+
+static PyObject* ds_getData(Dataset* self, PyObject *args)
+{
+    int iscan = 1;
+    if (!PyArg_ParseTuple(args, "i:getData", &iscan)) return NULL;
+    if (!datasetScan(self, iscan)) return NULL;
+
+    std::vector<double> d;
+    BEGIN_READER(self)
+    d = self->dataset->getData(iscan);
+    END_READER(self)
+    return vectorArray(d);
+}
+
+static PyObject* ds_find(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    ClassSelection sel;
+    if (!parseSelection(args, kwds, sel)) return NULL;
+
+    std::vector<int> scans;
+    BEGIN_READER(self)
+    scans = self->dataset->find(sel);
+    END_READER(self)
+    return scanArray(scans);
+}
+
+static PyObject* ds_getHeadTable(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    static const char *kwlist[] = {"select", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:getHeadTable", (char **)kwlist, &select)) return NULL;
+
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<SpectrumHeader> heads;
+    std::vector<DatasetEntry> entries(scans.size());
+    BEGIN_READER(self)
+    heads = self->dataset->getHeaders(scans);
+    for (size_t i = 0; i < scans.size(); i++) self->dataset->locate(scans[i], entries[i]);
+    END_READER(self)
+    return headerTable(heads, &entries);
+}
+
+static PyObject* ds_getDataBlock(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL, *axisObj = NULL;
+    const char *modeName = NULL, *smooth = NULL;
+    int velocity = 0, boxcar = 3, bin = 1;
+    static const char *kwlist[] = {"select", "axis", "mode", "velocity", "smooth", "width", "bin", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OOspzii:getDataBlock", (char **)kwlist,
+                                     &select, &axisObj, &modeName, &velocity, &smooth, &boxcar, &bin)) return NULL;
+
+    SpectralAxis axis;
+    ResampleMode mode;
+    Smoothing smoothing;
+    bool resample = (axisObj != NULL && axisObj != Py_None);
+    if (resample && !parseAxis(axisObj, axis)) return NULL;
+    if (!parseMode(modeName, mode)) return NULL;
+    if (!parseSmoothing(smooth, boxcar, bin, smoothing)) return NULL;
+    if (resample && smoothing.active()) {
+        PyErr_SetString(PyExc_ValueError, "spectra cannot be smoothed and resampled at once");
         return NULL;
     }
-    if (self->reader) {
-        ClassReader *reader = self->reader;
-        std::vector<double> f = reader->getFreq(iscan);
-        PyObject *array;
 
-        long int dims[] = { 0 };
-        dims[0] = f.size();
-        array = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
-        double *data = (double *)PyArray_GETPTR1((PyArrayObject *)array, 0);
-        for (int i = 0; i < dims[0]; i++) {
-            data[i] = f[i];
-        }
-        return array;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<double> block;
+    int width;
+    BEGIN_READER(self)
+    if (resample) {
+        resampleBlock(self->dataset->scanRefs(scans), axis, velocity, mode, block, self->dataset->getThreads());
+        width = axis.nchan;
+    } else {
+        width = self->dataset->getDataBlock(scans, block, smoothing);
     }
+    END_READER(self)
+    return blockArray(block, scans.size(), width);
+}
 
-    Py_RETURN_NONE;
+static PyObject* ds_average(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL, *axisObj = NULL;
+    const char *weight = NULL, *modeName = NULL;
+    int velocity = 0;
+    static const char *kwlist[] = {"select", "weight", "axis", "mode", "velocity", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OsOsp:average", (char **)kwlist,
+                                     &select, &weight, &axisObj, &modeName, &velocity)) return NULL;
+
+    Weighting weighting;
+    SpectralAxis axis;
+    ResampleMode mode;
+    bool resample = (axisObj != NULL && axisObj != Py_None);
+    if (!parseWeighting(weight, weighting)) return NULL;
+    if (resample && !parseAxis(axisObj, axis)) return NULL;
+    if (!parseMode(modeName, mode)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    AverageResult result;
+    bool ok;
+    BEGIN_READER(self)
+    if (resample) ok = average(self->dataset->scanRefs(scans), weighting, axis, velocity, mode, result,
+                               self->dataset->getThreads());
+    else          ok = average(self->dataset, scans, weighting, result);
+    END_READER(self)
+    return averageTuple(ok, result);
 }
 
-static PyObject* getData(Reader* self, PyObject *args)
+static PyObject* ds_baseline(Dataset* self, PyObject *args, PyObject *kwds)
 {
-    int iscan = 1;
-    if (!PyArg_ParseTuple(args, "i:getHead", &iscan)) return NULL;
+    PyObject *select = NULL, *windows = NULL;
+    int degree = 1, velocity = 1, stored = 0;
+    static const char *kwlist[] = {"select", "degree", "windows", "velocity", "stored", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OiOpp:baseline", (char **)kwlist,
+                                     &select, &degree, &windows, &velocity, &stored)) return NULL;
 
-    if (iscan < 1 || iscan > self->count) {
-        PyErr_SetString(PyExc_IndexError, "scan number out of range");
+    BaselineOptions options;
+    if (!parseBaseline(degree, windows, velocity, stored, options)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<double> block, rms;
+    int width;
+    BEGIN_READER(self)
+    width = baselineBlock(self->dataset->scanRefs(scans), options, block, rms, self->dataset->getThreads());
+    END_READER(self)
+    return Py_BuildValue("(NN)", blockArray(block, scans.size(), width), vectorArray(rms));
+}
+
+static PyObject* ds_pipeline(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *steps = NULL, *select = NULL;
+    const char *reduce = NULL, *weight = NULL;
+    static const char *kwlist[] = {"steps", "select", "reduce", "weight", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|Oss:pipeline", (char **)kwlist,
+                                     &steps, &select, &reduce, &weight)) return NULL;
+
+    Pipeline pipeline;
+    Weighting weighting;
+    bool averaged;
+    if (!parsePipeline(steps, pipeline)) return NULL;
+    if (!parseReduce(reduce, averaged)) return NULL;
+    if (!parseWeighting(weight, weighting)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    AverageResult result;
+    std::vector<double> block;
+    bool ok = true;
+    int width = 0;
+    BEGIN_READER(self)
+    int nthreads = self->dataset->getThreads();
+    if (averaged) ok = pipeline.average(self->dataset->scanRefs(scans), weighting, result, nthreads);
+    else          width = pipeline.block(self->dataset->scanRefs(scans), block, nthreads);
+    END_READER(self)
+    if (averaged) return averageTuple(ok, result);
+    return blockArray(block, scans.size(), width);
+}
+
+static PyObject* ds_grid(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    int nx, ny, tile = 256;
+    double cell, cx = 0.0, cy = 0.0, width = 0.0, support = 0.0;
+    const char *kernel = NULL, *weight = NULL;
+    static const char *kwlist[] = {"nx", "ny", "cell", "select", "center", "kernel", "width", "support", "weight",
+                                   "tile", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "iid|O(dd)zddzi:grid", (char **)kwlist, &nx, &ny, &cell, &select,
+                                     &cx, &cy, &kernel, &width, &support, &weight, &tile)) return NULL;
+
+    GridOptions options;
+    if (!parseGrid(nx, ny, cell, cx, cy, kernel, width, support, weight, tile, options)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    GridCube cube;
+    bool ok;
+    BEGIN_READER(self)
+    ok = gridSpectra(self->dataset->scanRefs(scans), options, cube, self->dataset->getThreads());
+    END_READER(self)
+    return cubeTuple(ok, cube);
+}
+
+static PyObject* ds_fold(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    static const char *kwlist[] = {"select", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:fold", (char **)kwlist, &select)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<double> block;
+    int width;
+    BEGIN_READER(self)
+    width = foldBlock(self->dataset->scanRefs(scans), block, self->dataset->getThreads());
+    END_READER(self)
+    return blockArray(block, scans.size(), width);
+}
+
+static PyObject* ds_statsTable(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    static const char *kwlist[] = {"select", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:statsTable", (char **)kwlist, &select)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    StatsTable table;
+    std::vector<DatasetEntry> entries(scans.size());
+    BEGIN_READER(self)
+    statsTable(self->dataset->scanRefs(scans), table, self->dataset->getThreads());
+    for (size_t i = 0; i < scans.size(); i++) self->dataset->locate(scans[i], entries[i]);
+    END_READER(self)
+    return statsColumns(scans, table, &entries);
+}
+
+static PyObject* ds_findLines(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    double threshold = 5.0, edge = 2.0;
+    int channels = 2, gap = 1, absorption = 0, width = 3, bin = 1;
+    const char *smooth = NULL;
+    static const char *kwlist[] = {"select", "threshold", "edge", "channels", "gap", "absorption",
+                                   "smooth", "width", "bin", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oddiipzii:findLines", (char **)kwlist, &select, &threshold,
+                                     &edge, &channels, &gap, &absorption, &smooth, &width, &bin)) return NULL;
+
+    LineOptions options;
+    if (!parseLines(threshold, edge, channels, gap, absorption, smooth, width, bin, options)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<LineCandidate> lines;
+    std::vector<DatasetEntry> entries(scans.size());
+    BEGIN_READER(self)
+    findLines(self->dataset->scanRefs(scans), options, lines, self->dataset->getThreads());
+    for (size_t i = 0; i < scans.size(); i++) self->dataset->locate(scans[i], entries[i]);
+    END_READER(self)
+    return lineColumns(scans, lines, &entries);
+}
+
+static PyObject* ds_storedGauss(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    static const char *kwlist[] = {"select", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:storedGauss", (char **)kwlist, &select)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<GaussResult> results;
+    std::vector<DatasetEntry> entries(scans.size());
+    BEGIN_READER(self)
+    storedGauss(self->dataset->scanRefs(scans), results, self->dataset->getThreads());
+    for (size_t i = 0; i < scans.size(); i++) self->dataset->locate(scans[i], entries[i]);
+    END_READER(self)
+    return gaussColumns(scans, results, storedComponents(results), true, &entries);
+}
+
+static PyObject* ds_fitGauss(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    int ncomp = 1, stored = 1, velocity = 1, maxiter = 50;
+    double threshold = 5.0, edge = 2.0;
+    int channels = 2, gap = 1, absorption = 0, width = 3, bin = 1;
+    const char *smooth = NULL;
+    static const char *kwlist[] = {"select", "components", "stored", "velocity", "maxiter", "threshold", "edge",
+                                   "channels", "gap", "absorption", "smooth", "width", "bin", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oippiddiipzii:fitGauss", (char **)kwlist, &select, &ncomp,
+                                     &stored, &velocity, &maxiter, &threshold, &edge, &channels, &gap, &absorption,
+                                     &smooth, &width, &bin)) return NULL;
+
+    GaussOptions options;
+    if (!parseGauss(ncomp, stored, velocity, maxiter, options)) return NULL;
+    if (!parseLines(threshold, edge, channels, gap, absorption, smooth, width, bin, options.lines)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<GaussResult> results;
+    std::vector<DatasetEntry> entries(scans.size());
+    BEGIN_READER(self)
+    fitGauss(self->dataset->scanRefs(scans), options, results, self->dataset->getThreads());
+    for (size_t i = 0; i < scans.size(); i++) self->dataset->locate(scans[i], entries[i]);
+    END_READER(self)
+    return gaussColumns(scans, results, ncomp, false, &entries);
+}
+
+static PyObject* ds_getPositions(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    static const char *kwlist[] = {"select", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:getPositions", (char **)kwlist, &select)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    PositionTable table;
+    std::vector<DatasetEntry> entries(scans.size());
+    BEGIN_READER(self)
+    positionTable(self->dataset->scanRefs(scans), table, self->dataset->getThreads());
+    for (size_t i = 0; i < scans.size(); i++) self->dataset->locate(scans[i], entries[i]);
+    END_READER(self)
+    return positionColumns(scans, table, &entries);
+}
+
+static PyObject* ds_getAxes(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    PyObject *select = NULL;
+    const char *kind = NULL;
+    static const char *kwlist[] = {"select", "kind", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Oz:getAxes", (char **)kwlist, &select, &kind)) return NULL;
+    AxisKind akind;
+    if (!parseAxisKind(kind, akind)) return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    std::vector<double> block;
+    int width;
+    BEGIN_READER(self)
+    width = axisBlock(self->dataset->scanRefs(scans), akind, block, self->dataset->getThreads());
+    END_READER(self)
+    return blockArray(block, scans.size(), width);
+}
+
+static PyObject* ds_export(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    const char *directory = NULL;
+    PyObject *select = NULL;
+    int group = 0;
+    static const char *kwlist[] = {"directory", "select", "group", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|Op:export", (char **)kwlist, &directory, &select, &group))
+        return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    long int n;
+    std::vector<DatasetEntry> entries(scans.size());
+    BEGIN_READER(self)
+    for (size_t i = 0; i < scans.size(); i++) self->dataset->locate(scans[i], entries[i]);
+    n = exportColumns(self->dataset->scanRefs(scans), scans, &entries, directory, group, self->dataset->getThreads());
+    END_READER(self)
+    if (n < 0) {
+        PyErr_Format(PyExc_IOError, "failed to export to '%s'", directory);
         return NULL;
     }
-    if (self->reader) {
-        ClassReader *reader = self->reader;
-        std::vector<double> d = reader->getData(iscan);
-        PyObject *array;
+    return Py_BuildValue("l", n);
+}
 
-        long int dims[] = { 0 };
-        dims[0] = d.size();
-        array = PyArray_SimpleNew(1, dims, NPY_DOUBLE);
-        double *data = (double *)PyArray_GETPTR1((PyArrayObject *)array, 0);
-        for (int i = 0; i < dims[0]; i++) {
-            data[i] = d[i];
-        }
-        return array;
+static PyObject* ds_exportSDFITS(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    const char *filename = NULL;
+    PyObject *select = NULL;
+    static const char *kwlist[] = {"filename", "select", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|O:exportSDFITS", (char **)kwlist, &filename, &select))
+        return NULL;
+    std::vector<int> scans;
+    if (!scanList(select, self->count, scans)) return NULL;
+
+    long int n;
+    BEGIN_READER(self)
+    n = exportSDFITS(self->dataset->scanRefs(scans), filename, self->dataset->getThreads());
+    END_READER(self)
+    if (n < 0) {
+        PyErr_Format(PyExc_IOError, "failed to export to '%s'", filename);
+        return NULL;
     }
+    return Py_BuildValue("l", n);
+}
 
-    Py_RETURN_NONE;
+/* the spatial index of a dataset, built on first use, with the dataset locked */
+static const SpatialIndex *datasetIndex(Dataset *self, bool absolute)
+{
+    SpatialIndex *&index = absolute ? self->positions : self->offsets;
+    if (index == 0) {
+        std::vector<int> scans(self->count);
+        for (int i = 0; i < self->count; i++) scans[i] = i+1;
+        index = spatialIndex(self->dataset->scanRefs(scans), absolute, self->dataset->getThreads());
+    }
+    return index;
 }
 
-static void class_dealloc(Reader* self)
+static PyObject* ds_cone(Dataset* self, PyObject *args, PyObject *kwds)
 {
-    if (self->reader) delete self->reader;
-    Py_XDECREF(self->filename);
-    Py_TYPE(self)->tp_free((PyObject*)self);
+    double x, y, radius;
+    int absolute = 0;
+    if (!parseCone(args, kwds, x, y, radius, absolute)) return NULL;
+
+    std::vector<int> scans;
+    BEGIN_READER(self)
+    datasetIndex(self, absolute)->cone(x, y, radius, scans);
+    END_READER(self)
+    return queryArray(scans);
 }
 
-static PyObject *Reader_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+static PyObject* ds_box(Dataset* self, PyObject *args, PyObject *kwds)
 {
-    Reader *self;
+    double x1, y1, x2, y2;
+    int absolute = 0;
+    if (!parseBox(args, kwds, x1, y1, x2, y2, absolute)) return NULL;
 
-    self = (Reader *)type->tp_alloc(type, 0);
-    printf("new Reader ... %p\n", self);
+    std::vector<int> scans;
+    BEGIN_READER(self)
+    datasetIndex(self, absolute)->box(x1, y1, x2, y2, scans);
+    END_READER(self)
+    return queryArray(scans);
+}
+
+static PyObject* ds_nearest(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    double x, y;
+    int k = 1, absolute = 0;
+    if (!parseNearest(args, kwds, x, y, k, absolute)) return NULL;
+
+    std::vector<int> scans;
+    std::vector<double> dist;
+    BEGIN_READER(self)
+    datasetIndex(self, absolute)->nearest(x, y, k, scans, dist);
+    END_READER(self)
+    return nearestTuple(scans, dist);
+}
+
+/* the time index of a dataset, built on first use, with the dataset locked */
+static const TimeIndex *datasetTimes(Dataset *self)
+{
+    if (self->times == 0) {
+        std::vector<int> scans(self->count);
+        for (int i = 0; i < self->count; i++) scans[i] = i+1;
+        self->times = new TimeIndex();
+        self->times->build(self->dataset->scanRefs(scans), scans, self->dataset->getThreads());
+    }
+    return self->times;
+}
+
+static PyObject* ds_timeRange(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    double t1, t2;
+    if (!parseRange(args, kwds, t1, t2)) return NULL;
+
+    std::vector<int> scans;
+    std::vector<double> times;
+    BEGIN_READER(self)
+    datasetTimes(self)->range(t1, t2, scans, times);
+    END_READER(self)
+    return rangeTuple(scans, times);
+}
+
+static PyObject* ds_timeBins(Dataset* self, PyObject *args, PyObject *kwds)
+{
+    double width, t1, t2;
+    if (!parseBins(args, kwds, width, t1, t2)) return NULL;
+
+    TimeBins bins;
+    bool ok;
+    BEGIN_READER(self)
+    ok = indexBins(datasetTimes(self), width, t1, t2, bins);
+    END_READER(self)
+    return binTable(ok, bins);
+}
+
+static void ds_dealloc(Dataset* self)
+{
+    PyTypeObject *tp = Py_TYPE(self);
+    delete self->dataset;
+    if (self->lock) PyThread_free_lock(self->lock);
+    dropIndexes(self);
+    Py_XDECREF(self->files);
+    Py_XDECREF(self->axes);
+    tp->tp_free((PyObject*)self);
+    Py_DECREF(tp);
+}
+
+static PyObject *Dataset_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    Dataset *self = (Dataset *)type->tp_alloc(type, 0);
     if (self != NULL) {
-        self->filename = PyUnicode_FromString("");
-        if (self->filename == NULL) {
+        self->dataset = 0;
+        self->count = 0;
+        self->offsets = self->positions = 0;
+        self->times = 0;
+        self->files = PyList_New(0);
+        self->axes = PyDict_New();
+        self->lock = PyThread_allocate_lock();
+        if (self->files == NULL || self->axes == NULL || self->lock == NULL) {
             Py_DECREF(self);
-            return NULL;
+            return PyErr_NoMemory();
         }
-        self->count = 0;
     }
     return (PyObject *)self;
 }
 
-static int Reader_init(Reader *self, PyObject *args, PyObject *kwds)
+/*
+ * A dataset is opened from a glob pattern (str), or from a sequence of file
+ * names (str or path-like objects). Files that cannot be opened are skipped,
+ * the names of those opened are kept in the files attribute, indexed by file id.
+ */
+static int Dataset_init(Dataset *self, PyObject *args, PyObject *kwds)
 {
-    PyObject *filename = NULL, *tmp;
+    PyObject *files = NULL;
+    int nthreads = 0;
 
-    static char *kwlist[] = {"filename", NULL};
-    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", kwlist, &filename)) return -1;
+    static const char *kwlist[] = {"files", "threads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", (char **)kwlist, &files, &nthreads)) return -1;
 
-    if (self != NULL) {
-        if (filename) {
-            tmp = self->filename;
-            Py_INCREF(filename);
-            self->filename = filename;
-            Py_XDECREF(tmp);
+    std::vector<std::string> names;
+    const char *pattern = NULL;
+    if (PyUnicode_Check(files)) {
+        pattern = PyUnicode_AsUTF8(files);
+        if (pattern == NULL) return -1;
+    } else {
+        PyObject *seq = PySequence_Fast(files, "files must be a glob pattern or a sequence of file names");
+        if (seq == NULL) return -1;
+        for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+            PyObject *name = PyOS_FSPath(PySequence_Fast_GET_ITEM(seq, i));
+            const char *cname = (name && PyUnicode_Check(name)) ? PyUnicode_AsUTF8(name) : NULL;
+            if (cname == NULL) {
+                if (!PyErr_Occurred()) PyErr_SetString(PyExc_TypeError, "expected a file name");
+                Py_XDECREF(name);
+                Py_DECREF(seq);
+                return -1;
+            }
+            names.push_back(cname);
+            Py_DECREF(name);
         }
-        self->count = 0;
+        Py_DECREF(seq);
+    }
+
+    ClassDataset *dataset = new ClassDataset(nthreads);
+    std::string cpattern = pattern ? pattern : "";
+    Py_BEGIN_ALLOW_THREADS
+    if (pattern) dataset->addGlob(cpattern.c_str());
+    for (size_t i = 0; i < names.size(); i++) dataset->addFile(names[i].c_str());
+    Py_END_ALLOW_THREADS
+
+    PyObject *list = PyList_New(0);
+    if (list == NULL) {
+        delete dataset;
+        return -1;
+    }
+    for (int i = 0; i < dataset->getFileCount(); i++) {
+        PyObject *name = PyUnicode_DecodeFSDefault(dataset->getFileName(i));
+        if (name == NULL || PyList_Append(list, name) < 0) {
+            Py_XDECREF(name);
+            Py_DECREF(list);
+            delete dataset;
+            return -1;
+        }
+        Py_DECREF(name);
     }
-    const char *name = PyUnicode_AsUTF8(self->filename);
-    struct stat buffer;
-    if (stat(name, &buffer) == 0) self->reader = openClassFile(name);
-    else                          self->reader = 0;
 
+    BEGIN_READER(self)
+    delete self->dataset;
+    self->dataset = dataset;
+    self->count = 0;
+    dropIndexes(self);
+    END_READER(self)
+    Py_SETREF(self->files, list);
     return 0;
 }
 
-static PyMemberDef Reader_members[] = {
-    {"filename", T_OBJECT_EX, offsetof(Reader, filename), 0,
-     "filename"},
-    {"count",    T_INT,       offsetof(Reader, count),    0,
-     "count"},
+static PyMemberDef Dataset_members[] = {
+    {"files", T_OBJECT_EX, offsetof(Dataset, files), READONLY,
+     "names of the files, indexed by file id"},
+    {"count", T_INT,       offsetof(Dataset, count), READONLY,
+     "number of spectra"},
     {NULL}  /* Sentinel */
 };
 
-static PyMethodDef Reader_methods[] = {
-    {"getDirectory", (PyCFunction)getDirectory, METH_NOARGS, "get number of spectra in file" },
-    {"getHead", (PyCFunction)getHead, METH_VARARGS, "get header of spectrum" },
-    {"getFreq", (PyCFunction)getFreq, METH_VARARGS, "get frequency vector of spectrum" },
-    {"getData", (PyCFunction)getData, METH_VARARGS, "get data vector of spectrum" },
+static PyMethodDef Dataset_methods[] = {
+    {"getDirectory", (PyCFunction)ds_getDirectory, METH_VARARGS | METH_KEYWORDS,
+     "read directories of all files, get number of spectra, see Reader.getDirectory()" },
+    {"locate", (PyCFunction)ds_locate, METH_VARARGS, "get (file id, number in file) of spectrum" },
+    {"getHead", (PyCFunction)ds_getHead, METH_VARARGS, "get header of spectrum" },
+    {"getFreq", (PyCFunction)ds_getFreq, METH_VARARGS, "get frequency vector of spectrum, read-only and shared by all spectra with the same axis" },
+    {"getData", (PyCFunction)ds_getData, METH_VARARGS, "get data vector of spectrum" },
+    {"find", (PyCFunction)ds_find, METH_VARARGS | METH_KEYWORDS,
+     "find(source=None, line=None, telescope=None, scan=None, kind=-1): numbers of matching spectra" },
+    {"getHeadTable", (PyCFunction)ds_getHeadTable, METH_VARARGS | METH_KEYWORDS,
+     "getHeadTable(select=None): headers of selected spectra as a dict of columns" },
+    {"getDataBlock", (PyCFunction)ds_getDataBlock, METH_VARARGS | METH_KEYWORDS,
+     "getDataBlock(select=None, axis=None, mode='linear', velocity=False, smooth=None, width=3, bin=1): "
+     "data of selected spectra as 2-D array, padded with NaN, resampled onto axis, or smoothed and binned" },
+    {"average", (PyCFunction)ds_average, METH_VARARGS | METH_KEYWORDS,
+     "average(select=None, weight='tsys', axis=None, mode='linear', velocity=False): "
+     "weighted average of selected spectra as (header, freq, data, weight)" },
+    {"baseline", (PyCFunction)ds_baseline, METH_VARARGS | METH_KEYWORDS,
+     "baseline(select=None, degree=1, windows=None, velocity=True, stored=False): "
+     "selected spectra with polynomial baselines fitted outside windows subtracted, as (block, rms)" },
+    {"findLines", (PyCFunction)ds_findLines, METH_VARARGS | METH_KEYWORDS,
+     "findLines(select=None, threshold=5.0, edge=2.0, channels=2, gap=1, absorption=False, smooth=None, width=3, "
+     "bin=1): lines above threshold times the robust noise, extended down to edge times the noise, "
+     "as a dict of columns" },
+    {"grid", (PyCFunction)ds_grid, METH_VARARGS | METH_KEYWORDS,
+     "grid(nx, ny, cell, select=None, center=(0, 0), kernel='gauss', width=0, support=0, weight='tsys', tile=256): "
+     "grid spectra by their offsets (arcsec) into a cube, returning (header, freq, data, weight) with data and "
+     "weight of shape (ny, nx, nchan)" },
+    {"fold", (PyCFunction)ds_fold, METH_VARARGS | METH_KEYWORDS,
+     "fold(select=None): fold frequency-switched spectra into a 2-D array, NaN for other spectra" },
+    {"storedGauss", (PyCFunction)ds_storedGauss, METH_VARARGS | METH_KEYWORDS,
+     "storedGauss(select=None): the gauss fit results stored with the spectra (area, position, width "
+     "and their errors) as a dict of columns" },
+    {"fitGauss", (PyCFunction)ds_fitGauss, METH_VARARGS | METH_KEYWORDS,
+     "fitGauss(select=None, components=1, stored=True, velocity=True, maxiter=50, threshold=5.0, edge=2.0, "
+     "channels=2, gap=1, absorption=False, smooth=None, width=3, bin=1): fit gaussians, starting from the "
+     "stored results or the strongest lines, and return area, position, width and their errors as a dict of columns" },
+    {"cone", (PyCFunction)ds_cone, METH_VARARGS | METH_KEYWORDS,
+     "cone(x, y, radius, absolute=False): numbers of spectra within radius of (x, y), by their offsets (arcsec) "
+     "or, if absolute, by RA and Dec (degrees)" },
+    {"box", (PyCFunction)ds_box, METH_VARARGS | METH_KEYWORDS,
+     "box(x1, y1, x2, y2, absolute=False): numbers of spectra with x1 <= x <= x2 and y1 <= y <= y2, by their offsets "
+     "(arcsec) or, if absolute, by RA and Dec (degrees), RA wrapping around 0 if x1 > x2" },
+    {"nearest", (PyCFunction)ds_nearest, METH_VARARGS | METH_KEYWORDS,
+     "nearest(x, y, k=1, absolute=False): numbers and distances of the k spectra nearest to (x, y), by their "
+     "offsets (arcsec) or, if absolute, by RA and Dec (degrees)" },
+    {"getPositions", (PyCFunction)ds_getPositions, METH_VARARGS | METH_KEYWORDS,
+     "getPositions(select=None): system, projection, epoch and absolute positions (degrees) of selected "
+     "spectra, in their own system and in equatorial and galactic coordinates, as a dict of columns" },
+    {"getAxes", (PyCFunction)ds_getAxes, METH_VARARGS | METH_KEYWORDS,
+     "getAxes(select=None, kind='frequency'): frequency, velocity or image frequency axes of selected spectra "
+     "as 2-D array, padded with NaN" },
+    {"export", (PyCFunction)ds_export, METH_VARARGS | METH_KEYWORDS,
+     "export(directory, select=None, group=False): write selected spectra as .npy files, see Reader.export(), "
+     "with file and scan columns" },
+    {"exportSDFITS", (PyCFunction)ds_exportSDFITS, METH_VARARGS | METH_KEYWORDS,
+     "exportSDFITS(filename, select=None): write selected spectra as an SDFITS binary table, "
+     "see Reader.exportSDFITS()" },
+    {"timeRange", (PyCFunction)ds_timeRange, METH_VARARGS | METH_KEYWORDS,
+     "timeRange(start=None, end=None): numbers and times (seconds since 1970) of spectra observed from start up "
+     "to end, given as seconds since 1970 or 'YYYY-MM-DD HH:MM:SS' (UTC), in time order" },
+    {"timeBins", (PyCFunction)ds_timeBins, METH_VARARGS | METH_KEYWORDS,
+     "timeBins(width, start=None, end=None): number of spectra, mean, minimum and maximum tsys and mean tau "
+     "in bins of width seconds from start to end, as a dict of columns" },
+    {"statsTable", (PyCFunction)ds_statsTable, METH_VARARGS | METH_KEYWORDS,
+     "statsTable(select=None): statistics (mean, rms, min, max, nbad, flatness) and calibration "
+     "(tsys, el, tau, taus, h2omm) of selected spectra as a dict of columns" },
+    {"stats_table", (PyCFunction)ds_statsTable, METH_VARARGS | METH_KEYWORDS, "alias of statsTable" },
+    {"pipeline", (PyCFunction)ds_pipeline, METH_VARARGS | METH_KEYWORDS,
+     "pipeline(steps, select=None, reduce='average', weight='tsys'): take selected spectra "
+     "through steps ('baseline', 'smooth', 'resample', 'fold') in one pass, reduced to their average or a 2-D array" },
     {NULL}  /* Sentinel */
 };
 
-static PyTypeObject ClassicReaderType = {
-    PyObject_HEAD_INIT(NULL)
-    "classic.Reader",          /* tp_name */
-    sizeof(Reader),            /* tp_basicsize */
-    0,                         /* tp_itemsize */
-    (destructor)class_dealloc, /* tp_dealloc */
-    0,                         /* tp_print */
-    0,                         /* tp_getattr */
-    0,                         /* tp_setattr */
-    0,                         /* tp_reserved */
-    0,                         /* tp_repr */
-    0,                         /* tp_as_number */
-    0,                         /* tp_as_sequence */
-    0,                         /* tp_as_mapping */
-    0,                         /* tp_hash  */
-    0,                         /* tp_call */
-    0,                         /* tp_str */
-    0,                         /* tp_getattro */
-    0,                         /* tp_setattro */
-    0,                         /* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT,        /* tp_flags */
-    "CLASSIC file reader object", /* tp_doc */
-    0,                         /* tp_traverse */
-    0,                         /* tp_clear */
-    0,                         /* tp_richcompare */
-    0,                         /* tp_weaklistoffset */
-    0,                         /* tp_iter */
-    0,                         /* tp_iternext */
-    Reader_methods,            /* tp_methods */
-    Reader_members,            /* tp_members */
-    0,                         /* tp_getset */
-    0,                         /* tp_base */
-    0,                         /* tp_dict */
-    0,                         /* tp_descr_get */
-    0,                         /* tp_descr_set */
-    0,                         /* tp_dictoffset */
-    (initproc)Reader_init,     /* tp_init */
-    0,                         /* tp_alloc */
-    Reader_new,                /* tp_new */
+static PyType_Slot Dataset_slots[] = {
+    {Py_tp_dealloc, (void *)ds_dealloc},
+    {Py_tp_doc, (void *)"Dataset(files, threads=0): several CLASSIC files read as a whole"},
+    {Py_tp_methods, Dataset_methods},
+    {Py_tp_members, Dataset_members},
+    {Py_tp_init, (void *)Dataset_init},
+    {Py_tp_new, (void *)Dataset_new},
+    {0, NULL}
+};
+
+static PyType_Spec Dataset_spec = {
+    "classic.Dataset",
+    sizeof(Dataset),
+    0,
+    Py_TPFLAGS_DEFAULT,
+    Dataset_slots
 };
 
 static PyObject* py_iarray(PyObject* self)
@@ -297,32 +2961,226 @@ static PyObject* py_version(PyObject* self)
     return version;
 }
 
+static PyObject* py_trace(PyObject* self, PyObject *args)
+{
+    int on = 1;
+    if (!PyArg_ParseTuple(args, "|p:trace", &on)) return NULL;
+
+    traceEnable(on);
+    Py_RETURN_NONE;
+}
+
+static PyObject* py_traceFlush(PyObject* self, PyObject *args)
+{
+    const char *filename = NULL;
+    if (!PyArg_ParseTuple(args, "s:traceFlush", &filename)) return NULL;
+
+    int nevents = traceFlush(filename);
+    if (nevents < 0) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, filename);
+        return NULL;
+    }
+    traceClear();
+    return Py_BuildValue("i", nevents);
+}
+
+static PyObject* py_maxFiles(PyObject* self, PyObject *args)
+{
+    int limit = 0;
+    if (!PyArg_ParseTuple(args, "|i:maxFiles", &limit)) return NULL;
+
+    FilePool &pool = FilePool::instance();
+    if (limit > 0) pool.setLimit(limit);
+    return Py_BuildValue("(ii)", pool.getLimit(), pool.getOpen());
+}
+
+/* convert positions in degrees between equatorial and galactic coordinates, as arrays of the shape of a */
+static PyObject* convertPositions(PyObject *args, PyObject *kwds, bool toGalactic)
+{
+    PyObject *a = NULL, *b = NULL;
+    double epoch = 2000.0;
+    static const char *eqlist[] = {"ra", "dec", "epoch", NULL};
+    static const char *galist[] = {"l", "b", "epoch", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, toGalactic ? "OO|d:equatorialToGalactic" : "OO|d:galacticToEquatorial",
+                                     (char **)(toGalactic ? eqlist : galist), &a, &b, &epoch)) return NULL;
+
+    PyArrayObject *pa = (PyArrayObject *)PyArray_FROM_OTF(a, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY);
+    PyArrayObject *pb = (PyArrayObject *)PyArray_FROM_OTF(b, NPY_DOUBLE, NPY_ARRAY_IN_ARRAY);
+    PyObject *ra = NULL, *rb = NULL;
+    if (pa && pb) {
+        if (PyArray_SIZE(pa) != PyArray_SIZE(pb)) {
+            PyErr_SetString(PyExc_ValueError, "both coordinates must have the same size");
+        } else {
+            ra = PyArray_SimpleNew(PyArray_NDIM(pa), PyArray_DIMS(pa), NPY_DOUBLE);
+            rb = PyArray_SimpleNew(PyArray_NDIM(pa), PyArray_DIMS(pa), NPY_DOUBLE);
+        }
+    }
+    if (ra && rb) {
+        int n = PyArray_SIZE(pa);
+        const double *x = (const double *)PyArray_DATA(pa), *y = (const double *)PyArray_DATA(pb);
+        double *u = (double *)PyArray_DATA((PyArrayObject *)ra), *v = (double *)PyArray_DATA((PyArrayObject *)rb);
+        Py_BEGIN_ALLOW_THREADS
+        const double rad = M_PI/180.0;
+        for (int i = 0; i < n; i++) {
+            u[i] = x[i]*rad;
+            v[i] = y[i]*rad;
+        }
+        if (toGalactic) equatorialToGalactic(u, v, n, epoch, u, v);
+        else            galacticToEquatorial(u, v, n, epoch, u, v);
+        for (int i = 0; i < n; i++) {
+            u[i] /= rad;
+            v[i] /= rad;
+        }
+        Py_END_ALLOW_THREADS
+    }
+    Py_XDECREF(pa);
+    Py_XDECREF(pb);
+    if (ra == NULL || rb == NULL) {
+        Py_XDECREF(ra);
+        Py_XDECREF(rb);
+        return NULL;
+    }
+    return Py_BuildValue("(NN)", ra, rb);
+}
+
+static PyObject* py_equatorialToGalactic(PyObject* self, PyObject *args, PyObject *kwds)
+{
+    return convertPositions(args, kwds, true);
+}
+
+static PyObject* py_galacticToEquatorial(PyObject* self, PyObject *args, PyObject *kwds)
+{
+    return convertPositions(args, kwds, false);
+}
+
+static PyObject* py_compact(PyObject* self, PyObject *args, PyObject *kwds)
+{
+    static const char *kwlist[] = {"input", "output", "sort", "versions", NULL};
+    const char *input = NULL, *output = NULL, *versions = NULL;
+    int sort = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "ss|pz:compact", (char **)kwlist, &input, &output, &sort, &versions))
+        return NULL;
+
+    CompactOptions options;
+    options.sort = sort;
+    if (!parseVersions(versions, options.allVersions)) return NULL;
+    long int n;
+    Py_BEGIN_ALLOW_THREADS
+    n = compactFile(input, output, options);
+    Py_END_ALLOW_THREADS
+    if (n < 0) {
+        PyErr_Format(PyExc_IOError, "failed to compact '%s' into '%s'", input, output);
+        return NULL;
+    }
+    return Py_BuildValue("l", n);
+}
+
+static PyObject* py_archive(PyObject* self, PyObject *args, PyObject *kwds)
+{
+    static const char *kwlist[] = {"input", "output", "sort", "versions", "threads", NULL};
+    const char *input = NULL, *output = NULL, *versions = NULL;
+    int sort = 0, nthreads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "ss|pzi:archive", (char **)kwlist, &input, &output, &sort, &versions,
+                                     &nthreads))
+        return NULL;
+
+    CompactOptions options;
+    options.sort = sort;
+    if (!parseVersions(versions, options.allVersions)) return NULL;
+    long int n;
+    Py_BEGIN_ALLOW_THREADS
+    n = archiveFile(input, output, options, nthreads);
+    Py_END_ALLOW_THREADS
+    if (n < 0) {
+        PyErr_Format(PyExc_IOError, "failed to archive '%s' into '%s'", input, output);
+        return NULL;
+    }
+    return Py_BuildValue("l", n);
+}
+
 static PyMethodDef classicMethods[] = {
 //     {"intarray",  (PyCFunction)py_iarray,  METH_NOARGS,  "Build integer array from scratch."},
 //     {"logarray",  (PyCFunction)py_barray,  METH_NOARGS,  "Build boolean array from scratch."},
 //     {"dblarray",  (PyCFunction)py_darray,  METH_NOARGS,  "Build double array from scratch."},
 //     {"strarray",  (PyCFunction)py_sarray,  METH_NOARGS,  "Build string array from scratch."},
     {"version",   (PyCFunction)py_version, METH_NOARGS,  "Returns the version."},
+    {"trace",     (PyCFunction)py_trace,   METH_VARARGS, "Switch tracing of reader operations on or off."},
+    {"traceFlush", (PyCFunction)py_traceFlush, METH_VARARGS, "Write recorded trace events as Chrome trace JSON, returns number of events."},
+    {"maxFiles",  (PyCFunction)py_maxFiles, METH_VARARGS, "Set the maximum number of open file descriptors if given, returns (limit, open)."},
+    {"equatorialToGalactic", (PyCFunction)py_equatorialToGalactic, METH_VARARGS | METH_KEYWORDS,
+     "equatorialToGalactic(ra, dec, epoch=2000.0): galactic (l, b) of equatorial positions, all in degrees, B1950 if epoch < 1975."},
+    {"galacticToEquatorial", (PyCFunction)py_galacticToEquatorial, METH_VARARGS | METH_KEYWORDS,
+     "galacticToEquatorial(l, b, epoch=2000.0): equatorial (ra, dec) of galactic positions, all in degrees, B1950 if epoch < 1975."},
+    {"compact", (PyCFunction)py_compact, METH_VARARGS | METH_KEYWORDS,
+     "compact(input, output, sort=False, versions='latest'): rewrite a file as a compact file of type 2, returns number of spectra."},
+    {"archive", (PyCFunction)py_archive, METH_VARARGS | METH_KEYWORDS,
+     "archive(input, output, sort=False, versions='latest', threads=0): rewrite a file as a compressed archive, which "
+     "is read like any other file, returns number of spectra."},
     {NULL, NULL, 0, NULL}
 };
 
+static int classic_exec(PyObject *m)
+{
+    import_array1(-1);
+
+    ModuleState *state = (ModuleState *)PyModule_GetState(m);
+    state->ReaderType = (PyTypeObject *)PyType_FromModuleAndSpec(m, &Reader_spec, NULL);
+    if (state->ReaderType == NULL) return -1;
+    state->ReaderIterType = (PyTypeObject *)PyType_FromModuleAndSpec(m, &ReaderIter_spec, NULL);
+    if (state->ReaderIterType == NULL) return -1;
+
+    state->DatasetType = (PyTypeObject *)PyType_FromModuleAndSpec(m, &Dataset_spec, NULL);
+    if (state->DatasetType == NULL) return -1;
+
+    if (PyModule_AddType(m, state->ReaderType) < 0) return -1;
+    if (PyModule_AddType(m, state->DatasetType) < 0) return -1;
+    return 0;
+}
+
+static int classic_traverse(PyObject *m, visitproc visit, void *arg)
+{
+    ModuleState *state = (ModuleState *)PyModule_GetState(m);
+    Py_VISIT(state->ReaderType);
+    Py_VISIT(state->ReaderIterType);
+    Py_VISIT(state->DatasetType);
+    return 0;
+}
+
+static int classic_clear(PyObject *m)
+{
+    ModuleState *state = (ModuleState *)PyModule_GetState(m);
+    Py_CLEAR(state->ReaderType);
+    Py_CLEAR(state->ReaderIterType);
+    Py_CLEAR(state->DatasetType);
+    return 0;
+}
+
+static void classic_free(void *m)
+{
+    classic_clear((PyObject *)m);
+}
+
+static PyModuleDef_Slot classicSlots[] = {
+    {Py_mod_exec, (void *)classic_exec},
+#if PY_VERSION_HEX >= 0x030D0000
+    {Py_mod_gil, Py_MOD_GIL_NOT_USED},      // safe for free-threaded python
+#endif
+    {0, NULL}
+};
+
 static struct PyModuleDef classic = {
     PyModuleDef_HEAD_INIT,
     "classic",                                  // name of module
     "Interface to CLASSIC data container",      // doc string
-    -1,
-    classicMethods
+    sizeof(ModuleState),
+    classicMethods,
+    classicSlots,
+    classic_traverse,
+    classic_clear,
+    classic_free
 };
 
 PyMODINIT_FUNC PyInit_classic(void)
 {
-    import_array();
-    if (PyType_Ready(&ClassicReaderType) < 0) return NULL;
-
-    PyObject *m = PyModule_Create(&classic);
-    if (m == NULL) return NULL;
-
-    Py_INCREF(&ClassicReaderType);
-    PyModule_AddObject(m, "Reader", (PyObject *)&ClassicReaderType);
-    return m;
+    return PyModuleDef_Init(&classic);
 }
@@ -0,0 +1,31 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "archive.h"
+#include "writer.h"
+
+#include <unistd.h>
+
+int main(int argc, char *argv[])
+{
+    CompactOptions options;
+    bool archive = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "saz")) != -1) {
+        if (opt == 's') options.sort = true;
+        else if (opt == 'a') options.allVersions = true;
+        else if (opt == 'z') archive = true;
+        else break;
+    }
+    if (opt != -1 || argc - optind != 2) {
+        fprintf(stderr, "usage: %s [-s] [-a] [-z] <input> <output>\n", argv[0]);
+        fprintf(stderr, "  -s  sort by source, line and time\n");
+        fprintf(stderr, "  -a  keep all versions of every observation\n");
+        fprintf(stderr, "  -z  write a compressed archive\n");
+        exit(1);
+    }
+
+    long int n = archive ? archiveFile(argv[optind], argv[optind+1], options)
+                         : compactFile(argv[optind], argv[optind+1], options);
+    if (n < 0) exit(1);
+    printf("%ld spectra written to %s\n", n, argv[optind+1]);
+    exit(0);
+}
@@ -0,0 +1,343 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "coords.h"
+#include "parallel.h"
+#include "resample.h"
+#include "trace.h"
+
+#include <math.h>
+
+#define RAD (M_PI/180.0)      // radians per degree
+
+/* rotation from equatorial B1950 and J2000 to galactic coordinates */
+static const double B1950[3][3] = {
+    { -0.066988739415, -0.872755765852, -0.483538914632 },
+    {  0.492728466075, -0.450346958020,  0.744584633283 },
+    { -0.867600811151, -0.188374601723,  0.460199784784 }
+};
+static const double J2000[3][3] = {
+    { -0.0548755604162154, -0.8734370902348850, -0.4838350155487132 },
+    {  0.4941094278755837, -0.4448296299600112,  0.7469822444972189 },
+    { -0.8676661490190047, -0.1980763734312015,  0.4559837761750669 }
+};
+
+/* angles wrapped into [0, 2 pi) */
+static void wrap(double *__restrict__ a, int n)
+{
+    for (int i = 0; i < n; i++) a[i] -= 2.0*M_PI*floor(a[i]/(2.0*M_PI));
+}
+
+/*
+ * Native coordinates of the offsets (u, v) as the components of a unit
+ * vector towards the centre (c), east (e) and north (d) of it.
+ */
+static void native(Projection proj, const double *__restrict__ u, const double *__restrict__ v, int n,
+                   double *__restrict__ c, double *__restrict__ e, double *__restrict__ d)
+{
+    switch (proj) {
+    case PROJ_GNOMONIC:
+        for (int i = 0; i < n; i++) {
+            double s = 1.0/sqrt(1.0 + u[i]*u[i] + v[i]*v[i]);
+            c[i] = s;
+            e[i] = s*u[i];
+            d[i] = s*v[i];
+        }
+        break;
+    case PROJ_ORTHO:
+        for (int i = 0; i < n; i++) {
+            c[i] = sqrt(1.0 - u[i]*u[i] - v[i]*v[i]);
+            e[i] = u[i];
+            d[i] = v[i];
+        }
+        break;
+    case PROJ_AZIMUTHAL:
+        for (int i = 0; i < n; i++) {
+            double r = sqrt(u[i]*u[i] + v[i]*v[i]);
+            double s = (r > 0.0) ? sin(r)/r : 1.0;
+            c[i] = cos(r);
+            e[i] = s*u[i];
+            d[i] = s*v[i];
+        }
+        break;
+    case PROJ_STEREO:
+        for (int i = 0; i < n; i++) {
+            double q = 0.25*(u[i]*u[i] + v[i]*v[i]);
+            double s = 1.0/(1.0 + q);
+            c[i] = (1.0 - q)*s;
+            e[i] = s*u[i];
+            d[i] = s*v[i];
+        }
+        break;
+    case PROJ_LAMBERT:
+        for (int i = 0; i < n; i++) {
+            double q = u[i]*u[i] + v[i]*v[i];
+            double s = sqrt(1.0 - 0.25*q);
+            c[i] = 1.0 - 0.5*q;
+            e[i] = s*u[i];
+            d[i] = s*v[i];
+        }
+        break;
+    case PROJ_AITOFF:
+        for (int i = 0; i < n; i++) {
+            double z = sqrt(1.0 - 0.0625*u[i]*u[i] - 0.25*v[i]*v[i]);
+            double lon = 2.0*atan2(0.5*z*u[i], 2.0*z*z - 1.0);
+            double lat = asin(z*v[i]);
+            c[i] = cos(lat)*cos(lon);
+            e[i] = cos(lat)*sin(lon);
+            d[i] = sin(lat);
+        }
+        break;
+    case PROJ_MOLLWEIDE:
+        for (int i = 0; i < n; i++) {
+            double t = asin(v[i]/M_SQRT2);
+            double lat = asin((2.0*t + sin(2.0*t))/M_PI);
+            double lon = M_PI*u[i]/(2.0*M_SQRT2*cos(t));
+            c[i] = (fabs(lon) <= M_PI) ? cos(lat)*cos(lon) : NAN;
+            e[i] = cos(lat)*sin(lon);
+            d[i] = sin(lat);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Every step is a separate pass over arrays of the batch, so that the
+ * arithmetic between the calls of the math library vectorizes.
+ */
+void deproject(Projection proj, const double *lam0, const double *bet0, const double *angle,
+               const double *x, const double *y, int n, double *lam, double *bet)
+{
+    if (n <= 0) return;
+    std::vector<double> work(5*(size_t)n);
+    double *u = work.data(), *v = u + n, *c = v + n, *e = c + n, *d = e + n;
+    for (int i = 0; i < n; i++) {
+        double ca = cos(angle[i]), sa = sin(angle[i]);
+        u[i] = x[i]*ca - y[i]*sa;
+        v[i] = x[i]*sa + y[i]*ca;
+    }
+
+    switch (proj) {
+    case PROJ_NONE:
+    case PROJ_CARTESIAN:
+        for (int i = 0; i < n; i++) {
+            lam[i] = lam0[i] + u[i];
+            bet[i] = bet0[i] + v[i];
+        }
+        break;
+    case PROJ_RADIO:
+        for (int i = 0; i < n; i++) {
+            lam[i] = lam0[i] + u[i]/cos(bet0[i]);
+            bet[i] = bet0[i] + v[i];
+        }
+        break;
+    case PROJ_SFL:
+        for (int i = 0; i < n; i++) {
+            bet[i] = bet0[i] + v[i];
+            lam[i] = lam0[i] + u[i]/cos(bet[i]);
+        }
+        break;
+    case PROJ_NCP:
+        for (int i = 0; i < n; i++) {
+            double a = cos(bet0[i]) - v[i]*sin(bet0[i]);
+            double cd = sqrt(u[i]*u[i] + a*a);
+            lam[i] = lam0[i] + atan2(u[i], a);
+            bet[i] = copysign(acos(cd < 1.0 ? cd : 1.0), bet0[i]);
+        }
+        break;
+    case PROJ_GNOMONIC:
+    case PROJ_ORTHO:
+    case PROJ_AZIMUTHAL:
+    case PROJ_STEREO:
+    case PROJ_LAMBERT:
+    case PROJ_AITOFF:
+    case PROJ_MOLLWEIDE:
+        native(proj, u, v, n, c, e, d);
+        for (int i = 0; i < n; i++) {
+            double cb = cos(bet0[i]), sb = sin(bet0[i]);
+            double z = c[i]*sb + d[i]*cb;
+            bet[i] = asin(z < 1.0 ? (z > -1.0 ? z : -1.0) : 1.0);
+            lam[i] = lam0[i] + atan2(e[i], c[i]*cb - d[i]*sb);
+        }
+        break;
+    default:
+        for (int i = 0; i < n; i++) lam[i] = bet[i] = NAN;
+        break;
+    }
+    wrap(lam, n);
+}
+
+/* rotate n positions (radians) by the matrix m, or by its transpose */
+static void rotate(const double m[3][3], bool transpose, const double *a, const double *b, int n,
+                   double *ra, double *rb)
+{
+    double r[3][3];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) r[i][j] = transpose ? m[j][i] : m[i][j];
+    }
+    std::vector<double> work(3*(size_t)n);
+    double *px = work.data(), *py = px + n, *pz = py + n;
+    for (int i = 0; i < n; i++) {
+        double cb = cos(b[i]);
+        px[i] = cb*cos(a[i]);
+        py[i] = cb*sin(a[i]);
+        pz[i] = sin(b[i]);
+    }
+    for (int i = 0; i < n; i++) {
+        double x = r[0][0]*px[i] + r[0][1]*py[i] + r[0][2]*pz[i];
+        double y = r[1][0]*px[i] + r[1][1]*py[i] + r[1][2]*pz[i];
+        double z = r[2][0]*px[i] + r[2][1]*py[i] + r[2][2]*pz[i];
+        px[i] = x;
+        py[i] = y;
+        pz[i] = (z < 1.0) ? (z > -1.0 ? z : -1.0) : 1.0;
+    }
+    for (int i = 0; i < n; i++) {
+        ra[i] = atan2(py[i], px[i]);
+        rb[i] = asin(pz[i]);
+    }
+    wrap(ra, n);
+}
+
+void equatorialToGalactic(const double *ra, const double *dec, int n, double epoch, double *l, double *b)
+{
+    rotate(epoch < 1975.0 ? B1950 : J2000, false, ra, dec, n, l, b);
+}
+
+void galacticToEquatorial(const double *l, const double *b, int n, double epoch, double *ra, double *dec)
+{
+    rotate(epoch < 1975.0 ? B1950 : J2000, true, l, b, n, ra, dec);
+}
+
+void PositionTable::resize(int n)
+{
+    system.assign(n, 0);
+    proj.assign(n, 0);
+    std::vector<double> *columns[] = { &epoch, &lam, &bet, &ra, &dec, &glon, &glat };
+    for (size_t c = 0; c < sizeof(columns)/sizeof(columns[0]); c++) columns[c]->assign(n, NAN);
+}
+
+/*
+ * Call fn(rows, a, b, n) with the rows selected by keep gathered into
+ * contiguous columns of the inputs a and b, and scatter the n results
+ * written to a and b back into the outputs.
+ */
+template <class Keep, class Function>
+static void batch(int nrows, Keep keep, const std::vector<const std::vector<double> *> &in,
+                  const std::vector<std::vector<double> *> &out, Function fn)
+{
+    std::vector<int> rows;
+    for (int i = 0; i < nrows; i++) {
+        if (keep(i)) rows.push_back(i);
+    }
+    int n = rows.size();
+    if (n == 0) return;
+    std::vector<std::vector<double> > a(in.size(), std::vector<double>(n)), b(out.size(), std::vector<double>(n));
+    for (size_t c = 0; c < in.size(); c++) {
+        for (int j = 0; j < n; j++) a[c][j] = (*in[c])[rows[j]];
+    }
+    fn(a, b, n);
+    for (size_t c = 0; c < out.size(); c++) {
+        for (int j = 0; j < n; j++) (*out[c])[rows[j]] = b[c][j];
+    }
+}
+
+void positionTable(const std::vector<ScanRef> &refs, PositionTable &table, int nthreads)
+{
+    TraceScope trace("positions", refs.size(), "count");
+    int n = refs.size();
+    table.resize(n);
+    std::vector<double> lam0(n), bet0(n), angle(n), x(n), y(n);
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int) {
+        const ClassDescriptor *desc = reader->getDescriptor(scan, false);
+        if (desc == 0) return;
+        table.system[pos] = desc->system;
+        table.proj[pos] = desc->proj;
+        table.epoch[pos] = desc->epoch;
+        lam0[pos] = desc->lam;
+        bet0[pos] = desc->bet;
+        angle[pos] = desc->projang;
+        x[pos] = desc->lamof;
+        y[pos] = desc->betof;
+    });
+
+    /* positions in the system of the spectra, one batch per projection */
+    std::vector<double> lam(n, NAN), bet(n, NAN);
+    for (int p = PROJ_NONE; p <= PROJ_CARTESIAN; p++) {
+        batch(n, [&](int i) { return table.system[i] != 0 && table.proj[i] == p; },
+              { &lam0, &bet0, &angle, &x, &y }, { &lam, &bet },
+              [&](std::vector<std::vector<double> > &a, std::vector<std::vector<double> > &b, int m) {
+            deproject((Projection)p, a[0].data(), a[1].data(), a[2].data(), a[3].data(), a[4].data(), m,
+                      b[0].data(), b[1].data());
+        });
+    }
+
+    /* the other systems, in batches of equatorial spectra of either epoch and of galactic spectra */
+    auto equatorial = [&](int i) { return table.system[i] == SYSTEM_EQUATORIAL || table.system[i] == SYSTEM_ICRS; };
+    auto epoch = [&](int i) { return table.system[i] == SYSTEM_ICRS ? 2000.0 : table.epoch[i]; };
+    for (int b1950 = 0; b1950 < 2; b1950++) {
+        batch(n, [&](int i) { return equatorial(i) && (epoch(i) < 1975.0) == (b1950 != 0); },
+              { &lam, &bet }, { &table.glon, &table.glat },
+              [&](std::vector<std::vector<double> > &a, std::vector<std::vector<double> > &b, int m) {
+            equatorialToGalactic(a[0].data(), a[1].data(), m, b1950 ? 1950.0 : 2000.0, b[0].data(), b[1].data());
+        });
+    }
+    batch(n, [&](int i) { return table.system[i] == SYSTEM_GALACTIC; },
+          { &lam, &bet }, { &table.ra, &table.dec },
+          [&](std::vector<std::vector<double> > &a, std::vector<std::vector<double> > &b, int m) {
+        galacticToEquatorial(a[0].data(), a[1].data(), m, 2000.0, b[0].data(), b[1].data());
+    });
+
+    for (int i = 0; i < n; i++) {
+        table.lam[i] = lam[i]/RAD;
+        table.bet[i] = bet[i]/RAD;
+        if (equatorial(i)) {
+            table.ra[i] = lam[i];
+            table.dec[i] = bet[i];
+        } else if (table.system[i] == SYSTEM_GALACTIC) {
+            table.glon[i] = lam[i];
+            table.glat[i] = bet[i];
+            table.epoch[i] = 2000.0;
+        }
+        table.ra[i] /= RAD;
+        table.dec[i] /= RAD;
+        table.glon[i] /= RAD;
+        table.glat[i] /= RAD;
+    }
+}
+
+/* the values of n channels of an axis, (k - ref)*df + f0 for channel k = 1..n */
+__attribute__((noinline))
+static void fillAxis(double *__restrict__ dst, int n, double f0, double ref, double df)
+{
+    for (int k = 0; k < n; k++) dst[k] = ((double)(k+1) - ref)*df + f0;
+}
+
+int axisBlock(const std::vector<ScanRef> &refs, AxisKind kind, std::vector<double> &block, int nthreads)
+{
+    TraceScope trace("axes", refs.size(), "count");
+    int n = refs.size();
+    std::vector<SpectralAxis> axes(n);
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int) {
+        const ClassDescriptor *desc = reader->getDescriptor(scan, false);
+        if (desc == 0) return;
+        bool line = reader->getIndex()[scan-1].xkind == 0;
+        SpectralAxis &axis = axes[pos];
+        if (kind == AXIS_IMAGE) axis = SpectralAxis(desc->ndata, desc->image, desc->rchan, -desc->fres);
+        else                    axis = spectrumAxis(reader, desc, kind == AXIS_VELOCITY && line);
+        /* as the frequency vectors of ClassReader, channel numbers without a channel width */
+        if (axis.df == 0.0) axis = SpectralAxis(axis.nchan, 0.0, 0.0, 1.0);
+        if (kind == AXIS_IMAGE && !line) axis.f0 = NAN;
+    });
+
+    int width = 0;
+    for (int i = 0; i < n; i++) {
+        if (axes[i].nchan > width) width = axes[i].nchan;
+    }
+    block.assign((size_t)n*width, NAN);
+    if (width == 0) return width;
+    parallelFor(n, nthreads, [&](int i, int) {
+        const SpectralAxis &a = axes[i];
+        fillAxis(&block[(size_t)i*width], a.nchan, a.f0, a.ref, a.df);
+    });
+    return width;
+}
@@ -0,0 +1,102 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSCOORDS_H
+#define CLASSCOORDS_H
+
+#include <vector>
+
+#include "class.h"
+#include "dataset.h"
+
+/**
+ * @file coords.h
+ */
+
+/**
+ * Compute the absolute positions of n offsets from their centres, all of
+ * the same projection. The offsets are first rotated counterclockwise by
+ * the projection angle. All angles are in radians, longitudes are returned
+ * in [0, 2 pi). Offsets outside the projection give NaN.
+ *
+ * @param proj the projection
+ * @param lam0 longitudes of the centres
+ * @param bet0 latitudes of the centres
+ * @param angle projection angles
+ * @param x first offsets
+ * @param y second offsets
+ * @param n number of positions
+ * @param lam resulting longitudes
+ * @param bet resulting latitudes
+ */
+void deproject(Projection proj, const double *lam0, const double *bet0, const double *angle,
+               const double *x, const double *y, int n, double *lam, double *bet);
+
+/**
+ * Convert n equatorial positions (radians) of the given epoch, B1950 if
+ * epoch < 1975 and J2000 otherwise, to galactic coordinates.
+ */
+void equatorialToGalactic(const double *ra, const double *dec, int n, double epoch, double *l, double *b);
+
+/**
+ * Convert n galactic positions (radians) to equatorial coordinates of the
+ * given epoch, B1950 if epoch < 1975 and J2000 otherwise.
+ */
+void galacticToEquatorial(const double *l, const double *b, int n, double epoch, double *ra, double *dec);
+
+/**
+ * @brief Positions of many spectra, one column per quantity, all angles in
+ * degrees.
+ *
+ * Equatorial positions are of the epoch of the spectrum for equatorial
+ * spectra, and J2000 for galactic ones. Columns that do not apply, such as
+ * galactic coordinates of horizontal positions, are NaN, and so is
+ * everything for spectra that could not be read.
+ */
+struct PositionTable {
+    void resize(int n);   ///< resize all columns to n rows of NaN
+
+    std::vector<int> system;      ///< CoordSystem, 0 if the spectrum could not be read
+    std::vector<int> proj;        ///< Projection
+    std::vector<double> epoch;    ///< epoch of equatorial coordinates
+    std::vector<double> lam;      ///< longitude in the system of the spectrum
+    std::vector<double> bet;      ///< latitude in the system of the spectrum
+    std::vector<double> ra;       ///< right ascension
+    std::vector<double> dec;      ///< declination
+    std::vector<double> glon;     ///< galactic longitude
+    std::vector<double> glat;     ///< galactic latitude
+};
+
+/**
+ * Compute the positions of the referenced spectra from section -3, reading
+ * the headers in parallel and transforming the positions in batches of the
+ * same projection and system.
+ *
+ * @param refs the spectra
+ * @param table the table, of refs.size() rows
+ * @param nthreads number of threads, <= 0 for the default
+ */
+void positionTable(const std::vector<ScanRef> &refs, PositionTable &table, int nthreads = 0);
+
+/**
+ * @brief Kinds of spectral axes.
+ */
+enum AxisKind {
+    AXIS_FREQUENCY,       ///< signal frequency in MHz, or time for continuum drifts
+    AXIS_VELOCITY,        ///< velocity in km/s, or time for continuum drifts
+    AXIS_IMAGE            ///< image frequency in MHz, NaN for continuum drifts
+};
+
+/**
+ * Compute the axes of the referenced spectra into a row-major block, padded
+ * with NaN to the largest number of channels. Only the headers are read,
+ * in parallel.
+ *
+ * @param refs the spectra
+ * @param kind the kind of axis
+ * @param block the block, of refs.size() rows
+ * @param nthreads number of threads, <= 0 for the default
+ * @return the width of the block
+ */
+int axisBlock(const std::vector<ScanRef> &refs, AxisKind kind, std::vector<double> &block, int nthreads = 0);
+
+#endif
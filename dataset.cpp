@@ -0,0 +1,255 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "dataset.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <glob.h>
+
+std::vector<ScanRef> scanRefs(ClassReader *reader, const std::vector<int> &scans)
+{
+    std::vector<ScanRef> refs(scans.size());
+    for (size_t i = 0; i < scans.size(); i++) {
+        refs[i].reader = reader;
+        refs[i].scan = scans[i];
+    }
+    return refs;
+}
+
+ClassDataset::ClassDataset(int nthreads) : m_nthreads(nthreads), m_allVersions(false)
+{
+}
+
+ClassDataset::~ClassDataset()
+{
+    for (size_t i = 0; i < m_readers.size(); i++) delete m_readers[i];
+}
+
+int ClassDataset::addFile(const char *filename)
+{
+    ClassReader *reader = openClassFile(filename);
+    if (reader == 0) return -1;
+
+    m_names.push_back(filename);
+    m_readers.push_back(reader);
+    return m_readers.size()-1;
+}
+
+int ClassDataset::addGlob(const char *pattern)
+{
+    glob_t matches;
+    int status = glob(pattern, 0, NULL, &matches);
+    if (status == GLOB_NOMATCH) {
+        fprintf(stderr, "no files matching '%s'\n", pattern);
+        return 0;
+    }
+    if (status != 0) {
+        fprintf(stderr, "failed to expand '%s'\n", pattern);
+        return 0;
+    }
+
+    /* glob() returns the names sorted */
+    int nfiles = 0;
+    for (size_t i = 0; i < matches.gl_pathc; i++) {
+        if (addFile(matches.gl_pathv[i]) >= 0) nfiles++;
+    }
+    globfree(&matches);
+    return nfiles;
+}
+
+int ClassDataset::getDirectory()
+{
+    TraceScope trace("datasetDirectory");
+    int nfiles = m_readers.size();
+    std::vector<int> counts(nfiles, 0);
+
+    parallelFor(nfiles, m_nthreads, [&](int file, int) {
+        m_readers[file]->setAllVersions(m_allVersions);
+        counts[file] = m_readers[file]->getDirectory();
+    });
+
+    m_first.resize(nfiles);
+    m_index.clear();
+    for (int file = 0; file < nfiles; file++) {
+        m_first[file] = m_index.size();
+        DatasetEntry entry;
+        entry.file = file;
+        for (int scan = 1; scan <= counts[file]; scan++) {
+            entry.scan = scan;
+            m_index.push_back(entry);
+        }
+    }
+    return m_index.size();
+}
+
+int ClassDataset::getFileCount() const
+{
+    return m_readers.size();
+}
+
+const char *ClassDataset::getFileName(int file) const
+{
+    if (file < 0 || file >= (int)m_names.size()) return 0;
+    return m_names[file].c_str();
+}
+
+ClassReader *ClassDataset::getReader(int file)
+{
+    if (file < 0 || file >= (int)m_readers.size()) return 0;
+    return m_readers[file];
+}
+
+void ClassDataset::setAllVersions(bool all)
+{
+    m_allVersions = all;
+}
+
+int ClassDataset::getThreads() const
+{
+    return m_nthreads;
+}
+
+int ClassDataset::getCount() const
+{
+    return m_index.size();
+}
+
+bool ClassDataset::locate(int scan, DatasetEntry &entry) const
+{
+    if (scan < 1 || scan > (int)m_index.size()) {
+        fprintf(stderr, "spectrum number %d out of range\n", scan);
+        return false;
+    }
+    entry = m_index[scan-1];
+    return true;
+}
+
+int ClassDataset::globalScan(int file, int scan) const
+{
+    if (file < 0 || file >= (int)m_first.size()) return 0;
+    int last = (file+1 < (int)m_first.size()) ? m_first[file+1] : m_index.size();
+    if (scan < 1 || m_first[file] + scan > last) return 0;
+    return m_first[file] + scan;
+}
+
+/* positions in scans, grouped by the file they belong to; invalid numbers are left out */
+std::vector<std::vector<int> > ClassDataset::groupByFile(const std::vector<int> &scans)
+{
+    std::vector<std::vector<int> > groups(m_readers.size());
+    for (size_t i = 0; i < scans.size(); i++) {
+        DatasetEntry entry;
+        if (locate(scans[i], entry)) groups[entry.file].push_back(i);
+    }
+    return groups;
+}
+
+std::vector<int> ClassDataset::find(const ClassSelection &sel)
+{
+    int nfiles = m_first.size();
+    std::vector<std::vector<int> > found(nfiles);
+
+    parallelFor(nfiles, m_nthreads, [&](int file, int) {
+        found[file] = m_readers[file]->find(sel);
+    });
+
+    std::vector<int> scans;
+    for (int file = 0; file < nfiles; file++) {
+        for (size_t i = 0; i < found[file].size(); i++) scans.push_back(m_first[file] + found[file][i]);
+    }
+    return scans;
+}
+
+SpectrumHeader ClassDataset::getHead(int scan)
+{
+    DatasetEntry entry;
+    SpectrumHeader head;
+
+    if (!locate(scan, entry)) return head;
+    head = m_readers[entry.file]->getHead(entry.scan);
+    head.id = scan;
+    return head;
+}
+
+SpectralAxis ClassDataset::getAxis(int scan)
+{
+    DatasetEntry entry;
+    if (!locate(scan, entry)) return SpectralAxis();
+    return m_readers[entry.file]->getAxis(entry.scan);
+}
+
+std::vector<double> ClassDataset::getFreq(int scan)
+{
+    DatasetEntry entry;
+    if (!locate(scan, entry)) return std::vector<double>();
+    return m_readers[entry.file]->getFreq(entry.scan);
+}
+
+std::vector<double> ClassDataset::getData(int scan)
+{
+    DatasetEntry entry;
+    if (!locate(scan, entry)) return std::vector<double>();
+    return m_readers[entry.file]->getData(entry.scan);
+}
+
+std::vector<SpectrumHeader> ClassDataset::getHeaders(const std::vector<int> &scans)
+{
+    std::vector<SpectrumHeader> heads(scans.size());
+    std::vector<std::vector<int> > groups = groupByFile(scans);
+
+    parallelFor(groups.size(), m_nthreads, [&](int file, int) {
+        ClassReader *reader = m_readers[file];
+        for (size_t i = 0; i < groups[file].size(); i++) {
+            int pos = groups[file][i];
+            heads[pos] = reader->getHead(m_index[scans[pos]-1].scan);
+            heads[pos].id = scans[pos];
+        }
+    });
+    return heads;
+}
+
+int ClassDataset::getDataBlock(const std::vector<int> &scans, std::vector<double> &block,
+                              const Smoothing &smoothing)
+{
+    std::vector<std::vector<int> > groups = groupByFile(scans);
+    int nfiles = groups.size();
+
+    std::vector<int> widths(nfiles, 0);
+    parallelFor(nfiles, m_nthreads, [&](int file, int) {
+        ClassReader *reader = m_readers[file];
+        for (size_t i = 0; i < groups[file].size(); i++) {
+            int nchan = smoothing.channels(reader->getChannels(m_index[scans[groups[file][i]]-1].scan));
+            if (nchan > widths[file]) widths[file] = nchan;
+        }
+    });
+    int width = 0;
+    for (int file = 0; file < nfiles; file++) {
+        if (widths[file] > width) width = widths[file];
+    }
+
+    /* rows of invalid numbers are not visited below, and stay NaN */
+    block.assign(scans.size()*width, NAN);
+    if (width == 0) return width;
+
+    parallelFor(nfiles, m_nthreads, [&](int file, int) {
+        ClassReader *reader = m_readers[file];
+        for (size_t i = 0; i < groups[file].size(); i++) {
+            int pos = groups[file][i];
+            reader->getData(m_index[scans[pos]-1].scan, &block[(size_t)pos*width], width, smoothing);
+        }
+    });
+    return width;
+}
+
+std::vector<ScanRef> ClassDataset::scanRefs(const std::vector<int> &scans)
+{
+    std::vector<ScanRef> refs;
+    refs.reserve(scans.size());
+    for (size_t i = 0; i < scans.size(); i++) {
+        DatasetEntry entry;
+        if (!locate(scans[i], entry)) continue;
+        ScanRef ref;
+        ref.reader = m_readers[entry.file];
+        ref.scan = entry.scan;
+        refs.push_back(ref);
+    }
+    return refs;
+}
@@ -0,0 +1,188 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSDATASET_H
+#define CLASSDATASET_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "class.h"
+#include "parallel.h"
+
+/**
+ * @file dataset.h
+ */
+
+/**
+ * @brief Location of a spectrum of a dataset.
+ */
+struct DatasetEntry {
+    int file;             ///< file id, 0..nfiles-1
+    int scan;             ///< number of the spectrum in its file, 1..nscans
+};
+
+/**
+ * @brief A spectrum of some reader, as processed by forEachScan().
+ */
+struct ScanRef {
+    ClassReader *reader;  ///< the reader of the file
+    int scan;             ///< number of the spectrum in the file, 1..nscans
+};
+
+/**
+ * Return references to the given spectra of a single reader.
+ */
+std::vector<ScanRef> scanRefs(ClassReader *reader, const std::vector<int> &scans);
+
+/**
+ * Call fn(reader, scan, pos, worker) for every refs[pos], using up to
+ * nthreads threads.
+ *
+ * The spectra are handed out in runs of consecutive positions, and every
+ * worker reads through its own clone of each reader it meets, so that the
+ * same file may be read by several threads. The reader passed to fn is only
+ * used by the calling worker until it returns, and the worker index may
+ * address per-thread workspaces.
+ */
+template <class Function>
+void forEachScan(const std::vector<ScanRef> &refs, int nthreads, Function fn)
+{
+    int n = refs.size();
+    if (nthreads <= 0) nthreads = defaultThreads();
+    if (nthreads > n) nthreads = n;
+    if (nthreads <= 1) {
+        for (int i = 0; i < n; i++) fn(refs[i].reader, refs[i].scan, i, 0);
+        return;
+    }
+
+    /* directories are read before the readers are shared */
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || refs[i].reader != refs[i-1].reader) refs[i].reader->getIndex();
+    }
+
+    int run = (n + 4*nthreads - 1)/(4*nthreads);
+    int nruns = (n + run - 1)/run;
+    std::vector<std::map<ClassReader *, ClassReader *> > clones(nthreads);
+    parallelFor(nruns, nthreads, [&](int irun, int worker) {
+        std::map<ClassReader *, ClassReader *> &own = clones[worker];
+        int last = (irun+1)*run < n ? (irun+1)*run : n;
+        for (int i = irun*run; i < last; i++) {
+            ClassReader *&reader = own[refs[i].reader];
+            if (reader == 0) reader = refs[i].reader->clone();
+            fn(reader, refs[i].scan, i, worker);
+        }
+    });
+
+    for (int w = 0; w < nthreads; w++) {
+        std::map<ClassReader *, ClassReader *>::iterator it;
+        for (it = clones[w].begin(); it != clones[w].end(); ++it) delete it->second;
+    }
+}
+
+/**
+ * @brief A collection of CLASSIC files read as a whole.
+ *
+ * The directories of all files are read in parallel, after which the spectra
+ * are addressed by a single global number 1..count, in the order of the files
+ * and of the spectra within each file. Queries spanning several files are
+ * split by file, and files are processed in parallel, each by one thread at
+ * a time.
+ *
+ * A dataset is not meant to be used by several threads at the same time.
+ */
+class ClassDataset {
+ public:
+    /**
+     * @param nthreads number of threads to use, <= 0 for the default
+     */
+    ClassDataset(int nthreads = 0);
+    ~ClassDataset();
+
+    /**
+     * Add a file to the dataset.
+     *
+     * @param filename name of the file
+     * @return the file id, or -1 if the file could not be opened
+     */
+    int addFile(const char *filename);
+    /**
+     * Add all files matching a shell pattern, in sorted order.
+     *
+     * @param pattern the pattern, e.g. "2016-06-*.apex"
+     * @return the number of files added
+     */
+    int addGlob(const char *pattern);
+    /**
+     * Read the directories of all files, and return the total number of spectra.
+     */
+    int getDirectory();
+    /**
+     * Keep all versions of every observation, or only the latest one (the
+     * default), see ClassReader::setAllVersions().
+     */
+    void setAllVersions(bool all);
+
+    int getFileCount() const;                   ///< number of files
+    const char *getFileName(int file) const;    ///< name of file with given id
+    ClassReader *getReader(int file);           ///< reader of file with given id
+    int getCount() const;                       ///< number of spectra, after getDirectory()
+
+    /**
+     * Locate a spectrum of the dataset.
+     *
+     * @param scan global number of spectrum (1..count)
+     * @param entry file id and number of the spectrum in that file
+     * @return false if the number is out of range
+     */
+    bool locate(int scan, DatasetEntry &entry) const;
+    /**
+     * Return the global number of a spectrum in a given file.
+     *
+     * @return the global number, or 0 if out of range
+     */
+    int globalScan(int file, int scan) const;
+
+    /**
+     * Return the global numbers of all spectra matching the selection.
+     */
+    std::vector<int> find(const ClassSelection &sel);
+    /**
+     * Return header, frequency axis or vector, or data vector for a given
+     * global number, where the id of the header is the global number.
+     */
+    SpectrumHeader getHead(int scan);
+    SpectralAxis getAxis(int scan);
+    std::vector<double> getFreq(int scan);
+    std::vector<double> getData(int scan);
+    /**
+     * Return the headers of the given global numbers.
+     */
+    std::vector<SpectrumHeader> getHeaders(const std::vector<int> &scans);
+    /**
+     * Read the data of the given global numbers into one row-major block,
+     * see ClassReader::getDataBlock().
+     *
+     * @return the width of the block
+     */
+    int getDataBlock(const std::vector<int> &scans, std::vector<double> &block,
+                     const Smoothing &smoothing = Smoothing());
+    /**
+     * Return references to the given global numbers, for forEachScan().
+     * Numbers out of range are left out.
+     */
+    std::vector<ScanRef> scanRefs(const std::vector<int> &scans);
+    int getThreads() const;                     ///< number of threads to use, <= 0 for the default
+
+ private:
+    std::vector<std::vector<int> > groupByFile(const std::vector<int> &scans);
+
+    int m_nthreads;
+    bool m_allVersions;
+    std::vector<std::string> m_names;
+    std::vector<ClassReader *> m_readers;
+    std::vector<int> m_first;             // global number of the first spectrum of each file, minus one
+    std::vector<DatasetEntry> m_index;
+};
+
+#endif
@@ -0,0 +1,522 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "export.h"
+#include "coords.h"
+#include "parallel.h"
+#include "resample.h"
+#include "times.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <math.h>
+#include <string>
+#include <sys/stat.h>
+#include <time.h>
+#include <thread>
+#include <tuple>
+#include <unistd.h>
+
+#define CHUNKBYTES (32 << 20)   // bytes of data decoded at a time
+#define FITSBLOCK  2880         // bytes of a FITS block
+#define CARDLEN    80           // bytes of a FITS header card
+
+/* one header column, stored as the bytes of its numpy type */
+struct Column {
+    Column(const char *name, const char *descr, int size) : name(name), descr(descr), size(size) {}
+
+    template <class T> void set(size_t i, T value) { memcpy(&values[i*size], &value, sizeof(T)); }
+    void set(size_t i, const char *s) { strncpy(&values[i*size], s, size); }
+
+    const char *name;
+    const char *descr;
+    int size;
+    std::vector<char> values;
+};
+
+static bool writeAll(int fd, long offset, const void *src, size_t len)
+{
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(fd, (const char *)src + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "failed to write %ld bytes: %s\n", (long)len, strerror(errno));
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+/* the header of a .npy file (version 1.0), padded to 64 bytes, for a matrix if cols >= 0 */
+static std::string npyHeader(const char *descr, long rows, long cols)
+{
+    char dict[256];
+    if (cols < 0) snprintf(dict, sizeof(dict), "{'descr': '%s', 'fortran_order': False, 'shape': (%ld,), }", descr, rows);
+    else snprintf(dict, sizeof(dict), "{'descr': '%s', 'fortran_order': False, 'shape': (%ld, %ld), }", descr, rows, cols);
+    std::string head = dict;
+    head.append(63 - (10 + head.size()) % 64, ' ');
+    head += '\n';
+    unsigned short len = head.size();
+    std::string magic("\x93NUMPY\x01\x00", 8);
+    magic += (char)(len & 0xff);
+    magic += (char)(len >> 8);
+    return magic + head;
+}
+
+static int createFile(const std::string &path)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) fprintf(stderr, "failed to create '%s': %s\n", path.c_str(), strerror(errno));
+    return fd;
+}
+
+static bool makeDirectory(const std::string &path)
+{
+    if (mkdir(path.c_str(), 0755) == 0 || errno == EEXIST) return true;
+    fprintf(stderr, "failed to create directory '%s': %s\n", path.c_str(), strerror(errno));
+    return false;
+}
+
+/* a 1-D file of the given rows of a column */
+static bool writeColumn(const std::string &dir, const Column &column, const std::vector<int> &rows)
+{
+    int fd = createFile(dir + "/" + column.name + ".npy");
+    if (fd < 0) return false;
+    std::string head = npyHeader(column.descr, rows.size(), -1);
+    std::vector<char> values(rows.size()*column.size);
+    for (size_t i = 0; i < rows.size(); i++) {
+        memcpy(&values[i*column.size], &column.values[(size_t)rows[i]*column.size], column.size);
+    }
+    bool ok = writeAll(fd, 0, head.data(), head.size()) && writeAll(fd, head.size(), values.data(), values.size());
+    if (close(fd) != 0) ok = false;
+    return ok;
+}
+
+/*
+ * One row of rowbytes bytes for each of refs, written from offset on.
+ * Chunks of rows are encoded in parallel by fill(reader, scan, row, dst)
+ * into one of two buffers, while the other one is written by a thread of
+ * its own. Chunks hold a whole number of align bytes where this keeps them
+ * of reasonable size, so that all but the last start on a block boundary.
+ */
+template <class Fill>
+static bool writeRows(int fd, long offset, const std::vector<ScanRef> &refs, size_t rowbytes, size_t align,
+                      int nthreads, Fill fill)
+{
+    if (rowbytes == 0 || refs.empty()) return true;
+    size_t chunk = CHUNKBYTES/rowbytes;
+    size_t a = rowbytes, b = align;
+    while (b != 0) {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    size_t step = align/a;
+    if (step*rowbytes > 4*(size_t)CHUNKBYTES) step = 1;
+    chunk = (chunk > step) ? chunk/step*step : step;
+
+    std::vector<char> buffers[2];
+    std::thread writer;
+    bool ok = true, written = true;
+    for (size_t r0 = 0, k = 0; ok && r0 < refs.size(); r0 += chunk, k++) {
+        size_t r1 = (r0 + chunk < refs.size()) ? r0 + chunk : refs.size();
+        std::vector<char> &buffer = buffers[k % 2];
+        buffer.resize((r1 - r0)*rowbytes);
+        std::vector<ScanRef> sub(refs.begin() + r0, refs.begin() + r1);
+        forEachScan(sub, nthreads, [&](ClassReader *reader, int scan, int pos, int) {
+            fill(reader, scan, r0 + pos, &buffer[(size_t)pos*rowbytes]);
+        });
+
+        if (writer.joinable()) writer.join();
+        ok = written;
+        long where = offset + r0*rowbytes;
+        writer = std::thread([&written, fd, where, &buffer]() {
+            written = writeAll(fd, where, buffer.data(), buffer.size());
+        });
+    }
+    if (writer.joinable()) writer.join();
+    return ok && written;
+}
+
+/* the data of the given rows as a matrix of the given width */
+static bool writeData(const std::string &dir, const std::vector<ScanRef> &refs, const std::vector<int> &rows,
+                      int width, int nthreads)
+{
+    int fd = createFile(dir + "/data.npy");
+    if (fd < 0) return false;
+    std::string head = npyHeader("<f4", rows.size(), width);
+    bool ok = writeAll(fd, 0, head.data(), head.size());
+
+    std::vector<ScanRef> sub;
+    sub.reserve(rows.size());
+    for (size_t r = 0; r < rows.size(); r++) sub.push_back(refs[rows[r]]);
+    ok = ok && writeRows(fd, head.size(), sub, (size_t)width*sizeof(float), 1, nthreads,
+                         [width](ClassReader *reader, int scan, size_t, char *row) {
+        float *dst = (float *)row;
+        std::fill(dst, dst + width, (float)NAN);
+        const ClassDescriptor *desc = reader->getDescriptor(scan, true);
+        if (desc == 0 || desc->data == 0) return;
+        int m = (desc->ndata < width) ? desc->ndata : width;
+        memcpy(dst, desc->data, m*sizeof(float));
+        float badl = desc->badl;
+        for (int j = 0; j < m; j++) {
+            if (dst[j] == badl) dst[j] = NAN;
+        }
+    });
+    if (close(fd) != 0) ok = false;
+    return ok;
+}
+
+long int exportColumns(const std::vector<ScanRef> &refs, const std::vector<int> &ids,
+                       const std::vector<DatasetEntry> *entries, const char *directory, bool group, int nthreads)
+{
+    TraceScope trace("export", refs.size(), "count");
+    int n = refs.size();
+    std::vector<Column> columns = {
+        Column("id", "<i4", 4), Column("file", "<i4", 4), Column("scan", "<i4", 4), Column("kind", "<i4", 4),
+        Column("nchan", "<i4", 4), Column("system", "<i4", 4), Column("number", "<i8", 8), Column("scanno", "<i8", 8),
+        Column("source", "|S12", 12), Column("line", "|S12", 12), Column("telescope", "|S12", 12),
+        Column("time", "<f8", 8), Column("lam", "<f8", 8), Column("bet", "<f8", 8), Column("lamof", "<f8", 8),
+        Column("betof", "<f8", 8), Column("az", "<f8", 8), Column("el", "<f8", 8), Column("f0", "<f8", 8),
+        Column("ref", "<f8", 8), Column("df", "<f8", 8), Column("voff", "<f8", 8), Column("vres", "<f8", 8),
+        Column("restf", "<f8", 8), Column("image", "<f8", 8), Column("tsys", "<f8", 8), Column("tau", "<f8", 8),
+        Column("dt", "<f8", 8)
+    };
+    const int FIRSTDOUBLE = 11;
+    if (!entries) columns.erase(columns.begin() + 1, columns.begin() + 3);
+    int first = entries ? FIRSTDOUBLE : FIRSTDOUBLE - 2;
+    for (size_t c = 0; c < columns.size(); c++) columns[c].values.assign((size_t)n*columns[c].size, 0);
+    for (int i = 0; i < n; i++) {
+        for (size_t c = first; c < columns.size(); c++) columns[c].set(i, (double)NAN);
+    }
+
+    /* the headers, and the axis of every spectrum */
+    std::vector<SpectralAxis> axes(n);
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int) {
+        const ClassEntry &entry = reader->getIndex()[scan-1];
+        const ClassDescriptor *desc = reader->getDescriptor(scan, false);
+        int c = 0;
+        columns[c++].set(pos, ids[pos]);
+        if (entries) {
+            columns[c++].set(pos, (*entries)[pos].file);
+            columns[c++].set(pos, (*entries)[pos].scan);
+        }
+        columns[c++].set(pos, entry.xkind);
+        if (desc == 0) {
+            columns[c].set(pos, -1);
+            return;
+        }
+        axes[pos] = spectrumAxis(reader, desc, false);
+        const double deg = 180.0/M_PI, arcsec = 3600.0*180.0/M_PI;
+        columns[c++].set(pos, desc->ndata);
+        columns[c++].set(pos, desc->system);
+        columns[c++].set(pos, (int64_t)entry.xnum);
+        columns[c++].set(pos, (int64_t)entry.xscan);
+        columns[c++].set(pos, entry.xsourc);
+        columns[c++].set(pos, entry.xline);
+        columns[c++].set(pos, entry.xtel);
+        const double values[] = {
+            observationTime(entry.xdobs, desc->ut), desc->lam*deg, desc->bet*deg, desc->lamof*arcsec,
+            desc->betof*arcsec, desc->az*deg, desc->el*deg, axes[pos].f0, axes[pos].ref, axes[pos].df,
+            desc->voff, desc->vres, desc->restf, desc->image, desc->tsys, desc->tau, desc->time
+        };
+        for (size_t k = 0; k < sizeof(values)/sizeof(values[0]); k++) columns[c++].set(pos, values[k]);
+    });
+
+    /* the rows of every group, with its axis */
+    std::vector<std::vector<int> > groups;
+    std::vector<SpectralAxis> groupAxes;
+    int width = 0;
+    if (group) {
+        std::map<std::tuple<int, double, double, double>, int> keys;
+        for (int i = 0; i < n; i++) {
+            const SpectralAxis &a = axes[i];
+            auto key = std::make_tuple(a.nchan, a.f0, a.ref, a.df);
+            auto it = keys.find(key);
+            if (it == keys.end()) {
+                it = keys.insert(std::make_pair(key, (int)groups.size())).first;
+                groups.push_back(std::vector<int>());
+                groupAxes.push_back(a);
+            }
+            groups[it->second].push_back(i);
+        }
+    } else {
+        groups.push_back(std::vector<int>(n));
+        for (int i = 0; i < n; i++) {
+            groups[0][i] = i;
+            if (axes[i].nchan > width) width = axes[i].nchan;
+        }
+    }
+
+    if (!makeDirectory(directory)) return -1;
+    for (size_t g = 0; g < groups.size(); g++) {
+        std::string dir = directory;
+        if (group) {
+            dir += "/group" + std::to_string(g);
+            if (!makeDirectory(dir)) return -1;
+            width = groupAxes[g].nchan;
+
+            Column freq("freq", "<f8", 8);
+            std::vector<int> rows(width);
+            freq.values.resize((size_t)width*freq.size);
+            for (int k = 0; k < width; k++) {
+                freq.set(k, groupAxes[g].value(k+1));
+                rows[k] = k;
+            }
+            if (!writeColumn(dir, freq, rows)) return -1;
+        }
+        for (size_t c = 0; c < columns.size(); c++) {
+            if (!writeColumn(dir, columns[c], groups[g])) return -1;
+        }
+        if (!writeData(dir, refs, groups[g], width, nthreads)) return -1;
+    }
+    return n;
+}
+
+/* a header card with a value formatted as FITS wants it */
+static void card(std::string &head, const char *key, const char *value)
+{
+    char buf[CARDLEN+1];
+    snprintf(buf, sizeof(buf), "%-8.8s= %s", key, value);
+    std::string c = buf;
+    c.resize(CARDLEN, ' ');
+    head += c;
+}
+
+static void card(std::string &head, const char *key, long value)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%20ld", value);
+    card(head, key, buf);
+}
+
+static void stringCard(std::string &head, const char *key, const char *value)
+{
+    char buf[72];
+    snprintf(buf, sizeof(buf), "'%-8.68s'", value);
+    card(head, key, buf);
+}
+
+/* the END card, and blanks up to the end of the block */
+static void endHeader(std::string &head)
+{
+    head += "END";
+    head.resize((head.size() + FITSBLOCK - 1)/FITSBLOCK*FITSBLOCK, ' ');
+}
+
+/* big-endian values and blank-padded strings of a table row */
+static void putBig(char *&p, uint64_t v, int size)
+{
+    for (int i = size - 1; i >= 0; i--) {
+        p[i] = (char)(v & 0xff);
+        v >>= 8;
+    }
+    p += size;
+}
+
+static void putFloat(char *&p, float v)
+{
+    uint32_t u;
+    memcpy(&u, &v, sizeof(u));
+    putBig(p, u, 4);
+}
+
+static void putDouble(char *&p, double v)
+{
+    uint64_t u;
+    memcpy(&u, &v, sizeof(u));
+    putBig(p, u, 8);
+}
+
+static void putString(char *&p, const char *s, int len)
+{
+    int n = 0;
+    while (n < len && s[n]) n++;
+    memcpy(p, s, n);
+    memset(p + n, ' ', len - n);
+    p += len;
+}
+
+/* ISO time with hundredths of seconds, as DATE-OBS */
+static void isoTime(double t, char *buf, size_t len)
+{
+    double cs = floor(t*100.0 + 0.5);
+    time_t secs = (time_t)floor(cs/100.0);
+    struct tm tm;
+    gmtime_r(&secs, &tm);
+    snprintf(buf, len, "%04d-%02d-%02dT%02d:%02d:%02d.%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+             tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(cs - 100.0*secs));
+}
+
+/* velocity frames of CLASS, as VELDEF */
+static const char *velocityDefinition(int vtype)
+{
+    switch (vtype) {
+    case 1: return "RADI-LSR";
+    case 2: return "RADI-HEL";
+    case 3: return "RADI-OBS";
+    case 4: return "RADI-GEO";
+    default: return "";
+    }
+}
+
+/* the columns of the table, in the order fillRow() writes them */
+struct FitsColumn {
+    const char *name;
+    const char *form;
+    const char *unit;
+    int size;
+};
+
+static const FitsColumn FITSCOLUMNS[] = {
+    {"OBJECT", "12A", "", 12}, {"LINE", "12A", "", 12}, {"TELESCOP", "12A", "", 12},
+    {"OBSNUM", "1K", "", 8}, {"SCAN", "1K", "", 8}, {"DATE-OBS", "22A", "", 22},
+    {"EXPOSURE", "1E", "s", 4}, {"TSYS", "1E", "K", 4}, {"TAU", "1E", "", 4},
+    {"CTYPE1", "8A", "", 8}, {"CRVAL1", "1D", "", 8}, {"CRPIX1", "1D", "", 8}, {"CDELT1", "1D", "", 8},
+    {"CTYPE2", "8A", "", 8}, {"CRVAL2", "1D", "deg", 8}, {"CTYPE3", "8A", "", 8}, {"CRVAL3", "1D", "deg", 8},
+    {"EQUINOX", "1D", "", 8}, {"AZIMUTH", "1D", "deg", 8}, {"ELEVATIO", "1D", "deg", 8},
+    {"RESTFREQ", "1D", "Hz", 8}, {"IMAGFREQ", "1D", "Hz", 8}, {"VELOCITY", "1D", "m/s", 8},
+    {"VELDEF", "8A", "", 8}, {"FREQRES", "1D", "Hz", 8}, {"BANDWID", "1D", "Hz", 8}
+};
+#define NFITSCOLUMNS (int)(sizeof(FITSCOLUMNS)/sizeof(FITSCOLUMNS[0]))
+
+/* a row of the table, the header columns followed by width channels of data */
+static void fillRow(ClassReader *reader, int scan, const PositionTable &table, size_t i, int width, char *p)
+{
+    const ClassEntry &entry = reader->getIndex()[scan-1];
+    const ClassDescriptor *desc = reader->getDescriptor(scan, true);
+    putString(p, entry.xsourc, 12);
+    putString(p, entry.xline, 12);
+    putString(p, entry.xtel, 12);
+    putBig(p, (uint64_t)(int64_t)entry.xnum, 8);
+    putBig(p, (uint64_t)(int64_t)entry.xscan, 8);
+
+    const double deg = 180.0/M_PI;
+    char date[64] = "";
+    SpectralAxis axis;
+    double scale = 1.0, ra = table.ra[i], dec = table.dec[i], epoch = table.epoch[i];
+    const char *ctype1 = "", *ctype2 = "RA", *ctype3 = "DEC";
+    if (desc) {
+        isoTime(observationTime(entry.xdobs, desc->ut), date, sizeof(date));
+        axis = spectrumAxis(reader, desc, false);
+        if (entry.xkind == 0) {
+            ctype1 = "FREQ";
+            scale = 1.0e6;
+        } else {
+            ctype1 = "TIME";
+        }
+    }
+    if (isnan(ra) && desc) {
+        ra = table.lam[i];
+        dec = table.bet[i];
+        epoch = NAN;
+        ctype2 = (table.system[i] == SYSTEM_HORIZONTAL) ? "AZ" : "";
+        ctype3 = (table.system[i] == SYSTEM_HORIZONTAL) ? "EL" : "";
+    }
+    putString(p, date, 22);
+    putFloat(p, desc ? desc->time : NAN);
+    putFloat(p, desc ? desc->tsys : NAN);
+    putFloat(p, desc ? desc->tau : NAN);
+    putString(p, ctype1, 8);
+    putDouble(p, desc ? axis.f0*scale : NAN);
+    putDouble(p, desc ? axis.ref : NAN);
+    putDouble(p, desc ? axis.df*scale : NAN);
+    putString(p, ctype2, 8);
+    putDouble(p, ra);
+    putString(p, ctype3, 8);
+    putDouble(p, dec);
+    putDouble(p, epoch);
+    putDouble(p, desc ? desc->az*deg : NAN);
+    putDouble(p, desc ? desc->el*deg : NAN);
+    putDouble(p, desc ? desc->restf*1.0e6 : NAN);
+    putDouble(p, desc ? desc->image*1.0e6 : NAN);
+    putDouble(p, desc ? desc->voff*1.0e3 : NAN);
+    putString(p, desc ? velocityDefinition(desc->vtype) : "", 8);
+    putDouble(p, desc ? fabs(desc->fres)*1.0e6 : NAN);
+    putDouble(p, desc ? fabs(desc->fres*desc->ndata)*1.0e6 : NAN);
+
+    int m = 0;
+    if (desc && desc->data) {
+        m = (desc->ndata < width) ? desc->ndata : width;
+        float badl = desc->badl;
+        /* the raw data need not be aligned */
+        const char *src = (const char *)desc->data;
+        for (int j = 0; j < m; j++) {
+            float v;
+            memcpy(&v, src + j*sizeof(float), sizeof(float));
+            putFloat(p, (v == badl) ? NAN : v);
+        }
+    }
+    for (int j = m; j < width; j++) putFloat(p, NAN);
+}
+
+long int exportSDFITS(const std::vector<ScanRef> &refs, const char *filename, int nthreads)
+{
+    TraceScope trace("sdfits", refs.size(), "count");
+    long n = refs.size();
+    PositionTable table;
+    positionTable(refs, table, nthreads);
+    std::vector<int> nchan(n, 0);
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int) {
+        const ClassDescriptor *desc = reader->getDescriptor(scan, false);
+        if (desc) nchan[pos] = desc->ndata;
+    });
+    int width = n > 0 ? *std::max_element(nchan.begin(), nchan.end()) : 0;
+    if (width == 0) width = 1;
+
+    size_t rowbytes = (size_t)width*sizeof(float);
+    for (int c = 0; c < NFITSCOLUMNS; c++) rowbytes += FITSCOLUMNS[c].size;
+
+    std::string head;
+    card(head, "SIMPLE", "                   T");
+    card(head, "BITPIX", 8);
+    card(head, "NAXIS", 0L);
+    card(head, "EXTEND", "                   T");
+    stringCard(head, "ORIGIN", "classic");
+    endHeader(head);
+
+    card(head, "XTENSION", "'BINTABLE'");
+    card(head, "BITPIX", 8);
+    card(head, "NAXIS", 2);
+    card(head, "NAXIS1", (long)rowbytes);
+    card(head, "NAXIS2", n);
+    card(head, "PCOUNT", 0L);
+    card(head, "GCOUNT", 1);
+    card(head, "TFIELDS", NFITSCOLUMNS + 1);
+    stringCard(head, "EXTNAME", "SINGLE DISH");
+    card(head, "EXTVER", 1);
+    card(head, "NMATRIX", 1);
+    char form[16];
+    snprintf(form, sizeof(form), "%dE", width);
+    for (int c = 0; c <= NFITSCOLUMNS; c++) {
+        char key[16];
+        const FitsColumn &column = (c < NFITSCOLUMNS) ? FITSCOLUMNS[c] : FitsColumn{"DATA", form, "", 0};
+        snprintf(key, sizeof(key), "TTYPE%d", c+1);
+        stringCard(head, key, column.name);
+        snprintf(key, sizeof(key), "TFORM%d", c+1);
+        stringCard(head, key, column.form);
+        if (column.unit[0]) {
+            snprintf(key, sizeof(key), "TUNIT%d", c+1);
+            stringCard(head, key, column.unit);
+        }
+    }
+    endHeader(head);
+
+    int fd = createFile(filename);
+    if (fd < 0) return -1;
+    bool ok = writeAll(fd, 0, head.data(), head.size());
+    ok = ok && writeRows(fd, head.size(), refs, rowbytes, FITSBLOCK, nthreads,
+                         [&table, width](ClassReader *reader, int scan, size_t i, char *row) {
+        fillRow(reader, scan, table, i, width, row);
+    });
+
+    /* the table ends with zeros up to the end of the block */
+    size_t tail = (FITSBLOCK - (n*rowbytes) % FITSBLOCK) % FITSBLOCK;
+    std::vector<char> zeros(tail, 0);
+    ok = ok && writeAll(fd, head.size() + n*rowbytes, zeros.data(), tail);
+    if (close(fd) != 0) ok = false;
+    return ok ? n : -1;
+}
@@ -0,0 +1,76 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSEXPORT_H
+#define CLASSEXPORT_H
+
+#include <vector>
+
+#include "class.h"
+#include "dataset.h"
+
+/**
+ * @file export.h
+ */
+
+/**
+ * Export spectra to a directory of .npy files, which numpy loads without
+ * parsing, or maps with np.load(..., mmap_mode='r').
+ *
+ * The data are written to data.npy as a float32 matrix of one row per
+ * spectrum, with bad channels as NaN, and the headers to one file per
+ * column:
+ *
+ *  - int32: id, file and scan (with entries only), kind (0 for spectra, 1
+ *    for drifts), nchan (-1 if the spectrum could not be read), system
+ *  - int64: number (observation number), scanno
+ *  - S12: source, line, telescope
+ *  - float64: time (seconds since 1970), lam, bet (centre of the position
+ *    section, degrees), lamof, betof (offsets, arcsec), az, el (degrees),
+ *    f0, ref, df (the axis, see SpectralAxis), voff, vres, restf, image,
+ *    tsys, tau, dt
+ *
+ * Without grouping, rows are padded with NaN to the largest number of
+ * channels. With grouping, spectra of the same axis go to a subdirectory
+ * group0, group1, ... each, in the order the axes are first seen, which
+ * holds data.npy of exactly their width, the columns of its spectra, and
+ * freq.npy with the values of the axis.
+ *
+ * Headers are read first, then the data are decoded in parallel in chunks
+ * of bounded size, each written while the next one is decoded.
+ *
+ * @param refs the spectra
+ * @param ids the id of every spectrum
+ * @param entries file ids and numbers of the spectra in a dataset, or NULL
+ * @param directory the directory, created if needed
+ * @param group write one set of files per axis
+ * @param nthreads number of threads, <= 0 for the default
+ * @return number of spectra exported, or -1 on error
+ */
+long int exportColumns(const std::vector<ScanRef> &refs, const std::vector<int> &ids,
+                       const std::vector<DatasetEntry> *entries, const char *directory, bool group,
+                       int nthreads = 0);
+
+/**
+ * Export spectra to an SDFITS file, a FITS binary table with extension
+ * SINGLE DISH of one row per spectrum, written without any FITS library.
+ *
+ * The columns are OBJECT, LINE, TELESCOP, OBSNUM, SCAN, DATE-OBS, EXPOSURE,
+ * TSYS, TAU, the axis as CTYPE1 (FREQ, or TIME for drifts), CRVAL1, CRPIX1
+ * and CDELT1 (Hz for frequencies), the position as CTYPE2 and CTYPE3 (RA and
+ * DEC, with equatorial coordinates as in positionTable(), or AZ and EL),
+ * CRVAL2 and CRVAL3 (degrees), EQUINOX, AZIMUTH, ELEVATIO, RESTFREQ,
+ * IMAGFREQ, VELOCITY (m/s), VELDEF, FREQRES, BANDWID, and DATA with the
+ * channels as float, padded with NaN to the largest number of channels,
+ * and bad channels as NaN.
+ *
+ * Headers are read first, then rows are decoded and encoded in parallel in
+ * chunks of whole FITS blocks, each written while the next one is encoded.
+ *
+ * @param refs the spectra
+ * @param filename the file, which is replaced if it exists
+ * @param nthreads number of threads, <= 0 for the default
+ * @return number of spectra exported, or -1 on error
+ */
+long int exportSDFITS(const std::vector<ScanRef> &refs, const char *filename, int nthreads = 0);
+
+#endif
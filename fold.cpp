@@ -0,0 +1,100 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "fold.h"
+#include "resample.h"
+#include "trace.h"
+
+#include <math.h>
+
+bool foldable(const ClassDescriptor *desc)
+{
+    return desc->nphas >= 2 && desc->swmod == SWITCH_FREQUENCY;
+}
+
+/* add w0*a + w1*b to dst, over n channels; kept apart so that the loop vectorizes */
+__attribute__((noinline))
+static void addShifted(const double *__restrict__ a, const double *__restrict__ b, double w0, double w1, int n,
+                       double *__restrict__ dst)
+{
+    for (int k = 0; k < n; k++) dst[k] += w0*a[k] + w1*b[k];
+}
+
+bool foldSpectrum(const double *src, int nchan, int nphase, const double *shift, const double *weight, double *dst)
+{
+    /* shifts of nchan or more leave no channel covered, and would overflow below if huge or not finite */
+    for (int i = 0; i < nphase; i++) {
+        if (!(fabs(shift[i]) < nchan)) {
+            for (int k = 0; k < nchan; k++) dst[k] = NAN;
+            return false;
+        }
+    }
+
+    int lo = 0, hi = nchan;
+    for (int k = 0; k < nchan; k++) dst[k] = 0.0;
+    for (int i = 0; i < nphase; i++) {
+        /* channel k takes src at k - shift, between channels k + i0 and k + i0 + 1 */
+        double x = -shift[i];
+        int i0 = (int)floor(x);
+        double f = x - i0;
+        int kmin = (-i0 > 0) ? -i0 : 0;
+        int kmax = nchan - i0 - (f > 0.0 ? 1 : 0);
+        if (kmax > nchan) kmax = nchan;
+        if (kmin > lo) lo = kmin;
+        if (kmax < hi) hi = kmax;
+        if (kmax <= kmin) continue;
+        const double *a = src + kmin + i0;
+        addShifted(a, (f > 0.0) ? a + 1 : a, weight[i]*(1.0 - f), weight[i]*f, kmax - kmin, dst + kmin);
+    }
+    for (int k = 0; k < nchan; k++) {
+        if (k < lo || k >= hi) dst[k] = NAN;
+    }
+    return true;
+}
+
+bool foldSpectrum(const ClassDescriptor *desc, const double *src, int nchan, double df, double *dst)
+{
+    double shift[MAXPHASE], weight[MAXPHASE];
+    for (int i = 0; i < desc->nphas; i++) {
+        shift[i] = desc->decal[i]/df;
+        weight[i] = desc->poids[i];
+    }
+    return foldSpectrum(src, nchan, desc->nphas, shift, weight, dst);
+}
+
+int foldBlock(const std::vector<ScanRef> &refs, std::vector<double> &block, int nthreads)
+{
+    TraceScope trace("fold", refs.size(), "count");
+    int n = refs.size();
+
+    /* widths first, so that the block is allocated once */
+    int width = 0;
+    std::vector<int> widths(n, 0);
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int) {
+        widths[pos] = reader->getChannels(scan);
+    });
+    for (int i = 0; i < n; i++) {
+        if (widths[i] > width) width = widths[i];
+    }
+    block.assign((size_t)n*width, NAN);
+    if (width == 0) return width;
+
+    if (nthreads <= 0) nthreads = defaultThreads();
+    std::vector<std::vector<double> > values(nthreads);
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int worker) {
+        const ClassDescriptor *desc = reader->getDescriptor(scan, true);
+        if (desc == 0 || desc->data == 0 || desc->ndata <= 0 || !foldable(desc)) return;
+
+        /* the raw data need not be aligned */
+        std::vector<double> &v = values[worker];
+        int m = (desc->ndata < width) ? desc->ndata : width;
+        v.resize(m);
+        const char *raw = (const char *)desc->data;
+        float badl = desc->badl;
+        for (int k = 0; k < m; k++) {
+            float x;
+            memcpy(&x, raw + k*sizeof(float), sizeof(float));
+            v[k] = (x != badl) ? x : NAN;
+        }
+        foldSpectrum(desc, v.data(), m, spectrumAxis(reader, desc, false).df, &block[(size_t)pos*width]);
+    });
+    return width;
+}
@@ -0,0 +1,57 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSFOLD_H
+#define CLASSFOLD_H
+
+#include <vector>
+
+#include "class.h"
+#include "dataset.h"
+
+/**
+ * @file fold.h
+ */
+
+/**
+ * True if the spectrum is frequency switched and not yet folded, with at
+ * least two phases.
+ */
+bool foldable(const ClassDescriptor *desc);
+
+/**
+ * Fold a frequency-switched spectrum: every phase i is shifted by
+ * -shift[i] channels, interpolating linearly between channels, and the
+ * shifted spectra are added with their weights. Channels that any of the
+ * shifted spectra do not cover, or which depend on a bad channel, are NaN.
+ * Spectra with a shift that is not finite, or of nchan channels or more,
+ * are not folded.
+ *
+ * @param src the nchan values, with bad channels as NaN
+ * @param nchan number of channels
+ * @param nphase number of phases
+ * @param shift the frequency offsets of the phases, in channels
+ * @param weight the weights of the phases
+ * @param dst the folded spectrum, which must not be src
+ * @return false if the spectrum was not folded, with dst all NaN
+ */
+bool foldSpectrum(const double *src, int nchan, int nphase, const double *shift, const double *weight, double *dst);
+
+/**
+ * Fold a spectrum with the offsets and weights of its switching section,
+ * for channels of width df in MHz, see above.
+ */
+bool foldSpectrum(const ClassDescriptor *desc, const double *src, int nchan, double df, double *dst);
+
+/**
+ * Fold the referenced spectra, as a row-major block padded with NaN to the
+ * largest number of channels. Rows of spectra that could not be read, are
+ * not foldable() or could not be folded are NaN.
+ *
+ * @param refs the spectra
+ * @param block the block
+ * @param nthreads number of threads, <= 0 for the default
+ * @return the width of the block
+ */
+int foldBlock(const std::vector<ScanRef> &refs, std::vector<double> &block, int nthreads = 0);
+
+#endif
@@ -0,0 +1,279 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "gauss.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <math.h>
+
+#define FOURLN2 2.772588722239781     // 4 ln 2, for widths at half maximum
+#define MAXLAMBDA 1.0e12              // damping beyond which no step can improve the fit
+
+GaussOptions::GaussOptions() : ncomp(1), stored(true), velocity(true), maxiter(50)
+{
+}
+
+/* decompose the lower triangle of a into its Cholesky factor, in place */
+static bool cholesky(double *a, int p)
+{
+    for (int j = 0; j < p; j++) {
+        double d = a[j*p+j];
+        for (int k = 0; k < j; k++) d -= a[j*p+k]*a[j*p+k];
+        if (!(d > 1.0e-12*(a[j*p+j] > 1.0 ? a[j*p+j] : 1.0))) return false;
+        d = sqrt(d);
+        a[j*p+j] = d;
+        for (int i = j+1; i < p; i++) {
+            double s = a[i*p+j];
+            for (int k = 0; k < j; k++) s -= a[i*p+k]*a[j*p+k];
+            a[i*p+j] = s/d;
+        }
+    }
+    return true;
+}
+
+/* solve l l^T x = b for the Cholesky factor l, with b given in x */
+static void backsolve(const double *l, int p, double *x)
+{
+    for (int i = 0; i < p; i++) {
+        double s = x[i];
+        for (int k = 0; k < i; k++) s -= l[i*p+k]*x[k];
+        x[i] = s/l[i*p+i];
+    }
+    for (int i = p-1; i >= 0; i--) {
+        double s = x[i];
+        for (int k = i+1; k < p; k++) s -= l[k*p+i]*x[k];
+        x[i] = s/l[i*p+i];
+    }
+}
+
+GaussFitter::GaussFitter() : m_ncomp(0)
+{
+    int p = 3*MAXGAUSS;
+    m_alpha.resize(p*p);
+    m_work.resize(p*p);
+    m_beta.resize(p);
+    m_step.resize(p);
+    m_trial.resize(p);
+}
+
+/*
+ * Return the sum of squared residuals of the model with parameters par. If
+ * derivatives is set, also fill the lower triangle of the normal matrix
+ * and the gradient. Channels more than five widths from a component do
+ * not contribute to it.
+ */
+double GaussFitter::evaluate(const double *par, bool derivatives)
+{
+    int p = 3*m_ncomp;
+    double d[3*MAXGAUSS];
+    double chi2 = 0.0;
+    if (derivatives) {
+        for (int i = 0; i < p*p; i++) m_alpha[i] = 0.0;
+        for (int i = 0; i < p; i++) m_beta[i] = 0.0;
+    }
+    for (size_t k = 0; k < m_x.size(); k++) {
+        double x = m_x[k];
+        double model = 0.0;
+        for (int c = 0; c < m_ncomp; c++) {
+            double area = par[3*c], pos = par[3*c+1], width = par[3*c+2];
+            double u = (x - pos)/width;
+            if (u*u > 25.0) {
+                d[3*c] = d[3*c+1] = d[3*c+2] = 0.0;
+                continue;
+            }
+            double e = sqrt(FOURLN2/M_PI)/width*exp(-FOURLN2*u*u);
+            double f = area*e;
+            model += f;
+            d[3*c] = e;
+            d[3*c+1] = 2.0*FOURLN2*f*u/width;
+            d[3*c+2] = f*(2.0*FOURLN2*u*u - 1.0)/width;
+        }
+        double r = m_y[k] - model;
+        chi2 += r*r;
+        if (!derivatives) continue;
+        for (int i = 0; i < p; i++) {
+            if (d[i] == 0.0) continue;
+            m_beta[i] += d[i]*r;
+            for (int j = 0; j <= i; j++) m_alpha[i*p+j] += d[i]*d[j];
+        }
+    }
+    return chi2;
+}
+
+/* the step of the damped normal equations, in m_step */
+bool GaussFitter::solve(int p, double lambda)
+{
+    for (int i = 0; i < p; i++) {
+        for (int j = 0; j <= i; j++) m_work[i*p+j] = m_alpha[i*p+j];
+        m_work[i*p+i] *= 1.0 + lambda;
+        m_step[i] = m_beta[i];
+    }
+    if (!cholesky(m_work.data(), p)) return false;
+    backsolve(m_work.data(), p, m_step.data());
+    return true;
+}
+
+bool GaussFitter::fit(const SpectralAxis &axis, const double *data, int maxiter, GaussResult &result)
+{
+    m_ncomp = result.ncomp;
+    int p = 3*m_ncomp;
+    double *par = result.par;
+    result.niter = 0;
+    result.converged = false;
+    result.rms = result.base = NAN;
+    for (int i = 0; i < 3*MAXGAUSS; i++) result.err[i] = NAN;
+
+    m_x.clear();
+    m_y.clear();
+    for (int k = 0; k < axis.nchan; k++) {
+        if (data[k] != data[k]) continue;
+        m_x.push_back(axis.value(k+1));
+        m_y.push_back(data[k]);
+    }
+    int n = m_x.size();
+    if (m_ncomp <= 0 || n <= p) {
+        for (int i = 0; i < p; i++) par[i] = NAN;
+        return false;
+    }
+
+    double chi2 = evaluate(par, true);
+    double lambda = 1.0e-3;
+    while (result.niter < maxiter && chi2 == chi2) {
+        result.niter++;
+        if (!solve(p, lambda)) break;
+        bool valid = true;
+        for (int c = 0; valid && c < m_ncomp; c++) {
+            for (int i = 3*c; i < 3*c+3; i++) m_trial[i] = par[i] + m_step[i];
+            valid = (m_trial[3*c+2] > 0.0) && m_trial[3*c] == m_trial[3*c] && m_trial[3*c+1] == m_trial[3*c+1];
+        }
+        double trial = valid ? evaluate(m_trial.data(), false) : NAN;
+        if (trial <= chi2) {
+            /* converged once the parameters no longer change noticeably */
+            bool small = true;
+            for (int i = 0; i < p; i++) small = small && fabs(m_step[i]) <= 1.0e-6*fabs(par[i]);
+            for (int i = 0; i < p; i++) par[i] = m_trial[i];
+            chi2 = evaluate(par, true);
+            lambda = (lambda > 1.0e-12) ? 0.1*lambda : lambda;
+            if (small) {
+                result.converged = true;
+                break;
+            }
+        } else {
+            lambda *= 10.0;
+            if (lambda > MAXLAMBDA) {
+                /* no step improves the fit: a minimum as far as the arithmetic goes */
+                result.converged = true;
+                break;
+            }
+        }
+    }
+    if (!(chi2 == chi2)) {
+        for (int i = 0; i < p; i++) par[i] = NAN;
+        return false;
+    }
+    result.rms = sqrt(chi2/n);
+
+    /* errors from the diagonal of the inverse of the normal matrix */
+    for (int i = 0; i < p*p; i++) m_work[i] = m_alpha[i];
+    if (cholesky(m_work.data(), p)) {
+        for (int i = 0; i < p; i++) {
+            for (int j = 0; j < p; j++) m_step[j] = (i == j) ? 1.0 : 0.0;
+            backsolve(m_work.data(), p, m_step.data());
+            result.err[i] = sqrt(m_step[i]*chi2/(n - p));
+        }
+    }
+    return true;
+}
+
+static void clearResult(GaussResult &result)
+{
+    result.ncomp = 0;
+    result.niter = 0;
+    result.converged = false;
+    result.rms = result.base = NAN;
+    for (int i = 0; i < 3*MAXGAUSS; i++) result.par[i] = result.err[i] = NAN;
+}
+
+void storedGauss(const std::vector<ScanRef> &refs, std::vector<GaussResult> &results, int nthreads)
+{
+    TraceScope trace("gauss", refs.size(), "count");
+    results.resize(refs.size());
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int) {
+        GaussResult &result = results[pos];
+        clearResult(result);
+        const ClassDescriptor *desc = reader->getDescriptor(scan, false);
+        if (desc == 0 || desc->nline < 0) return;
+
+        result.ncomp = desc->nline;
+        result.converged = true;
+        result.rms = desc->sigra;
+        result.base = desc->sigba;
+        for (int i = 0; i < 3*desc->nline; i++) {
+            result.par[i] = desc->nfit[i];
+            result.err[i] = desc->nerr[i];
+        }
+    });
+}
+
+/*
+ * Initial components from the stored results, which are in velocity and
+ * only used on the velocity axis, or else from the strongest lines.
+ */
+static void initialComponents(const ClassDescriptor *desc, const GaussOptions &options, const SpectralAxis &axis,
+                              bool velocity, const double *data, std::vector<LineCandidate> &lines,
+                              std::vector<double> &work, GaussResult &result)
+{
+    int ncomp = (options.ncomp < MAXGAUSS) ? options.ncomp : MAXGAUSS;
+    if (options.stored && velocity && desc->nline > 0) {
+        result.ncomp = (desc->nline < ncomp) ? desc->nline : ncomp;
+        bool valid = true;
+        for (int c = 0; c < result.ncomp; c++) {
+            for (int i = 3*c; i < 3*c+3; i++) result.par[i] = desc->nfit[i];
+            valid = valid && desc->nfit[3*c] != 0.0f && desc->nfit[3*c+2] > 0.0f;
+        }
+        if (valid) return;
+    }
+
+    spectrumLines(data, axis.nchan, options.lines, lines, work);
+    std::sort(lines.begin(), lines.end(), [](const LineCandidate &a, const LineCandidate &b) {
+        return fabs(a.peak) > fabs(b.peak);
+    });
+    double dx = fabs(axis.df);
+    result.ncomp = ((int)lines.size() < ncomp) ? lines.size() : ncomp;
+    for (int c = 0; c < result.ncomp; c++) {
+        double area = lines[c].area*dx;
+        double width = fabs(area/(sqrt(M_PI/FOURLN2)*lines[c].peak));
+        result.par[3*c] = area;
+        result.par[3*c+1] = axis.value(lines[c].channel);
+        result.par[3*c+2] = (width > dx) ? width : dx;
+    }
+}
+
+void fitGauss(const std::vector<ScanRef> &refs, const GaussOptions &options, std::vector<GaussResult> &results,
+              int nthreads)
+{
+    TraceScope trace("gauss", refs.size(), "count");
+    results.resize(refs.size());
+    if (nthreads <= 0) nthreads = defaultThreads();
+    std::vector<GaussFitter> fitters(nthreads);
+    std::vector<std::vector<LineCandidate> > lines(nthreads);
+    std::vector<std::vector<double> > data(nthreads), work(nthreads);
+
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int worker) {
+        GaussResult &result = results[pos];
+        clearResult(result);
+        const ClassDescriptor *desc = reader->getDescriptor(scan, true);
+        if (desc == 0 || desc->data == 0 || desc->ndata <= 0) return;
+
+        bool velocity = options.velocity && reader->getIndex()[scan-1].xkind == 0;
+        SpectralAxis axis = spectrumAxis(reader, desc, velocity);
+        const Smoothing &smoothing = options.lines.smoothing;
+        std::vector<double> &a = data[worker];
+        a.resize(smoothing.channels(desc->ndata));
+        smoothing.apply((const char *)desc->data, desc->ndata, desc->badl, a.data());
+        axis.nchan = a.size();
+        smoothing.axis(axis.ref, axis.df);
+
+        initialComponents(desc, options, axis, velocity, a.data(), lines[worker], work[worker], result);
+        if (result.ncomp > 0) fitters[worker].fit(axis, a.data(), options.maxiter, result);
+    });
+}
@@ -0,0 +1,112 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSGAUSS_H
+#define CLASSGAUSS_H
+
+#include <vector>
+
+#include "class.h"
+#include "dataset.h"
+#include "lines.h"
+#include "resample.h"
+
+/**
+ * @file gauss.h
+ */
+
+/**
+ * @brief Parameters of gaussian fits.
+ *
+ * Fits start from the stored fit results of a spectrum (section -9) if
+ * stored is set and there are any, and otherwise from the strongest lines
+ * found as by findLines(). The stored results are in velocity, so they are
+ * only used for fits on the velocity axis. The spectra are fitted as
+ * decoded, after the smoothing of the line options, so they should have had
+ * their baselines subtracted.
+ */
+struct GaussOptions {
+    GaussOptions();               ///< the defaults
+
+    int ncomp;                    ///< maximum number of components, 1..MAXGAUSS
+    bool stored;                  ///< start from the stored fit results
+    bool velocity;                ///< fit on the velocity axis, otherwise on the frequency axis
+    int maxiter;                  ///< maximum number of iterations
+    LineOptions lines;            ///< how to find initial components, and smoothing
+};
+
+/**
+ * @brief The gaussian components of one spectrum.
+ *
+ * Every component is given by its area, position and full width at half
+ * maximum, in units of the axis, as in CLASS. Parameters of components
+ * beyond ncomp, and errors that could not be estimated, are NaN.
+ */
+struct GaussResult {
+    int ncomp;                    ///< number of components, 0 if there was nothing to fit
+    int niter;                    ///< number of iterations, 0 for stored results
+    bool converged;               ///< true if the fit converged
+    double rms;                   ///< rms of the residuals, or the stored sigma on the line
+    double base;                  ///< the stored sigma on the baseline, NaN for fits
+    double par[3*MAXGAUSS];       ///< area, position and width of every component
+    double err[3*MAXGAUSS];       ///< their standard errors
+};
+
+/**
+ * @brief A Levenberg-Marquardt fit of gaussians to spectra.
+ *
+ * The model, its derivatives and the normal equations are computed in
+ * buffers kept by the fitter, so that one fitter per thread fits any
+ * number of spectra without allocating memory once it has seen the
+ * largest of them.
+ */
+class GaussFitter {
+ public:
+    GaussFitter();
+
+    /**
+     * Fit ncomp gaussians to a spectrum.
+     *
+     * @param axis the axis of the spectrum
+     * @param data the axis.nchan values, with bad channels as NaN
+     * @param maxiter maximum number of iterations
+     * @param result ncomp and the initial parameters, replaced by the fit
+     * @return false if the fit failed, in which case the parameters are NaN
+     */
+    bool fit(const SpectralAxis &axis, const double *data, int maxiter, GaussResult &result);
+
+ private:
+    double evaluate(const double *par, bool derivatives);
+    bool solve(int p, double lambda);
+
+    int m_ncomp;
+    std::vector<double> m_x, m_y;      // positions and values of the good channels
+    std::vector<double> m_jac;         // derivatives of the model, channel by channel
+    std::vector<double> m_alpha;       // the normal matrix
+    std::vector<double> m_beta;        // the gradient
+    std::vector<double> m_work;        // the damped normal matrix, decomposed
+    std::vector<double> m_step;
+    std::vector<double> m_trial;
+};
+
+/**
+ * Return the stored gauss fit results of the referenced spectra, in parallel.
+ * Spectra without a gauss section have no components.
+ *
+ * @param refs the spectra
+ * @param results the results, of refs.size() rows
+ * @param nthreads number of threads, <= 0 for the default
+ */
+void storedGauss(const std::vector<ScanRef> &refs, std::vector<GaussResult> &results, int nthreads = 0);
+
+/**
+ * Fit gaussians to the referenced spectra, in parallel.
+ *
+ * @param refs the spectra
+ * @param options how to fit
+ * @param results the results, of refs.size() rows
+ * @param nthreads number of threads, <= 0 for the default
+ */
+void fitGauss(const std::vector<ScanRef> &refs, const GaussOptions &options, std::vector<GaussResult> &results,
+              int nthreads = 0);
+
+#endif
@@ -0,0 +1,176 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "grid.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <math.h>
+
+#define ARCSEC (180.0*3600.0/M_PI)    // arcsec per radian
+
+GridOptions::GridOptions()
+    : nx(1), ny(1), x0(0.0), y0(0.0), dx(1.0), dy(1.0), kernel(GRID_GAUSS), width(0.0), support(0.0),
+      weighting(WEIGHT_TSYS), tile(256)
+{
+}
+
+GridCube::GridCube() : nx(0), ny(0), nchan(0), nspec(0), nskip(0)
+{
+}
+
+/* the width and support of the kernel, with the defaults applied */
+static void kernelSize(const GridOptions &options, double &width, double &support)
+{
+    double cell = (fabs(options.dx) > fabs(options.dy)) ? fabs(options.dx) : fabs(options.dy);
+    width = options.width;
+    support = options.support;
+    if (options.kernel == GRID_BESSEL_GAUSS) {
+        if (width <= 0.0) width = 3.0*cell;
+        if (support <= 0.0) support = width;
+    } else {
+        if (width <= 0.0) width = cell;
+        if (support <= 0.0) support = 1.5*width;
+    }
+}
+
+/*
+ * The Bessel-Gauss kernel is that of Mangum et al. (2007), with a = 1.55
+ * and b = 2.52 in units of a third of the beam.
+ */
+double gridKernel(const GridOptions &options, double r)
+{
+    double width, support;
+    kernelSize(options, width, support);
+    if (r > support) return 0.0;
+    if (options.kernel == GRID_BESSEL_GAUSS) {
+        double a = 1.55*width/3.0, b = 2.52*width/3.0;
+        double u = M_PI*r/a;
+        double bessel = (u > 1.0e-8) ? 2.0*j1(u)/u : 1.0;
+        return bessel*exp(-(r/b)*(r/b));
+    }
+    return exp(-4.0*M_LN2*(r/width)*(r/width));
+}
+
+/* the weight of spectrum row on pixel */
+struct Contribution {
+    int pixel;
+    int row;
+    double weight;
+};
+
+bool gridSpectra(const std::vector<ScanRef> &refs, const GridOptions &options, GridCube &cube, int nthreads)
+{
+    TraceScope trace("grid", refs.size(), "count");
+    cube = GridCube();
+    cube.nx = options.nx;
+    cube.ny = options.ny;
+
+    /* the axis of the first readable spectrum is the axis of the cube */
+    size_t first = 0;
+    SpectralAxis axis;
+    for (first = 0; first < refs.size(); first++) {
+        ClassReader *reader = refs[first].reader;
+        const ClassDescriptor *desc = reader->getDescriptor(refs[first].scan, false);
+        if (desc) {
+            axis = spectrumAxis(reader, desc, false);
+            cube.head = reader->getHead(refs[first].scan);
+            cube.freq = reader->getFreq(refs[first].scan);
+            break;
+        }
+    }
+    int nchan = cube.nchan = axis.nchan;
+    if (first == refs.size() || nchan <= 0 || options.nx <= 0 || options.ny <= 0) {
+        cube.nskip = refs.size();
+        return false;
+    }
+
+    /* the data, offsets and weights of all spectra, with bad channels as NaN */
+    int n = refs.size();
+    std::vector<float> values((size_t)n*nchan);
+    std::vector<double> x(n), y(n), w(n, 0.0), time(n, 0.0);
+    std::vector<char> incompatible(n, 0);
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int) {
+        const ClassDescriptor *desc = reader->getDescriptor(scan, true);
+        if (desc == 0 || desc->data == 0) return;
+        if (!axis.same(spectrumAxis(reader, desc, false))) {
+            incompatible[pos] = 1;
+            return;
+        }
+        w[pos] = spectrumWeight(desc, options.weighting);
+        x[pos] = desc->lamof*ARCSEC;
+        y[pos] = desc->betof*ARCSEC;
+        time[pos] = desc->time;
+
+        /* the raw data need not be aligned */
+        float *v = &values[(size_t)pos*nchan];
+        memcpy(v, desc->data, nchan*sizeof(float));
+        float badl = desc->badl;
+        for (int k = 0; k < nchan; k++) v[k] = (v[k] != badl) ? v[k] : NAN;
+    });
+
+    /* the pixels within the support of every spectrum, ordered by pixel */
+    double width, support;
+    kernelSize(options, width, support);
+    std::vector<Contribution> contributions;
+    int nincompatible = 0;
+    double total = 0.0;
+    for (int i = 0; i < n; i++) {
+        nincompatible += incompatible[i];
+        if (!(w[i] > 0.0)) {
+            cube.nskip++;
+            continue;
+        }
+        cube.nspec++;
+        total += time[i];
+        double px = (x[i] - options.x0)/options.dx, py = (y[i] - options.y0)/options.dy;
+        double rx = support/fabs(options.dx), ry = support/fabs(options.dy);
+        int ix0 = (int)ceil(px - rx), ix1 = (int)floor(px + rx);
+        int iy0 = (int)ceil(py - ry), iy1 = (int)floor(py + ry);
+        for (int iy = (iy0 > 0 ? iy0 : 0); iy <= iy1 && iy < options.ny; iy++) {
+            for (int ix = (ix0 > 0 ? ix0 : 0); ix <= ix1 && ix < options.nx; ix++) {
+                double r = hypot(options.x0 + ix*options.dx - x[i], options.y0 + iy*options.dy - y[i]);
+                double k = gridKernel(options, r);
+                if (k == 0.0) continue;
+                Contribution c = { iy*options.nx + ix, i, w[i]*k };
+                contributions.push_back(c);
+            }
+        }
+    }
+    cube.head.dt = total;
+    if (nincompatible > 0) {
+        fprintf(stderr, "%d spectra with an axis different from spectrum %d of '%s' skipped\n",
+                nincompatible, refs[first].scan, refs[first].reader->getFileName());
+    }
+    std::stable_sort(contributions.begin(), contributions.end(), [](const Contribution &a, const Contribution &b) {
+        return a.pixel < b.pixel;
+    });
+
+    /* enough tiles to keep all threads busy */
+    if (nthreads <= 0) nthreads = defaultThreads();
+    int tile = (options.tile > 0) ? options.tile : nchan;
+    int ntile = (nchan + tile - 1)/tile;
+    if (ntile < nthreads) {
+        tile = (nchan + nthreads - 1)/nthreads;
+        if (tile < 16) tile = 16;
+        ntile = (nchan + tile - 1)/tile;
+    }
+
+    size_t npix = (size_t)options.nx*options.ny;
+    cube.data.assign(npix*nchan, 0.0);
+    cube.weight.assign(npix*nchan, 0.0);
+    parallelFor(ntile, nthreads, [&](int t, int) {
+        int c0 = t*tile;
+        int m = (c0 + tile < nchan) ? tile : nchan - c0;
+        for (size_t i = 0; i < contributions.size(); i++) {
+            const Contribution &c = contributions[i];
+            size_t offset = (size_t)c.pixel*nchan + c0;
+            accumulate(&cube.data[offset], &cube.weight[offset], &values[(size_t)c.row*nchan + c0], m, c.weight,
+                       (float)NAN);
+        }
+        for (size_t p = 0; p < npix; p++) {
+            double *sum = &cube.data[p*nchan + c0];
+            const double *wsum = &cube.weight[p*nchan + c0];
+            for (int k = 0; k < m; k++) sum[k] = (wsum[k] > 0.0) ? sum[k]/wsum[k] : NAN;
+        }
+    });
+    return cube.nspec > 0;
+}
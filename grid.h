@@ -0,0 +1,90 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSGRID_H
+#define CLASSGRID_H
+
+#include <vector>
+
+#include "average.h"
+#include "class.h"
+#include "dataset.h"
+
+/**
+ * @file grid.h
+ */
+
+/**
+ * @brief Convolution kernels of the gridder.
+ */
+enum GridKernel {
+    GRID_GAUSS,           ///< gaussian of the given width at half maximum
+    GRID_BESSEL_GAUSS     ///< J1(pi r/a)/(pi r/a) exp(-(r/b)^2), with a and b scaled to the beam width
+};
+
+/**
+ * @brief The map grid and how spectra are convolved onto it.
+ *
+ * Pixel (ix, iy) is centred on the offsets x0 + ix*dx, y0 + iy*dy. All
+ * lengths are in arcsec.
+ */
+struct GridOptions {
+    GridOptions();                ///< the defaults
+
+    int nx, ny;                   ///< number of pixels
+    double x0, y0;                ///< offsets of pixel (0, 0)
+    double dx, dy;                ///< pixel size
+    GridKernel kernel;            ///< the kernel
+    /**
+     * Width at half maximum of a gaussian kernel, or the beam width for
+     * the Bessel-Gauss kernel, <= 0 for 1 or 3 pixels respectively.
+     */
+    double width;
+    /** Radius of the kernel, <= 0 for 1.5 widths (gaussian) or 1 beam (Bessel-Gauss). */
+    double support;
+    Weighting weighting;          ///< weights of the spectra
+    int tile;                     ///< number of channels gridded together
+};
+
+/**
+ * @brief A gridded cube.
+ *
+ * Cubes are stored pixel by pixel, with the nchan channels of a pixel
+ * contiguous, i.e. as arrays of (ny, nx, nchan) values.
+ */
+struct GridCube {
+    GridCube();           ///< constructor
+
+    SpectrumHeader head;           ///< header of the first spectrum, with total time
+    std::vector<double> freq;      ///< frequency (or time) axis
+    std::vector<double> data;      ///< the cube, NaN where there is no valid data
+    std::vector<double> weight;    ///< sum of weights per pixel and channel
+    int nx, ny, nchan;             ///< dimensions of the cube
+    int nspec;                     ///< number of spectra gridded
+    int nskip;                     ///< number of spectra skipped: unreadable, incompatible or of zero weight
+};
+
+/**
+ * Return the kernel of the options at distance r, in arcsec.
+ */
+double gridKernel(const GridOptions &options, double r);
+
+/**
+ * Grid spectra into a cube.
+ *
+ * The data of all spectra are read first, in parallel, along with their
+ * offsets (section -3) and weights. The kernel weights of every spectrum
+ * on nearby pixels are computed once. The channels are then gridded in
+ * tiles of options.tile channels in parallel, so that the part of the
+ * cube a thread writes to stays in its cache. Spectra whose axis differs
+ * from that of the first spectrum are skipped. Memory for the data of all
+ * spectra is needed, in single precision.
+ *
+ * @param refs the spectra
+ * @param options the grid
+ * @param cube the cube
+ * @param nthreads number of threads, <= 0 for the default
+ * @return false if not a single spectrum could be gridded
+ */
+bool gridSpectra(const std::vector<ScanRef> &refs, const GridOptions &options, GridCube &cube, int nthreads = 0);
+
+#endif
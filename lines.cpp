@@ -0,0 +1,130 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "lines.h"
+#include "resample.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <math.h>
+
+LineOptions::LineOptions() : threshold(5.0), edge(2.0), channels(2), gap(1), absorption(false)
+{
+}
+
+double robustNoise(const double *data, int nchan, std::vector<double> &work, double &median)
+{
+    work.clear();
+    for (int k = 0; k < nchan; k++) {
+        if (data[k] == data[k]) work.push_back(data[k]);
+    }
+    median = NAN;
+    size_t n = work.size();
+    if (n == 0) return NAN;
+
+    std::nth_element(work.begin(), work.begin() + n/2, work.end());
+    median = work[n/2];
+    if (n % 2 == 0) median = 0.5*(median + *std::max_element(work.begin(), work.begin() + n/2));
+    for (size_t k = 0; k < n; k++) work[k] = fabs(work[k] - median);
+    std::nth_element(work.begin(), work.begin() + n/2, work.end());
+    double mad = work[n/2];
+    if (n % 2 == 0) mad = 0.5*(mad + *std::max_element(work.begin(), work.begin() + n/2));
+    return 1.4826*mad;  // the standard deviation of gaussian noise
+}
+
+/* channels of lines of one sign, as 0-based ranges */
+static void lineRuns(const double *a, int n, double sign, double median, double noise, const LineOptions &options,
+                     std::vector<int> &lo, std::vector<int> &hi)
+{
+    double seed = options.threshold*noise, edge = options.edge*noise;
+    size_t start = lo.size();
+    for (int k = 0; k < n; k++) {
+        if (!(sign*(a[k] - median) > seed)) continue;
+        int l = k, h = k;
+        while (l > 0 && sign*(a[l-1] - median) > edge) l--;
+        while (h < n-1 && sign*(a[h+1] - median) > edge) h++;
+        if (lo.size() > start && l - hi.back() - 1 <= options.gap) {
+            hi.back() = h;
+        } else {
+            lo.push_back(l);
+            hi.push_back(h);
+        }
+        k = h;
+    }
+}
+
+void spectrumLines(const double *data, int nchan, const LineOptions &options, std::vector<LineCandidate> &lines,
+                   std::vector<double> &work)
+{
+    lines.clear();
+    double median;
+    double noise = robustNoise(data, nchan, work, median);
+    if (!(noise > 0.0)) return;
+
+    std::vector<int> lo, hi;
+    lineRuns(data, nchan, 1.0, median, noise, options, lo, hi);
+    if (options.absorption) lineRuns(data, nchan, -1.0, median, noise, options, lo, hi);
+
+    for (size_t i = 0; i < lo.size(); i++) {
+        if (hi[i] - lo[i] + 1 < options.channels) continue;
+        LineCandidate line;
+        line.row = 0;
+        line.first = lo[i] + 1;
+        line.last = hi[i] + 1;
+        line.channel = line.first;
+        line.peak = 0.0;
+        line.area = 0.0;
+        for (int k = lo[i]; k <= hi[i]; k++) {
+            double v = data[k] - median;
+            if (!(v == v)) continue;
+            line.area += v;
+            if (fabs(v) > fabs(line.peak)) {
+                line.peak = v;
+                line.channel = k + 1;
+            }
+        }
+        line.snr = line.peak/noise;
+        line.freq = line.velo = NAN;
+        line.noise = noise;
+        lines.push_back(line);
+    }
+}
+
+void findLines(const std::vector<ScanRef> &refs, const LineOptions &options, std::vector<LineCandidate> &lines,
+               int nthreads)
+{
+    TraceScope trace("lines", refs.size(), "count");
+    if (nthreads <= 0) nthreads = defaultThreads();
+    std::vector<std::vector<LineCandidate> > found(nthreads), spectrum(nthreads);
+    std::vector<std::vector<double> > data(nthreads), work(nthreads);
+
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int worker) {
+        const ClassDescriptor *desc = reader->getDescriptor(scan, true);
+        if (desc == 0 || desc->data == 0 || desc->ndata <= 0) return;
+
+        SpectralAxis freq = spectrumAxis(reader, desc, false);
+        SpectralAxis velo = spectrumAxis(reader, desc, reader->getIndex()[scan-1].xkind == 0);
+        const Smoothing &smoothing = options.smoothing;
+        int n = smoothing.channels(desc->ndata);
+        std::vector<double> &a = data[worker];
+        a.resize(n);
+        smoothing.apply((const char *)desc->data, desc->ndata, desc->badl, a.data());
+        smoothing.axis(freq.ref, freq.df);
+        smoothing.axis(velo.ref, velo.df);
+
+        std::vector<LineCandidate> &lines = spectrum[worker];
+        spectrumLines(a.data(), n, options, lines, work[worker]);
+        for (size_t i = 0; i < lines.size(); i++) {
+            LineCandidate &line = lines[i];
+            line.row = pos;
+            line.area *= fabs(velo.df);
+            line.freq = freq.value(line.channel);
+            line.velo = velo.value(line.channel);
+            found[worker].push_back(line);
+        }
+    });
+
+    lines.clear();
+    for (int w = 0; w < nthreads; w++) lines.insert(lines.end(), found[w].begin(), found[w].end());
+    std::sort(lines.begin(), lines.end(), [](const LineCandidate &a, const LineCandidate &b) {
+        return (a.row != b.row) ? a.row < b.row : a.first < b.first;
+    });
+}
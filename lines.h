@@ -0,0 +1,82 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSLINES_H
+#define CLASSLINES_H
+
+#include <vector>
+
+#include "class.h"
+#include "dataset.h"
+#include "smooth.h"
+
+/**
+ * @file lines.h
+ */
+
+/**
+ * @brief Parameters of the line detection.
+ *
+ * Channels more than threshold times the noise above the median seed a
+ * line, which extends to both sides as long as channels stay more than
+ * edge times the noise above it. Lines separated by at most gap channels
+ * are merged, and lines narrower than channels are dropped.
+ */
+struct LineOptions {
+    LineOptions();                ///< the defaults
+
+    double threshold;             ///< detection threshold, in units of the noise
+    double edge;                  ///< threshold for the extent of a line, in units of the noise
+    int channels;                 ///< minimum width of a line, in channels
+    int gap;                      ///< largest gap between lines merged into one, in channels
+    bool absorption;              ///< also detect lines below the median
+    Smoothing smoothing;          ///< smoothing and binning before the detection
+};
+
+/**
+ * @brief A line found in a spectrum.
+ *
+ * Channels are 1-based, of the spectrum after smoothing and binning.
+ * Intensities are relative to the median of the spectrum.
+ */
+struct LineCandidate {
+    int row;              ///< position of the spectrum in the selection
+    int first;            ///< first channel
+    int last;             ///< last channel
+    int channel;          ///< channel of the peak
+    double peak;          ///< peak intensity, negative for absorption
+    double snr;           ///< peak intensity in units of the noise
+    double area;          ///< integrated intensity, over velocity (or time for drifts)
+    double freq;          ///< frequency (or time) of the peak
+    double velo;          ///< velocity of the peak
+    double noise;         ///< noise of the spectrum
+};
+
+/**
+ * Return a robust estimate of the noise of nchan values, with bad channels
+ * as NaN, from the median absolute deviation about the median. The median
+ * is returned in median. work is scratch space. Both are NaN without good
+ * channels.
+ */
+double robustNoise(const double *data, int nchan, std::vector<double> &work, double &median);
+
+/**
+ * Find the lines of nchan values already decoded and smoothed, with bad
+ * channels as NaN, as findLines() does for every spectrum. The row,
+ * frequency and velocity of the lines are not set, and their area is in
+ * channels. work is scratch space.
+ */
+void spectrumLines(const double *data, int nchan, const LineOptions &options, std::vector<LineCandidate> &lines,
+                   std::vector<double> &work);
+
+/**
+ * Find lines in the referenced spectra, in parallel.
+ *
+ * @param refs the spectra
+ * @param options how to detect lines
+ * @param lines the lines, ordered by row and channel
+ * @param nthreads number of threads, <= 0 for the default
+ */
+void findLines(const std::vector<ScanRef> &refs, const LineOptions &options, std::vector<LineCandidate> &lines,
+               int nthreads = 0);
+
+#endif
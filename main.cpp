@@ -1,12 +1,250 @@
 /* Copyright 2017 Michael Olberg <michael.olberg@chalmers.se> */
 #include "class.h"
+#include "writer.h"
+#include "archive.h"
+
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+static bool sameHead(const SpectrumHeader &a, const SpectrumHeader &b)
+{
+    return a.id == b.id && a.scanno == b.scanno && strcmp(a.target, b.target) == 0
+        && strcmp(a.line, b.line) == 0 && strcmp(a.instr, b.instr) == 0
+        && a.RA == b.RA && a.Dec == b.Dec && a.fLO == b.fLO && a.f0 == b.f0 && a.df == b.df
+        && a.vs == b.vs && a.dt == b.dt && a.tsys == b.tsys && a.utc == b.utc;
+}
+
+/* compare the headers and data of every spectrum of a file and its copy, returning the differences */
+static int compareFiles(const char *source, const char *copy)
+{
+    ClassReader *r1 = openClassFile(source);
+    ClassReader *r2 = openClassFile(copy);
+    int errors = 0;
+    if (!r1 || !r2) {
+        fprintf(stderr, "failed to open '%s' or '%s'\n", source, copy);
+        errors = 1;
+    } else {
+        int nscans = r1->getDirectory();
+        if (r2->getDirectory() != nscans) {
+            fprintf(stderr, "'%s' holds %d spectra instead of %d\n", copy, r2->getDirectory(), nscans);
+            errors++;
+        }
+        for (int iscan = 1; iscan <= nscans && errors == 0; iscan++) {
+            if (!sameHead(r1->getHead(iscan), r2->getHead(iscan))
+                || r1->getFreq(iscan) != r2->getFreq(iscan) || r1->getData(iscan) != r2->getData(iscan)) {
+                fprintf(stderr, "spectrum %d of '%s' differs\n", iscan, copy);
+                errors++;
+            }
+        }
+    }
+    delete r1;
+    delete r2;
+    return errors;
+}
+
+/* compress and decompress bytes, returning 1 if they did not come back */
+static int checkCodec(const char *what, const std::vector<char> &src)
+{
+    std::vector<char> packed, dst(src.size());
+    archiveCompress(src.data(), src.size(), packed);
+    if (!archiveDecompress(packed.data(), packed.size(), dst.data(), dst.size()) || dst != src) {
+        fprintf(stderr, "%s data did not survive compression\n", what);
+        return 1;
+    }
+    printf("%s data: %ld bytes compressed into %ld\n", what, (long)src.size(), (long)packed.size());
+    return 0;
+}
+
+template <class T> static void put(std::vector<char> &dst, T value)
+{
+    const char *p = (const char *)&value;
+    dst.insert(dst.end(), p, p + sizeof(T));
+}
+
+static void putName(std::vector<char> &dst, const char *name)
+{
+    char s[12];
+    memset(s, ' ', sizeof(s));
+    memcpy(s, name, strnlen(name, sizeof(s)));
+    dst.insert(dst.end(), s, s + sizeof(s));
+}
+
+/* the channels of sample spectrum i: a line on a flat baseline in the first half, noise in the second */
+static void sampleData(int i, int n, int nchan, std::vector<float> &data)
+{
+    unsigned int seed = 1 + i;
+    data.resize(nchan);
+    for (int k = 0; k < nchan; k++) {
+        double x = (k - nchan/2)/4.0;
+        data[k] = 0.5f + 3.0f*exp(-0.5*x*x);
+        if (k == i) data[k] += 0.25f;
+        if (2*i >= n) {
+            seed = seed*1103515245u + 12345u;
+            data[k] = (seed >> 8)/(float)(1 << 24) - 0.5f;
+        }
+    }
+}
+
+/* write n sample spectra of nchan channels to a file of type 2, with general, position and spectroscopic sections */
+static bool writeSample(const char *filename, int n, int nchan)
+{
+    Type2Writer writer(filename, n);
+    std::vector<float> data;
+    for (int i = 0; i < n && writer.good(); i++) {
+        ClassObservation obs;
+        obs.version = 1;
+        std::vector<char> &s = obs.sections;
+        put(s, 0.5 + 0.01*i);      /* ut, st, az, el, tau, tsys, time, xunit */
+        put(s, 0.0);
+        put(s, 1.0f);
+        put(s, 0.5f);
+        put(s, 0.1f);
+        put(s, 200.0f + i);
+        put(s, 10.0f);
+        put(s, 0);
+        obs.codes.push_back(-2);
+        obs.lengths.push_back(10);
+        putName(s, (i % 2) ? "SGRB2" : "ORION");
+        put(s, 1);                 /* system, epoch, projection, lambda, beta, angle, offsets */
+        put(s, 2000.0f);
+        put(s, 1);
+        put(s, 83.8*M_PI/180.0);
+        put(s, -5.4*M_PI/180.0);
+        put(s, 0.0);
+        put(s, (float)(i*10.0/3600.0*M_PI/180.0));
+        put(s, 0.0f);
+        obs.codes.push_back(-3);
+        obs.lengths.push_back(14);
+        putName(s, "CO(2-1)");
+        put(s, 230538.0);          /* restf, nchan, rchan, fres, foff, vres, voff, badl, image, vtype, doppler */
+        put(s, nchan);
+        put(s, nchan/2.0f);
+        put(s, 0.5f);
+        put(s, 0.0f);
+        put(s, -0.65f);
+        put(s, 9.0f);
+        put(s, -1000.0f);
+        put(s, 238538.0);
+        put(s, 1);
+        put(s, 0.0);
+        obs.codes.push_back(-4);
+        obs.lengths.push_back(17);
+
+        sampleData(i, n, nchan, data);
+        obs.data.assign((const char *)data.data(), (const char *)(data.data() + nchan));
+
+        ClassEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.xnum = i + 1;
+        entry.xver = 1;
+        strcpy(entry.xsourc, (i % 2) ? "SGRB2       " : "ORION       ");
+        strcpy(entry.xline, "CO(2-1)     ");
+        strcpy(entry.xtel, "APEX-FLASH  ");
+        strcpy(entry.xtype, "EQ  ");
+        entry.xscan = 1000 + i;
+        if (!writer.write(entry, obs)) break;
+    }
+    return writer.close() && writer.count() == n;
+}
+
+/* read the sample back and compare it with what was written */
+static int checkSample(const char *filename, int n, int nchan)
+{
+    ClassReader *reader = openClassFile(filename);
+    int errors = 0;
+    if (!reader || reader->getDirectory() != n) {
+        fprintf(stderr, "failed to read %d spectra from '%s'\n", n, filename);
+        errors = 1;
+    }
+    std::vector<float> data;
+    for (int i = 0; i < n && errors == 0; i++) {
+        SpectrumHeader head = reader->getHead(i+1);
+        std::vector<double> d = reader->getData(i+1);
+        sampleData(i, n, nchan, data);
+        bool same = head.scanno == 1000 + i && strcmp(head.target, (i % 2) ? "SGRB2" : "ORION") == 0
+                 && head.tsys == 200.0 + i && (int)d.size() == nchan;
+        for (int k = 0; k < nchan && same; k++) same = (d[k] == data[k]);
+        if (!same) {
+            fprintf(stderr, "spectrum %d of '%s' differs from what was written\n", i+1, filename);
+            errors++;
+        }
+    }
+    delete reader;
+    return errors;
+}
+
+/*
+ * Rewrite a file as type 2 and as an archive, and read both back. Without
+ * a file, a sample written here is used, with spectra of equal channels
+ * which are XORed with a key when archived, and noisy spectra which do not
+ * compress. The codec is also run on data XORed with a similar key, which
+ * leave long runs of zeros copied from overlapping matches, and on noise,
+ * which stays literal.
+ */
+static int roundTrip(const char *filename)
+{
+    char sample[256], compact[256], archive[256];
+    snprintf(sample, sizeof(sample), "%s/classictest-%d-sample.apex", P_tmpdir, (int)getpid());
+    snprintf(compact, sizeof(compact), "%s/classictest-%d.apex", P_tmpdir, (int)getpid());
+    snprintf(archive, sizeof(archive), "%s/classictest-%d.clar", P_tmpdir, (int)getpid());
+
+    int errors = 0;
+    if (!filename) {
+        const int nsample = 40, nchan = 256;
+        if (!writeSample(sample, nsample, nchan)) errors++;
+        else errors += checkSample(sample, nsample, nchan);
+        printf("sample: %d spectra, %s\n", nsample, errors ? "failed" : "ok");
+        if (errors) {
+            unlink(sample);
+            return errors;
+        }
+        filename = sample;
+    }
+
+    int before = errors;
+    long int n = compactFile(filename, compact);
+    if (n < 0) errors++;
+    else errors += compareFiles(filename, compact);
+    printf("compaction: %ld spectra, %s\n", n, errors > before ? "failed" : "ok");
+
+    before = errors;
+    n = archiveFile(filename, archive);
+    if (n < 0) errors++;
+    else errors += compareFiles(filename, archive);
+    printf("archive: %ld spectra, %s\n", n, errors > before ? "failed" : "ok");
+    unlink(compact);
+    unlink(archive);
+    unlink(sample);
+
+    const int nchan = 4096;
+    std::vector<float> spectrum(nchan), key(nchan);
+    unsigned int seed = 12345;
+    for (int k = 0; k < nchan; k++) {
+        key[k] = 100.0f + 10.0f*sin(0.01*k);
+        spectrum[k] = key[k];
+        if (k % 64 == 0) spectrum[k] += 1.0f;
+    }
+    std::vector<char> data(4*nchan);
+    const char *s = (const char *)spectrum.data(), *m = (const char *)key.data();
+    for (int k = 0; k < 4*nchan; k++) data[k] = s[k] ^ m[k];
+    errors += checkCodec("keyed", data);
+    for (int k = 0; k < 4*nchan; k++) {
+        seed = seed*1103515245u + 12345u;
+        data[k] = (char)(seed >> 16);
+    }
+    errors += checkCodec("incompressible", data);
+    return errors;
+}
 
 int main(int argc, char *argv[])
 {
     if (argc < 2) {
-        fprintf(stderr, "usage: %s <filename>\n", argv[0]);
+        fprintf(stderr, "usage: %s <filename> [<scan>]\n", argv[0]);
+        fprintf(stderr, "       %s -r [<filename>]\n", argv[0]);
         exit(1);
     }
+    if (strcmp(argv[1], "-r") == 0) exit(roundTrip((argc > 2) ? argv[2] : 0) ? 1 : 0);
 
     ClassReader *reader = openClassFile(argv[1]);
     std::vector<SpectrumHeader> shv;
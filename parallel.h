@@ -0,0 +1,65 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSPARALLEL_H
+#define CLASSPARALLEL_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <stdlib.h>
+
+/**
+ * @file parallel.h
+ *
+ * Minimal helpers to spread independent work items over threads.
+ */
+
+/**
+ * Number of worker threads to use by default.
+ *
+ * This is taken from the environment variable CLASSIC_THREADS if set,
+ * otherwise it is the number of hardware threads.
+ */
+inline int defaultThreads()
+{
+    const char *env = getenv("CLASSIC_THREADS");
+    if (env && atoi(env) > 0) return atoi(env);
+    int n = (int)std::thread::hardware_concurrency();
+    return (n > 0) ? n : 1;
+}
+
+/**
+ * Call fn(i, worker) for i = 0..n-1, using up to nthreads threads.
+ *
+ * Items are handed out dynamically, so uneven work is balanced. The worker
+ * index (0..nthreads-1) may be used to address per-thread workspaces.
+ *
+ * @param n number of work items
+ * @param nthreads number of threads, <= 0 for defaultThreads()
+ * @param fn callable taking the item and worker index
+ * @return number of threads actually used
+ */
+template <class Function>
+int parallelFor(int n, int nthreads, Function fn)
+{
+    if (nthreads <= 0) nthreads = defaultThreads();
+    if (nthreads > n) nthreads = n;
+    if (nthreads <= 1) {
+        for (int i = 0; i < n; i++) fn(i, 0);
+        return 1;
+    }
+
+    std::atomic<int> next(0);
+    std::vector<std::thread> workers;
+    for (int w = 0; w < nthreads; w++) {
+        workers.push_back(std::thread([&next, n, &fn, w]() {
+            int i;
+            while ((i = next++) < n) fn(i, w);
+        }));
+    }
+    for (size_t w = 0; w < workers.size(); w++) workers[w].join();
+    return nthreads;
+}
+
+#endif
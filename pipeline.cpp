@@ -0,0 +1,261 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "pipeline.h"
+#include "trace.h"
+
+/* buffers, cached fits and plans, and running sums of one thread */
+struct Pipeline::Worker {
+    std::vector<double> a;                // the spectrum at the current step
+    std::vector<double> b;                // scratch for steps which cannot work in place
+    std::vector<BaselineFit> fits;        // per step
+    std::vector<ResamplePlan> plans;      // per step
+    AverageSums sums;
+};
+
+Pipeline::Pipeline()
+{
+}
+
+void Pipeline::baseline(const BaselineOptions &options)
+{
+    PipelineOperator op;
+    op.step = STEP_BASELINE;
+    op.baseline = options;
+    op.velocity = false;
+    op.mode = RESAMPLE_LINEAR;
+    m_ops.push_back(op);
+}
+
+void Pipeline::smooth(const Smoothing &smoothing)
+{
+    PipelineOperator op;
+    op.step = STEP_SMOOTH;
+    op.smoothing = smoothing;
+    op.velocity = false;
+    op.mode = RESAMPLE_LINEAR;
+    m_ops.push_back(op);
+}
+
+void Pipeline::resample(const SpectralAxis &to, bool velocity, ResampleMode mode)
+{
+    PipelineOperator op;
+    op.step = STEP_RESAMPLE;
+    op.axis = to;
+    op.velocity = velocity;
+    op.mode = mode;
+    m_ops.push_back(op);
+}
+
+void Pipeline::fold()
+{
+    PipelineOperator op;
+    op.step = STEP_FOLD;
+    op.velocity = false;
+    op.mode = RESAMPLE_LINEAR;
+    m_ops.push_back(op);
+}
+
+int Pipeline::size() const
+{
+    return m_ops.size();
+}
+
+int Pipeline::channels(int nchan) const
+{
+    if (nchan < 0) return nchan;
+    for (size_t i = 0; i < m_ops.size(); i++) {
+        if (m_ops[i].step == STEP_SMOOTH)   nchan = m_ops[i].smoothing.channels(nchan);
+        if (m_ops[i].step == STEP_RESAMPLE) nchan = m_ops[i].axis.nchan;
+    }
+    return nchan;
+}
+
+/* frequency and velocity axes of a spectrum as read, which are the same for continuum drifts */
+static void inputAxes(ClassReader *reader, int scan, const ClassDescriptor *desc, SpectralAxis &freq,
+                      SpectralAxis &velo)
+{
+    freq = spectrumAxis(reader, desc, false);
+    velo = spectrumAxis(reader, desc, reader->getIndex()[scan-1].xkind == 0);
+}
+
+/*
+ * Follow both axes through a step. After resampling onto one of them, the
+ * other one is mapped through the channels of the source axis, which keeps
+ * it linear.
+ */
+void Pipeline::axes(const PipelineOperator &op, SpectralAxis &freq, SpectralAxis &velo) const
+{
+    if (op.step == STEP_SMOOTH) {
+        freq.nchan = velo.nchan = op.smoothing.channels(freq.nchan);
+        op.smoothing.axis(freq.ref, freq.df);
+        op.smoothing.axis(velo.ref, velo.df);
+    } else if (op.step == STEP_RESAMPLE) {
+        SpectralAxis &from = op.velocity ? velo : freq;
+        SpectralAxis &other = op.velocity ? freq : velo;
+        double v1 = other.value(from.channel(op.axis.value(1)));
+        double v2 = other.value(from.channel(op.axis.value(2)));
+        other = SpectralAxis(op.axis.nchan, v1, 1.0, v2 - v1);
+        from = op.axis;
+    }
+}
+
+/*
+ * Decode a spectrum into worker.a and take it through all steps. If the
+ * first step smoothes, it is done while decoding.
+ */
+bool Pipeline::run(Worker &worker, ClassReader *reader, int scan, const ClassDescriptor *&desc, SpectralAxis &freq)
+{
+    desc = reader->getDescriptor(scan, true);
+    if (desc == 0 || desc->data == 0 || desc->ndata <= 0) return false;
+
+    SpectralAxis velo;
+    inputAxes(reader, scan, desc, freq, velo);
+    std::vector<double> &a = worker.a;
+    int n = desc->ndata;
+    size_t first = 0;
+    if (!m_ops.empty() && m_ops[0].step == STEP_SMOOTH) {
+        a.resize(m_ops[0].smoothing.channels(n));
+        m_ops[0].smoothing.apply((const char *)desc->data, n, desc->badl, a.data());
+        axes(m_ops[0], freq, velo);
+        first = 1;
+    } else {
+        /* the raw data need not be aligned */
+        a.resize(n);
+        const char *raw = (const char *)desc->data;
+        float badl = desc->badl;
+        for (int k = 0; k < n; k++) {
+            float v;
+            memcpy(&v, raw + k*sizeof(float), sizeof(float));
+            a[k] = (v != badl) ? v : NAN;
+        }
+    }
+
+    for (size_t i = first; i < m_ops.size(); i++) {
+        const PipelineOperator &op = m_ops[i];
+        n = a.size();
+        if (n == 0) break;
+        if (op.step == STEP_BASELINE) {
+            bool velocity;
+            int degree;
+            std::vector<double> w1, w2;
+            baselineWindows(desc, op.baseline, velocity, degree, w1, w2);
+            const SpectralAxis &axis = velocity ? velo : freq;
+            BaselineFit &fit = worker.fits[i];
+            if (!fit.matches(axis, degree, w1, w2)) fit = BaselineFit(axis, degree, w1, w2);
+            fit.subtract(a.data(), a.data());
+        } else if (op.step == STEP_SMOOTH) {
+            op.smoothing.apply(a.data(), n, a.data());
+            a.resize(op.smoothing.channels(n));
+        } else if (op.step == STEP_FOLD) {
+            if (!foldable(desc)) return false;
+            worker.b.resize(n);
+            if (!foldSpectrum(desc, a.data(), n, freq.df, worker.b.data())) return false;
+            a.swap(worker.b);
+        } else {
+            const SpectralAxis &from = op.velocity ? velo : freq;
+            ResamplePlan &plan = worker.plans[i];
+            if (plan.source().nchan == 0 || !plan.source().same(from, 1.0e-6)) plan = ResamplePlan(from, op.axis, op.mode);
+            worker.b.resize(op.axis.nchan);
+            plan.apply(a.data(), worker.b.data());
+            a.swap(worker.b);
+        }
+        axes(op, freq, velo);
+    }
+    return true;
+}
+
+int Pipeline::block(const std::vector<ScanRef> &refs, std::vector<double> &block, int nthreads)
+{
+    TraceScope trace("pipeline", refs.size(), "count");
+    int n = refs.size();
+
+    /* widths first, so that the block is allocated once */
+    int width = 0;
+    std::vector<int> widths(n, 0);
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int) {
+        widths[pos] = channels(reader->getChannels(scan));
+    });
+    for (int i = 0; i < n; i++) {
+        if (widths[i] > width) width = widths[i];
+    }
+    block.assign((size_t)n*width, NAN);
+    if (width == 0) return width;
+
+    if (nthreads <= 0) nthreads = defaultThreads();
+    std::vector<Worker> workers(nthreads);
+    for (int w = 0; w < nthreads; w++) {
+        workers[w].fits.resize(m_ops.size());
+        workers[w].plans.resize(m_ops.size());
+    }
+
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int worker) {
+        Worker &w = workers[worker];
+        const ClassDescriptor *desc;
+        SpectralAxis freq;
+        if (!run(w, reader, scan, desc, freq)) return;
+        size_t m = (w.a.size() < (size_t)width) ? w.a.size() : width;
+        if (m > 0) memcpy(&block[(size_t)pos*width], w.a.data(), m*sizeof(double));
+    });
+    return width;
+}
+
+bool Pipeline::average(const std::vector<ScanRef> &refs, Weighting weighting, AverageResult &result, int nthreads)
+{
+    TraceScope trace("pipeline", refs.size(), "count");
+    result = AverageResult();
+
+    /* the axis of the first readable spectrum after all steps is the axis of the average */
+    size_t first = 0;
+    SpectralAxis axis;
+    for (first = 0; first < refs.size(); first++) {
+        ClassReader *reader = refs[first].reader;
+        const ClassDescriptor *desc = reader->getDescriptor(refs[first].scan, false);
+        if (desc) {
+            SpectralAxis velo;
+            inputAxes(reader, refs[first].scan, desc, axis, velo);
+            for (size_t i = 0; i < m_ops.size(); i++) axes(m_ops[i], axis, velo);
+            result.head = reader->getHead(refs[first].scan);
+            result.head.df = axis.df;
+            break;
+        }
+    }
+    int nchan = axis.nchan;
+    if (first == refs.size() || nchan <= 0) {
+        result.nskip = refs.size();
+        return false;
+    }
+    result.freq = axis.values();
+
+    if (nthreads <= 0) nthreads = defaultThreads();
+    std::vector<Worker> workers(nthreads);
+    for (int w = 0; w < nthreads; w++) {
+        Worker &a = workers[w];
+        a.fits.resize(m_ops.size());
+        a.plans.resize(m_ops.size());
+        a.sums.reset(nchan);
+    }
+
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int, int worker) {
+        Worker &a = workers[worker];
+        const ClassDescriptor *desc;
+        SpectralAxis freq;
+        if (!run(a, reader, scan, desc, freq)) {
+            a.sums.nskip++;
+            return;
+        }
+        if (!axis.same(freq)) {
+            a.sums.nincompatible++;
+            a.sums.nskip++;
+            return;
+        }
+        double w = spectrumWeight(desc, weighting);
+        if (!(w > 0.0)) {
+            a.sums.nskip++;
+            return;
+        }
+        a.sums.add(a.a.data(), (double)NAN, desc, w);
+    });
+
+    /* reduce the workers' sums */
+    for (int w = 1; w < nthreads; w++) workers[0].sums.reduce(workers[w].sums);
+    return workers[0].sums.finish(refs[first], result);
+}
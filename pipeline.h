@@ -0,0 +1,103 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSPIPELINE_H
+#define CLASSPIPELINE_H
+
+#include <vector>
+
+#include "average.h"
+#include "baseline.h"
+#include "class.h"
+#include "dataset.h"
+#include "fold.h"
+#include "resample.h"
+#include "smooth.h"
+
+/**
+ * @file pipeline.h
+ */
+
+/**
+ * @brief Steps of a pipeline.
+ */
+enum PipelineStep {
+    STEP_BASELINE,        ///< subtract a polynomial baseline
+    STEP_SMOOTH,          ///< smooth and bin
+    STEP_RESAMPLE,        ///< resample onto an axis
+    STEP_FOLD             ///< fold frequency-switched spectra
+};
+
+/**
+ * @brief One step of a pipeline with its parameters.
+ */
+struct PipelineOperator {
+    PipelineStep step;            ///< what to do
+    BaselineOptions baseline;     ///< for STEP_BASELINE
+    Smoothing smoothing;          ///< for STEP_SMOOTH
+    SpectralAxis axis;            ///< target axis for STEP_RESAMPLE
+    bool velocity;                ///< for STEP_RESAMPLE, axis is in velocity
+    ResampleMode mode;            ///< for STEP_RESAMPLE
+};
+
+/**
+ * @brief A chain of operators applied to every spectrum, followed by a
+ * reducer.
+ *
+ * Every spectrum is decoded once and taken through all steps in a pair of
+ * per-thread buffers, before it is added to the result, so that no
+ * intermediate results of the selection as a whole are kept. Baseline fits
+ * and resampling plans are cached per thread and step, as long as the axis
+ * of the spectra does not change. The axis of a spectrum, both in
+ * frequency (or time) and in velocity, follows it through the steps, so
+ * that windows and target axes refer to the axis at that step.
+ */
+class Pipeline {
+ public:
+    Pipeline();
+
+    /** Append a baseline subtraction. */
+    void baseline(const BaselineOptions &options);
+    /** Append smoothing and binning. */
+    void smooth(const Smoothing &smoothing);
+    /** Append resampling onto an axis, in velocity if velocity is set. */
+    void resample(const SpectralAxis &to, bool velocity, ResampleMode mode);
+    /** Append folding, which skips spectra that are not foldable(). */
+    void fold();
+
+    /** Return the number of steps. */
+    int size() const;
+    /** Return the number of channels after all steps, for nchan channels read. */
+    int channels(int nchan) const;
+
+    /**
+     * Reduce the referenced spectra to a row-major block, padded with NaN
+     * to the largest number of channels after all steps.
+     *
+     * @param refs the spectra
+     * @param block the block
+     * @param nthreads number of threads, <= 0 for the default
+     * @return the width of the block
+     */
+    int block(const std::vector<ScanRef> &refs, std::vector<double> &block, int nthreads = 0);
+    /**
+     * Reduce the referenced spectra to their weighted average, see average().
+     * Spectra whose axis after all steps differs from that of the first
+     * one are skipped.
+     *
+     * @param refs the spectra
+     * @param weighting how to weight the spectra
+     * @param result the average
+     * @param nthreads number of threads, <= 0 for the default
+     * @return false if not a single spectrum could be averaged
+     */
+    bool average(const std::vector<ScanRef> &refs, Weighting weighting, AverageResult &result, int nthreads = 0);
+
+ private:
+    struct Worker;
+    void axes(const PipelineOperator &op, SpectralAxis &freq, SpectralAxis &velo) const;
+    bool run(Worker &worker, ClassReader *reader, int scan, const ClassDescriptor *&desc, SpectralAxis &freq);
+
+    std::vector<PipelineOperator> m_ops;
+};
+
+#endif
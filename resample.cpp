@@ -0,0 +1,142 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "resample.h"
+#include "trace.h"
+
+SpectralAxis spectrumAxis(ClassReader *reader, const ClassDescriptor *desc, bool velocity)
+{
+    if (velocity) return SpectralAxis(desc->ndata, desc->voff, desc->rchan, desc->vres);
+
+    double f0, ref, df;
+    reader->axis(f0, ref, df);
+    return SpectralAxis(desc->ndata, f0, ref, df);
+}
+
+ResamplePlan::ResamplePlan() : m_mode(RESAMPLE_LINEAR)
+{
+    m_start.push_back(0);
+}
+
+/*
+ * Source channels are addressed by their centre, in 0-based fractional
+ * channel units of the source axis: target channel k lies at
+ * from.channel(to.value(k+1)) - 1.
+ */
+ResamplePlan::ResamplePlan(const SpectralAxis &from, const SpectralAxis &to, ResampleMode mode)
+    : m_from(from), m_to(to), m_mode(mode)
+{
+    int n = from.nchan;
+    m_start.reserve(to.nchan+1);
+    for (int k = 0; k < to.nchan; k++) {
+        m_start.push_back(m_index.size());
+        if (from.df == 0.0) continue;
+        double x = from.channel(to.value(k+1)) - 1.0;
+
+        if (mode == RESAMPLE_NEAREST) {
+            int i = (int)floor(x + 0.5);
+            if (i < 0 || i >= n) continue;
+            m_index.push_back(i);
+            m_weight.push_back(1.0);
+        } else if (mode == RESAMPLE_LINEAR) {
+            if (x < -0.5 || x > n - 0.5) continue;
+            int i = (int)floor(x);
+            double t = x - i;
+            /* within half a channel of the ends, the end channel is used */
+            if (i < 0)       { i = 0;   t = 0.0; }
+            if (i >= n - 1)  { i = n-1; t = 0.0; }
+            m_index.push_back(i);
+            m_weight.push_back(1.0 - t);
+            if (t > 0.0) {
+                m_index.push_back(i+1);
+                m_weight.push_back(t);
+            }
+        } else {
+            /* edges of the target channel, in source channels */
+            double a = from.channel(to.value(k+0.5)) - 1.0;
+            double b = from.channel(to.value(k+1.5)) - 1.0;
+            if (a > b) { double c = a; a = b; b = c; }
+            int i0 = (int)floor(a + 0.5);
+            int i1 = (int)floor(b + 0.5);
+            if (i0 < 0) i0 = 0;
+            if (i1 > n-1) i1 = n-1;
+            for (int i = i0; i <= i1; i++) {
+                double lo = (a > i - 0.5) ? a : i - 0.5;
+                double hi = (b < i + 0.5) ? b : i + 0.5;
+                if (hi > lo) {
+                    m_index.push_back(i);
+                    m_weight.push_back(hi - lo);
+                }
+            }
+        }
+    }
+    m_start.push_back(m_index.size());
+}
+
+const SpectralAxis &ResamplePlan::source() const
+{
+    return m_from;
+}
+
+ResampleMode ResamplePlan::mode() const
+{
+    return m_mode;
+}
+
+void ResamplePlan::apply(const float *src, float badl, double *dst) const
+{
+    resample(src, badl, dst);
+}
+
+void ResamplePlan::apply(const double *src, double *dst) const
+{
+    resample(src, (double)NAN, dst);
+}
+
+template <typename T>
+void ResamplePlan::resample(const T *src, T badl, double *dst) const
+{
+    const int *start = &m_start[0];
+    const int *index = m_index.empty() ? 0 : &m_index[0];
+    const double *weight = m_weight.empty() ? 0 : &m_weight[0];
+    int nto = m_start.size() - 1;
+
+    for (int k = 0; k < nto; k++) {
+        double sum = 0.0, wsum = 0.0, wall = 0.0;
+        for (int j = start[k]; j < start[k+1]; j++) {
+            T v = src[index[j]];
+            bool good = (v == v) & (v != badl);
+            double w = good ? weight[j] : 0.0;
+            sum += w*(good ? v : (T)0);
+            wsum += w;
+            wall += weight[j];
+        }
+        dst[k] = (wsum > 0.0 && wsum >= 0.5*wall) ? sum/wsum : NAN;
+    }
+}
+
+void resampleBlock(const std::vector<ScanRef> &refs, const SpectralAxis &to, bool velocity, ResampleMode mode,
+                   std::vector<double> &block, int nthreads)
+{
+    TraceScope trace("resample", refs.size(), "count");
+    block.assign(refs.size()*to.nchan, NAN);
+    if (to.nchan == 0) return;
+
+    /* a plan per worker, reused as long as the source axis does not change */
+    if (nthreads <= 0) nthreads = defaultThreads();
+    std::vector<ResamplePlan> plans(nthreads);
+    std::vector<std::vector<float> > values(nthreads);
+
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int worker) {
+        const ClassDescriptor *desc = reader->getDescriptor(scan, true);
+        if (desc == 0 || desc->data == 0) return;
+
+        SpectralAxis from = spectrumAxis(reader, desc, velocity);
+        ResamplePlan &plan = plans[worker];
+        if (plan.source().nchan == 0 || !plan.source().same(from, 1.0e-6)) plan = ResamplePlan(from, to, mode);
+
+        /* the raw data need not be aligned */
+        std::vector<float> &v = values[worker];
+        v.resize(from.nchan);
+        if (from.nchan > 0) memcpy(&v[0], desc->data, from.nchan*sizeof(float));
+        plan.apply(from.nchan > 0 ? &v[0] : 0, desc->badl, &block[(size_t)pos*to.nchan]);
+    });
+}
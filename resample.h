@@ -0,0 +1,82 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSRESAMPLE_H
+#define CLASSRESAMPLE_H
+
+#include <vector>
+
+#include "class.h"
+#include "dataset.h"
+
+/**
+ * @file resample.h
+ */
+
+/**
+ * Return the axis of the spectrum last read by reader, in frequency (or
+ * time, for continuum drifts) or in velocity.
+ */
+SpectralAxis spectrumAxis(ClassReader *reader, const ClassDescriptor *desc, bool velocity);
+
+/**
+ * @brief How values are taken from the source channels.
+ */
+enum ResampleMode {
+    RESAMPLE_NEAREST,     ///< value of the nearest channel
+    RESAMPLE_LINEAR,      ///< linear interpolation between the two nearest channels
+    RESAMPLE_FLUX         ///< mean over the source channels, weighted by their overlap with the target channel
+};
+
+/**
+ * @brief The weights mapping one axis onto another.
+ *
+ * Every target channel is a weighted sum of a few source channels, stored
+ * as a sparse matrix, so that spectra with the same axis are resampled
+ * without computing weights again. Bad source channels (the blanking value
+ * or NaN) are left out and the remaining weights renormalised. Target
+ * channels where less than half of the weight is valid are NaN, as are
+ * those outside the source axis.
+ */
+class ResamplePlan {
+ public:
+    ResamplePlan();
+    ResamplePlan(const SpectralAxis &from, const SpectralAxis &to, ResampleMode mode);
+
+    const SpectralAxis &source() const;     ///< the axis resampled from
+    ResampleMode mode() const;              ///< the mode of the plan
+    /**
+     * Resample src, of source().nchan channels, onto the target axis.
+     */
+    void apply(const float *src, float badl, double *dst) const;
+    /**
+     * Resample src, already decoded with bad channels as NaN.
+     */
+    void apply(const double *src, double *dst) const;
+
+ private:
+    template <typename T> void resample(const T *src, T badl, double *dst) const;
+
+    SpectralAxis m_from;
+    SpectralAxis m_to;
+    ResampleMode m_mode;
+    std::vector<int> m_start;       // first weight of every target channel, and one past the end
+    std::vector<int> m_index;       // source channel, 0-based
+    std::vector<double> m_weight;
+};
+
+/**
+ * Resample the referenced spectra onto a common axis, as a row-major block
+ * of refs.size() rows of to.nchan channels. Rows of spectra that could not
+ * be read are NaN.
+ *
+ * @param refs the spectra
+ * @param to the target axis
+ * @param velocity if set, to is a velocity axis
+ * @param mode how to resample
+ * @param block the block
+ * @param nthreads number of threads, <= 0 for the default
+ */
+void resampleBlock(const std::vector<ScanRef> &refs, const SpectralAxis &to, bool velocity, ResampleMode mode,
+                   std::vector<double> &block, int nthreads = 0);
+
+#endif
@@ -1,6 +1,9 @@
 from distutils.core import setup, Extension
 
-module = Extension('classic', sources = ['classicModule.cpp', 'class.cpp'])
+module = Extension('classic',
+                   sources = ['classicModule.cpp', 'class.cpp', 'archive.cpp', 'average.cpp', 'baseline.cpp', 'coords.cpp', 'dataset.cpp', 'export.cpp', 'fold.cpp', 'gauss.cpp', 'grid.cpp', 'lines.cpp', 'pipeline.cpp', 'resample.cpp', 'smooth.cpp', 'source.cpp', 'spatial.cpp', 'stats.cpp', 'times.cpp', 'trace.cpp', 'writer.cpp'],
+                   extra_compile_args = ['-pthread', '-O3', '-fno-trapping-math'],
+                   extra_link_args = ['-pthread'])
 
 setup (name = 'PackageName',
        version = '1.0',
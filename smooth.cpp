@@ -0,0 +1,148 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include "smooth.h"
+
+Smoothing::Smoothing() : kernel(SMOOTH_NONE), width(1), bin(1)
+{
+}
+
+Smoothing::Smoothing(SmoothKernel k, int w, int b) : kernel(k), width(w), bin(b)
+{
+}
+
+bool Smoothing::active() const
+{
+    return kernel != SMOOTH_NONE || bin > 1;
+}
+
+int Smoothing::channels(int nchan) const
+{
+    return (bin > 1) ? nchan/bin : nchan;
+}
+
+/*
+ * Binned channel j (1-based) is centred on raw channel (j-1)*bin + (bin+1)/2,
+ * so the reference channel moves accordingly.
+ */
+void Smoothing::axis(double &ref, double &df) const
+{
+    if (bin <= 1) return;
+    ref = (ref - 0.5*(bin+1))/bin + 1.0;
+    df *= bin;
+}
+
+/*
+ * Values are copied once into a padded scratch array, with bad channels set
+ * to zero and a separate array of weights, so that the kernel and binning
+ * loops below are free of branches.
+ */
+template <typename T>
+static void maskValues(std::vector<T> &val, std::vector<T> &good, int nchan, T badl)
+{
+    T *v = &val[0];
+    T *g = &good[0];
+    v[0] = v[nchan+1] = 0;
+    g[0] = g[nchan+1] = 0;
+    for (int k = 1; k <= nchan; k++) {
+        T x = v[k];
+        bool ok = (x == x) & (x != badl);
+        g[k] = ok ? 1 : 0;
+        v[k] = ok ? x : 0;
+    }
+}
+
+/* smooth and bin the masked values v, with weights g, both padded by one channel at either end */
+template <typename T>
+static void smoothMasked(const Smoothing &smoothing, const T *v, const T *g, int nchan, double *dst)
+{
+    static thread_local std::vector<double> sval, sgood;
+    SmoothKernel kernel = smoothing.kernel;
+    int width = smoothing.width;
+    int bin = smoothing.bin;
+
+    /* kernel: sval is the smoothed value, sgood 1 where it is valid */
+    sval.resize(nchan);
+    sgood.resize(nchan);
+    double *sv = &sval[0];
+    double *sg = &sgood[0];
+    if (kernel == SMOOTH_HANNING) {
+        for (int k = 0; k < nchan; k++) {
+            double s = 0.25*v[k] + 0.5*v[k+1] + 0.25*v[k+2];
+            double w = 0.25*g[k] + 0.5*g[k+1] + 0.25*g[k+2];
+            bool ok = (w >= 0.5);
+            sv[k] = s/(ok ? w : 1.0);
+            sg[k] = ok ? 1.0 : 0.0;
+        }
+    } else if (kernel == SMOOTH_BOXCAR && width > 1) {
+        /* running sums, so that the cost does not depend on the width */
+        int h = width/2;
+        double s = 0.0, w = 0.0;
+        for (int k = 1; k <= h && k <= nchan; k++) {
+            s += v[k];
+            w += g[k];
+        }
+        for (int k = 0; k < nchan; k++) {
+            int in = k+1+h;
+            int out = k-h;
+            if (in <= nchan) {
+                s += v[in];
+                w += g[in];
+            }
+            if (out >= 1) {
+                s -= v[out];
+                w -= g[out];
+            }
+            bool ok = (2.0*w >= width) & (w > 0.0);
+            sv[k] = ok ? s/w : 0.0;
+            sg[k] = ok ? 1.0 : 0.0;
+        }
+    } else {
+        for (int k = 0; k < nchan; k++) {
+            sv[k] = v[k+1];
+            sg[k] = g[k+1];
+        }
+    }
+
+    if (bin <= 1) {
+        for (int k = 0; k < nchan; k++) dst[k] = (sg[k] > 0.0) ? sv[k] : NAN;
+        return;
+    }
+    int nout = nchan/bin;
+    for (int j = 0; j < nout; j++) {
+        double s = 0.0, w = 0.0;
+        const double *pv = sv + (size_t)j*bin;
+        const double *pg = sg + (size_t)j*bin;
+        for (int i = 0; i < bin; i++) {
+            s += pv[i]*pg[i];
+            w += pg[i];
+        }
+        dst[j] = (2.0*w >= bin) ? s/w : NAN;
+    }
+}
+
+void Smoothing::apply(const char *src, int nchan, float badl, double *dst) const
+{
+    static thread_local std::vector<float> val, good;
+    if (nchan <= 0) return;
+
+    val.resize(nchan+2);
+    good.resize(nchan+2);
+    memcpy(&val[1], src, nchan*sizeof(float));
+    maskValues(val, good, nchan, badl);
+    smoothMasked(*this, &val[0], &good[0], nchan, dst);
+}
+
+void Smoothing::apply(const double *src, int nchan, double *dst) const
+{
+    static thread_local std::vector<double> val, good;
+    if (nchan <= 0) return;
+
+    val.resize(nchan+2);
+    good.resize(nchan+2);
+    memcpy(&val[1], src, nchan*sizeof(double));
+    maskValues(val, good, nchan, (double)NAN);
+    smoothMasked(*this, &val[0], &good[0], nchan, dst);
+}
@@ -0,0 +1,55 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSSMOOTH_H
+#define CLASSSMOOTH_H
+
+/**
+ * @file smooth.h
+ */
+
+/**
+ * @brief Smoothing kernels.
+ */
+enum SmoothKernel {
+    SMOOTH_NONE,          ///< no smoothing
+    SMOOTH_BOXCAR,        ///< running mean over an odd number of channels
+    SMOOTH_HANNING        ///< weights 1/4, 1/2, 1/4
+};
+
+/**
+ * @brief How spectra are smoothed and binned while they are decoded.
+ *
+ * The kernel is applied first, then every bin consecutive channels are
+ * averaged into one, dropping channels left over at the end. Bad channels
+ * (the blanking value or NaN) are left out and the remaining weights
+ * renormalised; an output channel is NaN if less than half of its weight
+ * is valid.
+ */
+struct Smoothing {
+    Smoothing();                                      ///< no smoothing, no binning
+    Smoothing(SmoothKernel kernel, int width, int bin); ///< constructor
+
+    SmoothKernel kernel;  ///< the kernel
+    int width;            ///< width of the boxcar, odd
+    int bin;              ///< number of channels binned into one
+
+    bool active() const;                  ///< true if the data are changed at all
+    int channels(int nchan) const;        ///< number of channels after binning nchan
+    /**
+     * Transform the reference channel and channel width of an axis to
+     * those of the binned channels.
+     */
+    void axis(double &ref, double &df) const;
+    /**
+     * Smooth and bin nchan raw values, which need not be aligned, into
+     * channels(nchan) values. Bad channels become NaN.
+     */
+    void apply(const char *src, int nchan, float badl, double *dst) const;
+    /**
+     * Smooth and bin nchan values already decoded, with bad channels as
+     * NaN. src and dst may be the same.
+     */
+    void apply(const double *src, int nchan, double *dst) const;
+};
+
+#endif
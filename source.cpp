@@ -0,0 +1,226 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "source.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+ClassSource::~ClassSource()
+{
+}
+
+const char *ClassSource::data(long offset, size_t len)
+{
+    return 0;
+}
+
+long ClassSource::size()
+{
+    return -1;
+}
+
+FilePool &FilePool::instance()
+{
+    /* never destroyed, as sources may still be deleted while the program exits */
+    static FilePool *pool = new FilePool();
+    return *pool;
+}
+
+FilePool::FilePool()
+{
+    const char *env = getenv("CLASSIC_MAXFILES");
+    if (env && atoi(env) > 0) {
+        m_limit = atoi(env);
+    } else {
+        struct rlimit rl;
+        m_limit = 512;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) m_limit = rl.rlim_cur/2;
+        if (m_limit < 16) m_limit = 16;
+    }
+}
+
+void FilePool::setLimit(int limit)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_limit = (limit > 1) ? limit : 1;
+    evict(m_limit);
+}
+
+int FilePool::getLimit()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_limit;
+}
+
+int FilePool::getOpen()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lru.size();
+}
+
+/*
+ * Close least recently used idle descriptors until at most target are open.
+ * Called with the mutex held, returns false if not enough were idle.
+ */
+bool FilePool::evict(size_t target)
+{
+    std::list<FileSource *>::iterator it = m_lru.end();
+    while (m_lru.size() > target && it != m_lru.begin()) {
+        --it;
+        FileSource *source = *it;
+        if (source->m_busy > 0) continue;
+        close(source->m_fd);
+        source->m_fd = -1;
+        it = m_lru.erase(it);
+    }
+    return m_lru.size() <= target;
+}
+
+/* return the open descriptor of source, marked busy until release() */
+int FilePool::acquire(FileSource *source)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (source->m_fd >= 0) {
+        m_lru.splice(m_lru.begin(), m_lru, source->m_entry);
+        source->m_busy++;
+        return source->m_fd;
+    }
+
+    /* if all descriptors are busy, the limit is exceeded for a while */
+    evict(m_limit-1);
+    int fd = open(source->m_name, O_RDONLY);
+    while (fd < 0 && (errno == EMFILE || errno == ENFILE) && !m_lru.empty() && evict(m_lru.size()-1)) {
+        fd = open(source->m_name, O_RDONLY);
+    }
+    if (fd < 0) return -1;
+
+    source->m_fd = fd;
+    source->m_entry = m_lru.insert(m_lru.begin(), source);
+    source->m_busy++;
+    return fd;
+}
+
+void FilePool::release(FileSource *source)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    source->m_busy--;
+}
+
+void FilePool::remove(FileSource *source)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (source->m_fd >= 0) {
+        close(source->m_fd);
+        source->m_fd = -1;
+        m_lru.erase(source->m_entry);
+    }
+}
+
+FileSource::FileSource(const char *filename) : m_fd(-1), m_owned(true), m_pooled(true), m_busy(0)
+{
+    strncpy(m_name, filename, sizeof(m_name)-1);
+    m_name[sizeof(m_name)-1] = '\0';
+
+    /* open once, leaving the descriptor in the pool for the reads to come */
+    FilePool &pool = FilePool::instance();
+    m_good = (pool.acquire(this) >= 0);
+    if (m_good) pool.release(this);
+}
+
+FileSource::FileSource(int fd, bool owned) : m_fd(fd), m_owned(owned), m_pooled(false), m_good(fd >= 0), m_busy(0)
+{
+    snprintf(m_name, sizeof(m_name), "<fd %d>", fd);
+}
+
+FileSource::~FileSource()
+{
+    if (m_pooled) FilePool::instance().remove(this);
+    else if (m_owned && m_fd >= 0) close(m_fd);
+}
+
+size_t FileSource::read(long offset, void *dst, size_t len)
+{
+    int fd = m_fd;
+    if (m_pooled) {
+        fd = FilePool::instance().acquire(this);
+        if (fd < 0) return 0;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, (char *)dst + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+
+    if (m_pooled) FilePool::instance().release(this);
+    return done;
+}
+
+long FileSource::size()
+{
+    int fd = m_fd;
+    if (m_pooled) {
+        fd = FilePool::instance().acquire(this);
+        if (fd < 0) return -1;
+    }
+
+    struct stat st;
+    long size = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) ? (long)st.st_size : -1;
+
+    if (m_pooled) FilePool::instance().release(this);
+    return size;
+}
+
+const char *FileSource::name()
+{
+    return m_name;
+}
+
+bool FileSource::good()
+{
+    return m_good;
+}
+
+MemorySource::MemorySource(const void *data, size_t len) : m_data((const char *)data), m_len(len)
+{
+}
+
+MemorySource::~MemorySource()
+{
+}
+
+size_t MemorySource::read(long offset, void *dst, size_t len)
+{
+    if (offset < 0 || (size_t)offset >= m_len) return 0;
+    if (len > m_len - offset) len = m_len - offset;
+    memcpy(dst, m_data + offset, len);
+    return len;
+}
+
+const char *MemorySource::data(long offset, size_t len)
+{
+    if (offset < 0 || (size_t)offset > m_len || len > m_len - offset) return 0;
+    return m_data + offset;
+}
+
+long MemorySource::size()
+{
+    return (long)m_len;
+}
+
+const char *MemorySource::name()
+{
+    return "<memory>";
+}
+
+bool MemorySource::good()
+{
+    return m_data != 0;
+}
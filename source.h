@@ -0,0 +1,146 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSSOURCE_H
+#define CLASSSOURCE_H
+
+#include <list>
+#include <mutex>
+
+#include <stddef.h>
+
+/**
+ * @file source.h
+ */
+
+/**
+ * @brief The origin of the bytes of a CLASSIC file.
+ *
+ * Readers access their file only through positioned reads, so that the
+ * same code serves files on disk, open file descriptors and memory
+ * regions, and so that several threads may read from one source.
+ */
+class ClassSource {
+ public:
+    virtual ~ClassSource();
+
+    /**
+     * Read bytes at a given position.
+     *
+     * @param offset position in bytes from the start of the file
+     * @param dst destination buffer of at least len bytes
+     * @param len number of bytes to read
+     * @return number of bytes read, less than len at end of file or on error
+     */
+    virtual size_t read(long offset, void *dst, size_t len) = 0;
+    /**
+     * Direct access to bytes at a given position, without copying.
+     *
+     * @return pointer to len bytes, or NULL if the source is not in memory
+     *         or the range is not completely inside the source
+     */
+    virtual const char *data(long offset, size_t len);
+    /**
+     * @return the size of the source in bytes, or -1 if it is not known
+     */
+    virtual long size();
+    /**
+     * @return a name describing the source, used in messages
+     */
+    virtual const char *name() = 0;
+    /**
+     * @return true if the source could be opened
+     */
+    virtual bool good() = 0;
+};
+
+class FileSource;
+
+/**
+ * @brief The shared manager of the descriptors of files opened by name.
+ *
+ * A FileSource opened by name holds a descriptor only while it is in this
+ * pool. Descriptors are opened when needed, and the least recently used
+ * idle ones are closed when the limit is reached, so that any number of
+ * sources may exist at the same time. The limit defaults to the environment
+ * variable CLASSIC_MAXFILES, or to half the soft limit of open files.
+ */
+class FilePool {
+ public:
+    static FilePool &instance();     ///< the pool used by all file sources
+
+    void setLimit(int limit);        ///< set maximum number of open descriptors, closing idle ones if needed
+    int getLimit();                  ///< maximum number of open descriptors
+    int getOpen();                   ///< number of descriptors open right now
+
+ private:
+    friend class FileSource;
+    FilePool();
+
+    int acquire(FileSource *source);
+    void release(FileSource *source);
+    void remove(FileSource *source);
+    bool evict(size_t target);
+
+    std::mutex m_mutex;
+    std::list<FileSource *> m_lru;   // sources with open descriptors, most recently used first
+    size_t m_limit;
+};
+
+/**
+ * A source reading from a file, or from an already open file descriptor.
+ */
+class FileSource : public ClassSource {
+ public:
+    /**
+     * Read the named file. Its descriptor is managed by the FilePool, the
+     * file is only checked to be readable here.
+     */
+    FileSource(const char *filename);
+    /**
+     * Read from an open file descriptor. Positioned reads are used, so the
+     * file offset of the descriptor is left alone.
+     *
+     * @param fd the file descriptor
+     * @param owned if true, the descriptor is closed with the source
+     */
+    FileSource(int fd, bool owned);
+    ~FileSource();
+
+    size_t read(long offset, void *dst, size_t len);
+    long size();
+    const char *name();
+    bool good();
+
+ private:
+    friend class FilePool;
+
+    int m_fd;
+    bool m_owned;
+    bool m_pooled;                               // descriptor managed by the pool
+    bool m_good;
+    int m_busy;                                  // reads in progress, guarded by the pool
+    std::list<FileSource *>::iterator m_entry;   // position in the pool, if open
+    char m_name[256];
+};
+
+/**
+ * A source reading from a caller-owned memory region, which has to stay
+ * valid for the lifetime of the source. Nothing is copied.
+ */
+class MemorySource : public ClassSource {
+ public:
+    MemorySource(const void *data, size_t len);
+    ~MemorySource();
+
+    size_t read(long offset, void *dst, size_t len);
+    const char *data(long offset, size_t len);
+    long size();
+    const char *name();
+    bool good();
+
+ private:
+    const char *m_data;
+    size_t m_len;
+};
+
+#endif
@@ -0,0 +1,267 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "spatial.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <math.h>
+
+#define ARCSEC (180.0*3600.0/M_PI)    // arcsec per radian
+#define DEG (M_PI/180.0)              // radians per degree
+
+/* RA in [0, 360) */
+static inline double wrapRA(double x)
+{
+    double ra = fmod(fmod(x, 360.0) + 360.0, 360.0);
+    return (ra < 360.0) ? ra : 0.0;
+}
+
+SpatialIndex::SpatialIndex()
+    : m_spherical(false), m_nx(1), m_ny(1), m_x0(0.0), m_y0(0.0), m_sx(1.0), m_sy(1.0)
+{
+    m_start.assign(2, 0);
+}
+
+void SpatialIndex::build(const std::vector<double> &x, const std::vector<double> &y, const std::vector<int> &ids,
+                         bool spherical)
+{
+    m_spherical = spherical;
+    int n = 0;
+    double xmin = HUGE_VAL, xmax = -HUGE_VAL, ymin = HUGE_VAL, ymax = -HUGE_VAL;
+    for (size_t i = 0; i < x.size(); i++) {
+        if (x[i] != x[i] || y[i] != y[i]) continue;
+        n++;
+        if (x[i] < xmin) xmin = x[i];
+        if (x[i] > xmax) xmax = x[i];
+        if (y[i] < ymin) ymin = y[i];
+        if (y[i] > ymax) ymax = y[i];
+    }
+    if (spherical && n > 0) {
+        /* the shortest arc of RA holding all points, which is the circle without the widest gap between them */
+        std::vector<double> ra;
+        ra.reserve(n);
+        for (size_t i = 0; i < x.size(); i++) {
+            if (x[i] == x[i] && y[i] == y[i]) ra.push_back(wrapRA(x[i]));
+        }
+        std::sort(ra.begin(), ra.end());
+        double gap = ra[0] + 360.0 - ra.back();
+        xmin = ra[0];
+        for (size_t k = 1; k < ra.size(); k++) {
+            if (ra[k] - ra[k-1] > gap) {
+                gap = ra[k] - ra[k-1];
+                xmin = ra[k];
+            }
+        }
+        xmax = xmin + 360.0 - gap;
+    }
+
+    /* about two points per cell, in cells as square as the extent allows */
+    double w = (n > 0 && xmax > xmin) ? xmax - xmin : 0.0;
+    double h = (n > 0 && ymax > ymin) ? ymax - ymin : 0.0;
+    double ncell = (n > 2) ? n/2.0 : 1.0;
+    if (w > 0.0 && h > 0.0) {
+        m_nx = (int)ceil(sqrt(ncell*w/h));
+        if (m_nx > ncell) m_nx = (int)ncell;
+        m_ny = (int)ceil(ncell/m_nx);
+    } else {
+        m_nx = (w > 0.0) ? (int)ncell : 1;
+        m_ny = (h > 0.0) ? (int)ncell : 1;
+    }
+    m_x0 = (n > 0) ? xmin : 0.0;
+    m_y0 = (n > 0) ? ymin : 0.0;
+    m_sx = (w > 0.0) ? m_nx/w : 1.0;
+    m_sy = (h > 0.0) ? m_ny/h : 1.0;
+
+    /* counting sort of the points by cell */
+    std::vector<int> cells(x.size(), -1);
+    m_start.assign((size_t)m_nx*m_ny + 1, 0);
+    for (size_t i = 0; i < x.size(); i++) {
+        if (x[i] != x[i] || y[i] != y[i]) continue;
+        int cx, cy;
+        cell(spherical ? wrapRA(x[i] - m_x0) : x[i] - m_x0, y[i], cx, cy);
+        cells[i] = cy*m_nx + cx;
+        m_start[cells[i]+1]++;
+    }
+    for (size_t c = 1; c < m_start.size(); c++) m_start[c] += m_start[c-1];
+    std::vector<int> next(m_start.begin(), m_start.end() - 1);
+    m_x.resize(n);
+    m_y.resize(n);
+    m_id.resize(n);
+    for (size_t i = 0; i < x.size(); i++) {
+        if (cells[i] < 0) continue;
+        int j = next[cells[i]]++;
+        m_x[j] = spherical ? wrapRA(x[i]) : x[i];
+        m_y[j] = y[i];
+        m_id[j] = ids[i];
+    }
+}
+
+int SpatialIndex::size() const
+{
+    return m_id.size();
+}
+
+bool SpatialIndex::spherical() const
+{
+    return m_spherical;
+}
+
+/* the cell of a point, clamped to the grid, with x counted from the lower corner of the grid */
+void SpatialIndex::cell(double u, double y, int &cx, int &cy) const
+{
+    double fx = u*m_sx, fy = (y - m_y0)*m_sy;
+    cx = (fx < 0.0) ? 0 : (fx >= m_nx) ? m_nx - 1 : (int)fx;
+    cy = (fy < 0.0) ? 0 : (fy >= m_ny) ? m_ny - 1 : (int)fy;
+}
+
+double SpatialIndex::distance(double x1, double y1, double x2, double y2) const
+{
+    if (!m_spherical) return hypot(x2 - x1, y2 - y1);
+
+    /* haversine formula, accurate at small distances */
+    double sy = sin(0.5*(y2 - y1)*DEG), sx = sin(0.5*(x2 - x1)*DEG);
+    double a = sy*sy + cos(y1*DEG)*cos(y2*DEG)*sx*sx;
+    return 2.0*asin(sqrt(a < 1.0 ? a : 1.0))/DEG;
+}
+
+/*
+ * Call fn(j) for every point j of the cells overlapping the box, with x1 <=
+ * x2. On the sky, the RA range may extend beyond 0 or 360, while the grid
+ * only spans the arc of RA holding the points, from m_x0 on, so that the
+ * range may overlap its columns in two parts.
+ */
+template <class Function>
+void SpatialIndex::cells(double x1, double y1, double x2, double y2, Function fn) const
+{
+    if (m_id.empty() || x2 < x1 || y2 < y1) return;
+    int cx1, cy1, cx2, cy2, cx3 = 0, cx4 = -1;
+    if (!m_spherical) {
+        cell(x1 - m_x0, y1, cx1, cy1);
+        cell(x2 - m_x0, y2, cx2, cy2);
+    } else {
+        cell(0.0, y1, cx1, cy1);
+        cell(0.0, y2, cx2, cy2);
+        cx1 = 0;
+        cx2 = m_nx - 1;
+        double u1 = wrapRA(x1 - m_x0), u2 = u1 + (x2 - x1);
+        if (x2 - x1 < 360.0) {
+            int cy;
+            if (u2 >= 360.0) cell(u2 - 360.0, y1, cx4, cy);
+            if (u1 > m_nx/m_sx) {
+                cx1 = 1;
+                cx2 = 0;
+            } else {
+                cell(u1, y1, cx1, cy);
+                cell(u2, y1, cx2, cy);
+            }
+            if (cx1 <= cx2 && cx4 >= cx1 - 1) {
+                cx1 = 0;
+                cx4 = -1;
+            }
+        }
+    }
+    for (int cy = cy1; cy <= cy2; cy++) {
+        if (cx1 <= cx2) {
+            for (int j = m_start[cy*m_nx + cx1]; j < m_start[cy*m_nx + cx2 + 1]; j++) fn(j);
+        }
+        for (int j = m_start[cy*m_nx + cx3]; j < m_start[cy*m_nx + cx4 + 1]; j++) fn(j);
+    }
+}
+
+/* call fn(j, distance) for every point j within radius of (x, y) */
+template <class Function>
+void SpatialIndex::within(double x, double y, double radius, Function fn) const
+{
+    if (!(radius >= 0.0)) return;
+    auto test = [&](int j) {
+        double d = distance(x, y, m_x[j], m_y[j]);
+        if (d <= radius) fn(j, d);
+    };
+    if (!m_spherical) {
+        cells(x - radius, y - radius, x + radius, y + radius, test);
+        return;
+    }
+
+    /* the range of RA within radius, everything if the cone contains a pole */
+    double dx = 180.0;
+    if (fabs(y) + radius < 90.0) dx = asin(sin(radius*DEG)/cos(y*DEG))/DEG;
+    if (dx >= 180.0) cells(0.0, y - radius, 360.0, y + radius, test);
+    else cells(x - dx, y - radius, x + dx, y + radius, test);
+}
+
+void SpatialIndex::cone(double x, double y, double radius, std::vector<int> &ids) const
+{
+    within(x, y, radius, [&](int j, double) { ids.push_back(m_id[j]); });
+}
+
+void SpatialIndex::box(double x1, double y1, double x2, double y2, std::vector<int> &ids) const
+{
+    /* wrapping around RA = 0 */
+    bool wrap = m_spherical && x1 > x2;
+    auto add = [&](int j) {
+        bool inside = wrap ? (m_x[j] >= x1 || m_x[j] <= x2) : (m_x[j] >= x1 && m_x[j] <= x2);
+        if (inside && m_y[j] >= y1 && m_y[j] <= y2) ids.push_back(m_id[j]);
+    };
+    cells(x1, y1, wrap ? x2 + 360.0 : x2, y2, add);
+}
+
+/*
+ * Cones of growing radius, starting from the radius expected to hold k
+ * points at the mean density, until one holds at least k points: those
+ * are then the k nearest.
+ */
+void SpatialIndex::nearest(double x, double y, int k, std::vector<int> &ids, std::vector<double> &dist) const
+{
+    ids.clear();
+    dist.clear();
+    int n = m_id.size();
+    if (k <= 0 || n == 0) return;
+    if (k > n) k = n;
+
+    double area = (m_nx/m_sx)*(m_ny/m_sy);
+    double radius = (area > 0.0) ? sqrt(k*area/(M_PI*n)) : 1.0;
+    double limit = m_spherical ? 180.0
+                 : hypot(fabs(x - m_x0) + m_nx/m_sx, fabs(y - m_y0) + m_ny/m_sy);
+    std::vector<std::pair<double, int> > found;
+    while (true) {
+        found.clear();
+        within(x, y, radius, [&](int j, double d) { found.push_back(std::make_pair(d, m_id[j])); });
+        if ((int)found.size() >= k || radius >= limit) break;
+        radius *= 2.0;
+    }
+    if ((int)found.size() < k) {
+        /* only possible through rounding at the limit: take all points */
+        found.clear();
+        for (int j = 0; j < n; j++) found.push_back(std::make_pair(distance(x, y, m_x[j], m_y[j]), m_id[j]));
+    }
+
+    std::partial_sort(found.begin(), found.begin() + k, found.end());
+    for (int i = 0; i < k; i++) {
+        ids.push_back(found[i].second);
+        dist.push_back(found[i].first);
+    }
+}
+
+void entryOffsets(const std::vector<ScanRef> &refs, std::vector<double> &x, std::vector<double> &y)
+{
+    x.resize(refs.size());
+    y.resize(refs.size());
+    for (size_t i = 0; i < refs.size(); i++) {
+        const ClassEntry &entry = refs[i].reader->getIndex()[refs[i].scan-1];
+        x[i] = entry.xoff1*ARCSEC;
+        y[i] = entry.xoff2*ARCSEC;
+    }
+}
+
+void headerPositions(const std::vector<ScanRef> &refs, std::vector<double> &x, std::vector<double> &y,
+                     int nthreads)
+{
+    TraceScope trace("positions", refs.size(), "count");
+    x.assign(refs.size(), NAN);
+    y.assign(refs.size(), NAN);
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int) {
+        if (reader->getDescriptor(scan, false) == 0) return;
+        SpectrumHeader head = reader->getHead(scan);
+        x[pos] = head.RA;
+        y[pos] = head.Dec;
+    });
+}
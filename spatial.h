@@ -0,0 +1,84 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSSPATIAL_H
+#define CLASSSPATIAL_H
+
+#include <vector>
+
+#include "class.h"
+#include "dataset.h"
+
+/**
+ * @file spatial.h
+ */
+
+/**
+ * @brief An index of points in the plane, or on the sky, for cone, box and
+ * nearest neighbour queries.
+ *
+ * The points are hashed into a uniform grid of cells holding about two
+ * points each, stored cell by cell in flat arrays, so that a query only
+ * looks at the points of the cells it overlaps. Points on the sky are
+ * given as (RA, Dec) in degrees and distances are great circle distances
+ * in degrees, with boxes and cones wrapping around RA = 0. On the sky, the
+ * grid spans the shortest arc of RA holding the points, which may itself
+ * wrap around RA = 0. Points with a NaN coordinate are left out.
+ */
+class SpatialIndex {
+ public:
+    SpatialIndex();
+
+    /**
+     * Build the index.
+     *
+     * @param x first coordinates
+     * @param y second coordinates
+     * @param ids the ids returned for the points
+     * @param spherical if set, x and y are RA and Dec in degrees
+     */
+    void build(const std::vector<double> &x, const std::vector<double> &y, const std::vector<int> &ids,
+               bool spherical);
+
+    int size() const;             ///< number of points indexed
+    bool spherical() const;       ///< true for points on the sky
+
+    /** Append the ids of the points within radius of (x, y) to ids. */
+    void cone(double x, double y, double radius, std::vector<int> &ids) const;
+    /** Append the ids of the points with x1 <= x <= x2 and y1 <= y <= y2 to ids, RA wrapping if x1 > x2. */
+    void box(double x1, double y1, double x2, double y2, std::vector<int> &ids) const;
+    /**
+     * Return the ids and distances of the k points nearest to (x, y), in
+     * order of distance, fewer if there are not as many points.
+     */
+    void nearest(double x, double y, int k, std::vector<int> &ids, std::vector<double> &dist) const;
+
+ private:
+    void cell(double u, double y, int &cx, int &cy) const;
+    double distance(double x1, double y1, double x2, double y2) const;
+    template <class Function> void within(double x, double y, double radius, Function fn) const;
+    template <class Function> void cells(double x1, double y1, double x2, double y2, Function fn) const;
+
+    bool m_spherical;
+    int m_nx, m_ny;                    // number of cells
+    double m_x0, m_y0;                 // lower corner of the grid
+    double m_sx, m_sy;                 // cells per unit
+    std::vector<int> m_start;          // first point of every cell, and one past the end
+    std::vector<double> m_x, m_y;      // coordinates, cell by cell
+    std::vector<int> m_id;             // ids, cell by cell
+};
+
+/**
+ * Return the offsets of the referenced spectra from their directory
+ * entries, in arcsec, without reading the spectra.
+ */
+void entryOffsets(const std::vector<ScanRef> &refs, std::vector<double> &x, std::vector<double> &y);
+
+/**
+ * Return the absolute positions (RA, Dec) of the referenced spectra from
+ * their headers, in degrees, read in parallel. Positions of spectra that
+ * could not be read are NaN.
+ */
+void headerPositions(const std::vector<ScanRef> &refs, std::vector<double> &x, std::vector<double> &y,
+                     int nthreads = 0);
+
+#endif
@@ -0,0 +1,152 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "stats.h"
+#include "trace.h"
+
+#include <float.h>
+
+#define LANES 8       // independent partial sums, so that reductions vectorize without reassociation
+#define CHUNK 1024    // channels summed in single precision before adding to the totals
+
+/*
+ * Sum n channels (a multiple of LANES) of v into the lanes of sums: the
+ * number of good channels, their sum and sum of squares after subtracting
+ * shift, and the squared differences of pairs of adjacent good channels
+ * and their number. v[-1] must exist. The extremes are kept in lo and hi.
+ * Not inlined, since the loop is no longer vectorized within the caller.
+ */
+__attribute__((noinline))
+static void sumChunk(const float *__restrict__ v, int n, float badl, float shift,
+                     float *__restrict__ sums, float *__restrict__ lo, float *__restrict__ hi)
+{
+    /* local copies, which the compiler keeps in registers */
+    float cnt[LANES], s[LANES], s2[LANES], d2[LANES], npair[LANES], vlo[LANES], vhi[LANES];
+    for (int j = 0; j < LANES; j++) {
+        cnt[j] = s[j] = s2[j] = d2[j] = npair[j] = 0.0f;
+        vlo[j] = lo[j];
+        vhi[j] = hi[j];
+    }
+    for (int k = 0; k < n; k += LANES) {
+        for (int j = 0; j < LANES; j++) {
+            float x = v[k+j];
+            float xp = v[k+j-1];
+            bool good = (x == x) & (x != badl);
+            bool pair = good & (xp == xp) & (xp != badl);
+            float y = good ? x - shift : 0.0f;
+            float d = pair ? x - xp : 0.0f;
+            cnt[j] += good ? 1.0f : 0.0f;
+            s[j] += y;
+            s2[j] += y*y;
+            d2[j] += d*d;
+            npair[j] += pair ? 1.0f : 0.0f;
+            float xlo = good ? x : FLT_MAX, xhi = good ? x : -FLT_MAX;
+            vlo[j] = (xlo < vlo[j]) ? xlo : vlo[j];
+            vhi[j] = (xhi > vhi[j]) ? xhi : vhi[j];
+        }
+    }
+    for (int j = 0; j < LANES; j++) {
+        sums[j] += cnt[j];
+        sums[LANES+j] += s[j];
+        sums[2*LANES+j] += s2[j];
+        sums[3*LANES+j] += d2[j];
+        sums[4*LANES+j] += npair[j];
+        lo[j] = vlo[j];
+        hi[j] = vhi[j];
+    }
+}
+
+/*
+ * All sums are formed in one branch-free pass with bad channels masked, in
+ * LANES partial sums which the compiler maps onto vector registers, and
+ * added to double precision totals every CHUNK channels. The variance is
+ * taken about a provisional mean, the first good value, to avoid
+ * cancellation for spectra far from zero.
+ */
+void spectrumStats(const char *raw, int nchan, float badl, SpectrumStats &stats)
+{
+    static thread_local std::vector<float> values;
+    stats.nchan = nchan;
+    stats.nbad = nchan;
+    stats.mean = stats.rms = stats.min = stats.max = stats.flatness = NAN;
+    if (nchan <= 0) return;
+
+    /* one bad channel in front, and padded to whole lanes with bad channels */
+    int npad = (nchan + LANES - 1)/LANES*LANES;
+    values.resize(npad+1);
+    float *v = values.data() + 1;
+    v[-1] = NAN;
+    memcpy(v, raw, nchan*sizeof(float));
+    for (int k = nchan; k < npad; k++) v[k] = NAN;
+
+    float shift = 0.0f;
+    for (int k = 0; k < nchan; k++) {
+        if (v[k] == v[k] && v[k] != badl) {
+            shift = v[k];
+            break;
+        }
+    }
+
+    double total[5] = { 0.0 };
+    float lo[LANES], hi[LANES];
+    for (int j = 0; j < LANES; j++) {
+        lo[j] = FLT_MAX;
+        hi[j] = -FLT_MAX;
+    }
+    for (int k0 = 0; k0 < npad; k0 += CHUNK) {
+        int n = (k0 + CHUNK < npad) ? CHUNK : npad - k0;
+        float sums[5*LANES] = { 0.0f };
+        sumChunk(v + k0, n, badl, shift, sums, lo, hi);
+        for (int i = 0; i < 5; i++) {
+            for (int j = 0; j < LANES; j++) total[i] += sums[i*LANES+j];
+        }
+    }
+    float vmin = FLT_MAX, vmax = -FLT_MAX;
+    for (int j = 0; j < LANES; j++) {
+        if (lo[j] < vmin) vmin = lo[j];
+        if (hi[j] > vmax) vmax = hi[j];
+    }
+
+    double ngood = total[0], npair = total[4];
+    stats.nbad = nchan - (int)ngood;
+    if (ngood == 0.0) return;
+    double m = total[1]/ngood;
+    double var = total[2]/ngood - m*m;
+    stats.mean = m + shift;
+    stats.rms = (var > 0.0) ? sqrt(var) : 0.0;
+    stats.min = vmin;
+    stats.max = vmax;
+    if (npair > 0.0 && stats.rms > 0.0) stats.flatness = sqrt(total[3]/npair/2.0)/stats.rms;
+}
+
+void StatsTable::resize(int n)
+{
+    nchan.assign(n, -1);
+    nbad.assign(n, 0);
+    std::vector<double> *columns[] = { &mean, &rms, &min, &max, &flatness, &tsys, &el, &tau, &taus, &h2omm };
+    for (size_t c = 0; c < sizeof(columns)/sizeof(columns[0]); c++) columns[c]->assign(n, NAN);
+}
+
+void statsTable(const std::vector<ScanRef> &refs, StatsTable &table, int nthreads)
+{
+    TraceScope trace("stats", refs.size(), "count");
+    table.resize(refs.size());
+
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int) {
+        const ClassDescriptor *desc = reader->getDescriptor(scan, true);
+        if (desc == 0 || desc->data == 0) return;
+
+        SpectrumStats stats;
+        spectrumStats((const char *)desc->data, desc->ndata, desc->badl, stats);
+        table.nchan[pos] = stats.nchan;
+        table.nbad[pos] = stats.nbad;
+        table.mean[pos] = stats.mean;
+        table.rms[pos] = stats.rms;
+        table.min[pos] = stats.min;
+        table.max[pos] = stats.max;
+        table.flatness[pos] = stats.flatness;
+        table.tsys[pos] = desc->tsys;
+        table.el[pos] = desc->el*180.0/M_PI;
+        table.tau[pos] = desc->tau;
+        table.taus[pos] = desc->taus;
+        table.h2omm[pos] = desc->h2omm;
+    });
+}
@@ -0,0 +1,73 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSSTATS_H
+#define CLASSSTATS_H
+
+#include <vector>
+
+#include "class.h"
+#include "dataset.h"
+
+/**
+ * @file stats.h
+ */
+
+/**
+ * @brief Statistics of the data of one spectrum.
+ *
+ * Bad channels (the blanking value or NaN) are counted in nbad and left
+ * out of everything else. Without any good channel, all values are NaN.
+ */
+struct SpectrumStats {
+    int nchan;            ///< number of channels
+    int nbad;             ///< number of bad channels
+    double mean;          ///< mean
+    double rms;           ///< standard deviation about the mean
+    double min;           ///< minimum
+    double max;           ///< maximum
+    /**
+     * rms of the differences of adjacent good channels, divided by
+     * sqrt(2)*rms: close to 1 for white noise, smaller if the spectrum has
+     * lines, slopes or ripples.
+     */
+    double flatness;
+};
+
+/**
+ * Compute the statistics of nchan values, which need not be aligned.
+ */
+void spectrumStats(const char *data, int nchan, float badl, SpectrumStats &stats);
+
+/**
+ * @brief Statistics and calibration values of many spectra, one column per
+ * quantity.
+ *
+ * Calibration values from a missing calibration section are NaN.
+ */
+struct StatsTable {
+    void resize(int n);   ///< resize all columns to n rows, of NaN and zero counts
+
+    std::vector<int> nchan;       ///< number of channels, -1 if the spectrum could not be read
+    std::vector<int> nbad;        ///< number of bad channels
+    std::vector<double> mean;     ///< mean
+    std::vector<double> rms;      ///< standard deviation
+    std::vector<double> min;      ///< minimum
+    std::vector<double> max;      ///< maximum
+    std::vector<double> flatness; ///< see SpectrumStats
+    std::vector<double> tsys;     ///< system temperature (section -2)
+    std::vector<double> el;       ///< elevation in degrees (section -2)
+    std::vector<double> tau;      ///< opacity (section -2)
+    std::vector<double> taus;     ///< opacity in the signal band (section -14)
+    std::vector<double> h2omm;    ///< precipitable water vapour in mm (section -14)
+};
+
+/**
+ * Compute the statistics of the referenced spectra, in parallel.
+ *
+ * @param refs the spectra
+ * @param table the table, of refs.size() rows
+ * @param nthreads number of threads, <= 0 for the default
+ */
+void statsTable(const std::vector<ScanRef> &refs, StatsTable &table, int nthreads = 0);
+
+#endif
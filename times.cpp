@@ -0,0 +1,123 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "times.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <math.h>
+
+double observationTime(int xdobs, double ut)
+{
+    /* CLASS days are counted from MJD 60549, the epoch of 1970 is MJD 40587 */
+    return (xdobs + 60549.0 - 40587.0)*86400.0 + ut*3600.0*12.0/M_PI;
+}
+
+TimeIndex::TimeIndex()
+{
+}
+
+void TimeIndex::build(const std::vector<ScanRef> &refs, const std::vector<int> &ids, int nthreads)
+{
+    TraceScope trace("times", refs.size(), "count");
+    int n = refs.size();
+    std::vector<double> time(n, NAN), tsys(n, NAN), tau(n, NAN);
+    forEachScan(refs, nthreads, [&](ClassReader *reader, int scan, int pos, int) {
+        const ClassDescriptor *desc = reader->getDescriptor(scan, false);
+        if (desc == 0) return;
+        time[pos] = observationTime(reader->getIndex()[scan-1].xdobs, desc->ut);
+        tsys[pos] = desc->tsys;
+        tau[pos] = desc->tau;
+    });
+
+    /* a stable sort keeps spectra observed at the same time in their order */
+    std::vector<int> order;
+    order.reserve(n);
+    for (int i = 0; i < n; i++) {
+        if (time[i] == time[i]) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return time[a] < time[b]; });
+
+    size_t m = order.size();
+    m_time.resize(m);
+    m_tsys.resize(m);
+    m_tau.resize(m);
+    m_id.resize(m);
+    for (size_t j = 0; j < m; j++) {
+        m_time[j] = time[order[j]];
+        m_tsys[j] = tsys[order[j]];
+        m_tau[j] = tau[order[j]];
+        m_id[j] = ids[order[j]];
+    }
+}
+
+int TimeIndex::size() const
+{
+    return m_id.size();
+}
+
+double TimeIndex::first() const
+{
+    return m_time.empty() ? NAN : m_time.front();
+}
+
+double TimeIndex::last() const
+{
+    return m_time.empty() ? NAN : m_time.back();
+}
+
+/* the position of the first spectrum observed at or after t */
+size_t TimeIndex::lower(double t) const
+{
+    return std::lower_bound(m_time.begin(), m_time.end(), t) - m_time.begin();
+}
+
+void TimeIndex::range(double t1, double t2, std::vector<int> &ids, std::vector<double> &times) const
+{
+    for (size_t j = lower(t1), end = lower(t2); j < end; j++) {
+        ids.push_back(m_id[j]);
+        times.push_back(m_time[j]);
+    }
+}
+
+void TimeIndex::bins(double t1, double t2, double width, TimeBins &bins) const
+{
+    bins = TimeBins();
+    if (!(width > 0.0) || !(t2 > t1)) return;
+    size_t nbin = (size_t)ceil((t2 - t1)/width);
+    bins.time.resize(nbin);
+    bins.count.assign(nbin, 0);
+    bins.tsys.assign(nbin, NAN);
+    bins.tsysMin.assign(nbin, NAN);
+    bins.tsysMax.assign(nbin, NAN);
+    bins.tau.assign(nbin, NAN);
+
+    /* every bin is a range of the index, found by binary search */
+    size_t j = lower(t1);
+    for (size_t b = 0; b < nbin; b++) {
+        double start = t1 + b*width;
+        double end = (b + 1 < nbin) ? t1 + (b + 1)*width : t2;
+        size_t stop = lower(end);
+        bins.time[b] = start;
+        bins.count[b] = stop - j;
+
+        double st = 0.0, sa = 0.0, lo = HUGE_VAL, hi = -HUGE_VAL;
+        int nt = 0, na = 0;
+        for (; j < stop; j++) {
+            if (m_tsys[j] == m_tsys[j]) {
+                st += m_tsys[j];
+                if (m_tsys[j] < lo) lo = m_tsys[j];
+                if (m_tsys[j] > hi) hi = m_tsys[j];
+                nt++;
+            }
+            if (m_tau[j] == m_tau[j]) {
+                sa += m_tau[j];
+                na++;
+            }
+        }
+        if (nt > 0) {
+            bins.tsys[b] = st/nt;
+            bins.tsysMin[b] = lo;
+            bins.tsysMax[b] = hi;
+        }
+        if (na > 0) bins.tau[b] = sa/na;
+    }
+}
@@ -0,0 +1,84 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSTIMES_H
+#define CLASSTIMES_H
+
+#include <vector>
+
+#include "class.h"
+#include "dataset.h"
+
+/**
+ * @file times.h
+ */
+
+/**
+ * @brief Observation times, system temperatures and opacities of many
+ * time bins, one column per quantity.
+ *
+ * Means, minima and maxima leave out NaN values, and are NaN for bins
+ * without any valid value.
+ */
+struct TimeBins {
+    std::vector<double> time;     ///< start of the bin, seconds since 1970-01-01 00:00 (UTC)
+    std::vector<int> count;       ///< number of spectra
+    std::vector<double> tsys;     ///< mean system temperature
+    std::vector<double> tsysMin;  ///< minimum system temperature
+    std::vector<double> tsysMax;  ///< maximum system temperature
+    std::vector<double> tau;      ///< mean opacity
+};
+
+/**
+ * @brief An index of spectra by the time of their observation.
+ *
+ * The times are taken from the observation date of the directory entries
+ * and the UT of section -2, together with the system temperature and
+ * opacity of that section, in one pass over the headers. They are kept in
+ * time order, so that ranges are found by binary search. Spectra that
+ * cannot be read are left out.
+ */
+class TimeIndex {
+ public:
+    TimeIndex();
+
+    /**
+     * Build the index, reading the headers in parallel.
+     *
+     * @param refs the spectra
+     * @param ids the ids returned for the spectra
+     * @param nthreads number of threads, <= 0 for the default
+     */
+    void build(const std::vector<ScanRef> &refs, const std::vector<int> &ids, int nthreads = 0);
+
+    int size() const;             ///< number of spectra indexed
+    double first() const;         ///< earliest time, NaN if empty
+    double last() const;          ///< latest time, NaN if empty
+
+    /**
+     * Append the ids and times of the spectra with t1 <= time < t2 to ids
+     * and times, in time order.
+     */
+    void range(double t1, double t2, std::vector<int> &ids, std::vector<double> &times) const;
+    /**
+     * Aggregate the spectra with t1 <= time < t2 into consecutive bins of
+     * width seconds, starting at t1.
+     */
+    void bins(double t1, double t2, double width, TimeBins &bins) const;
+
+ private:
+    size_t lower(double t) const;
+
+    std::vector<double> m_time;   // seconds since 1970, in time order
+    std::vector<double> m_tsys;
+    std::vector<double> m_tau;
+    std::vector<int> m_id;
+};
+
+/**
+ * Return the time of observation in seconds since 1970-01-01 00:00 (UTC),
+ * from the date of the directory entry (CLASS days) and the UT of section
+ * -2 (radians), without rounding to seconds.
+ */
+double observationTime(int xdobs, double ut);
+
+#endif
@@ -0,0 +1,138 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "trace.h"
+
+#include <atomic>
+#include <mutex>
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+typedef struct {
+    const char *name;
+    double ts;
+    double dur;
+    long tid;
+    long arg;
+    const char *argName;
+} TraceRecord;
+
+static TraceRecord events[TRACE_EVENTS];
+static unsigned long nevents = 0;       // total number of events recorded since last clear
+static std::mutex lock;
+static std::atomic<bool> enabled(false);
+static char tracefile[256];
+
+static long threadId()
+{
+#ifdef SYS_gettid
+    return (long)syscall(SYS_gettid);
+#else
+    return (long)getpid();
+#endif
+}
+
+static void traceAtExit()
+{
+    if (tracefile[0]) traceFlush(tracefile);
+}
+
+/* pick up CLASSIC_TRACE from the environment when the library is loaded */
+static struct TraceInit {
+    TraceInit() {
+        const char *fn = getenv("CLASSIC_TRACE");
+        if (fn && *fn) {
+            strncpy(tracefile, fn, sizeof(tracefile)-1);
+            enabled = true;
+            atexit(traceAtExit);
+        }
+    }
+} traceInit;
+
+void traceEnable(bool on)
+{
+    enabled = on;
+}
+
+bool traceEnabled()
+{
+    return enabled;
+}
+
+void traceClear()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    nevents = 0;
+}
+
+double traceClock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec*1.0e6 + (double)ts.tv_nsec*1.0e-3;
+}
+
+void traceEvent(const char *name, double t0, long arg, const char *argName)
+{
+    double t1 = traceClock();
+    long tid = threadId();
+
+    std::lock_guard<std::mutex> guard(lock);
+    TraceRecord *ev = &events[nevents % TRACE_EVENTS];
+    ev->name = name;
+    ev->ts = t0;
+    ev->dur = t1 - t0;
+    ev->tid = tid;
+    ev->arg = arg;
+    ev->argName = argName;
+    nevents++;
+}
+
+int traceFlush(const char *filename)
+{
+    FILE *fp = fopen(filename, "w");
+    if (!fp) {
+        fprintf(stderr, "failed to open trace file '%s'\n", filename);
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    unsigned long first = (nevents > TRACE_EVENTS) ? nevents - TRACE_EVENTS : 0;
+    long pid = (long)getpid();
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (unsigned long i = first; i < nevents; i++) {
+        const TraceRecord *ev = &events[i % TRACE_EVENTS];
+        fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"classic\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%ld",
+                (i == first) ? "" : ",\n", ev->name, ev->ts, ev->dur, pid, ev->tid);
+        if (ev->arg >= 0) fprintf(fp, ",\"args\":{\"%s\":%ld}", ev->argName, ev->arg);
+        fprintf(fp, "}");
+    }
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+
+    return (int)(nevents - first);
+}
+
+TraceScope::TraceScope(const char *name, long arg, const char *argName)
+    : m_name(name), m_arg(arg), m_argName(argName), m_t0(0.0)
+{
+    m_active = enabled;
+    if (m_active) m_t0 = traceClock();
+}
+
+TraceScope::~TraceScope()
+{
+    end();
+}
+
+void TraceScope::end()
+{
+    if (m_active) {
+        traceEvent(m_name, m_t0, m_arg, m_argName);
+        m_active = false;
+    }
+}
@@ -0,0 +1,87 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSTRACE_H
+#define CLASSTRACE_H
+
+/**
+ * @file trace.h
+ *
+ * Optional event tracing of reader operations.
+ *
+ * When enabled, every traced operation (directory scan, entry lookup,
+ * section read, data read and decoding) is recorded with its start time,
+ * duration and thread id in a fixed size ring buffer. The buffer can be
+ * written as Chrome trace JSON, which may be loaded into Perfetto
+ * (https://ui.perfetto.dev) or chrome://tracing.
+ *
+ * Tracing is switched on either by calling traceEnable(), or by setting
+ * the environment variable CLASSIC_TRACE to the name of an output file,
+ * in which case the buffer is flushed to that file at program exit.
+ */
+
+#define TRACE_EVENTS 65536   // size of the ring buffer, oldest events are overwritten
+
+/**
+ * Switch tracing on or off.
+ *
+ * @param on true to start recording events
+ */
+void traceEnable(bool on);
+
+/**
+ * @return true if events are currently being recorded
+ */
+bool traceEnabled();
+
+/**
+ * Discard all events recorded so far.
+ */
+void traceClear();
+
+/**
+ * Write the recorded events as Chrome trace JSON.
+ *
+ * @param filename name of the output file
+ * @return number of events written, or -1 if the file could not be opened
+ */
+int traceFlush(const char *filename);
+
+/**
+ * Record one complete event.
+ *
+ * @param name static string naming the operation
+ * @param t0 start time as returned by traceClock()
+ * @param arg optional integer argument (e.g. spectrum number), ignored if < 0
+ * @param argName static string naming the argument in the trace
+ */
+void traceEvent(const char *name, double t0, long arg, const char *argName = "scan");
+
+/**
+ * @return monotonic time in microseconds
+ */
+double traceClock();
+
+/**
+ * Scoped trace event.
+ *
+ * The event starts when the object is constructed and ends when it is
+ * destroyed, or when end() is called explicitly. If tracing is disabled
+ * this costs a single flag test. Scopes of single spectra pass the spectrum
+ * number as argument, scopes of many spectra their number, named "count".
+ */
+class TraceScope {
+ public:
+    TraceScope(const char *name, long arg = -1, const char *argName = "scan");
+    ~TraceScope();
+
+    void end();
+
+ private:
+    const char *m_name;
+    long m_arg;
+    const char *m_argName;
+    double m_t0;
+    bool m_active;
+};
+
+#endif
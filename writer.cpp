@@ -0,0 +1,292 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+#include "writer.h"
+#include "dataset.h"
+#include "parallel.h"
+#include "times.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RECLEN   1024         // words per record
+#define LIND     32           // words per directory entry
+#define DATABUF  (4 << 20)    // bytes of obsblocks collected before writing
+#define ENTRYBUF 1024         // directory entries collected before writing
+#define MAXLEX   (BUFSIZE/(4*LIND))   // entries of an extension, which the reader reads at once
+
+static void putInt(char *&p, int v)
+{
+    memcpy(p, &v, sizeof(int));
+    p += sizeof(int);
+}
+
+static void putLong(char *&p, long int v)
+{
+    int64_t w = v;
+    memcpy(p, &w, sizeof(int64_t));
+    p += sizeof(int64_t);
+}
+
+/* a name padded with blanks, as CLASS stores it */
+static void putName(char *&p, const char *name, int len)
+{
+    int n = strnlen(name, len);
+    memcpy(p, name, n);
+    memset(p + n, ' ', len - n);
+    p += len;
+}
+
+void packEntry(char *p, const ClassEntry &entry, long int block, int word)
+{
+    putLong(p, block);
+    putInt(p, word);
+    putLong(p, entry.xnum);
+    putInt(p, entry.xver);
+    putName(p, entry.xsourc, 12);
+    putName(p, entry.xline, 12);
+    putName(p, entry.xtel, 12);
+    putInt(p, entry.xdobs);
+    putInt(p, entry.xdred);
+    memcpy(p, &entry.xoff1, sizeof(float));
+    p += sizeof(float);
+    memcpy(p, &entry.xoff2, sizeof(float));
+    p += sizeof(float);
+    putName(p, entry.xtype, 4);
+    putInt(p, entry.xkind);
+    putInt(p, entry.xqual);
+    putInt(p, entry.xposa);
+    putLong(p, entry.xscan);
+    putInt(p, entry.xsubs);
+}
+
+Type2Writer::Type2Writer(const char *filename, long int capacity)
+{
+    m_capacity = (capacity > 0) ? capacity : 0;
+    m_count = m_entryCount = m_words = 0;
+    m_lex1 = (m_capacity + RECLEN/LIND - 1)/(RECLEN/LIND)*(RECLEN/LIND);
+    if (m_lex1 == 0) m_lex1 = RECLEN/LIND;
+    if (m_lex1 > MAXLEX) m_lex1 = MAXLEX;
+    m_nex = (m_capacity + m_lex1 - 1)/m_lex1;
+    if (m_nex == 0) m_nex = 1;
+    m_first = (1 + m_nex*m_lex1*LIND/RECLEN)*RECLEN;
+    m_failed = false;
+    m_fd = -1;
+    if (m_nex > MAXEXT) {
+        fprintf(stderr, "too many entries for a directory: %ld\n", capacity);
+        return;
+    }
+    m_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0) fprintf(stderr, "failed to create '%s': %s\n", filename, strerror(errno));
+}
+
+Type2Writer::~Type2Writer()
+{
+    if (m_fd >= 0) close();
+}
+
+bool Type2Writer::good() const
+{
+    return m_fd >= 0 && !m_failed;
+}
+
+long int Type2Writer::count() const
+{
+    return m_count;
+}
+
+bool Type2Writer::writeAt(long offset, const void *src, size_t len)
+{
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pwrite(m_fd, (const char *)src + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            fprintf(stderr, "failed to write %ld bytes: %s\n", (long)len, strerror(errno));
+            m_failed = true;
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+/* the buffer holds the last m_data.size() bytes of the m_words words of obsblocks */
+bool Type2Writer::flushData()
+{
+    if (m_data.empty()) return true;
+    long offset = 4*(m_first + m_words) - m_data.size();
+    bool ok = writeAt(offset, m_data.data(), m_data.size());
+    m_data.clear();
+    return ok;
+}
+
+bool Type2Writer::flushEntries()
+{
+    if (m_entries.empty()) return true;
+    long offset = 4*(RECLEN + m_entryCount*LIND);
+    bool ok = writeAt(offset, m_entries.data(), m_entries.size());
+    m_entryCount = m_count;
+    m_entries.clear();
+    return ok;
+}
+
+bool Type2Writer::write(const ClassEntry &entry, const ClassObservation &obs)
+{
+    if (!good()) return false;
+    if (m_count >= m_capacity) {
+        fprintf(stderr, "directory of %ld entries is full\n", m_capacity);
+        return false;
+    }
+
+    /* the obsblock: header, sections and data, with addresses counted in words from 1 */
+    int nsec = obs.codes.size();
+    long hw = 11 + 5*nsec;
+    long ldata = (obs.data.size() + 3)/4;
+    long nword = hw + obs.sections.size()/4 + ldata;
+    long pos = m_first + m_words;
+    size_t start = m_data.size();
+    m_data.resize(start + 4*nword, 0);
+    char *p = &m_data[start];
+    memcpy(p, "2   ", 4);
+    p += 4;
+    putInt(p, obs.version);
+    putInt(p, nsec);
+    putLong(p, nword);
+    putLong(p, hw + obs.sections.size()/4 + 1);
+    putLong(p, ldata);
+    putLong(p, entry.xnum);
+    for (int i = 0; i < nsec; i++) putInt(p, obs.codes[i]);
+    for (int i = 0; i < nsec; i++) putLong(p, obs.lengths[i]);
+    long adr = hw + 1;
+    for (int i = 0; i < nsec; i++) {
+        putLong(p, adr);
+        adr += obs.lengths[i];
+    }
+    if (!obs.sections.empty()) memcpy(p, obs.sections.data(), obs.sections.size());
+    p += obs.sections.size();
+    if (!obs.data.empty()) memcpy(p, obs.data.data(), obs.data.size());
+    m_words += nword;
+
+    /* its directory entry */
+    size_t estart = m_entries.size();
+    m_entries.resize(estart + 4*LIND, 0);
+    packEntry(&m_entries[estart], entry, pos/RECLEN + 1, pos%RECLEN + 1);
+    m_count++;
+
+    if (m_data.size() >= DATABUF && !flushData()) return false;
+    if (m_entries.size() >= ENTRYBUF*4*LIND && !flushEntries()) return false;
+    return true;
+}
+
+bool Type2Writer::close()
+{
+    if (m_fd < 0) return false;
+    bool ok = flushData() && flushEntries();
+
+    /* the file descriptor, in the first record */
+    long next = m_first + m_words;
+    std::vector<char> record(4*RECLEN, 0);
+    char *p = record.data();
+    memcpy(p, "2A  ", 4);
+    p += 4;
+    putInt(p, RECLEN);
+    putInt(p, 1);                 // kind: written by CLASS
+    putInt(p, 1);                 // version of the index
+    putInt(p, LIND);
+    putInt(p, 0);                 // flags
+    putLong(p, m_count + 1);      // next entry
+    putLong(p, next/RECLEN + 1);  // next record and word
+    putInt(p, next%RECLEN + 1);
+    putInt(p, m_lex1);
+    putInt(p, m_nex);
+    putInt(p, 10);                // extensions of constant size
+    for (long i = 0; i < m_nex; i++) putLong(p, 2 + i*m_lex1*LIND/RECLEN);
+    ok = ok && writeAt(0, record.data(), record.size());
+
+    /* the directory has to exist in full, even if not all entries were used */
+    if (ok && ftruncate(m_fd, 4*next) != 0) {
+        fprintf(stderr, "failed to extend file: %s\n", strerror(errno));
+        ok = false;
+    }
+    if (::close(m_fd) != 0) ok = false;
+    m_fd = -1;
+    if (!ok) m_failed = true;
+    return ok;
+}
+
+CompactOptions::CompactOptions() : sort(false), allVersions(false)
+{
+}
+
+/* source, line and time, keeping the order of the file for equal keys */
+static std::vector<int> sortedScans(ClassReader *reader, const std::vector<int> &scans)
+{
+    const std::vector<ClassEntry> &index = reader->getIndex();
+    int n = scans.size();
+    std::vector<double> time(n, HUGE_VAL);
+    forEachScan(scanRefs(reader, scans), 0, [&](ClassReader *r, int scan, int pos, int) {
+        const ClassDescriptor *desc = r->getDescriptor(scan, false);
+        if (desc) time[pos] = observationTime(index[scan-1].xdobs, desc->ut);
+    });
+
+    std::vector<int> order(n);
+    for (int i = 0; i < n; i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        const ClassEntry &ea = index[scans[a]-1], &eb = index[scans[b]-1];
+        int c = strcmp(ea.xsourc, eb.xsourc);
+        if (c == 0) c = strcmp(ea.xline, eb.xline);
+        if (c != 0) return c < 0;
+        return time[a] < time[b];
+    });
+    std::vector<int> sorted(n);
+    for (int i = 0; i < n; i++) sorted[i] = scans[order[i]];
+    return sorted;
+}
+
+ClassReader *openRewrite(const char *input, const char *output, const CompactOptions &options, std::vector<int> &scans)
+{
+    struct stat sin, sout;
+    if (stat(input, &sin) == 0 && stat(output, &sout) == 0 && sin.st_dev == sout.st_dev && sin.st_ino == sout.st_ino) {
+        fprintf(stderr, "cannot rewrite '%s' onto itself\n", input);
+        return 0;
+    }
+    ClassReader *reader = openClassFile(input);
+    if (reader == 0) return 0;
+
+    reader->setAllVersions(options.allVersions);
+    int n = reader->getDirectory();
+    scans.resize(n);
+    for (int i = 0; i < n; i++) scans[i] = i+1;
+    if (options.sort) scans = sortedScans(reader, scans);
+    return reader;
+}
+
+long int compactFile(const char *input, const char *output, const CompactOptions &options)
+{
+    TraceScope trace("compact");
+    std::vector<int> scans;
+    ClassReader *reader = openRewrite(input, output, options, scans);
+    if (reader == 0) return -1;
+
+    int n = scans.size();
+    Type2Writer writer(output, n);
+    const std::vector<ClassEntry> &index = reader->getIndex();
+    ClassObservation obs;
+    int nskip = 0;
+    bool ok = writer.good();
+    for (int i = 0; ok && i < n; i++) {
+        if (!reader->getObservation(scans[i], obs)) {
+            nskip++;
+            continue;
+        }
+        ok = writer.write(index[scans[i]-1], obs);
+    }
+    ok = writer.close() && ok;
+    if (nskip > 0) fprintf(stderr, "%d spectra of '%s' could not be read and were left out\n", nskip, input);
+    delete reader;
+    return ok ? writer.count() : -1;
+}
@@ -0,0 +1,114 @@
+/* Copyright 2019 Michael Olberg <michael.olberg@chalmers.se> */
+
+#ifndef CLASSWRITER_H
+#define CLASSWRITER_H
+
+#include <vector>
+
+#include "class.h"
+
+/**
+ * @file writer.h
+ */
+
+/**
+ * Write a directory entry of type 2, of 128 bytes, with the observation at
+ * the given record and word (both counted from 1).
+ */
+void packEntry(char *p, const ClassEntry &entry, long int block, int word);
+
+/**
+ * @brief A writer of CLASSIC files of type 2.
+ *
+ * The directory is written right after the file descriptor, for the
+ * number of entries given when the file is created, as extensions of equal
+ * size which readers can read at once. The obsblocks follow one after the
+ * other without gaps. Obsblocks and entries are collected in buffers of
+ * bounded size which are written when full, so that files of any size are
+ * written with little memory.
+ */
+class Type2Writer {
+ public:
+    /**
+     * Create a file.
+     *
+     * @param filename name of the file, which is replaced if it exists
+     * @param capacity number of entries of the directory
+     */
+    Type2Writer(const char *filename, long int capacity);
+    ~Type2Writer();                       ///< close() the file if still open
+
+    bool good() const;                    ///< true if the file could be created
+    long int count() const;               ///< number of observations written
+
+    /**
+     * Append an observation, with its directory entry, where xblock and
+     * xword are set to the place the observation is written to.
+     *
+     * @return false if the directory is full or the file could not be written
+     */
+    bool write(const ClassEntry &entry, const ClassObservation &obs);
+    /**
+     * Write what is left in the buffers and the file descriptor, and close
+     * the file.
+     *
+     * @return false if the file could not be written
+     */
+    bool close();
+
+ private:
+    bool put(const void *src, size_t len);
+    bool flushData();
+    bool flushEntries();
+    bool writeAt(long offset, const void *src, size_t len);
+
+    int m_fd;
+    long int m_capacity;
+    long int m_count;
+    long int m_entryCount;     // entries written to the file so far
+    long int m_lex1;           // entries of an extension, a whole number of records
+    long int m_nex;            // number of extensions
+    long int m_first;          // first word of the obsblocks (0-based)
+    long int m_words;          // words of obsblocks written or buffered
+    bool m_failed;
+    std::vector<char> m_data;
+    std::vector<char> m_entries;
+};
+
+/**
+ * @brief How compactFile() rewrites a file.
+ */
+struct CompactOptions {
+    CompactOptions();     ///< latest versions, in file order
+
+    bool sort;            ///< sort by source, line and time, instead of keeping the file order
+    bool allVersions;     ///< keep superseded versions, see ClassReader::setAllVersions()
+};
+
+/**
+ * Open a file to be rewritten into another one, which must not be the
+ * same file, and read its directory as the options say.
+ *
+ * @param input name of the file to rewrite
+ * @param output name of the file to be written
+ * @param options which observations to keep and in which order
+ * @param scans the numbers of the spectra to write, in that order
+ * @return the reader, to be deleted by the caller, or NULL on error
+ */
+ClassReader *openRewrite(const char *input, const char *output, const CompactOptions &options, std::vector<int> &scans);
+
+/**
+ * Rewrite a file of type 1 or 2 as a compact file of type 2, which holds
+ * only the latest version of every observation. Sorted by source, line and
+ * time, the spectra of one source and line end up next to each other, so
+ * that reading them becomes one sequential read. Observations are copied
+ * without being decoded, one at a time.
+ *
+ * @param input name of the file to rewrite
+ * @param output name of the file written, which must not be the input
+ * @param options how to rewrite
+ * @return number of observations written, or -1 on error
+ */
+long int compactFile(const char *input, const char *output, const CompactOptions &options = CompactOptions());
+
+#endif